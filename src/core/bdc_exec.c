@@ -50,6 +50,7 @@
 #include "dm_exec.h"
 #include "stomp.h"
 #include "os_utils.h"
+#include "msg_queue.h"
 #include "device.h"
 #include "rfc1123.h"
 
@@ -74,12 +75,8 @@ typedef struct
 static bdc_connection_t bdc_connection[BULKDATA_MAX_PROFILES];
 
 //------------------------------------------------------------------------------
-// Unix domain socket pair used to implement a message queue
-// One socket is always used for sending, and the other always used for receiving
-static int bdc_mq_sockets[2] = {-1, -1};
-
-#define mq_rx_socket  bdc_mq_sockets[0]
-#define mq_tx_socket  bdc_mq_sockets[1]
+// Message queue used by the data model thread to post messages to the BDC thread
+static msg_queue_t bdc_mq = MSG_QUEUE_UNINITIALISED;
 
 //-------------------------------------------------------------------------
 // Enumeration of message types for BDC thread's message queue
@@ -124,6 +121,7 @@ static bool bdc_exit_scheduled = false;
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void UpdateBdcSockSet(socket_set_t *set);
 void ProcessBdcMessageQueueSocketActivity(socket_set_t *set);
+void ProcessBdcExecMessage(bdc_exec_msg_t *msg);
 int StartSendingReport(bdc_connection_t *bc);
 void FreeBdcExecMsgContents(bdc_exec_msg_t *msg);
 size_t bulkdata_curl_null_sink(void *buffer, size_t size, size_t nmemb, void *userp);
@@ -160,12 +158,11 @@ int BDC_EXEC_Init(void)
         bc->profile_id = INVALID;
     }
 
-    // Exit if unable to initialize the unix domain socket pair used to implement a message queue
-    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, bdc_mq_sockets);
-    if (err != 0)
+    // Exit if unable to initialize the message queue
+    err = MSG_QUEUE_Init(&bdc_mq, sizeof(bdc_exec_msg_t), BDC_EXEC_MSG_QUEUE_SIZE);
+    if (err != USP_ERR_OK)
     {
-        USP_ERR_ERRNO("socketpair", errno);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 
     return USP_ERR_OK;
@@ -194,7 +191,6 @@ int BDC_EXEC_Init(void)
 int BDC_EXEC_PostReportToSend(int profile_id, char *full_url, char *query_string, char *username, char *password, unsigned char *report, int report_len, unsigned flags)
 {
     bdc_exec_msg_t  msg;
-    int bytes_sent;
 
     // Form message (do this first, so that we can free message contents if a failure occurs)
     memset(&msg, 0, sizeof(msg));
@@ -209,26 +205,16 @@ int BDC_EXEC_PostReportToSend(int profile_id, char *full_url, char *query_string
     msg.flags = flags;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&bdc_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         FreeBdcExecMsgContents(&msg);
         return USP_ERR_INTERNAL_ERROR;
     }
 
-    // Exit if unable to send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-
-        // Free all buffers whose ownership has not passed to BDC exec
-        FreeBdcExecMsgContents(&msg);
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    // Send the message
+    MSG_QUEUE_Post(&bdc_mq, &msg);
 
-    // Message was sent successfully
     return USP_ERR_OK;
 }
 
@@ -246,27 +232,20 @@ int BDC_EXEC_PostReportToSend(int profile_id, char *full_url, char *query_string
 void BDC_EXEC_ScheduleExit(void)
 {
     bdc_exec_msg_t  msg;
-    int bytes_sent;
 
     // Form message (do this first, so that we can free message contents if a failure occurs)
     memset(&msg, 0, sizeof(msg));
     msg.msg_type = kBdcMsgType_ScheduleExit;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&bdc_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return;
     }
 
-    // Exit if unable to send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    // Send the message
+    MSG_QUEUE_Post(&bdc_mq, &msg);
 }
 /*********************************************************************//**
 **
@@ -286,6 +265,9 @@ void *BDC_EXEC_Main(void *args)
     bdc_connection_t *bc;
     int i;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     // Exit if uable to create a curl multi-interface handle
     curl_multi_ctx = curl_multi_init();
     if (curl_multi_ctx == NULL)
@@ -400,7 +382,7 @@ void UpdateBdcSockSet(socket_set_t *set)
 
 exit:
     // Add the message queue receiving socket to the socket set
-    SOCKET_SET_AddSocketToReceiveFrom(mq_rx_socket, MAX_SOCKET_TIMEOUT, set);
+    SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&bdc_mq), MAX_SOCKET_TIMEOUT, set);
 }
 
 /*********************************************************************//**
@@ -416,27 +398,41 @@ exit:
 **************************************************************************/
 void ProcessBdcMessageQueueSocketActivity(socket_set_t *set)
 {
-    int bytes_read;
     bdc_exec_msg_t  msg;
-    bdc_connection_t *bc;
-    int err;
 
     // Exit if there is no activity on the message queue socket
-    if (SOCKET_SET_IsReadyToRead(mq_rx_socket, set) == 0)
+    if (SOCKET_SET_IsReadyToRead(MSG_QUEUE_GetSocket(&bdc_mq), set) == 0)
     {
         return;
     }
 
-    // Exit if unable to read the full message received
-    bytes_read = recv(mq_rx_socket, &msg, sizeof(msg), 0);
-    if (bytes_read != sizeof(msg))
+    // Process all messages on the queue
+    // NOTE: The wakeup must be cleared before reading the messages, otherwise a message posted whilst reading could be missed
+    MSG_QUEUE_ClearWakeup(&bdc_mq);
+    while (MSG_QUEUE_Get(&bdc_mq, &msg))
     {
-        USP_LOG_Error("%s: recv() did not return a full message", __FUNCTION__);
-        return;
+        ProcessBdcExecMessage(&msg);
     }
+}
+
+/*********************************************************************//**
+**
+** ProcessBdcExecMessage
+**
+** Processes a message received on the BDC thread's message queue
+**
+** \param   msg - pointer to message to process
+**
+** \return  None (any errors that occur are handled internally)
+**
+**************************************************************************/
+void ProcessBdcExecMessage(bdc_exec_msg_t *msg)
+{
+    bdc_connection_t *bc;
+    int err;
 
     // Exit if this is a ScheduleExit message
-    if (msg.msg_type == kBdcMsgType_ScheduleExit)
+    if (msg->msg_type == kBdcMsgType_ScheduleExit)
     {
         bdc_exit_scheduled = true;
         return;
@@ -444,26 +440,26 @@ void ProcessBdcMessageQueueSocketActivity(socket_set_t *set)
 
     // If the code gets here, it must be a SendReport message
     // Exit if unable to find a connection slot
-    USP_ASSERT(msg.msg_type == kBdcMsgType_SendReport);
+    USP_ASSERT(msg->msg_type == kBdcMsgType_SendReport);
     bc = FindFreeBdcConnection();
     if (bc == NULL)
     {
         USP_LOG_Error("%s: Unable to find a free BDC connection slot", __FUNCTION__);
-        FreeBdcExecMsgContents(&msg);
+        FreeBdcExecMsgContents(msg);
         return;
     }
 
     // Fill in the connection slot
     // Ownership of dynamically allocated buffers moves from the BdcExecMsg to the Bdc connection slot
-    bc->profile_id = msg.profile_id;
+    bc->profile_id = msg->profile_id;
     bc->curl_ctx = NULL;
-    bc->full_url = msg.full_url;
-    bc->query_string = msg.query_string;
-    bc->username = msg.username;
-    bc->password = msg.password;
-    bc->report = msg.report;
-    bc->report_len = msg.report_len;
-    bc->flags = msg.flags;
+    bc->full_url = msg->full_url;
+    bc->query_string = msg->query_string;
+    bc->username = msg->username;
+    bc->password = msg->password;
+    bc->report = msg->report;
+    bc->report_len = msg->report_len;
+    bc->flags = msg->flags;
     bc->headers = NULL;
 
     // Attempt to start sending the report
@@ -66,6 +66,7 @@
 #include "stomp.h"
 #include "group_get_vector.h"
 #include "bdc_exec.h"
+#include "proto_trace.h"
 
 //------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
@@ -90,6 +91,8 @@ int ExecuteCli_DbSet(char *param, char *value, char *usage);
 int ExecuteCli_DbDel(char *param, char *arg2, char *usage);
 int ExecuteCli_Verbose(char *level, char *arg2, char *usage);
 int ExecuteCli_ProtoTrace(char *level, char *arg2, char *usage);
+int ExecuteCli_ProtoTraceSample(char *arg1, char *arg2, char *usage);
+int ExecuteCli_ProtoTraceFilter(char *arg1, char *arg2, char *usage);
 int ExecuteCli_Stop(char *arg1, char *arg2, char *usage);
 char *SplitOffTrailingNumber(char *s);
 int SplitSetExpression(char *expr, char *search_path, int search_path_len, char *param_name, int param_name_len);
@@ -145,7 +148,9 @@ cli_cmd_t cli_commands[] =
     { "dbset",   2, RUN_LOCALLY,  ExecuteCli_DbSet, "dbset [parameter] [value]"},
     { "dbdel",   1, RUN_LOCALLY,  ExecuteCli_DbDel, "dbdel [parameter]"},
     { "verbose", 1, RUN_REMOTELY, ExecuteCli_Verbose, "verbose [level]"},
-    { "prototrace", 1, RUN_REMOTELY, ExecuteCli_ProtoTrace, "prototrace [enable]"},
+    { "prototrace", 1, RUN_REMOTELY, ExecuteCli_ProtoTrace, "prototrace [enable | 'compact']"},
+    { "prototracesample", 1, RUN_REMOTELY, ExecuteCli_ProtoTraceSample, "prototracesample [1-in-N]"},
+    { "prototracefilter", 1, RUN_REMOTELY, ExecuteCli_ProtoTraceFilter, "prototracefilter [msg-type | endpoint_id | 'none']"},
     { "stop",    0, RUN_REMOTELY, ExecuteCli_Stop, "stop"},
 };
 
@@ -1588,7 +1593,7 @@ int ExecuteCli_Verbose(char *arg1, char *arg2, char *usage)
 **
 ** Executes the prototrace CLI command
 **
-** \param   arg1 - Value setting whether protocol tracing is enabled or not (0=off, 1 = enabled)
+** \param   arg1 - Value setting whether protocol tracing is enabled or not (0=off, 1 = enabled, 'compact' = enabled with one line per USP message)
 ** \param   arg2 - unused
 ** \param   usage - pointer to string containing usage info for this command
 **
@@ -1600,6 +1605,15 @@ int ExecuteCli_ProtoTrace(char *arg1, char *arg2, char *usage)
     int err;
     log_level_t enable;
 
+    // Exit if enabling compact protocol tracing
+    if (strcmp(arg1, "compact")==0)
+    {
+        PROTO_TRACE_SetMode(kProtoTraceMode_Compact);
+        enable_protocol_trace = true;
+        SendCliResponse("Compact Protocol Tracing has been enabled\n");
+        return USP_ERR_OK;
+    }
+
     err = TEXT_UTILS_StringToUnsigned(arg1, &enable);
     if ((err != USP_ERR_OK) || (enable > 1))
     {
@@ -1608,6 +1622,7 @@ int ExecuteCli_ProtoTrace(char *arg1, char *arg2, char *usage)
     }
     else
     {
+        PROTO_TRACE_SetMode(kProtoTraceMode_Full);
         enable_protocol_trace = (bool) enable;
         SendCliResponse("Protocol Tracing has been %s\n", (enable) ? "enabled" : "disabled");
     }
@@ -1615,6 +1630,66 @@ int ExecuteCli_ProtoTrace(char *arg1, char *arg2, char *usage)
     return err;
 }
 
+/*********************************************************************//**
+**
+** ExecuteCli_ProtoTraceSample
+**
+** Executes the prototracesample CLI command
+**
+** \param   arg1 - Only 1 in this number of USP messages are traced (1 = all USP messages traced)
+** \param   arg2 - unused
+** \param   usage - pointer to string containing usage info for this command
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int ExecuteCli_ProtoTraceSample(char *arg1, char *arg2, char *usage)
+{
+    int err;
+    unsigned rate;
+
+    err = TEXT_UTILS_StringToUnsigned(arg1, &rate);
+    if ((err != USP_ERR_OK) || (rate == 0))
+    {
+        SendCliResponse("ERROR: Prototrace sample rate (%s) is invalid\n", arg1);
+        return USP_ERR_INVALID_ARGUMENTS;
+    }
+
+    PROTO_TRACE_SetSampleRate(rate);
+    SendCliResponse("Protocol Tracing will trace 1 in %u USP messages\n", rate);
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** ExecuteCli_ProtoTraceFilter
+**
+** Executes the prototracefilter CLI command
+** USP messages matching the filter are traced in full, all others are traced in compact format
+**
+** \param   arg1 - USP message type (eg 'GET') or endpoint_id of USP messages to trace in full, or 'none' to remove the filter
+** \param   arg2 - unused
+** \param   usage - pointer to string containing usage info for this command
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int ExecuteCli_ProtoTraceFilter(char *arg1, char *arg2, char *usage)
+{
+    if (strcmp(arg1, "none")==0)
+    {
+        PROTO_TRACE_SetFilter(NULL);
+        SendCliResponse("Protocol Tracing filter has been removed\n");
+        return USP_ERR_OK;
+    }
+
+    PROTO_TRACE_SetFilter(arg1);
+    SendCliResponse("Protocol Tracing will trace USP messages matching '%s' in full\n", arg1);
+
+    return USP_ERR_OK;
+}
+
 /*********************************************************************//**
 **
 ** ExecuteCli_stop
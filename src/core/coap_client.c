@@ -68,6 +68,8 @@
 #include "text_utils.h"
 #include "nu_ipaddr.h"
 #include "iso8601.h"
+#include "dns_resolver.h"
+#include "uptime.h"
 
 
 //------------------------------------------------------------------------
@@ -90,23 +92,26 @@ typedef struct
 	BIO *rbio;                   // SSL BIO used to read DTLS packets
 	BIO *wbio;                   // SSL BIO used to write DTLS packets
 
-    unsigned message_id;         // Message ID - unique for the current block being sent
+    unsigned message_id;         // Message ID - unique for the current block being sent. Subsequent blocks in flight use the following message IDs
     unsigned char token[4];      // Token to identify the request being sent (same for all blocks encapsulating a single USP message)
     char uri_query_option[128];  // URI query string, telling the recipient what to send the response to
 
-    int cur_block;               // Current block number that we're trying to send
+    int cur_block;               // Current block number that we're trying to send (ie the oldest block that has not been acknowledged yet)
+    int num_blocks_in_flight;    // Number of blocks (starting at cur_block) that have been sent, but not acknowledged yet
+    int window_size;             // Maximum number of blocks that may be in flight. This is 1 until the first block has been acknowledged, so that the block size is negotiated first
     int block_size;              // Size of blocks (in bytes) that we're sending (the receiver may request that we send a smaller block size)
     int bytes_sent;              // Number of bytes successfully sent of the USP record in BLOCK PDUs.
 
-    int ack_timeout_ms;          // Timeout to receiving next ACK in milliseconds. NOTE: Currently code rounds this down to the nearest number of seconds
-    time_t ack_timeout_time;     // Absolute time at which we timeout waiting for an ACK
+    int ack_timeout_ms;          // Timeout to receiving next ACK in milliseconds
+    uint64_t ack_timeout_time;   // Monotonic time (in ms) at which we timeout waiting for an ACK
     int retransmission_counter;  // Number of times that we've retried sending the current block
 
     int reconnect_timeout_ms;    // Timeout to next trying to reconnect
-    time_t reconnect_time;       // Time at which we try to connect the socket again. This is used if we're unable to resolve the server IP address
+    uint64_t reconnect_time;     // Monotonic time (in ms) at which we try to connect the socket again. This is used if we're unable to resolve the server IP address
                                  // This variable is only valid if socket_fd==INVALID
     int reconnect_count;         // Count of number of times that we've tried reconnecting. NOTE: This also includes a count of the retransmission counter
-    time_t linger_time;          // time at which we close the connection because we have no more USP Records to send
+    bool is_resolving;           // Set if we are waiting for the DNS resolver thread to lookup the controller's hostname
+    uint64_t linger_time;        // Monotonic time (in ms) at which we close the connection because we have no more USP Records to send
 
 } coap_client_t;
 
@@ -149,7 +154,7 @@ SSL_CTX *coap_client_ssl_ctx = NULL;
 //------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void HandleCoapAck(coap_client_t *cc);
-unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp);
+unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp, int *num_acked);
 void HandleNoCoapAck(coap_client_t *cc);
 void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags);
 int ClientConnectToController(coap_client_t *cc, nu_ipaddr_t *peer_addr, coap_config_t *config);
@@ -157,8 +162,9 @@ void StopSendingToController(coap_client_t *cc);
 void RetryClientSendLater(coap_client_t *cc, unsigned flags);
 int SendCoapRstFromClient(coap_client_t *cc, parsed_pdu_t *pp);
 void SendFirstCoapBlock(coap_client_t *cc);
-int SendCoapBlock(coap_client_t *cc);
-int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len);
+int SendMoreCoapBlocks(coap_client_t *cc);
+int SendCoapBlock(coap_client_t *cc, int index);
+int WriteCoapBlock(coap_client_t *cc, int index, unsigned char *buf, int len);
 int CalcCoapInitialTimeout(void);
 coap_client_t *FindUnusedCoapClient(void);
 coap_client_t *FindCoapClientByInstance(int cont_instance, int mtp_instance);
@@ -218,6 +224,9 @@ int COAP_CLIENT_InitStart(void)
         return USP_ERR_INTERNAL_ERROR;
     }
 
+    // Allow reconnects to the controller to resume the previous DTLS session, avoiding a full handshake
+    DEVICE_SECURITY_EnableSessionCache(coap_client_ssl_ctx);
+
     return USP_ERR_OK;
 }
 
@@ -300,11 +309,14 @@ int COAP_CLIENT_Start(int cont_instance, int mtp_instance, char *endpoint_id)
     cc->mtp_instance = mtp_instance;
     cc->socket_fd = INVALID;
     cc->message_id = rand_r(&mtp_thread_random_seed) & 0xFFFF;
-    cc->reconnect_time = INVALID_TIME;
+    cc->num_blocks_in_flight = 0;
+    cc->window_size = 1;
+    cc->reconnect_time = INVALID_MSECS;
     cc->reconnect_count = 0;
     cc->reconnect_timeout_ms = CalcCoapInitialTimeout();
+    cc->is_resolving = false;
 
-    cc->linger_time = INVALID_TIME;
+    cc->linger_time = INVALID_MSECS;
 
     err = USP_ERR_OK;
 
@@ -395,11 +407,10 @@ void COAP_CLIENT_UpdateAllSockSet(socket_set_t *set)
 {
     int i;
     coap_client_t *cc;
-    time_t cur_time;
+    uint64_t cur_time;
     int timeout;        // timeout in milliseconds
 
-    cur_time = time(NULL);
-    #define CALC_TIMEOUT(res, t) res = t - cur_time; if (res < 0) { res = 0; }
+    cur_time = tu_uptime_msecs64();
 
     // Add all CoAP client sockets (these receive CoAP ACK packets from the controller)
     for (i=0; i<MAX_COAP_CLIENTS; i++)
@@ -410,26 +421,26 @@ void COAP_CLIENT_UpdateAllSockSet(socket_set_t *set)
             if (cc->socket_fd != INVALID)
             {
                 // If keeping socket open in case a new USP Record becomes ready to send...
-                timeout = MAX_SOCKET_TIMEOUT_SECONDS;
-                if (cc->linger_time != INVALID_TIME)
+                timeout = MAX_SOCKET_TIMEOUT;
+                if (cc->linger_time != INVALID_MSECS)
                 {
-                    CALC_TIMEOUT(timeout, cc->linger_time);
+                    timeout = tu_msecs_until(cc->linger_time, cur_time);
                 }
-                else if (cc->ack_timeout_time != INVALID_TIME)
+                else if (cc->ack_timeout_time != INVALID_MSECS)
                 {
                     // Wait until timeout on receiving an ACK on this socket
-                    CALC_TIMEOUT(timeout, cc->ack_timeout_time);
+                    timeout = tu_msecs_until(cc->ack_timeout_time, cur_time);
                 }
 
-                SOCKET_SET_AddSocketToReceiveFrom(cc->socket_fd, timeout*1000, set);
+                SOCKET_SET_AddSocketToReceiveFrom(cc->socket_fd, timeout, set);
             }
             else
             {
                 // We were unable to connect to the controller last time, so wait until timeout, then try again
-                if (cc->reconnect_time != INVALID_TIME)
+                if (cc->reconnect_time != INVALID_MSECS)
                 {
-                    CALC_TIMEOUT(timeout, cc->reconnect_time);
-                    SOCKET_SET_UpdateTimeout(timeout*1000, set);
+                    timeout = tu_msecs_until(cc->reconnect_time, cur_time);
+                    SOCKET_SET_UpdateTimeout(timeout, set);
                 }
             }
         }
@@ -451,9 +462,9 @@ void COAP_CLIENT_ProcessAllSocketActivity(socket_set_t *set)
 {
     int i;
     coap_client_t *cc;
-    time_t cur_time;
+    uint64_t cur_time;
 
-    cur_time = time(NULL);
+    cur_time = tu_uptime_msecs64();
 
     // Service all CoAP client sockets (these receive CoAP ACK packets from the controller)
     for (i=0; i<MAX_COAP_CLIENTS; i++)
@@ -461,6 +472,15 @@ void COAP_CLIENT_ProcessAllSocketActivity(socket_set_t *set)
         cc = &coap_clients[i];
         if (cc->cont_instance != INVALID)
         {
+            // Continue sending the current USP Record, if we were waiting for the controller's hostname to be resolved
+            // NOTE: If the lookup is still pending, then StartSendingCoapUspRecord() just sets is_resolving again
+            if (cc->is_resolving)
+            {
+                cc->is_resolving = false;
+                StartSendingCoapUspRecord(cc, RETRY_CURRENT);
+                continue;
+            }
+
             if (cc->socket_fd != INVALID)
             {
                 if (SOCKET_SET_IsReadyToRead(cc->socket_fd, set))
@@ -468,12 +488,12 @@ void COAP_CLIENT_ProcessAllSocketActivity(socket_set_t *set)
                     // Handle ACK received
                     HandleCoapAck(cc);
                 }
-                else if ((cc->ack_timeout_time != INVALID_TIME) && (cur_time >= cc->ack_timeout_time))
+                else if ((cc->ack_timeout_time != INVALID_MSECS) && (cur_time >= cc->ack_timeout_time))
                 {
                     // Handle ACK not received within timeout period
                     HandleNoCoapAck(cc);
                 }
-                else if ((cc->linger_time != INVALID_TIME) && (cur_time >= cc->linger_time))
+                else if ((cc->linger_time != INVALID_MSECS) && (cur_time >= cc->linger_time))
                 {
                     // Handle closing down socket after linger period
                     USP_PROTOCOL("%s: Closing down CoAP client socket after linger period", __FUNCTION__);
@@ -483,7 +503,7 @@ void COAP_CLIENT_ProcessAllSocketActivity(socket_set_t *set)
             else
             {
                 // Retry connecting to controller's CoAP server
-                if ((cc->reconnect_time != INVALID_TIME) && (cur_time >= cc->reconnect_time))
+                if ((cc->reconnect_time != INVALID_MSECS) && (cur_time >= cc->reconnect_time))
                 {
                     StartSendingCoapUspRecord(cc, RETRY_CURRENT);
                 }
@@ -634,6 +654,7 @@ void HandleCoapAck(coap_client_t *cc)
     unsigned char buf[MAX_COAP_PDU_SIZE];
     parsed_pdu_t pp;
     unsigned action_flags;
+    int num_acked = 0;
 
     // Exit if connection was closed
     len = COAP_ReceivePdu(cc->ssl, cc->rbio, cc->socket_fd, buf, sizeof(buf));
@@ -660,7 +681,7 @@ void HandleCoapAck(coap_client_t *cc)
     }
 
     // Determine what actions to take
-    action_flags = CalcCoapClientActions(cc, &pp);
+    action_flags = CalcCoapClientActions(cc, &pp, &num_acked);
 
 exit:
     // Perform the actions set in the action flags
@@ -681,21 +702,37 @@ exit:
         return;
     }
 
-    // Handle sending the next block
+    // Handle sending the next block(s)
     if (action_flags & SEND_NEXT_BLOCK)
     {
-        cc->cur_block++;
-        cc->bytes_sent += cc->block_size;
-        cc->message_id = NEXT_MESSAGE_ID(cc->message_id);
+        // The ACK acknowledges all blocks in flight up to and including the one that it is for
+        cc->cur_block += num_acked;
+        cc->bytes_sent += num_acked * cc->block_size;
+        cc->message_id = (cc->message_id + num_acked) & 0xFFFF;
+        cc->num_blocks_in_flight -= num_acked;
         cc->ack_timeout_ms = CalcCoapInitialTimeout();
         cc->retransmission_counter = 0;
+        cc->window_size = COAP_CLIENT_NSTART;
 
         // Change the size of the next blocks being sent out, if the receiver requested it,
         //and the size they requested is less than our current (otherwise ignore the request)
-        cc->block_size = MIN(cc->block_size, pp.block_size);
+        if (pp.block_size < cc->block_size)
+        {
+            // Blocks still in flight were sent with the old block size, so abandon them and send them again with the new block size
+            // NOTE: Late ACKs for the abandoned blocks are ignored, because the resent blocks use later message IDs
+            cc->message_id = (cc->message_id + cc->num_blocks_in_flight) & 0xFFFF;
+            cc->num_blocks_in_flight = 0;
+            cc->block_size = pp.block_size;
+        }
 
-        // Send the next block
-        err = SendCoapBlock(cc);
+        // Restart the timeout for the oldest block still in flight (if there is one)
+        if (cc->num_blocks_in_flight > 0)
+        {
+            cc->ack_timeout_time = tu_uptime_msecs64() + cc->ack_timeout_ms;
+        }
+
+        // Send the next block(s)
+        err = SendMoreCoapBlocks(cc);
         if (err != USP_ERR_OK)
         {
             // If failed to send next block, then go back to retrying to transmit the first block
@@ -745,14 +782,17 @@ void HandleCoapClientConnectionError(coap_client_t *cc)
 **
 ** \param   cc - pointer to structure describing coap client to update
 ** \param   pp - pointer to structure containing the parsed CoAP PDU
+** \param   num_acked - pointer to variable in which to return the number of blocks in flight acknowledged by the PDU
+**                      NOTE: This is only set if SEND_NEXT_BLOCK is returned
 **
 ** \return  action flags determining what actions to take
 **
 **************************************************************************/
-unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp)
+unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp, int *num_acked)
 {
     coap_send_item_t *csi;
     bool sent_last_block;
+    int index;
 
     // Exit if we received a RST. Retry sending the message, starting at the first block
     if (pp->pdu_type == kPduType_Reset)
@@ -778,11 +818,20 @@ unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp)
         return SEND_RST;
     }
 
-    // Exit if ACK has unexpected message_id
+    // Exit if ACK has unexpected message_id (ie it is not for any of the blocks in flight)
     // NOTE: This is not an error. It may occur in practice if server sent out more than one ACK, and some got delayed
-    if (pp->message_id != cc->message_id)
+    index = (pp->message_id - cc->message_id) & 0xFFFF;
+    if (index >= cc->num_blocks_in_flight)
     {
-        USP_PROTOCOL("%s: Received CoAP PDU (MID=%d) is not an ACK for the current message_id=%d. Ignoring.", __FUNCTION__, pp->message_id, cc->message_id);
+        USP_PROTOCOL("%s: Received CoAP PDU (MID=%d) is not an ACK for the current message_id=%d (blocks in flight=%d). Ignoring.", __FUNCTION__, pp->message_id, cc->message_id, cc->num_blocks_in_flight);
+        return IGNORE_PDU;
+    }
+
+    // Exit if the receiver got a block before an earlier block that is still in flight (which may have been lost)
+    // NOTE: This is not an error. The block will be sent again after the earlier block has been resent
+    if ((index != 0) && (pp->pdu_class == kPduClass_ClientErrorResponse) && (pp->request_response_code == kPduClientErrRespCode_RequestEntityIncomplete))
+    {
+        USP_PROTOCOL("%s: Received CoAP PDU (MID=%d) indicates that block=%d was received out of order. Ignoring.", __FUNCTION__, pp->message_id, cc->cur_block + index);
         return IGNORE_PDU;
     }
 
@@ -810,7 +859,7 @@ unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp)
 
     // Exit if we got a 'Changed' response
     // NOTE: Changed response never contains a BLOCK1 option
-    sent_last_block = (cc->bytes_sent + cc->block_size >= csi->pbuf_len) ? true : false;
+    sent_last_block = (cc->bytes_sent + (index+1)*cc->block_size >= csi->pbuf_len) ? true : false;
     if (pp->request_response_code == kPduSuccessRespCode_Changed)
     {
         // Exit if we were not expecting a 'Changed' response, as we haven't sent all of the blocks
@@ -845,15 +894,16 @@ unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp)
         return RESET_STATE;
     }
 
-    // Exit if the block being acknowledged is not the current block
+    // Exit if the block being acknowledged is not the block sent with this message_id
     // NOTE: This should never occur as the message_id and block number are tied together
-    if (pp->rxed_block != cc->cur_block)
+    if (pp->rxed_block != cc->cur_block + index)
     {
-        USP_PROTOCOL("%s: Received CoAP PDU (MID=%d) is for a different block than current (rxed_block=%d, expected=%d)", __FUNCTION__, pp->message_id, pp->rxed_block, cc->cur_block);
+        USP_PROTOCOL("%s: Received CoAP PDU (MID=%d) is for a different block than current (rxed_block=%d, expected=%d)", __FUNCTION__, pp->message_id, pp->rxed_block, cc->cur_block + index);
         return RESET_STATE;
     }
 
     USP_PROTOCOL("%s: Received CoAP ACK 'Continue' (MID=%d)", __FUNCTION__, pp->message_id);
+    *num_acked = index + 1;
     return SEND_NEXT_BLOCK;
 }
 
@@ -870,6 +920,7 @@ unsigned CalcCoapClientActions(coap_client_t *cc, parsed_pdu_t *pp)
 **************************************************************************/
 void HandleNoCoapAck(coap_client_t *cc)
 {
+    int i;
     int err;
 
     // Exit if we have exhausted the number of retransmission retries for this BLOCK
@@ -894,13 +945,17 @@ void HandleNoCoapAck(coap_client_t *cc)
         return;
     }
 
-    // Retry with a longer timeout period for the ACK
+    // Retry with a longer timeout period for the ACK, resending all blocks in flight (with their original message IDs)
     cc->ack_timeout_ms *= 2;
-    err = SendCoapBlock(cc);
-    if (err != USP_ERR_OK)
+    for (i=0; i < cc->num_blocks_in_flight; i++)
     {
-        // If an error occurred when trying to send the block, then retry sending the whole USP Record later
-        RetryClientSendLater(cc, 0);
+        err = SendCoapBlock(cc, i);
+        if (err != USP_ERR_OK)
+        {
+            // If an error occurred when trying to send the block, then retry sending the whole USP Record later
+            RetryClientSendLater(cc, 0);
+            return;
+        }
     }
 }
 
@@ -923,6 +978,7 @@ void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags)
     coap_send_item_t *csi;
     nu_ipaddr_t csi_peer_addr;
     bool prefer_ipv6;
+    dns_result_t dns_result;
 
     // Drop the current queued USP Record (if required)
     if (flags & SEND_NEXT)
@@ -931,9 +987,10 @@ void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags)
     }
 
     // Clear all timeouts and failure counts
-    cc->ack_timeout_time = INVALID_TIME;
-    cc->reconnect_time = INVALID_TIME;
-    cc->linger_time = INVALID_TIME;
+    cc->ack_timeout_time = INVALID_MSECS;
+    cc->reconnect_time = INVALID_MSECS;
+    cc->linger_time = INVALID_MSECS;
+    cc->is_resolving = false;
 
     // Reset the reconnect count, if this is not a connect retry
     if ((flags & RETRY_CURRENT) == 0)
@@ -950,7 +1007,7 @@ void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags)
     csi = (coap_send_item_t *)cc->send_queue.head;
     if (csi == NULL)
     {
-        cc->linger_time = time(NULL) + COAP_CLIENT_LINGER_PERIOD;
+        cc->linger_time = tu_uptime_msecs64() + COAP_CLIENT_LINGER_PERIOD*SECONDS;
         return;
     }
 
@@ -970,9 +1027,17 @@ void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags)
         // Get the preference for IPv4 or IPv6, if dual stack
         prefer_ipv6 = DEVICE_LOCAL_AGENT_GetDualStackPreference();
 
+        // Exit if the hostname is not in the DNS cache yet. The DNS resolver thread wakes up the MTP thread
+        // when the lookup has completed, and then this function is called again (from COAP_CLIENT_ProcessAllSocketActivity)
+        dns_result = DNS_RESOLVER_Lookup(csi->host, prefer_ipv6, NULL, &csi_peer_addr, MTP_EXEC_CoapWakeup);
+        if (dns_result == kDnsResult_Pending)
+        {
+            cc->is_resolving = true;
+            return;
+        }
+
         // Exit if unable to lookup the IP address of the USP controller to send to
-        err = tw_ulib_diags_lookup_host(csi->host, AF_UNSPEC, prefer_ipv6, NULL, &csi_peer_addr);
-        if (err != USP_ERR_OK)
+        if (dns_result == kDnsResult_Failed)
         {
             RetryClientSendLater(cc, 0);
             return;
@@ -998,6 +1063,8 @@ void StartSendingCoapUspRecord(coap_client_t *cc, unsigned flags)
         err = ClientConnectToController(cc, &csi_peer_addr, &csi->config);
         if (err != USP_ERR_OK)
         {
+            // Look up the IP address of the controller again on the next retry, in case it has moved to a different IP address
+            DNS_RESOLVER_Invalidate(csi->host);
             return;
         }
     }
@@ -1107,6 +1174,7 @@ int PerformClientDtlsConnect(coap_client_t *cc, struct sockaddr_storage *remote_
     int err;
     int result;
     struct timeval timeout;
+    char buf[NU_IPADDRSTRLEN];
 
     USP_ASSERT(cc->ssl == NULL);
 
@@ -1154,6 +1222,10 @@ int PerformClientDtlsConnect(coap_client_t *cc, struct sockaddr_storage *remote_
     // We don't need the certificate chain when we are posting to a controller, only when receiving from a controller (to determine controller trust role)
     SSL_set_app_data(cc->ssl, NULL);
 
+    // Offer a previously negotiated session to the controller, to avoid a full handshake on reconnect
+    nu_ipaddr_str(&cc->peer_addr, buf, sizeof(buf));
+    DEVICE_SECURITY_SetSessionKey(cc->ssl, buf, cc->peer_port);
+
     // Exit if unable to perform the DTLS handshake
     result = SSL_connect(cc->ssl);
     if (result <= 0)
@@ -1197,11 +1269,14 @@ void StopSendingToController(coap_client_t *cc)
     memset(cc->token, 0, sizeof(cc->token));
     cc->message_id = 0;
     cc->cur_block = 0;
+    cc->num_blocks_in_flight = 0;
+    cc->window_size = 1;
     cc->block_size = 0;
     cc->bytes_sent = 0;
-    cc->ack_timeout_time = INVALID_TIME;
-    cc->reconnect_time = INVALID_TIME;
-    cc->linger_time = INVALID_TIME;
+    cc->ack_timeout_time = INVALID_MSECS;
+    cc->reconnect_time = INVALID_MSECS;
+    cc->linger_time = INVALID_MSECS;
+    cc->is_resolving = false;
 }
 
 /*********************************************************************//**
@@ -1219,7 +1294,6 @@ void StopSendingToController(coap_client_t *cc)
 **************************************************************************/
 void RetryClientSendLater(coap_client_t *cc, unsigned flags)
 {
-    time_t cur_time;
     coap_send_item_t *csi;
     int timeout;
 
@@ -1242,15 +1316,14 @@ void RetryClientSendLater(coap_client_t *cc, unsigned flags)
     {
         // Timeout is normally a delay, with the exception of the case where we have already delayed due to a missing ACK
         // (in which case the timeout is 0)
-        timeout = (cc->reconnect_timeout_ms) / 1000;
+        timeout = cc->reconnect_timeout_ms;
         if ((flags & ZERO_DELAY_FOR_FIRST_RECONNECT) && (cc->reconnect_count == 2))  // Using 2 for reconnect count because we've already incremented it by this time
         {
             timeout =0;
         }
 
-        cur_time = time(NULL);
-        cc->reconnect_time = cur_time + timeout;
-        USP_LOG_Error("%s: Retrying to send to %s over CoAP in %d seconds (Retry_count=%d/%d)", __FUNCTION__, csi->host, timeout, cc->reconnect_count, MAX_COAP_RECONNECTS);
+        cc->reconnect_time = tu_uptime_msecs64() + timeout;
+        USP_LOG_Error("%s: Retrying to send to %s over CoAP in %d ms (Retry_count=%d/%d)", __FUNCTION__, csi->host, timeout, cc->reconnect_count, MAX_COAP_RECONNECTS);
 
         // Update the timeout to use next time, in the case of trying to connect again
         cc->reconnect_timeout_ms *= 2;
@@ -1315,6 +1388,8 @@ void SendFirstCoapBlock(coap_client_t *cc)
     STORE_4_BYTES(cc->token, token);
     cc->message_id = NEXT_MESSAGE_ID(cc->message_id);
     cc->cur_block = 0;
+    cc->num_blocks_in_flight = 0;
+    cc->window_size = 1;
     cc->block_size = COAP_CLIENT_PAYLOAD_TX_SIZE;
     cc->bytes_sent = 0;
 
@@ -1328,7 +1403,7 @@ void SendFirstCoapBlock(coap_client_t *cc)
     USP_PROTOCOL("%s: Sending CoAP UriQueryOption='%s'", __FUNCTION__, cc->uri_query_option);
 
     // Send the first block
-    err = SendCoapBlock(cc);
+    err = SendMoreCoapBlocks(cc);
 
 exit:
     // If failed to send the first block, then retry again later
@@ -1338,6 +1413,46 @@ exit:
     }
 }
 
+/*********************************************************************//**
+**
+** SendMoreCoapBlocks
+**
+** Sends as many of the following blocks of the USP record as the window allows
+** With COAP_CLIENT_NSTART=1, this sends only the current block (ie stop-and-wait)
+**
+** \param   cc - pointer to structure describing controller to send to
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int SendMoreCoapBlocks(coap_client_t *cc)
+{
+    int err;
+    coap_send_item_t *csi;
+    int offset;
+
+    csi = (coap_send_item_t *) cc->send_queue.head;
+    while (cc->num_blocks_in_flight < cc->window_size)
+    {
+        // Exit if all blocks of the USP record have been sent
+        // NOTE: The current block is always sent, even if the USP record is empty
+        offset = cc->bytes_sent + cc->num_blocks_in_flight * cc->block_size;
+        if ((cc->num_blocks_in_flight != 0) && (offset >= csi->pbuf_len))
+        {
+            break;
+        }
+
+        err = SendCoapBlock(cc, cc->num_blocks_in_flight);
+        if (err != USP_ERR_OK)
+        {
+            return err;
+        }
+        cc->num_blocks_in_flight++;
+    }
+
+    return USP_ERR_OK;
+}
+
 /*********************************************************************//**
 **
 ** SendCoapBlock
@@ -1345,24 +1460,27 @@ exit:
 ** Sends a CoAP Block using the specified CoAP client
 **
 ** \param   cc - pointer to structure describing controller to send to
+** \param   index - index of the block to send, relative to the current block
 **
 ** \return  USP_ERR_OK if successful
 **
 **************************************************************************/
-int SendCoapBlock(coap_client_t *cc)
+int SendCoapBlock(coap_client_t *cc, int index)
 {
     unsigned char buf[MAX_COAP_PDU_SIZE];
-    time_t cur_time;
     int len;
     int err;
 
     // Exit if unable to create the CoAP PDU to send
-    len = WriteCoapBlock(cc, buf, sizeof(buf));
+    len = WriteCoapBlock(cc, index, buf, sizeof(buf));
     USP_ASSERT(len != 0);
 
     // Calculate the absolute time to timeout waiting for an ACK for this packet
-    cur_time = time(NULL);
-    cc->ack_timeout_time = cur_time + (cc->ack_timeout_ms)/1000;
+    // NOTE: Only the oldest block in flight is timed. Later blocks are resent along with it
+    if (index == 0)
+    {
+        cc->ack_timeout_time = tu_uptime_msecs64() + cc->ack_timeout_ms;
+    }
 
     // Exit if unable to send the CoAP block
     err = COAP_SendPdu(cc->ssl, cc->wbio, cc->socket_fd, buf, len);
@@ -1381,13 +1499,14 @@ int SendCoapBlock(coap_client_t *cc)
 ** Writes a CoAP PDU containing a block of the message to send
 **
 ** \param   cc - pointer to structure describing controller to send to
+** \param   index - index of the block to write, relative to the current block
 ** \param   buf - pointer to buffer in which to write the CoAP PDU
 ** \param   len - length of buffer in which to write the CoAP PDU
 **
 ** \return  Number of bytes written to the CoAP PDU buffer, or 0 if buffer is too small
 **
 **************************************************************************/
-int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
+int WriteCoapBlock(coap_client_t *cc, int index, unsigned char *buf, int len)
 {
     int err;
     unsigned header = 0;
@@ -1399,7 +1518,8 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     unsigned char port_option[2];
     unsigned char content_format_option[1];
     unsigned char block_option[3];
-    unsigned char size_option[2];
+    unsigned char size_option[4];
+    int size_option_len;
     pdu_option_t last_option;
     int block_option_len;
     int pdu_size;
@@ -1407,6 +1527,14 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     str_vector_t uri_path;
     int i;
     int total_uri_path_len;
+    int offset;
+    int block;
+    unsigned message_id;
+
+    // Calculate the position of this block within the USP record, and the message ID that it is sent with
+    offset = cc->bytes_sent + index * cc->block_size;
+    block = cc->cur_block + index;
+    message_id = (cc->message_id + index) & 0xFFFF;
 
     // Calculate the port and content format options
     csi = (coap_send_item_t *) cc->send_queue.head;
@@ -1414,12 +1542,21 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     STORE_BYTE(content_format_option, kPduContentFormat_OctetStream);
 
     // Calculate the block option
-    bytes_remaining = csi->pbuf_len - cc->bytes_sent;
+    bytes_remaining = csi->pbuf_len - offset;
     is_more_blocks = (bytes_remaining <= cc->block_size) ? 0 : 1;
-    block_option_len = COAP_CalcBlockOption(block_option, cc->cur_block, is_more_blocks, cc->block_size);
+    block_option_len = COAP_CalcBlockOption(block_option, block, is_more_blocks, cc->block_size);
 
     // Calculate the size option (this option contains the total size of the message)
-    STORE_2_BYTES(size_option, csi->pbuf_len);
+    if (csi->pbuf_len > 0xFFFF)
+    {
+        STORE_4_BYTES(size_option, csi->pbuf_len);
+        size_option_len = 4;
+    }
+    else
+    {
+        STORE_2_BYTES(size_option, csi->pbuf_len);
+        size_option_len = 2;
+    }
 
     // Exit if unable to convert the destination address to a string literal
     err = nu_ipaddr_to_str(&cc->peer_addr, peer_addr_str, sizeof(peer_addr_str));
@@ -1444,7 +1581,7 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     pdu_size = COAP_HEADER_SIZE + sizeof(cc->token) +
                (NUM_OPTIONS + uri_path.num_entries)*MAX_OPTION_HEADER_SIZE +
                strlen(peer_addr_str) + sizeof(port_option) + total_uri_path_len + sizeof(content_format_option) +
-               strlen(cc->uri_query_option) + block_option_len + sizeof(size_option) +
+               strlen(cc->uri_query_option) + block_option_len + size_option_len +
                1 + payload_size;  // Plus 1 for PDU_OPTION_END_MARKER
     if (pdu_size > len)
     {
@@ -1459,7 +1596,7 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     MODIFY_BITS(27, 24, header, sizeof(cc->token));
     MODIFY_BITS(23, 21, header, kPduClass_Request);
     MODIFY_BITS(20, 16, header, kPduRequestMethod_Post);
-    MODIFY_BITS(15, 0, header, cc->message_id);
+    MODIFY_BITS(15, 0, header, message_id);
 
     // Write the CoAP header bytes and token into the output buffer
     p = buf;
@@ -1484,17 +1621,17 @@ int WriteCoapBlock(coap_client_t *cc, unsigned char *buf, int len)
     p = COAP_WriteOption(kPduOption_ContentFormat, content_format_option, sizeof(content_format_option), p, &last_option);
     p = COAP_WriteOption(kPduOption_UriQuery, (unsigned char *)cc->uri_query_option, strlen(cc->uri_query_option), p, &last_option);
     p = COAP_WriteOption(kPduOption_Block1, block_option, block_option_len, p, &last_option);
-    p = COAP_WriteOption(kPduOption_Size1, size_option, sizeof(size_option), p, &last_option);
+    p = COAP_WriteOption(kPduOption_Size1, size_option, size_option_len, p, &last_option);
 
     // Write the end of options marker into the output buffer
     WRITE_BYTE(p, PDU_OPTION_END_MARKER);
 
     // Write the payload into the output buffer
-    memcpy(p, &csi->pbuf[cc->bytes_sent], payload_size);
+    memcpy(p, &csi->pbuf[offset], payload_size);
     p += payload_size;
 
     // Log a message
-    USP_PROTOCOL("%s: Sending CoAP PDU (MID=%d) block=%d%s (%d bytes). RetryCount=%d/%d, Timeout=%d ms", __FUNCTION__, cc->message_id, cc->cur_block, (is_more_blocks == 0) ? " (last)" : "", payload_size, cc->retransmission_counter, COAP_MAX_RETRANSMIT, cc->ack_timeout_ms);
+    USP_PROTOCOL("%s: Sending CoAP PDU (MID=%d) block=%d%s (%d bytes). RetryCount=%d/%d, Timeout=%d ms", __FUNCTION__, message_id, block, (is_more_blocks == 0) ? " (last)" : "", payload_size, cc->retransmission_counter, COAP_MAX_RETRANSMIT, cc->ack_timeout_ms);
     STR_VECTOR_Destroy(&uri_path);
 
     // Return the number of bytes written to the output buffer
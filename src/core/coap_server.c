@@ -47,6 +47,7 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <net/if.h>
 
 #include <openssl/ssl.h>
@@ -69,6 +70,7 @@
 #include "nu_ipaddr.h"
 #include "iso8601.h"
 #include "usp-record.pb-c.h"
+#include "uptime.h"
 
 //------------------------------------------------------------------------
 // Structure storing the last CoAP response PDU sent. Used to send the same response
@@ -79,15 +81,32 @@ typedef struct
     int len;                   // Length (in bytes) of the response in pdu_data[]
 } pdu_response_t;
 
+//------------------------------------------------------------------------
+// Number of buckets in the hash table used to find a CoAP server session by the peer's IP address and port
+#define COAP_SESSION_HASH_BUCKETS 64
+
+//------------------------------------------------------------------------
+// State of the DTLS handshake on a CoAP server session
+typedef enum
+{
+    kDtlsHandshake_None,        // Not performing a DTLS handshake (either the session is unencrypted, or the handshake has completed)
+    kDtlsHandshake_Listening,   // Waiting for the peer to send a 'ClientHello' containing the cookie that we sent in the 'HelloVerifyRequest'
+    kDtlsHandshake_Accepting,   // Performing the rest of the DTLS handshake
+} dtls_handshake_state_t;
+
 //------------------------------------------------------------------------
 // Structure representing a CoAP server session
-typedef struct
+typedef struct coap_server_session_tag
 {
-    int socket_fd;          // Socket that we are listening on for USP messages from a controller or INVALID if this slot is not in use
-    int index;              // Index of session in sessions[] array of coap_server_t structure. Used only for debug
+    double_link_t link;     // Doubly linked list pointers. These must always be first in this structure
+    struct coap_server_session_tag *hash_next; // Next session in the same bucket of the session hash table
+
+    int socket_fd;          // Socket that we are listening on for USP messages from a controller or INVALID if the session has been stopped
+    int index;              // Identifier of this session, unique within the CoAP server. Used only for debug
     SSL *ssl;               // SSL connection object used for this CoAP server
     BIO *rbio;              // SSL BIO used to read DTLS packets
     BIO *wbio;              // SSL BIO used to write DTLS packets
+    dtls_handshake_state_t handshake_state; // State of the (non-blocking) DTLS handshake
 
     bool is_first_usp_msg;  // Set if this is the first USP request message received since the server was reset.
                             // This is used as a hint to reset our CoAP client sending the USP response
@@ -104,7 +123,7 @@ typedef struct
 
     int block_count;        // Count of number of blocks received for the current USP message (ie for current CoAP message token)
     int block_size;         // Size of the blocks being received. The server must use the same size of all of the blocks making up a USP record.
-    int last_block_time;    // Time at which the last block was received
+    uint64_t last_block_time; // Monotonic time (in ms) at which the last block was received
 
     unsigned char *usp_buf; // Pointer to buffer in which the payload is appended, to form the full USP record
     int usp_buf_len;        // Length of the USP record buffer
@@ -128,7 +147,10 @@ typedef struct
     int listen_sock;        // Socket listening for new connections, this socket will get moved to one of the CoAP
                             // sessions when a new packet is received, and a new listening socket will take its place
 
-    coap_server_session_t sessions[MAX_COAP_SERVER_SESSIONS]; // concurrent communication sessions with this server
+    double_linked_list_t sessions;  // concurrent communication sessions with this server
+    coap_server_session_t *session_table[COAP_SESSION_HASH_BUCKETS]; // Hash table of the sessions, indexed by peer IP address and port
+    int num_sessions;       // Number of sessions in the sessions list
+    int next_session_index; // Identifier to give to the next session created. Used only for debug
 
 } coap_server_t;
 
@@ -152,13 +174,19 @@ static unsigned char coap_hmac_key[16];
 
 //------------------------------------------------------------------------------
 // Variables associated with determining whether the listening IP address of our CoAP server has changed (used by UpdateCoapServerInterfaces)
-static time_t next_coap_server_if_poll_time = 0;   // Absolute time at which to next poll for IP address change
+static uint64_t next_coap_server_if_poll_time = 0; // Monotonic time (in ms) at which to next poll for IP address change
 
 //------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 int StartCoapListenSock(coap_server_t *cs);
 void InitCoapSession(coap_server_session_t *css);
-coap_server_session_t *FindCoapSession(coap_server_t *cs, nu_ipaddr_t *peer_addr);
+coap_server_session_t *AllocCoapSession(coap_server_t *cs, nu_ipaddr_t *peer_addr, uint16_t peer_port);
+coap_server_session_t *FindCoapSessionByPeer(coap_server_t *cs, nu_ipaddr_t *peer_addr, uint16_t peer_port);
+coap_server_session_t *FindCoapSessionToEvict(coap_server_t *cs, nu_ipaddr_t *peer_addr);
+void FreeCoapSession(coap_server_t *cs, coap_server_session_t *css);
+void StopAllCoapSessions(coap_server_t *cs);
+int UpdateCoapSessions(coap_server_t *cs);
+unsigned CalcCoapSessionHash(nu_ipaddr_t *peer_addr, uint16_t peer_port);
 void ReceiveCoapBlock(coap_server_t *cs, coap_server_session_t *css);
 void StartCoapSession(coap_server_t *cs);
 void StopCoapSession(coap_server_session_t *css);
@@ -179,7 +207,9 @@ coap_server_t *FindFirstCoapServerByInterface(char *interface, bool encryption_p
 void CalcCoapClassForAck(parsed_pdu_t *pp, unsigned action_flags, int *pdu_class, int *response_code);
 void LogRxedCoapPdu(parsed_pdu_t *pp);
 int UpdateCoapServerInterfaces(void);
-int PerformSessionDtlsConnect(coap_server_session_t *css);
+int StartSessionDtlsHandshake(coap_server_session_t *css);
+int ContinueSessionDtlsHandshake(coap_server_session_t *css);
+int SetSessionSocketBlocking(coap_server_session_t *css, bool is_blocking);
 int CalcCoapServerCookie(SSL *ssl, unsigned char *buf, unsigned int *p_len);
 int VerifyCoapServerCookie(SSL *ssl, SSL_CONST unsigned char *buf, unsigned int len);
 
@@ -300,9 +330,7 @@ void COAP_SERVER_Destroy(void)
 **************************************************************************/
 int COAP_SERVER_Start(int instance, char *interface, coap_config_t *config)
 {
-    int j;
     coap_server_t *cs;
-    coap_server_session_t *css;
     int err = USP_ERR_OK;
 
     COAP_LockMutex();
@@ -333,14 +361,10 @@ int COAP_SERVER_Start(int instance, char *interface, coap_config_t *config)
     cs->listen_resource = USP_STRDUP(config->resource);
     cs->enable_encryption = config->enable_encryption;
 
-    // Mark all sockets and CoAP sessions as not in use yet
+    // Mark the listening socket as not in use yet. There are no CoAP sessions yet
+    // NOTE: The session hash table has already been zeroed by the memset above
     cs->listen_sock = INVALID;
-    for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
-    {
-        css = &cs->sessions[j];
-        css->socket_fd = INVALID;
-        css->index = j;
-    }
+    DLLIST_Init(&cs->sessions);
 
     USP_LOG_Info("%s: Starting CoAP server on interface=%s, port=%d (%s), resource=%s", __FUNCTION__, interface, cs->listen_port, IS_ENCRYPTED_STRING(cs->enable_encryption), cs->listen_resource);
 
@@ -377,9 +401,7 @@ exit:
 **************************************************************************/
 int COAP_SERVER_Stop(int instance, char *interface, coap_config_t *unused)
 {
-    int i;
     coap_server_t *cs;
-    coap_server_session_t *css;
 
     USP_LOG_Info("%s: Stopping CoAP server [%d]", __FUNCTION__, instance);
 
@@ -405,12 +427,10 @@ int COAP_SERVER_Stop(int instance, char *interface, coap_config_t *unused)
     // Free all dynamically allocated buffers
     USP_SAFE_FREE(cs->listen_resource);
 
-    // Close all session sockets and any associated SSL, BIO objects and buffers
-    for (i=0; i<MAX_COAP_SERVER_SESSIONS; i++)
-    {
-        css = &cs->sessions[i];
-        StopCoapSession(css);
-    }
+    // Close all session sockets and any associated SSL, BIO objects and buffers, then free the sessions
+    StopAllCoapSessions(cs);
+    UpdateCoapSessions(cs);
+    USP_ASSERT(cs->num_sessions == 0);
 
     // Put back to init state
     memset(cs, 0, sizeof(coap_server_t));
@@ -479,14 +499,14 @@ exit:
 **************************************************************************/
 void COAP_SERVER_UpdateAllSockSet(socket_set_t *set)
 {
-    int i, j;
+    int i;
     coap_server_t *cs;
     coap_server_session_t *css;
     int timeout;        // timeout in milliseconds
 
     // Determine whether IP address of any of CoAP servers has changed (if time to poll it)
     timeout = UpdateCoapServerInterfaces();
-    SOCKET_SET_UpdateTimeout(timeout*SECONDS, set);
+    SOCKET_SET_UpdateTimeout(timeout, set);
 
     // Iterate over all CoAP servers
     for (i=0; i<MAX_COAP_SERVERS; i++)
@@ -500,14 +520,16 @@ void COAP_SERVER_UpdateAllSockSet(socket_set_t *set)
                 SOCKET_SET_AddSocketToReceiveFrom(cs->listen_sock, MAX_SOCKET_TIMEOUT, set);
             }
 
+            // Free all sessions which have stopped or been idle for too long, and determine when the next session becomes idle
+            timeout = UpdateCoapSessions(cs);
+            SOCKET_SET_UpdateTimeout(timeout, set);
+
             // Iterate over all existing sessions on this interface
-            for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
+            css = (coap_server_session_t *) cs->sessions.head;
+            while (css != NULL)
             {
-                css = &cs->sessions[j];
-                if (css->socket_fd != INVALID)
-                {
-                    SOCKET_SET_AddSocketToReceiveFrom(css->socket_fd, MAX_SOCKET_TIMEOUT, set);
-                }
+                SOCKET_SET_AddSocketToReceiveFrom(css->socket_fd, MAX_SOCKET_TIMEOUT, set);
+                css = (coap_server_session_t *) css->link.next;
             }
         }
     }
@@ -526,7 +548,7 @@ void COAP_SERVER_UpdateAllSockSet(socket_set_t *set)
 **************************************************************************/
 void COAP_SERVER_ProcessAllSocketActivity(socket_set_t *set)
 {
-    int i, j;
+    int i;
     coap_server_t *cs;
     coap_server_session_t *css;
 
@@ -537,16 +559,23 @@ void COAP_SERVER_ProcessAllSocketActivity(socket_set_t *set)
         if (cs->instance != INVALID)
         {
             // Service existing connections
-            for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
+            // NOTE: Sessions stopped whilst doing this are only freed (by UpdateCoapSessions) after this loop
+            css = (coap_server_session_t *) cs->sessions.head;
+            while (css != NULL)
             {
-                css = &cs->sessions[j];
                 if (css->socket_fd != INVALID)
                 {
                     if (SOCKET_SET_IsReadyToRead(css->socket_fd, set))
                     {
                         ReceiveCoapBlock(cs, css);
                     }
+                    else if (css->handshake_state != kDtlsHandshake_None)
+                    {
+                        // Retransmit the last DTLS handshake flight, if the DTLS timer has expired
+                        DTLSv1_handle_timeout(css->ssl);
+                    }
                 }
+                css = (coap_server_session_t *) css->link.next;
             }
 
             // Accept new connections
@@ -575,7 +604,7 @@ void COAP_SERVER_ProcessAllSocketActivity(socket_set_t *set)
 **************************************************************************/
 bool COAP_SERVER_AreNoOutstandingIncomingMessages(void)
 {
-    int i, j;
+    int i;
     coap_server_t *cs;
     coap_server_session_t *css;
 
@@ -585,13 +614,14 @@ bool COAP_SERVER_AreNoOutstandingIncomingMessages(void)
         cs = &coap_servers[i];
         if (cs->instance != INVALID)
         {
-            for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
+            css = (coap_server_session_t *) cs->sessions.head;
+            while (css != NULL)
             {
-                css = &cs->sessions[j];
                 if (css->usp_buf_len != 0)
                 {
                     return false;
                 }
+                css = (coap_server_session_t *) css->link.next;
             }
         }
     }
@@ -740,12 +770,8 @@ void StartCoapSession(coap_server_t *cs)
         return;
     }
 
-    // Find a CoAP session slot, possibly killing an existing session if one is not free otherwise
-    css = FindCoapSession(cs, &peer_addr);
-    USP_ASSERT(css != NULL)
-
-    // Initialise the new session
-    InitCoapSession(css);
+    // Create a new CoAP session, possibly killing an existing session if the maximum number of sessions has been reached
+    css = AllocCoapSession(cs, &peer_addr, peer_port);
 
     // Move the listening socket into this session
     css->socket_fd = cs->listen_sock;
@@ -767,16 +793,13 @@ void StartCoapSession(coap_server_t *cs)
         return;
     }
 
-    // Store the peer's IP address and port in the session structure
-    USP_PROTOCOL("%s: Accepting %s CoAP session from %s, port %d (using session %d)", __FUNCTION__, IS_ENCRYPTED_STRING(cs->enable_encryption), nu_ipaddr_str(&peer_addr, buf, sizeof(buf)), peer_port, css->index);
-    memcpy(&css->peer_addr, &peer_addr, sizeof(peer_addr));
-    css->peer_port = peer_port;
+    USP_PROTOCOL("%s: Accepting %s CoAP session from %s, port %d (using session %d, %d sessions active)", __FUNCTION__, IS_ENCRYPTED_STRING(cs->enable_encryption), nu_ipaddr_str(&peer_addr, buf, sizeof(buf)), peer_port, css->index, cs->num_sessions);
     css->role = ROLE_NON_SSL;       // This role will be overridden if the DTLS handshake is performed
 
-    // Perform DTLS handshake
+    // Start the DTLS handshake. This is continued by ReceiveCoapBlock() as each handshake packet is received from the peer
     if (cs->enable_encryption)
     {
-        err = PerformSessionDtlsConnect(css);
+        err = StartSessionDtlsHandshake(css);
         if (err != USP_ERR_OK)
         {
             StopCoapSession(css);
@@ -803,6 +826,7 @@ void InitCoapSession(coap_server_session_t *css)
     css->ssl = NULL;
     css->rbio = NULL;
     css->wbio = NULL;
+    css->handshake_state = kDtlsHandshake_None;
     css->is_first_usp_msg = true;
     css->cert_chain = NULL;
     css->role = ROLE_DEFAULT;    // Set default role, if not determined from SSL certs
@@ -812,7 +836,7 @@ void InitCoapSession(coap_server_session_t *css)
     css->token_size = 0;
     css->block_count = 0;
     css->block_size = 0;
-    css->last_block_time = time(NULL);
+    css->last_block_time = tu_uptime_msecs64();
     css->usp_buf = NULL;
     css->usp_buf_len = 0;
 
@@ -866,10 +890,136 @@ int GetPeerAddr(int sock, nu_ipaddr_t *peer_addr, uint16_t *peer_port)
 
 /*********************************************************************//**
 **
-** FindCoapSession
+** AllocCoapSession
+**
+** Allocates and initialises a new CoAP session for the specified peer, adding it to the CoAP server's sessions
+** NOTE: This function may shutdown an existing session in order to achieve this, if the maximum number of sessions has been reached
+**
+** \param   cs - pointer to coap server
+** \param   peer_addr - IP address of peer that is starting a new session
+** \param   peer_port - port of peer that is starting a new session
+**
+** \return  pointer to coap session
+**
+**************************************************************************/
+coap_server_session_t *AllocCoapSession(coap_server_t *cs, nu_ipaddr_t *peer_addr, uint16_t peer_port)
+{
+    coap_server_session_t *css;
+    unsigned hash;
+
+    // Stop any existing session with the same peer. Since the session's socket is connected to the peer,
+    // the peer must have re-used its port after the session was stopped by us
+    css = FindCoapSessionByPeer(cs, peer_addr, peer_port);
+    if (css != NULL)
+    {
+        StopCoapSession(css);
+        FreeCoapSession(cs, css);
+    }
+
+    // Make room for the new session, if the maximum number of sessions has been reached
+    if (cs->num_sessions >= MAX_COAP_SERVER_SESSIONS)
+    {
+        css = FindCoapSessionToEvict(cs, peer_addr);
+        USP_ASSERT(css != NULL);
+        USP_LOG_Warning("%s: Maximum number of CoAP sessions (%d) reached. Evicting session %d", __FUNCTION__, MAX_COAP_SERVER_SESSIONS, css->index);
+        StopCoapSession(css);
+        FreeCoapSession(cs, css);
+    }
+
+    // Allocate and initialise the new session
+    css = USP_MALLOC(sizeof(coap_server_session_t));
+    memset(css, 0, sizeof(coap_server_session_t));
+    InitCoapSession(css);
+    css->index = cs->next_session_index++;
+    memcpy(&css->peer_addr, peer_addr, sizeof(css->peer_addr));
+    css->peer_port = peer_port;
+
+    // Add the session to the list of sessions, and to the hash table
+    DLLIST_LinkToTail(&cs->sessions, css);
+    hash = CalcCoapSessionHash(peer_addr, peer_port);
+    css->hash_next = cs->session_table[hash];
+    cs->session_table[hash] = css;
+    cs->num_sessions++;
+
+    return css;
+}
+
+/*********************************************************************//**
+**
+** FreeCoapSession
+**
+** Removes the specified session from the CoAP server, and frees it
+** NOTE: The session must have been stopped before calling this function
+**
+** \param   cs - pointer to coap server
+** \param   css - pointer to coap session to free
+**
+** \return  None
+**
+**************************************************************************/
+void FreeCoapSession(coap_server_t *cs, coap_server_session_t *css)
+{
+    coap_server_session_t **p;
+    unsigned hash;
+
+    USP_ASSERT(css->socket_fd == INVALID);
+
+    // Remove the session from the hash table
+    hash = CalcCoapSessionHash(&css->peer_addr, css->peer_port);
+    p = &cs->session_table[hash];
+    while (*p != NULL)
+    {
+        if (*p == css)
+        {
+            *p = css->hash_next;
+            break;
+        }
+        p = &(*p)->hash_next;
+    }
+
+    // Remove the session from the list of sessions, and free it
+    DLLIST_Unlink(&cs->sessions, css);
+    cs->num_sessions--;
+    USP_FREE(css);
+}
+
+/*********************************************************************//**
+**
+** FindCoapSessionByPeer
 **
-** Gets a new CoAP session on which to process the new PDU
-** NOTE: This function may shutdown an unused session in order to achieve this
+** Finds the CoAP session associated with the specified peer
+**
+** \param   cs - pointer to coap server
+** \param   peer_addr - IP address of peer
+** \param   peer_port - port of peer
+**
+** \return  pointer to coap session, or NULL if no session exists for the peer
+**
+**************************************************************************/
+coap_server_session_t *FindCoapSessionByPeer(coap_server_t *cs, nu_ipaddr_t *peer_addr, uint16_t peer_port)
+{
+    coap_server_session_t *css;
+    unsigned hash;
+
+    hash = CalcCoapSessionHash(peer_addr, peer_port);
+    css = cs->session_table[hash];
+    while (css != NULL)
+    {
+        if ((css->peer_port == peer_port) && (memcmp(peer_addr, &css->peer_addr, sizeof(css->peer_addr))==0))
+        {
+            return css;
+        }
+        css = css->hash_next;
+    }
+
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+** FindCoapSessionToEvict
+**
+** Chooses the existing CoAP session to shutdown, in order to make room for a new session
 **
 ** \param   cs - pointer to coap server
 ** \param   peer_addr - IP address of peer that is starting a new session
@@ -877,79 +1027,197 @@ int GetPeerAddr(int sock, nu_ipaddr_t *peer_addr, uint16_t *peer_port)
 ** \return  pointer to coap session
 **
 **************************************************************************/
-coap_server_session_t *FindCoapSession(coap_server_t *cs, nu_ipaddr_t *peer_addr)
+coap_server_session_t *FindCoapSessionToEvict(coap_server_t *cs, nu_ipaddr_t *peer_addr)
 {
-    int j;
     coap_server_session_t *css;
-    time_t cur_time;
+    uint64_t cur_time;
     int score;
     int max_score = 0;
     coap_server_session_t *chosen_css = NULL;
 
-    // Exit if there is an existing unused session
-    for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
-    {
-        css = &cs->sessions[j];
+    // Iterate over all existing sessions, choosing the one with the highest score
+    cur_time = tu_uptime_msecs64();
+    css = (coap_server_session_t *) cs->sessions.head;
+    while (css != NULL)
+    {
+        // Choose to reuse sessions with longest inactive time
+        #define MAX_INACTIVE_TIME 3600          // Maximum amount of time before we consider the session to be completely inactive
+        USP_ASSERT(css->last_block_time > 0);
+        score = (cur_time - css->last_block_time) / SECONDS;
+        if (score > MAX_INACTIVE_TIME)
+        {
+            score = MAX_INACTIVE_TIME;
+        }
+
+        // Prioritize reuse of sessions with the same peer
+        if (memcmp(peer_addr, &css->peer_addr, sizeof(css->peer_addr))==0)
+        {
+            score += MAX_INACTIVE_TIME+1;
+        }
+
+        // Prioritize reuse of sessions which have already been stopped
         if (css->socket_fd == INVALID)
         {
-            return css;
+            score += 2*(MAX_INACTIVE_TIME+1);
         }
+
+        if (score >= max_score)  // NOTE: Use >=, so that it always finds at least one match (even if score==0)
+        {
+            max_score = score;
+            chosen_css = css;
+        }
+
+        css = (coap_server_session_t *) css->link.next;
     }
 
-    // Iterate over all existing sessions, choosing the one with the highest score
-    cur_time = time(NULL);
-    for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
+    return chosen_css;
+}
+
+/*********************************************************************//**
+**
+** StopAllCoapSessions
+**
+** Stops all sessions of the specified CoAP server
+** NOTE: The sessions are freed later by UpdateCoapSessions()
+**
+** \param   cs - pointer to coap server
+**
+** \return  None
+**
+**************************************************************************/
+void StopAllCoapSessions(coap_server_t *cs)
+{
+    coap_server_session_t *css;
+
+    css = (coap_server_session_t *) cs->sessions.head;
+    while (css != NULL)
     {
-        css = &cs->sessions[j];
-        if (css->socket_fd != INVALID)
+        StopCoapSession(css);
+        css = (coap_server_session_t *) css->link.next;
+    }
+}
+
+/*********************************************************************//**
+**
+** UpdateCoapSessions
+**
+** Frees all sessions of the specified CoAP server which have been stopped
+** Also stops sessions which have been idle for longer than COAP_SERVER_SESSION_IDLE_TIMEOUT (including those part way through receiving a USP record)
+** and sessions which have not completed the DTLS handshake within COAP_SERVER_DTLS_HANDSHAKE_TIMEOUT
+**
+** \param   cs - pointer to coap server
+**
+** \return  Number of milliseconds until the next session times out
+**
+**************************************************************************/
+int UpdateCoapSessions(coap_server_t *cs)
+{
+    coap_server_session_t *css;
+    coap_server_session_t *next;
+    uint64_t cur_time;
+    uint64_t expiry_time;
+    int timeout;
+    int min_timeout = MAX_SOCKET_TIMEOUT;
+    struct timeval tv;
+
+    cur_time = tu_uptime_msecs64();
+    css = (coap_server_session_t *) cs->sessions.head;
+    while (css != NULL)
+    {
+        next = (coap_server_session_t *) css->link.next;
+
+        // Determine the time at which this session times out
+        if (css->handshake_state != kDtlsHandshake_None)
         {
-            // Choose to reuse sessions with longest inactive time
-            #define MAX_INACTIVE_TIME 3600          // Maximum amount of time before we consider the session to be completely inactive
-            USP_ASSERT(css->last_block_time > (time_t)0);
-            score = cur_time - css->last_block_time;
-            if (score > MAX_INACTIVE_TIME)
-            {
-                score = MAX_INACTIVE_TIME;
-            }
+            expiry_time = css->last_block_time + COAP_SERVER_DTLS_HANDSHAKE_TIMEOUT*SECONDS;
+        }
+        else
+        {
+            expiry_time = css->last_block_time + COAP_SERVER_SESSION_IDLE_TIMEOUT*SECONDS;
+        }
 
-            // Prioritize reuse of sessions with the same peer
-            if (memcmp(peer_addr, &css->peer_addr, sizeof(css->peer_addr))==0)
+        // Stop the session, if it has timed out
+        // NOTE: This includes sessions which are part way through receiving a USP record, as the peer has abandoned the block transfer
+        timeout = tu_msecs_until(expiry_time, cur_time);
+        if ((css->socket_fd != INVALID) && (timeout == 0))
+        {
+            if (css->usp_buf_len != 0)
             {
-                score += MAX_INACTIVE_TIME+1;
+                USP_LOG_Error("%s: Dropping partially received USP Record (%d bytes) after idle timeout", __FUNCTION__, css->usp_buf_len);
             }
+            USP_PROTOCOL("%s: Closing CoAP session %d after %s", __FUNCTION__, css->index, (css->handshake_state != kDtlsHandshake_None) ? "DTLS handshake timeout" : "idle timeout");
+            StopCoapSession(css);
+        }
 
-            if (score >= max_score)  // NOTE: Use >=, so that it always finds at least one match (even if score==0)
-            {
-                max_score = score;
-                chosen_css = css;
-            }
+        // Free the session, if it has been stopped
+        if (css->socket_fd == INVALID)
+        {
+            FreeCoapSession(cs, css);
+            css = next;
+            continue;
         }
+
+        // Ensure that the select() wakes up in time to retransmit DTLS handshake packets
+        if ((css->handshake_state != kDtlsHandshake_None) && (DTLSv1_get_timeout(css->ssl, &tv) == 1))
+        {
+            timeout = MIN(timeout, tv.tv_sec*SECONDS + tv.tv_usec/1000);
+        }
+
+        min_timeout = MIN(min_timeout, timeout);
+        css = next;
     }
 
-    // Stop the existing session
-    USP_ASSERT(chosen_css != NULL);
-    StopCoapSession(chosen_css);
+    return min_timeout;
+}
 
-    return chosen_css;
+/*********************************************************************//**
+**
+** CalcCoapSessionHash
+**
+** Calculates the hash table bucket for a session with the specified peer
+**
+** \param   peer_addr - IP address of peer
+** \param   peer_port - port of peer
+**
+** \return  index of the hash table bucket
+**
+**************************************************************************/
+unsigned CalcCoapSessionHash(nu_ipaddr_t *peer_addr, uint16_t peer_port)
+{
+    unsigned char *p;
+    unsigned hash;
+    int i;
+
+    // FNV-1a hash of the peer's IP address and port
+    hash = 2166136261U;
+    p = (unsigned char *) peer_addr;
+    for (i=0; i < sizeof(nu_ipaddr_t); i++)
+    {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+    hash = (hash ^ (peer_port & 0xFF)) * 16777619U;
+    hash = (hash ^ (peer_port >> 8)) * 16777619U;
+
+    return hash % COAP_SESSION_HASH_BUCKETS;
 }
 
 /*********************************************************************//**
 **
-** PerformSessionDtlsConnect
+** StartSessionDtlsHandshake
 **
-** Function called to perform the DTLS Handshake when receiving from a controller
+** Function called to start the DTLS Handshake when receiving from a controller
 ** This is called only after our CoAP server receives a packet
+** NOTE: The handshake is performed using a non-blocking socket, so that it does not hold up other sessions
+**       It is continued by ContinueSessionDtlsHandshake() each time a packet is received from the peer
 **
 ** \param   css - pointer to structure describing coap session
 **
 ** \return  USP_ERR_OK if successful
 **
 **************************************************************************/
-int PerformSessionDtlsConnect(coap_server_session_t *css)
+int StartSessionDtlsHandshake(coap_server_session_t *css)
 {
-    int result;
     int err;
-    struct sockaddr_storage saddr;
     struct timeval timeout;
 
     // Exit if unable to create an SSL object
@@ -987,48 +1255,90 @@ int PerformSessionDtlsConnect(coap_server_session_t *css)
     // Set the DTLS bio for reading and writing
     SSL_set_bio(css->ssl, css->rbio, css->wbio);
 
-    // Set timeouts for DTLSv1_listen() and SSL_accept()
+    // Set timeouts used by SSL_read() once the handshake has completed
     timeout.tv_sec = DTLS_READ_TIMEOUT;
     timeout.tv_usec = 0;
     BIO_ctrl(css->rbio, BIO_CTRL_DGRAM_SET_RECV_TIMEOUT, 0, &timeout);
     BIO_ctrl(css->wbio, BIO_CTRL_DGRAM_SET_RECV_TIMEOUT, 0, &timeout);
     SSL_set_options(css->ssl, SSL_OP_COOKIE_EXCHANGE);
 
-    // Exit if an error occurred when listening to the server socket
-    // DTLSv1_listen() responds to the 'ClientHello' by sending a 'Hello Verify Request' containing a cookie
-    // then waits for the peer to sent back the 'Client Hello' with the cookie
-    result = DTLSv1_listen(css->ssl, (void *) &saddr);
-    if (result < 0)
+    // Exit if unable to make the socket non-blocking for the duration of the handshake
+    err = SetSessionSocketBlocking(css, false);
+    if (err != USP_ERR_OK)
     {
-        err = SSL_get_error(css->ssl, result);
-        USP_LOG_ErrorSSL(__FUNCTION__, "DTLSv1_listen() failed. Resetting CoAP session.", result, err);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 
-    // Exit if no packet was received (Note: This shouldn't happen as we should have only got here if a packet was ready to read)
-    if (result == 0)
+    // Process the 'ClientHello' which caused this session to be started
+    css->handshake_state = kDtlsHandshake_Listening;
+    err = ContinueSessionDtlsHandshake(css);
+
+    return err;
+}
+
+/*********************************************************************//**
+**
+** ContinueSessionDtlsHandshake
+**
+** Progresses the DTLS handshake as far as possible, without blocking
+**
+** \param   css - pointer to structure describing coap session
+**
+** \return  USP_ERR_OK if successful (the handshake may still be in progress)
+**
+**************************************************************************/
+int ContinueSessionDtlsHandshake(coap_server_session_t *css)
+{
+    int result;
+    int err;
+    struct sockaddr_storage saddr;
+
+    if (css->handshake_state == kDtlsHandshake_Listening)
     {
-        USP_LOG_Warning("%s: DTLSv1_listen() returned 0. Resetting CoAP session", __FUNCTION__);
-        return USP_ERR_INTERNAL_ERROR;
-    }
+        // Exit if an error occurred when listening to the server socket
+        // DTLSv1_listen() responds to the 'ClientHello' by sending a 'Hello Verify Request' containing a cookie
+        // then returns 0 until the peer sends back the 'Client Hello' with the cookie
+        memset(&saddr, 0, sizeof(saddr));
+        result = DTLSv1_listen(css->ssl, (void *) &saddr);
+        if (result < 0)
+        {
+            err = SSL_get_error(css->ssl, result);
+            USP_LOG_ErrorSSL(__FUNCTION__, "DTLSv1_listen() failed. Resetting CoAP session.", result, err);
+            return USP_ERR_INTERNAL_ERROR;
+        }
+
+        // Exit if the 'Client Hello' with the cookie has not been received yet
+        if (result == 0)
+        {
+            return USP_ERR_OK;
+        }
 
-    // Set the BIO object to the 'connected' state
-    BIO_ctrl(css->rbio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &saddr);
-    BIO_ctrl(css->wbio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &saddr);
+        // Set the BIO object to the 'connected' state
+        BIO_ctrl(css->rbio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &saddr);
+        BIO_ctrl(css->wbio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &saddr);
 
-    // The following is needed for compatibility with libcoap
-    // If not set, then the DTLS handshake takes a number of seconds to complete, as our OpenSSL server tries successively smaller MTUs
-    // Also the maximum MTU size must be set after DTLSv1_listen(), because DTLSv1_listen() resets it
-    SSL_set_mtu(css->ssl, MAX_COAP_PDU_SIZE);
+        // The following is needed for compatibility with libcoap
+        // If not set, then the DTLS handshake takes a number of seconds to complete, as our OpenSSL server tries successively smaller MTUs
+        // Also the maximum MTU size must be set after DTLSv1_listen(), because DTLSv1_listen() resets it
+        SSL_set_mtu(css->ssl, MAX_COAP_PDU_SIZE);
+        css->handshake_state = kDtlsHandshake_Accepting;
+    }
 
     // Exit if unable to finish the DTLS handshake
     // Sends the 'ServerHello' containing server Certificate, client certificate request, and ending in 'ServerHelloDone'
     // Then waits for SSL Handshake message and finally sends a NewSessionTicket
     // NOTE: This agent must have its own cert (same as STOMP client cert), otherwise SSL_accept complains that there's 'no shared cipher'
+    USP_ASSERT(css->handshake_state == kDtlsHandshake_Accepting);
     result = SSL_accept(css->ssl);
-    if (result < 0)
+    if (result <= 0)
     {
+        // Exit if the handshake is still in progress, waiting for the next packet from the peer
         err = SSL_get_error(css->ssl, result);
+        if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE))
+        {
+            return USP_ERR_OK;
+        }
+
         USP_LOG_ErrorSSL(__FUNCTION__, "SSL_accept() failed. Resetting CoAP session", result, err);
         return USP_ERR_INTERNAL_ERROR;
     }
@@ -1045,6 +1355,44 @@ int PerformSessionDtlsConnect(coap_server_session_t *css)
         }
     }
 
+    // Handshake has completed, so revert to a blocking socket, as expected by the rest of the CoAP server code
+    USP_PROTOCOL("%s: DTLS handshake completed on CoAP session %d", __FUNCTION__, css->index);
+    css->handshake_state = kDtlsHandshake_None;
+    err = SetSessionSocketBlocking(css, true);
+
+    return err;
+}
+
+/*********************************************************************//**
+**
+** SetSessionSocketBlocking
+**
+** Sets whether the socket of the specified session blocks
+**
+** \param   css - pointer to structure describing coap session
+** \param   is_blocking - set if the socket should block
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int SetSessionSocketBlocking(coap_server_session_t *css, bool is_blocking)
+{
+    int flags;
+
+    flags = fcntl(css->socket_fd, F_GETFL, 0);
+    if (flags == -1)
+    {
+        USP_ERR_ERRNO("fcntl", errno);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    flags = (is_blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    if (fcntl(css->socket_fd, F_SETFL, flags) == -1)
+    {
+        USP_ERR_ERRNO("fcntl", errno);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
     return USP_ERR_OK;
 }
 
@@ -1151,6 +1499,17 @@ void ReceiveCoapBlock(coap_server_t *cs, coap_server_session_t *css)
     unsigned action_flags;
     int err;
 
+    // Exit if this packet was part of the DTLS handshake
+    if (css->handshake_state != kDtlsHandshake_None)
+    {
+        err = ContinueSessionDtlsHandshake(css);
+        if (err != USP_ERR_OK)
+        {
+            StopCoapSession(css);
+        }
+        return;
+    }
+
     // Exit if the connection has been closed by the peer
     len = COAP_ReceivePdu(css->ssl, css->rbio, css->socket_fd, buf, sizeof(buf));
     if (len == -1)
@@ -1174,7 +1533,7 @@ void ReceiveCoapBlock(coap_server_t *cs, coap_server_session_t *css)
         return;
     }
 
-    css->last_block_time = time(NULL);
+    css->last_block_time = tu_uptime_msecs64();
 
     // Exit if an error occurred whilst parsing the PDU
     memset(&pp, 0, sizeof(pp));
@@ -2258,25 +2617,24 @@ void LogRxedCoapPdu(parsed_pdu_t *pp)
 **
 ** \param   None
 **
-** \return  Number of seconds remaining until next time to poll the interfaces for IP address change
+** \return  Number of milliseconds remaining until next time to poll the interfaces for IP address change
 **
 **************************************************************************/
 int UpdateCoapServerInterfaces(void)
 {
-    int i, j;
+    int i;
     coap_server_t *cs;
-    coap_server_session_t *css;
     bool has_changed;
-    time_t cur_time;
+    uint64_t cur_time;
     int timeout;
     static bool is_first_time = true; // The first time this function is called, it just sets up the IP address and next_coap_server_if_poll_time
     bool has_addr = false;
 
     // Exit if it's not yet time to poll the network interface addresses
-    cur_time = time(NULL);
+    cur_time = tu_uptime_msecs64();
     if (is_first_time == false)
     {
-        timeout = next_coap_server_if_poll_time - cur_time;
+        timeout = tu_msecs_until(next_coap_server_if_poll_time, cur_time);
         if (timeout > 0)
         {
             goto exit;
@@ -2293,11 +2651,7 @@ int UpdateCoapServerInterfaces(void)
             if ((has_changed) && (has_addr))
             {
                 USP_LOG_Error("%s: Restarting CoAP server on interface=%s after IP address change", __FUNCTION__, cs->interface);
-                for (j=0; j<MAX_COAP_SERVER_SESSIONS; j++)
-                {
-                    css = &cs->sessions[j];
-                    StopCoapSession(css);
-                }
+                StopAllCoapSessions(cs);
 
                 // Attempt to restart CoAP listening socket for this server
                 close(cs->listen_sock);
@@ -2309,7 +2663,7 @@ int UpdateCoapServerInterfaces(void)
 
     // Set next time to poll for IP address change
     #define COAP_SERVER_IP_ADDR_POLL_PERIOD 5
-    timeout = COAP_SERVER_IP_ADDR_POLL_PERIOD;
+    timeout = COAP_SERVER_IP_ADDR_POLL_PERIOD*SECONDS;
     next_coap_server_if_poll_time = cur_time + timeout;
     is_first_time = false;
 
@@ -49,6 +49,7 @@
 #include "database.h"
 #include "int_vector.h"
 #include "dm_inst_vector.h"
+#include "path_resolver.h"
 #include "dm_trans.h"
 #include "dm_access.h"
 #include "cli.h"
@@ -108,7 +109,14 @@ static dm_node_t *root_internal_node;
 
 //--------------------------------------------------------------------
 // Map containing all data model nodes, indexed by squashed hash value
-dm_node_t *dm_node_map[MAX_NODE_MAP_BUCKETS] = { 0 };
+// The number of buckets is always a power of 2, and grows to keep the average chain length at most 1
+static dm_node_t **dm_node_map = NULL;
+static unsigned dm_node_map_size = 0;   // Number of buckets in dm_node_map[]
+static unsigned dm_node_map_count = 0;  // Number of nodes stored in dm_node_map[]
+
+//--------------------------------------------------------------------
+// Registration sequence number to assign to the next node added to the schema (see dm_node_t.reg_seq)
+static unsigned next_node_reg_seq = 0;
 
 //--------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
@@ -117,6 +125,10 @@ void FormInstanceString(dm_instances_t *inst, char *buf, int len);
 dm_node_t *CreateNode(char *name, dm_node_type_t type, char *schema_path);
 int ParseSchemaPath(char *path, char *path_segments, int path_segment_len, dm_node_type_t type, dm_path_segment *segments, int max_segments);
 dm_node_t *FindNodeFromHash(dm_hash_t hash);
+void AddNodeToMap(dm_node_t *node);
+void ResizeNodeMap(unsigned new_size);
+void AddChildNode(dm_node_t *parent, dm_node_t *child);
+void RebuildChildTable(dm_node_t *parent, unsigned table_size);
 char *ParseInstanceInteger(char *p, int *p_value);
 int AddChildParamsDefaultValues(char *path, int path_len, dm_node_t *node, dm_instances_t *inst);
 int DeleteChildParams(char *path, int path_len, dm_node_t *node, dm_instances_t *inst);
@@ -382,6 +394,8 @@ void DATA_MODEL_Stop(void)
     // Free the instance vectors here, so that they are not reported as a memory leak
     DestroyInstanceVectorRecursive(root_device_node);
     DestroyInstanceVectorRecursive(root_internal_node);
+    DM_INST_VECTOR_Stop();
+    PATH_RESOLVER_Destroy();
 
     // Stop all checking of memory allocations
     // This is necessary because the data model schema was allocated before memory checking was turned on.
@@ -391,6 +405,9 @@ void DATA_MODEL_Stop(void)
     // Free all allocations that occurred before mem info collection was turned on
     DestroySchemaRecursive(root_device_node);
     DestroySchemaRecursive(root_internal_node);
+    USP_SAFE_FREE(dm_node_map);
+    dm_node_map_size = 0;
+    dm_node_map_count = 0;
 
     // If logging memory usage, print out all memory still in use, after attempting to free all known references
     USP_MEM_PrintLeakReport();
@@ -1796,6 +1813,69 @@ unsigned DATA_MODEL_GetPathProperties(char *path, combined_role_t *combined_role
     return flags;
 }
 
+/*********************************************************************//**
+**
+** DATA_MODEL_GetValueChangeInfo
+**
+** Determines how changes to the value of the specified parameter are detected for value change subscriptions
+** Changes to parameters stored in the database (and to constant parameters) are only made through the set path
+** (see DM_TRANS_Commit() and DATA_MODEL_SetParameterInDatabase()), so they do not need to be polled.
+** All other parameters obtain their values from vendor hooks (or from the number of instances of an object), so need polling
+**
+** \param   path - instantiated data model path of the parameter
+** \param   hash - pointer to variable in which to return the hash of the schema path of the parameter
+** \param   inst - pointer to structure in which to return the instance numbers in the path
+** \param   poll_period - pointer to variable in which to return the period (in seconds) at which the parameter must be polled,
+**                        or 0 if changes to the parameter are notified by DEVICE_SUBSCRIPTION_NotifyParamValueChange()
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int DATA_MODEL_GetValueChangeInfo(char *path, dm_hash_t *hash, dm_req_instances_t *inst, unsigned *poll_period)
+{
+    dm_node_t *node;
+    dm_instances_t dm_inst;
+
+    // Exit if the path does not exist in the schema
+    node = DM_PRIV_GetNodeFromPath(path, &dm_inst, NULL);
+    if (node == NULL)
+    {
+        return USP_ERR_INVALID_PATH;
+    }
+
+    *hash = node->hash;
+    memcpy(inst, &dm_inst, sizeof(dm_req_instances_t));
+
+    switch(node->type)
+    {
+        case kDMNodeType_Param_ConstantValue:
+        case kDMNodeType_DBParam_ReadWrite:
+        case kDMNodeType_DBParam_ReadOnly:
+        case kDMNodeType_DBParam_ReadOnlyAuto:
+        case kDMNodeType_DBParam_ReadWriteAuto:
+        case kDMNodeType_DBParam_Secure:
+            *poll_period = 0;
+            break;
+
+        case kDMNodeType_Param_NumEntries:
+        case kDMNodeType_VendorParam_ReadOnly:
+        case kDMNodeType_VendorParam_ReadWrite:
+            *poll_period = node->registered.param_info.value_change_poll_period;
+            if (*poll_period == 0)
+            {
+                *poll_period = VALUE_CHANGE_POLL_PERIOD;
+            }
+            break;
+
+        default:
+            USP_ERR_SetMessage("%s: Path (%s) is not a parameter", __FUNCTION__, path);
+            return USP_ERR_INVALID_PATH;
+            break;
+    }
+
+    return USP_ERR_OK;
+}
+
 /*********************************************************************//**
 **
 ** DATA_MODEL_SplitPath
@@ -2634,6 +2714,7 @@ int DATA_MODEL_SetParameterInDatabase(char *path, char *value)
     int err;
     dm_hash_t hash;
     char instances[MAX_DM_PATH];
+    dm_instances_t inst;
     unsigned path_flags;
     unsigned db_flags;
 
@@ -2655,6 +2736,12 @@ int DATA_MODEL_SetParameterInDatabase(char *path, char *value)
         return err;
     }
 
+    // Notify value change subscriptions, as this set bypasses the transaction
+    if (DM_PRIV_GetNodeFromPath(path, &inst, NULL) != NULL)
+    {
+        DEVICE_SUBSCRIPTION_NotifyParamValueChange(hash, (dm_req_instances_t *) &inst);
+    }
+
     return USP_ERR_OK;
 }
 
@@ -3101,7 +3188,7 @@ dm_node_t *DM_PRIV_AddSchemaPath(char *path, dm_node_type_t type, unsigned flags
             }
 
             // Add the node to it's parent
-            DLLIST_LinkToTail(&parent->child_nodes, child);
+            AddChildNode(parent, child);
 
             // Add this node to the instance node array, if it is a multi-instance object
             if (seg->type == kDMNodeType_Object_MultiInstance)
@@ -3384,25 +3471,121 @@ int DM_PRIV_FormPath_FromDB(dm_hash_t hash, char *instances, char *buf, int len)
 dm_node_t *DM_PRIV_FindMatchingChild(dm_node_t *parent, char *name)
 {
     dm_node_t *child;
+    dm_hash_t name_hash;
 
-    // Iterate over list of children, seeing if any match
-    child = (dm_node_t *) parent->child_nodes.head;
+    // If the parent has few children, then it's quicker to just iterate over them, seeing if any match
+    if (parent->child_table == NULL)
+    {
+        child = (dm_node_t *) parent->child_nodes.head;
+        while (child != NULL)
+        {
+            if (strcmp(child->name, name)==0)
+            {
+                // Found a match
+                return child;
+            }
+
+            // Move to next sibling in the data model tree
+            child = (dm_node_t *) child->link.next;
+        }
+
+        // If the code gets here, then no match was found
+        return NULL;
+    }
+
+    // Otherwise only compare against the children in the bucket selected by the hash of the name
+    name_hash = TEXT_UTILS_CalcHash(name);
+    child = parent->child_table[name_hash & (parent->child_table_size - 1)];
     while (child != NULL)
     {
-        if (strcmp(child->name, name)==0)
+        if ((child->name_hash == name_hash) && (strcmp(child->name, name)==0))
         {
             // Found a match
             return child;
         }
 
-        // Move to next sibling in the data model tree
-        child = (dm_node_t *) child->link.next;
+        child = child->next_child_hash_link;
     }
 
     // If the code gets here, then no match was found
     return NULL;
 }
 
+/*********************************************************************//**
+**
+** AddChildNode
+**
+** Adds the specified node as the last child of the parent node, updating the parent's hash index of children
+** NOTE: The hash index is only created once the parent has more than MIN_CHILDREN_FOR_HASH_INDEX children
+**
+** \param   parent - pointer to data model node to add the child node to
+** \param   child - pointer to data model node to add
+**
+** \return  None
+**
+**************************************************************************/
+void AddChildNode(dm_node_t *parent, dm_node_t *child)
+{
+    unsigned index;
+
+    // Add the node to the list of children. This list determines the order in which children are iterated
+    DLLIST_LinkToTail(&parent->child_nodes, child);
+    parent->num_children++;
+
+    // Exit if the parent does not yet have enough children to warrant a hash index
+    if (parent->num_children <= MIN_CHILDREN_FOR_HASH_INDEX)
+    {
+        return;
+    }
+
+    // Create (or grow) the hash index, keeping the number of buckets at least the number of children
+    // NOTE: Rebuilding the index also adds the child that has just been added to the list
+    if (parent->num_children > parent->child_table_size)
+    {
+        RebuildChildTable(parent, (parent->child_table_size == 0) ? 2*MIN_CHILDREN_FOR_HASH_INDEX : 2*parent->child_table_size);
+        return;
+    }
+
+    // Otherwise just add the new child into the existing hash index
+    index = child->name_hash & (parent->child_table_size - 1);
+    child->next_child_hash_link = parent->child_table[index];
+    parent->child_table[index] = child;
+}
+
+/*********************************************************************//**
+**
+** RebuildChildTable
+**
+** Replaces the hash index of the children of the specified node with one containing the specified number of buckets
+**
+** \param   parent - pointer to data model node to rebuild the hash index of
+** \param   table_size - number of buckets in the new hash index. This must be a power of 2
+**
+** \return  None
+**
+**************************************************************************/
+void RebuildChildTable(dm_node_t *parent, unsigned table_size)
+{
+    dm_node_t *child;
+    unsigned index;
+
+    USP_SAFE_FREE(parent->child_table);
+    parent->child_table = USP_MALLOC(table_size * sizeof(dm_node_t *));
+    memset(parent->child_table, 0, table_size * sizeof(dm_node_t *));
+    parent->child_table_size = table_size;
+
+    // Add all children to the new hash index
+    child = (dm_node_t *) parent->child_nodes.head;
+    while (child != NULL)
+    {
+        index = child->name_hash & (table_size - 1);
+        child->next_child_hash_link = parent->child_table[index];
+        parent->child_table[index] = child;
+
+        child = (dm_node_t *) child->link.next;
+    }
+}
+
 /*********************************************************************//**
 **
 ** DM_PRIV_AddUniqueKey
@@ -3449,6 +3632,7 @@ void DM_PRIV_ApplyPermissions(dm_node_t *node, ctrust_role_t role, unsigned shor
 
     // Apply permissions to this node
     node->permissions[role] = permission_bitmask;
+    PATH_RESOLVER_InvalidateCache();
 
     // Iterate over list of children
     child = (dm_node_t *) node->child_nodes.head;
@@ -3769,8 +3953,6 @@ char *ParseInstanceInteger(char *p, int *p_value)
 dm_node_t *CreateNode(char *name, dm_node_type_t type, char *schema_path)
 {
     dm_node_t *node;
-    unsigned squashed_hash;
-    dm_node_t *existing_node;
     dm_node_t *n;
 
     // Allocate memory for the node
@@ -3782,6 +3964,7 @@ dm_node_t *CreateNode(char *name, dm_node_type_t type, char *schema_path)
     node->next_node_map_link = NULL;
     node->type = type;
     node->name = USP_STRDUP(name);
+    node->name_hash = TEXT_UTILS_CalcHash(name);
     node->path = USP_STRDUP(schema_path);
     DLLIST_Init(&node->child_nodes);
 
@@ -3797,16 +3980,80 @@ dm_node_t *CreateNode(char *name, dm_node_type_t type, char *schema_path)
         return NULL;
     }
 
-    // Push this node at the front of the linked list of nodes matching the squashed hash
-    squashed_hash = ((unsigned)node->hash) % MAX_NODE_MAP_BUCKETS;
-    existing_node = dm_node_map[squashed_hash];
-    if (existing_node != NULL)
+    AddNodeToMap(node);
+    node->reg_seq = next_node_reg_seq++;
+    PATH_RESOLVER_InvalidateCache();
+
+    return node;
+}
+
+/*********************************************************************//**
+**
+** AddNodeToMap
+**
+** Adds the specified node to dm_node_map[], growing the map if the average chain length would exceed 1
+**
+** \param   node - pointer to data model node to add
+**
+** \return  None
+**
+**************************************************************************/
+void AddNodeToMap(dm_node_t *node)
+{
+    unsigned squashed_hash;
+
+    // Grow the map, if necessary, before adding the node
+    if (dm_node_map_count >= dm_node_map_size)
     {
-        node->next_node_map_link = existing_node;
+        ResizeNodeMap((dm_node_map_size == 0) ? INITIAL_NODE_MAP_BUCKETS : 2*dm_node_map_size);
     }
+
+    // Push this node at the front of the linked list of nodes matching the squashed hash
+    squashed_hash = ((unsigned)node->hash) & (dm_node_map_size - 1);
+    node->next_node_map_link = dm_node_map[squashed_hash];
     dm_node_map[squashed_hash] = node;
+    dm_node_map_count++;
+}
 
-    return node;
+/*********************************************************************//**
+**
+** ResizeNodeMap
+**
+** Moves all nodes in dm_node_map[] into a newly allocated map with the specified number of buckets
+**
+** \param   new_size - number of buckets in the new map. This must be a power of 2
+**
+** \return  None
+**
+**************************************************************************/
+void ResizeNodeMap(unsigned new_size)
+{
+    dm_node_t **new_map;
+    dm_node_t *node;
+    dm_node_t *next_node;
+    unsigned squashed_hash;
+    unsigned i;
+
+    new_map = USP_MALLOC(new_size * sizeof(dm_node_t *));
+    memset(new_map, 0, new_size * sizeof(dm_node_t *));
+
+    // Move all nodes from the old map into the new map
+    for (i=0; i<dm_node_map_size; i++)
+    {
+        node = dm_node_map[i];
+        while (node != NULL)
+        {
+            next_node = node->next_node_map_link;
+            squashed_hash = ((unsigned)node->hash) & (new_size - 1);
+            node->next_node_map_link = new_map[squashed_hash];
+            new_map[squashed_hash] = node;
+            node = next_node;
+        }
+    }
+
+    USP_SAFE_FREE(dm_node_map);
+    dm_node_map = new_map;
+    dm_node_map_size = new_size;
 }
 
 /*********************************************************************//**
@@ -4307,6 +4554,7 @@ void DestroySchemaRecursive(dm_node_t *parent)
     }
 
     // Finally free this node itself
+    USP_SAFE_FREE(parent->child_table);
     USP_FREE(parent->path);
     USP_FREE(parent->name);
     USP_FREE(parent);
@@ -4366,6 +4614,10 @@ void DumpInstanceVectorRecursive(dm_node_t *parent)
         // This node is a top level multi instance node, storing it's instances and all instances of its children
         // So print the instances it holds, then exit
         // NOTE: we do not have to recurse to its children because their instances are stored here
+        if (parent->registered.object_info.refresh_instances_cb != NULL)
+        {
+            DM_INST_VECTOR_DumpRefreshStats(parent);
+        }
         DM_INST_VECTOR_Dump(&parent->registered.object_info.inst_vector);
         return;
     }
@@ -4428,14 +4680,16 @@ void DumpSchemaFromRoot(dm_node_t *root, char *name)
 **************************************************************************/
 void DumpDataModelNodeMap(void)
 {
-    int i;
+    unsigned i;
     dm_node_t *node;
-    int num_links;
-    int max_num_links = 0;
-    int index_with_max_links = 0;
+    unsigned num_links;
+    unsigned max_num_links = 0;
+    unsigned index_with_max_links = 0;
+    unsigned num_used_buckets = 0;
+    unsigned chain_length_histogram[5] = { 0 };    // Number of buckets with chain length 0,1,2,3 and 4+
 
     USP_DUMP("\nDumping Data Model Node Map...");
-    for (i=0; i<MAX_NODE_MAP_BUCKETS; i++)
+    for (i=0; i<dm_node_map_size; i++)
     {
         node = dm_node_map[i];
         num_links = 0;
@@ -4452,10 +4706,21 @@ void DumpDataModelNodeMap(void)
             max_num_links = num_links;
             index_with_max_links = i;
         }
-    }
 
-    USP_DUMP("\nMaximum number of nodes mapping into same bucket=%d (at [%d])", max_num_links, index_with_max_links);
+        // Update chain statistics
+        if (num_links > 0)
+        {
+            num_used_buckets++;
+        }
+        chain_length_histogram[ (num_links < NUM_ELEM(chain_length_histogram)) ? num_links : NUM_ELEM(chain_length_histogram)-1 ]++;
+    }
 
+    USP_DUMP("\nNumber of nodes=%u, buckets=%u (used=%u), load factor=%.2f", dm_node_map_count, dm_node_map_size, num_used_buckets,
+             (dm_node_map_size == 0) ? 0.0 : (double)dm_node_map_count / (double)dm_node_map_size);
+    USP_DUMP("Average chain length of used buckets=%.2f", (num_used_buckets == 0) ? 0.0 : (double)dm_node_map_count / (double)num_used_buckets);
+    USP_DUMP("Buckets with chain length 0=%u, 1=%u, 2=%u, 3=%u, 4+=%u", chain_length_histogram[0], chain_length_histogram[1],
+             chain_length_histogram[2], chain_length_histogram[3], chain_length_histogram[4]);
+    USP_DUMP("Maximum number of nodes mapping into same bucket=%u (at [%u])", max_num_links, index_with_max_links);
 }
 
 /*********************************************************************//**
@@ -4568,7 +4833,13 @@ dm_node_t *FindNodeFromHash(dm_hash_t hash)
     unsigned squashed_hash;
     dm_node_t *node;
 
-    squashed_hash = ((unsigned)hash) % MAX_NODE_MAP_BUCKETS;
+    // Exit if no nodes have been registered yet
+    if (dm_node_map == NULL)
+    {
+        return NULL;
+    }
+
+    squashed_hash = ((unsigned)hash) & (dm_node_map_size - 1);
 
     // Find the node in the linked list of nodes which match the squashed hash
     node = dm_node_map[squashed_hash];
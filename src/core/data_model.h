@@ -106,10 +106,13 @@ typedef struct
 
 //-----------------------------------------------------------------------------------------
 // Typedef for structure containing all object instances for a top level multi-instance node and its children
+// NOTE: The vector is kept sorted (see CompareInstances() in dm_inst_vector.c), so that all instances of an object
+//       and all of their children occupy a contiguous range of entries, which can be found by binary search
 typedef struct
 {
     dm_instances_t *vector;
     int num_entries;
+    int max_entries;        // Number of entries allocated in vector[]
 } dm_instances_vector_t;
 
 //-----------------------------------------------------------------------------------------
@@ -127,8 +130,19 @@ typedef struct
     int group_id;
     unsigned type_flags;                  // type of the parameter
     struct dm_node_tag *table_node;       // database node representing the table which we need to get the number of entries in (for kDMNodeType_Param_NumEntries)
+    unsigned value_change_poll_period;    // Period (in seconds) between polling the value of this parameter for value change subscriptions, or 0 to use VALUE_CHANGE_POLL_PERIOD
 } dm_param_info_t;
 
+// Statistics about the cache of instances for a top-level multi-instance object with a refresh instances vendor hook
+typedef struct
+{
+    unsigned num_refreshes;             // Number of times the refresh instances vendor hook has been called
+    unsigned num_background_refreshes;  // Number of times the refresh instances vendor hook has been called ahead of expiry by a timer, rather than when accessing the instances
+    unsigned num_hits;                  // Number of times the instances have been accessed without needing to call the refresh instances vendor hook
+    uint64_t total_refresh_ms;          // Cumulative time spent in the refresh instances vendor hook
+    unsigned max_refresh_ms;            // Longest time spent in a single call to the refresh instances vendor hook
+} dm_refresh_stats_t;
+
 // Information registered in the data model for objects
 typedef struct
 {
@@ -148,8 +162,10 @@ typedef struct
     // The following are only used by top-level multi-instance objects
     dm_instances_vector_t inst_vector;          // vector of instances for this multi-instance object and all its children
     dm_refresh_instances_cb_t refresh_instances_cb; // (optional) callback to get the instances of this object and its children
-    time_t refresh_instances_expiry_time;       // Absolute time at which the instances in the inst_vector are valid until. NOTE: Only used if refresh_instances_cb is non-NULL.
+    uint64_t refresh_instances_expiry_ms;       // Monotonic time (in ms, see tu_uptime_msecs64()) at which the instances in the inst_vector are valid until. NOTE: Only used if refresh_instances_cb is non-NULL.
                                                 // After this time, if the USP Agent needs to access the top-level multi-instance object or any of its children, then the callback will be invoked again.
+    bool refresh_instances_accessed;            // Set if the instances have been accessed since they were last refreshed. Only objects in use are refreshed in the background (see REFRESH_INSTANCES_IN_BACKGROUND)
+    dm_refresh_stats_t refresh_stats;           // Statistics about calls to refresh_instances_cb
 } dm_object_info_t;
 
 // Information registered in the data model for operations
@@ -187,10 +203,17 @@ typedef struct dm_node_tag
     char *path;                 // Schema path for this node. Used for debug, passed to the vendor hooks and with GetSupportedDM
 
     char *name;                 // Part of the path that this node implements (name of path segment)
+    dm_hash_t name_hash;        // Hash of name. Used to index this node in its parent's child_table[]
     dm_node_type_t type;
-    double_linked_list_t child_nodes;
+    double_linked_list_t child_nodes;   // Children in registration order (used when iterating the tree)
+
+    struct dm_node_tag **child_table;   // Hash index of child_nodes by name. NULL until the node has more than MIN_CHILDREN_FOR_HASH_INDEX children
+    unsigned child_table_size;          // Number of buckets in child_table[] (always a power of 2)
+    unsigned num_children;              // Number of nodes in child_nodes
+    struct dm_node_tag *next_child_hash_link;  // pointer to next sibling in the same child_table[] bucket of the parent
 
     dm_hash_t hash;             // Contains hash of the data model schema path to this node. If this node is a multi-instance object, then schema path includes trailing '{i}'
+    unsigned reg_seq;           // Order in which this node was registered in the schema. Used to order the instances of sibling objects in instance vectors
 
     int order;                   // Number of instance separators in the path to this node
                                  // e.g. Device.Wifi.{i}.Interface.{i}.Enable would have an order of 2
@@ -313,6 +336,7 @@ int DATA_MODEL_Operate(char *path, kv_vector_t *input_args, kv_vector_t *output_
 int DATA_MODEL_ShouldOperationRestart(char *path, int instance, bool *is_restart, int *err_code, char *err_msg, int err_msg_len, kv_vector_t *output_args);
 int DATA_MODEL_RestartAsyncOperation(char *path, kv_vector_t *input_args, int instance);
 unsigned DATA_MODEL_GetPathProperties(char *path, combined_role_t *combined_role, unsigned short *permission_bitmask, int *group_id, unsigned *type_flags);
+int DATA_MODEL_GetValueChangeInfo(char *path, dm_hash_t *hash, dm_req_instances_t *inst, unsigned *poll_period);
 int DATA_MODEL_SplitPath(char *path, char **schema_path, dm_req_instances_t *instances, bool *instances_exist);
 int DATA_MODEL_InformInstance(char *path);
 int DATA_MODEL_AddParameterInstances(dm_hash_t hash, char *instances);
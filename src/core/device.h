@@ -185,6 +185,7 @@ void DEVICE_SUBSCRIPTION_ProcessAllOperationCompleteSubscriptions(char *command,
 void DEVICE_SUBSCRIPTION_ResolveObjectDeletionPaths(void);
 void DEVICE_SUBSCRIPTION_NotifyObjectLifeEvent(char *obj_path, subs_notify_t notify_type);
 void DEVICE_SUBSCRIPTION_ProcessAllObjectLifeEventSubscriptions(void);
+void DEVICE_SUBSCRIPTION_NotifyParamValueChange(unsigned hash, dm_req_instances_t *inst);
 void DEVICE_SUBSCRIPTION_ProcessAllEventCompleteSubscriptions(char *event_name, kv_vector_t *output_args);
 void DEVICE_SUBSCRIPTION_SendPeriodicEvent(int cont_instance);
 void DEVICE_SUBSCRIPTION_NotifyControllerDeleted(int cont_instance);
@@ -202,6 +203,11 @@ int DEVICE_SECURITY_TrustCertVerifyCallback(int preverify_ok, X509_STORE_CTX *x5
 int DEVICE_SECURITY_NoSaveTrustCertVerifyCallback(int preverify_ok, X509_STORE_CTX *x509_ctx);
 int DEVICE_SECURITY_AddCertHostnameValidation(SSL* ssl, const char* name, size_t length);
 int DEVICE_SECURITY_AddCertHostnameValidationCtx(SSL_CTX* ssl_ctx, const char* name, size_t length);
+void DEVICE_SECURITY_EnableSessionCache(SSL_CTX *ssl_ctx);
+void DEVICE_SECURITY_SetSessionKey(SSL *ssl, char *host, int port);
+void DEVICE_SECURITY_SetCtxSessionKey(SSL_CTX *ssl_ctx, char *host, int port);
+bool DEVICE_SECURITY_GetResumedSessionRole(SSL *ssl, ctrust_role_t *role);
+void DEVICE_SECURITY_SetSessionRole(SSL *ssl, ctrust_role_t role);
 int DEVICE_CTRUST_Init(void);
 int DEVICE_CTRUST_Start(void);
 void DEVICE_CTRUST_Stop(void);
@@ -109,13 +109,15 @@ int NotifyChange_MQTTCleanSession(dm_req_t *req, char *value);
 int NotifyChange_MQTTCleanStart(dm_req_t *req, char *value);
 int NotifyChange_MQTTRequestResponseInfo(dm_req_t *req, char *value);
 int NotifyChange_MQTTRequestProblemInfo(dm_req_t *req, char *value);
+int Validate_MQTTTopicAliasMaximum(dm_req_t *req, char *value);
+int NotifyChange_MQTTTopicAliasMaximum(dm_req_t *req, char *value);
+int Validate_MQTTSharedSubscriptionGroup(dm_req_t *req, char *value);
+int NotifyChange_MQTTSharedSubscriptionGroup(dm_req_t *req, char *value);
 #if 0
 // TODO: Removed as these are not yet used
 int NotifyChange_MQTTSessionExpiryInterval(dm_req_t *req, char *value);
 int NotifyChange_MQTTReceiveMaximum(dm_req_t *req, char *value);
 int NotifyChange_MQTTMaximumPacketSize(dm_req_t *req, char *value);
-int Validate_MQTTTopicAliasMaximum(dm_req_t *req, char *value);
-int NotifyChange_MQTTTopicAliasMaximum(dm_req_t *req, char *value);
 int NotifyChange_MQTTWillEnable(dm_req_t *req, char *value);
 int Validate_MQTTWillQoS(dm_req_t *req, char *value);
 int NotifyChange_MQTTWillQoS(dm_req_t *req, char *value);
@@ -144,6 +146,7 @@ int ValidateAdd_MqttClientSubscriptions(dm_req_t *req);
 int Notify_MqttClientSubcriptionsAdded(dm_req_t *req);
 int Notify_MqttClientSubscriptionsDeleted(dm_req_t *req);
 int NotifyChange_MQTTSubscriptionEnable(dm_req_t *req, char *value);
+int Validate_MQTTSubscriptionTopic(dm_req_t *req, char *value);
 int NotifyChange_MQTTSubscriptionTopic(dm_req_t *req, char *value);
 int Validate_MQTTSubscriptionQoS(dm_req_t *req, char *value);
 int NotifyChange_MQTTSubscriptionQoS(dm_req_t *req, char *value);
@@ -233,12 +236,13 @@ int DEVICE_MQTT_Init(void)
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.CleanStart", "true", NULL, NotifyChange_MQTTCleanStart , DM_BOOL);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.RequestResponseInfo", "false", NULL, NotifyChange_MQTTRequestResponseInfo , DM_BOOL);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.RequestProblemInfo", "false", NULL, NotifyChange_MQTTRequestProblemInfo , DM_BOOL);
+    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.TopicAliasMaximum", "0", Validate_MQTTTopicAliasMaximum, NotifyChange_MQTTTopicAliasMaximum, DM_UINT);
+    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.X_BBF_SharedSubscriptionGroup", "", Validate_MQTTSharedSubscriptionGroup, NotifyChange_MQTTSharedSubscriptionGroup, DM_STRING);
 #if 0
     // TODO: Removed as these are not yet used
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.SessionExpiryInterval", NULL, NULL, NotifyChange_MQTTSessionExpiryInterval, DM_UINT);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.ReceiveMaximum", NULL, NULL, NotifyChange_MQTTReceiveMaximum, DM_UINT);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.MaximumPacketSize", NULL, NULL, NotifyChange_MQTTMaximumPacketSize, DM_UINT);
-    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.TopicAliasMaximum", NULL, Validate_MQTTTopicAliasMaximum, NotifyChange_MQTTTopicAliasMaximum, DM_UINT);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.WillEnable", "false", NULL, NotifyChange_MQTTWillEnable , DM_BOOL);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.WillQoS", NULL, Validate_MQTTWillQoS, NotifyChange_MQTTWillQoS, DM_UINT);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.WillRetain", "false", NULL, NotifyChange_MQTTWillRetain , DM_BOOL);
@@ -265,7 +269,7 @@ int DEVICE_MQTT_Init(void)
     err |= USP_REGISTER_Param_NumEntries(DEVICE_MQTT_CLIENT ".{i}.SubscriptionNumberOfEntries", DEVICE_MQTT_CLIENT".{i}.Subscription.{i}");
     err |= USP_REGISTER_DBParam_Alias(DEVICE_MQTT_CLIENT ".{i}.Subscription.{i}.Alias", NULL);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.Subscription.{i}.Enable", "false", NULL, NotifyChange_MQTTSubscriptionEnable, DM_BOOL);
-    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.Subscription.{i}.Topic", NULL, NULL, NotifyChange_MQTTSubscriptionTopic, DM_STRING);
+    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.Subscription.{i}.Topic", NULL, Validate_MQTTSubscriptionTopic, NotifyChange_MQTTSubscriptionTopic, DM_STRING);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_MQTT_CLIENT ".{i}.Subscription.{i}.QoS", NULL, Validate_MQTTSubscriptionQoS, NotifyChange_MQTTSubscriptionQoS, DM_UINT);
 
     // Exit if any errors occurred
@@ -754,6 +758,23 @@ int ProcessMqttClientAdded(int instance)
         goto exit;
     }
 
+    // Exit if unable to get the TopicAliasMaximum for this MQTT client
+    USP_SNPRINTF(path, sizeof(path), "%s.%d.TopicAliasMaximum", device_mqtt_client_root, instance);
+    err = DM_ACCESS_GetUnsigned(path, &mqttclient->conn_params.topic_alias_max);
+    if (err != USP_ERR_OK)
+    {
+        goto exit;
+    }
+
+    // Exit if unable to get the shared subscription group for this MQTT client
+    USP_SNPRINTF(path, sizeof(path), "%s.%d.X_BBF_SharedSubscriptionGroup", device_mqtt_client_root, instance);
+    USP_SAFE_FREE(mqttclient->conn_params.shared_subscription_group);
+    err = DM_ACCESS_GetString(path, &mqttclient->conn_params.shared_subscription_group);
+    if (err != USP_ERR_OK)
+    {
+        goto exit;
+    }
+
 #if 0
     // TODO: Removed as these are not yet used
     // Exit if unable to get the SessionExpiryInterval for this MQTT client
@@ -780,14 +801,6 @@ int ProcessMqttClientAdded(int instance)
         goto exit;
     }
 
-    // Exit if unable to get the TopicAliasMaximum for this MQTT client
-    USP_SNPRINTF(path, sizeof(path), "%s.%d.TopicAliasMaximum", device_mqtt_client_root, instance);
-    err = DM_ACCESS_GetUnsigned(path, &mqttclient->conn_params.topic_alias_max);
-    if (err != USP_ERR_OK)
-    {
-        goto exit;
-    }
-
     // Exit if unable to get the WillEnable for this MQTT client
     USP_SNPRINTF(path, sizeof(path), "%s.%d.WillEnable", device_mqtt_client_root, instance);
     err = DM_ACCESS_GetBool(path, &mqttclient->conn_params.will_enable);
@@ -1710,6 +1723,72 @@ int NotifyChange_MQTTRequestProblemInfo(dm_req_t *req, char *value)
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** Validate_MQTTSharedSubscriptionGroup
+**
+** Validates Device.MQTT.Client.{i}.X_BBF_SharedSubscriptionGroup
+** by checking that it is usable as the ShareName of an MQTT shared subscription
+**
+** \param   req - pointer to structure identifying the parameter
+** \param   value - value that the controller would like to set the parameter to
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int Validate_MQTTSharedSubscriptionGroup(dm_req_t *req, char *value)
+{
+    // Empty string disables shared subscription of the response topic
+    if ((*value != '\0') && (MQTT_IsValidShareName(value) == false))
+    {
+        USP_ERR_SetMessage("%s: '%s' must not contain '/', '+' or '#'", __FUNCTION__, value);
+        return USP_ERR_INVALID_VALUE;
+    }
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** NotifyChange_MQTTSharedSubscriptionGroup
+**
+** Function called when Device.MQTT.Client.{i}.X_BBF_SharedSubscriptionGroup is modified
+**
+** \param   req - pointer to structure identifying the path
+** \param   value - new value of this parameter
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int NotifyChange_MQTTSharedSubscriptionGroup(dm_req_t *req, char *value)
+{
+    mqtt_conn_params_t *mp;
+    bool schedule_reconnect = false;
+
+    // Determine mqtt client to be updated
+    mp = FindMqttParamsByInstance(inst1);
+    USP_ASSERT(mp != NULL);
+
+    // Determine whether to schedule a reconnect
+    // NOTE: This parameter is only used by protocol version 5.0
+    if ((strcmp(mp->shared_subscription_group, value) != 0) && (mp->enable) && (mp->version == kMqttProtocol_5_0))
+    {
+        schedule_reconnect = true;
+    }
+
+    // Set the new value. This must be done before scheduling a reconnect, so that the reconnect uses the correct values
+    USP_SAFE_FREE(mp->shared_subscription_group);
+    mp->shared_subscription_group = USP_STRDUP(value);
+
+    // Schedule a reconnect after the present response has been sent, if the value has changed
+    if (schedule_reconnect)
+    {
+        ScheduleMqttReconnect(mp);
+    }
+
+    return USP_ERR_OK;
+}
+
 #if 0
 // TODO: These are removed as they are not used
 /*********************************************************************//**
@@ -1846,6 +1925,8 @@ int NotifyChange_MQTTMaximumPacketSize(dm_req_t *req, char *value)
 }
 
 
+#endif
+
 /*********************************************************************//**
 **
 ** Validate_MQTTTopicAliasMaximum
@@ -1883,13 +1964,9 @@ int NotifyChange_MQTTTopicAliasMaximum(dm_req_t *req, char *value)
     mp = FindMqttParamsByInstance(inst1);
     USP_ASSERT(mp != NULL);
 
-    //this parameter only supports protocol version 5.0
-    if(mp->version != kMqttProtocol_5_0)
-    {
-        return EOK;
-    }
     // Determine whether to schedule a reconnect
-    if ((mp->topic_alias_max != val_uint) && (mp->enable) && val_uint)
+    // NOTE: This parameter is only used by protocol version 5.0
+    if ((mp->topic_alias_max != val_uint) && (mp->enable) && (mp->version == kMqttProtocol_5_0))
     {
         schedule_reconnect = true;
     }
@@ -1906,6 +1983,8 @@ int NotifyChange_MQTTTopicAliasMaximum(dm_req_t *req, char *value)
     return USP_ERR_OK;
 }
 
+#if 0
+// TODO: These are removed as they are not used
 /*********************************************************************//**
 **
 ** NotifyChange_MQTTWillEnable
@@ -2945,6 +3024,30 @@ int NotifyChange_MQTTSubscriptionEnable(dm_req_t *req, char *value)
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** Validate_MQTTSubscriptionTopic
+**
+** Validates Device.MQTT.Client.{i}.Subscription.{i}.Topic
+** by checking the format of shared subscriptions ie "$share/<ShareName>/<TopicFilter>"
+**
+** \param   req - pointer to structure identifying the parameter
+** \param   value - value that the controller would like to set the parameter to
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int Validate_MQTTSubscriptionTopic(dm_req_t *req, char *value)
+{
+    if (MQTT_IsValidTopicFilter(value) == false)
+    {
+        USP_ERR_SetMessage("%s: '%s' is not a valid shared subscription (expected '%s<ShareName>/<TopicFilter>')", __FUNCTION__, value, MQTT_SHARED_SUBSCRIPTION_PREFIX);
+        return USP_ERR_INVALID_VALUE;
+    }
+
+    return USP_ERR_OK;
+}
+
 /*************************************************************************
 **
 ** NotifyChange_MQTTSubscriptionTopic
@@ -63,6 +63,7 @@
 #include "vendor_api.h"
 #include "iso8601.h"
 #include "text_utils.h"
+#include "os_utils.h"
 
 
 //-----------------------------------------------------------------------------------------
@@ -150,6 +151,51 @@ static cert_t *all_certs = NULL;
 static int num_all_certs = 0;
 static int num_trust_certs = 0;
 
+//------------------------------------------------------------------------------
+// Cache of TLS/DTLS client sessions, used to perform an abbreviated handshake when reconnecting to a server
+// Each entry is keyed by the SSL context and the server (hostname and port) which the session was negotiated with
+// The controller trust role is cached alongside the session, because the verify callback (which collects
+// the certificate chain used to determine the role) is not called when a session is resumed
+typedef struct
+{
+    SSL_CTX *ssl_ctx;           // SSL context that the session was created with. NULL if this entry is unused
+    char key[MAX_DM_SHORT_VALUE_LEN]; // Identifies the server that the session was negotiated with
+    SSL_SESSION *session;       // Session to resume. A reference is held on this session
+    ctrust_role_t role;         // Controller trust role determined when the session was negotiated, or INVALID_ROLE if not known
+    unsigned last_used;         // Value of tls_session_cache_clock when this entry was last used. Used to determine which entry to replace
+} tls_session_entry_t;
+
+#if MAX_TLS_SESSION_CACHE_ENTRIES > 0
+static tls_session_entry_t tls_session_cache[MAX_TLS_SESSION_CACHE_ENTRIES];
+#else
+static tls_session_entry_t *tls_session_cache = NULL;
+#endif
+static unsigned tls_session_cache_clock = 0;
+static unsigned tls_session_hits = 0;   // Number of handshakes which resumed a cached session
+static unsigned tls_session_misses = 0; // Number of handshakes which performed a full handshake
+
+// Mutex protecting the session cache, as it is accessed by all MTP threads
+static pthread_mutex_t tls_session_mutex;
+
+//------------------------------------------------------------------------------
+// Per connection state, attached to each client SSL object as ex data
+typedef struct
+{
+    char key[MAX_DM_SHORT_VALUE_LEN]; // Identifies the server that this connection is to
+    ctrust_role_t role;         // Controller trust role for this connection, or INVALID_ROLE if not yet known
+    bool is_counted;            // Set once the handshake has been counted as a hit or miss
+} tls_session_key_t;
+
+static int tls_session_key_index = -1;
+
+// Index of the server key attached to an SSL context by DEVICE_SECURITY_SetCtxSessionKey()
+static int tls_ctx_key_index = -1;
+
+// Index of the marker attached to an SSL context by DEVICE_SECURITY_EnableSessionCache()
+// Its free callback purges the sessions cached for the SSL context when the SSL context is freed,
+// as a new SSL context (with a different trust store and credentials) may be allocated at the same address
+static int tls_ctx_cache_index = -1;
+
 //------------------------------------------------------------------------------------
 // Enumeration for FingerprintAlgorithm input argument of GetFingerprint() command
 typedef enum
@@ -234,6 +280,15 @@ void LogCert_DER(X509 *cert);
 const trust_store_t *GetTrustStoreFromFile(int *num_trusted_certs);
 const trust_store_t *Read_TrustStoreFromFile(int *num_trusted_certs);
 int Operate_GetFingerprint(dm_req_t *req, char *command_key, kv_vector_t *input_args, kv_vector_t *output_args);
+int Get_TlsSessionHits(dm_req_t *req, char *buf, int len);
+int Get_TlsSessionMisses(dm_req_t *req, char *buf, int len);
+tls_session_key_t *GetSessionKey(SSL *ssl, bool create);
+void FreeSessionKey(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+void FlushSessionCache(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+tls_session_entry_t *FindSessionEntry(SSL_CTX *ssl_ctx, char *key);
+int NewSessionCallback(SSL *ssl, SSL_SESSION *session);
+void SessionInfoCallback(const SSL *ssl, int where, int ret);
+void ResumeCachedSession(SSL *ssl, tls_session_key_t *sk);
 
 /*********************************************************************//**
 **
@@ -278,6 +333,10 @@ int DEVICE_SECURITY_Init(void)
                                                                                         fp_output_args, NUM_ELEM(fp_output_args));
     err |= USP_REGISTER_Param_SupportedList("Device.LocalAgent.SupportedFingerprintAlgorithms", fp_algs, NUM_ELEM(fp_algs));
 
+    // Register TLS session resumption statistics
+    err |= USP_REGISTER_VendorParam_ReadOnly("Device.Security.X_BBF_TLSSessionResumptionHits", Get_TlsSessionHits, DM_UINT);
+    err |= USP_REGISTER_VendorParam_ReadOnly("Device.Security.X_BBF_TLSSessionResumptionMisses", Get_TlsSessionMisses, DM_UINT);
+
     // Register unique keys for tables
     char *unique_keys[] = { "SerialNumber", "Issuer" };
     err |= USP_REGISTER_Object_UniqueKey(DEVICE_CERT_ROOT ".{i}", unique_keys, NUM_ELEM(unique_keys));
@@ -309,6 +368,34 @@ int DEVICE_SECURITY_Init(void)
     client_cert.is_san_equal_endpoint_id = false;
     client_cert.is_loaded = false;
 
+    // Exit if unable to initialise the TLS session cache
+    err = OS_UTILS_InitMutex(&tls_session_mutex);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+
+    tls_session_key_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, FreeSessionKey);
+    if (tls_session_key_index < 0)
+    {
+        USP_ERR_SetMessage("%s: SSL_get_ex_new_index() failed", __FUNCTION__);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    tls_ctx_key_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, FreeSessionKey);
+    if (tls_ctx_key_index < 0)
+    {
+        USP_ERR_SetMessage("%s: SSL_CTX_get_ex_new_index() failed", __FUNCTION__);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    tls_ctx_cache_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, FlushSessionCache);
+    if (tls_ctx_cache_index < 0)
+    {
+        USP_ERR_SetMessage("%s: SSL_CTX_get_ex_new_index() failed", __FUNCTION__);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
     // If the code gets here, then registration was successful
     return USP_ERR_OK;
 }
@@ -441,6 +528,18 @@ void DEVICE_SECURITY_Stop(void)
         OPENSSL_free(client_cert.issuer);
     }
 
+    // Free all cached TLS sessions
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    for (i=0; i<MAX_TLS_SESSION_CACHE_ENTRIES; i++)
+    {
+        if (tls_session_cache[i].session != NULL)
+        {
+            SSL_SESSION_free(tls_session_cache[i].session);
+        }
+        memset(&tls_session_cache[i], 0, sizeof(tls_session_entry_t));
+    }
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+
     // No explicit cleanup of OpenSSL is required.
     // Cleanup routines are now NoOps which have been deprecated. See OpenSSL Changes between 1.0.2h and 1.1.0  [25 Aug 2016]
 }
@@ -575,6 +674,504 @@ exit:
     return ssl_ctx;
 }
 
+/*********************************************************************//**
+**
+**  DEVICE_SECURITY_EnableSessionCache
+**
+**  Enables TLS/DTLS session resumption for client connections created from the specified SSL context
+**  Sessions negotiated with a server are cached (keyed by the server), and offered to the server when reconnecting,
+**  allowing an abbreviated handshake to be performed
+**  NOTE: This function must only be called for SSL contexts used by client connections,
+**        as it also turns off OpenSSL's server side session cache
+**
+** \param   ssl_ctx - pointer to SSL context to enable session resumption on
+**
+** \return  None
+**
+**************************************************************************/
+void DEVICE_SECURITY_EnableSessionCache(SSL_CTX *ssl_ctx)
+{
+    // Exit if session resumption has been disabled at compile time
+    if (MAX_TLS_SESSION_CACHE_ENTRIES == 0)
+    {
+        return;
+    }
+
+    // Mark the SSL context, so that the sessions cached for it are purged when it is freed
+    // NOTE: The value of the ex data is unused, it just needs to be non NULL
+    SSL_CTX_set_ex_data(ssl_ctx, tls_ctx_cache_index, ssl_ctx);
+
+    // Sessions are stored in our cache (keyed by server), rather than OpenSSL's internal cache (keyed by session id)
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, NewSessionCallback);
+    SSL_CTX_set_info_callback(ssl_ctx, SessionInfoCallback);
+}
+
+/*********************************************************************//**
+**
+**  DEVICE_SECURITY_SetSessionKey
+**
+**  Identifies the server that the specified client SSL connection is to, and offers a cached session
+**  to resume with that server (if one exists)
+**  This function must be called before SSL_connect()
+**
+** \param   ssl - pointer to SSL connection
+** \param   host - hostname or IP address of the server
+** \param   port - port on the server
+**
+** \return  None
+**
+**************************************************************************/
+void DEVICE_SECURITY_SetSessionKey(SSL *ssl, char *host, int port)
+{
+    tls_session_key_t *sk;
+
+    sk = GetSessionKey(ssl, true);
+    if (sk == NULL)
+    {
+        return;
+    }
+
+    USP_SNPRINTF(sk->key, sizeof(sk->key), "%s:%d", host, port);
+    ResumeCachedSession(ssl, sk);
+}
+
+/*********************************************************************//**
+**
+**  DEVICE_SECURITY_SetCtxSessionKey
+**
+**  Identifies the server that the next client SSL connection created from the specified SSL context will connect to
+**  This is used instead of DEVICE_SECURITY_SetSessionKey() when the SSL connection is created and connected
+**  internally by a library (eg libmosquitto), so the cached session is offered when the handshake starts
+**  This function must be called before the library connects to the server
+**
+** \param   ssl_ctx - pointer to SSL context that the library will create the SSL connection from
+** \param   host - hostname or IP address of the server
+** \param   port - port on the server
+**
+** \return  None
+**
+**************************************************************************/
+void DEVICE_SECURITY_SetCtxSessionKey(SSL_CTX *ssl_ctx, char *host, int port)
+{
+    char *key;
+    char buf[MAX_DM_SHORT_VALUE_LEN];
+
+    if (tls_ctx_key_index < 0)
+    {
+        return;
+    }
+
+    USP_SNPRINTF(buf, sizeof(buf), "%s:%d", host, port);
+    key = SSL_CTX_get_ex_data(ssl_ctx, tls_ctx_key_index);
+    if ((key != NULL) && (strcmp(key, buf) == 0))
+    {
+        return;
+    }
+
+    // NOTE: The previous key (if any) is not freed by SSL_CTX_set_ex_data(), and the new key is freed by FreeSessionKey() when the SSL context is freed
+    USP_SAFE_FREE(key);
+    SSL_CTX_set_ex_data(ssl_ctx, tls_ctx_key_index, USP_STRDUP(buf));
+}
+
+/*********************************************************************//**
+**
+**  DEVICE_SECURITY_GetResumedSessionRole
+**
+**  Determines whether the handshake on the specified SSL connection resumed a cached session,
+**  and if so, the controller trust role determined when the session was originally negotiated
+**  This is necessary because the verify callback is not called when resuming a session,
+**  so the certificate chain is not available to determine the role
+**
+** \param   ssl - pointer to SSL connection (which has completed the handshake)
+** \param   role - pointer to variable in which to return the cached role
+**
+** \return  true if the session was resumed and a cached role was returned
+**
+**************************************************************************/
+bool DEVICE_SECURITY_GetResumedSessionRole(SSL *ssl, ctrust_role_t *role)
+{
+    tls_session_key_t *sk;
+
+    // Exit if a full handshake was performed
+    if (SSL_session_reused(ssl) == 0)
+    {
+        return false;
+    }
+
+    // Exit if the role was not known when the session was cached
+    sk = GetSessionKey(ssl, false);
+    if ((sk == NULL) || (sk->role == INVALID_ROLE))
+    {
+        return false;
+    }
+
+    *role = sk->role;
+    return true;
+}
+
+/*********************************************************************//**
+**
+**  DEVICE_SECURITY_SetSessionRole
+**
+**  Stores the controller trust role determined after a full handshake, so that it
+**  may be restored when the session is subsequently resumed
+**
+** \param   ssl - pointer to SSL connection (which has completed the handshake)
+** \param   role - controller trust role determined for this connection
+**
+** \return  None
+**
+**************************************************************************/
+void DEVICE_SECURITY_SetSessionRole(SSL *ssl, ctrust_role_t role)
+{
+    tls_session_key_t *sk;
+    tls_session_entry_t *entry;
+
+    sk = GetSessionKey(ssl, false);
+    if (sk == NULL)
+    {
+        return;
+    }
+    sk->role = role;
+
+    // Update the cache entry if the session has already been cached (TLS 1.2 sessions are cached during the handshake)
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    entry = FindSessionEntry(SSL_get_SSL_CTX(ssl), sk->key);
+    if ((entry != NULL) && (entry->session == SSL_get_session(ssl)))
+    {
+        entry->role = role;
+    }
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+}
+
+/*********************************************************************//**
+**
+**  Get_TlsSessionHits
+**
+**  Gets the value of Device.Security.X_BBF_TLSSessionResumptionHits
+**
+** \param   req - pointer to structure identifying the parameter
+** \param   buf - pointer to buffer into which to return the value of the parameter (as a textual string)
+** \param   len - length of buffer in which to return the value of the parameter
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int Get_TlsSessionHits(dm_req_t *req, char *buf, int len)
+{
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    val_uint = tls_session_hits;
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+**  Get_TlsSessionMisses
+**
+**  Gets the value of Device.Security.X_BBF_TLSSessionResumptionMisses
+**
+** \param   req - pointer to structure identifying the parameter
+** \param   buf - pointer to buffer into which to return the value of the parameter (as a textual string)
+** \param   len - length of buffer in which to return the value of the parameter
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int Get_TlsSessionMisses(dm_req_t *req, char *buf, int len)
+{
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    val_uint = tls_session_misses;
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+**  GetSessionKey
+**
+**  Gets the session resumption state attached to the specified SSL connection, optionally creating it
+**
+** \param   ssl - pointer to SSL connection
+** \param   create - set if the state should be created, if it does not already exist
+**
+** \return  pointer to session resumption state, or NULL if none exists
+**
+**************************************************************************/
+tls_session_key_t *GetSessionKey(SSL *ssl, bool create)
+{
+    tls_session_key_t *sk;
+
+    if (tls_session_key_index < 0)
+    {
+        return NULL;
+    }
+
+    sk = SSL_get_ex_data(ssl, tls_session_key_index);
+    if ((sk == NULL) && (create))
+    {
+        sk = USP_MALLOC(sizeof(tls_session_key_t));
+        memset(sk, 0, sizeof(tls_session_key_t));
+        sk->role = INVALID_ROLE;
+        SSL_set_ex_data(ssl, tls_session_key_index, sk);
+    }
+
+    return sk;
+}
+
+/*********************************************************************//**
+**
+**  FreeSessionKey
+**
+**  Called by OpenSSL when an SSL connection is freed, to free the session resumption state attached to it
+**
+** \param   parent - pointer to SSL connection being freed
+** \param   ptr - pointer to session resumption state to free
+** \param   ad, idx, argl, argp - unused
+**
+** \return  None
+**
+**************************************************************************/
+void FreeSessionKey(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+    USP_SAFE_FREE(ptr);
+}
+
+/*********************************************************************//**
+**
+**  FlushSessionCache
+**
+**  Called by OpenSSL when an SSL context which has session resumption enabled is freed
+**  Frees all sessions cached for the SSL context, so that they cannot be resumed by a later SSL context
+**  which happens to be allocated at the same address
+**
+** \param   parent - pointer to SSL context being freed
+** \param   ptr - marker set by DEVICE_SECURITY_EnableSessionCache(), or NULL if session resumption is not enabled
+** \param   ad, idx, argl, argp - unused
+**
+** \return  None
+**
+**************************************************************************/
+void FlushSessionCache(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+    int i;
+    tls_session_entry_t *entry;
+
+    // Exit if session resumption was not enabled on this SSL context
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    for (i=0; i<MAX_TLS_SESSION_CACHE_ENTRIES; i++)
+    {
+        entry = &tls_session_cache[i];
+        if (entry->ssl_ctx == (SSL_CTX *) parent)
+        {
+            if (entry->session != NULL)
+            {
+                SSL_SESSION_free(entry->session);
+            }
+            memset(entry, 0, sizeof(tls_session_entry_t));
+        }
+    }
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+}
+
+/*********************************************************************//**
+**
+**  FindSessionEntry
+**
+**  Finds the session cache entry for the specified server
+**  NOTE: This function must be called with tls_session_mutex held
+**
+** \param   ssl_ctx - SSL context that the session was created with
+** \param   key - identifies the server
+**
+** \return  pointer to cache entry, or NULL if no session is cached for the server
+**
+**************************************************************************/
+tls_session_entry_t *FindSessionEntry(SSL_CTX *ssl_ctx, char *key)
+{
+    int i;
+    tls_session_entry_t *entry;
+
+    for (i=0; i<MAX_TLS_SESSION_CACHE_ENTRIES; i++)
+    {
+        entry = &tls_session_cache[i];
+        if ((entry->ssl_ctx == ssl_ctx) && (strcmp(entry->key, key) == 0))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+**  ResumeCachedSession
+**
+**  Offers the cached session for the server (if one exists) to the server in the next handshake
+**
+** \param   ssl - pointer to SSL connection
+** \param   sk - pointer to session resumption state identifying the server
+**
+** \return  None
+**
+**************************************************************************/
+void ResumeCachedSession(SSL *ssl, tls_session_key_t *sk)
+{
+    tls_session_entry_t *entry;
+
+    OS_UTILS_LockMutex(&tls_session_mutex);
+    entry = FindSessionEntry(SSL_get_SSL_CTX(ssl), sk->key);
+    if (entry != NULL)
+    {
+        // NOTE: SSL_set_session() takes its own reference on the session
+        SSL_set_session(ssl, entry->session);
+        sk->role = entry->role;
+        entry->last_used = ++tls_session_cache_clock;
+    }
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+}
+
+/*********************************************************************//**
+**
+**  NewSessionCallback
+**
+**  Called by OpenSSL when a new session has been negotiated with the server (or, for TLS 1.3, a session ticket received)
+**  Stores the session in the cache, replacing any previous session for the same server
+**
+** \param   ssl - pointer to SSL connection
+** \param   session - pointer to new session
+**
+** \return  1 if this function has taken a reference on the session, 0 otherwise
+**
+**************************************************************************/
+int NewSessionCallback(SSL *ssl, SSL_SESSION *session)
+{
+    int i;
+    tls_session_key_t *sk;
+    tls_session_entry_t *entry;
+    SSL_CTX *ssl_ctx;
+
+    // Exit if the server has not been identified (this is the case for server connections)
+    sk = GetSessionKey(ssl, false);
+    if ((sk == NULL) || (sk->key[0] == '\0'))
+    {
+        return 0;
+    }
+
+    OS_UTILS_LockMutex(&tls_session_mutex);
+
+    // Find the entry to store the session in, replacing the least recently used entry if the server is not already in the cache
+    ssl_ctx = SSL_get_SSL_CTX(ssl);
+    entry = FindSessionEntry(ssl_ctx, sk->key);
+    if (entry == NULL)
+    {
+        entry = &tls_session_cache[0];
+        for (i=1; i<MAX_TLS_SESSION_CACHE_ENTRIES; i++)
+        {
+            if (tls_session_cache[i].last_used < entry->last_used)
+            {
+                entry = &tls_session_cache[i];
+            }
+        }
+    }
+
+    if (entry->session != NULL)
+    {
+        SSL_SESSION_free(entry->session);
+    }
+
+    entry->ssl_ctx = ssl_ctx;
+    USP_STRNCPY(entry->key, sk->key, sizeof(entry->key));
+    entry->session = session;
+    entry->role = sk->role;
+    entry->last_used = ++tls_session_cache_clock;
+
+    OS_UTILS_UnlockMutex(&tls_session_mutex);
+
+    return 1;
+}
+
+/*********************************************************************//**
+**
+**  SessionInfoCallback
+**
+**  Called by OpenSSL as the state of a handshake changes
+**  At the start of the handshake, if the server has not already been identified by DEVICE_SECURITY_SetSessionKey()
+**  (eg libmosquitto creates and connects the SSL connection internally), it is identified by the key set
+**  on the SSL context by DEVICE_SECURITY_SetCtxSessionKey(), and any cached session is offered
+**  NOTE: OpenSSL calls this before the ClientHello is constructed, so the session is offered in this handshake
+**  At the end of the handshake, the hit and miss counters are updated
+**
+** \param   ssl - pointer to SSL connection
+** \param   where - bitmask identifying the state change
+** \param   ret - unused
+**
+** \return  None
+**
+**************************************************************************/
+void SessionInfoCallback(const SSL *ssl, int where, int ret)
+{
+    SSL *s = (SSL *) ssl;  // Cast away const: OpenSSL passes the connection as const, but the session must be set on it
+    tls_session_key_t *sk;
+    char *ctx_key;
+    bool is_reused;
+
+    if (SSL_is_server(s))
+    {
+        return;
+    }
+
+    if (where & SSL_CB_HANDSHAKE_START)
+    {
+        sk = GetSessionKey(s, false);
+        ctx_key = (tls_ctx_key_index < 0) ? NULL : SSL_CTX_get_ex_data(SSL_get_SSL_CTX(s), tls_ctx_key_index);
+        if ((sk == NULL) && (ctx_key != NULL) && (SSL_get_session(s) == NULL))
+        {
+            sk = GetSessionKey(s, true);
+            if (sk != NULL)
+            {
+                USP_STRNCPY(sk->key, ctx_key, sizeof(sk->key));
+                ResumeCachedSession(s, sk);
+            }
+        }
+    }
+
+    if (where & SSL_CB_HANDSHAKE_DONE)
+    {
+        // Exit if this handshake has already been counted
+        // NOTE: With TLS 1.3, this callback is also called after each post-handshake session ticket is received
+        sk = GetSessionKey(s, false);
+        if ((sk == NULL) || (sk->is_counted))
+        {
+            return;
+        }
+        sk->is_counted = true;
+
+        is_reused = (SSL_session_reused(s) != 0);
+        OS_UTILS_LockMutex(&tls_session_mutex);
+        if (is_reused)
+        {
+            tls_session_hits++;
+        }
+        else
+        {
+            tls_session_misses++;
+        }
+        OS_UTILS_UnlockMutex(&tls_session_mutex);
+
+        USP_LOG_Debug("%s: %s handshake with %s", __FUNCTION__, (is_reused) ? "Abbreviated" : "Full", sk->key);
+    }
+}
+
 /*********************************************************************//**
 **
 **  DEVICE_SECURITY_LoadTrustStore
@@ -51,6 +51,7 @@
 #include "device.h"
 #include "iso8601.h"
 #include "subs_vector.h"
+#include "subs_index.h"
 #include "path_resolver.h"
 #include "msg_handler.h"
 #include "database.h"
@@ -60,6 +61,7 @@
 #include "expr_vector.h"
 #include "json.h"
 #include "group_get_vector.h"
+#include "uptime.h"
 
 //------------------------------------------------------------------------------
 // List of notification types that USP Agent currently supports
@@ -77,6 +79,10 @@ const enum_entry_t notify_types[kSubNotifyType_Max] =
 // Vector containing all subscriptions
 subs_vector_t subscriptions;
 
+//------------------------------------------------------------------------------
+// Index used to find the subscriptions which might match an event, operation or object life event
+// NOTE: This must be invalidated whenever a subscription is added, deleted, enabled/disabled, or its NotifType or ReferenceList is changed
+static subs_index_t subs_index;
 
 //------------------------------------------------------------------------------
 // Ordered vector of objects which have been recently added/deleted from the data model
@@ -98,6 +104,28 @@ typedef struct
 
 obj_life_event_vector_t object_life_events;
 
+//------------------------------------------------------------------------------
+// Set of parameters whose value has been changed by a set since the value change subscriptions were last processed
+// Implemented as an open addressing hash table keyed by the hash of the parameter's schema path and its instance numbers
+// NOTE: Only parameters which are not polled need to be looked up in this set (see DATA_MODEL_GetValueChangeInfo)
+typedef struct
+{
+    bool is_used;                       // Set if this slot in the hash table contains a parameter
+    unsigned hash;                      // Hash of the schema path of the parameter (dm_hash_t)
+    dm_req_instances_t inst;            // Instance numbers in the path of the parameter
+} changed_param_t;
+
+static changed_param_t *changed_params = NULL;      // Hash table of changed parameters
+static unsigned changed_params_size = 0;            // Number of slots in the hash table (always a power of 2)
+static unsigned num_changed_params = 0;             // Number of slots in the hash table which are in use
+
+//------------------------------------------------------------------------------
+// Set once value change subscriptions have started to be processed (after notifications have been enabled)
+static bool is_value_change_started = false;
+
+// Monotonic time (in ms) at which the ValueChangeExec timer is next due to fire
+static uint64_t value_change_exec_ms = 0;
+
 //------------------------------------------------------------------------------
 // Boolean which is used by an assert to check that we always call DEVICE_SUBSCRIPTION_ResolveObjectDeletionPaths()
 // before deleting an object from the data model. This is needed so that ObjectDeletion subscriptions work correctly
@@ -113,6 +141,9 @@ static const char device_subs_root[] = DEVICE_SUBS_ROOT;
 static const char device_boot_event[] = DEVICE_BOOT_EVENT;
 static const char *periodic_event_str = "Device.LocalAgent.Periodic!";
 
+// Initial number of slots in the hash table of changed parameters (must be a power of 2)
+#define MIN_CHANGED_PARAMS_SLOTS 64
+
 //------------------------------------------------------------------------------------
 // Array of arguments sent in Boot! event
 static char *boot_event_args[] =
@@ -135,6 +166,7 @@ int NotifyChange_SubsRefList(dm_req_t *req, char *value);
 int NotifyChange_SubsTimeToLive(dm_req_t *req, char *value);
 int NotifyChange_NotifRetry(dm_req_t *req, char *value);
 int NotifyChange_NotifExpiration(dm_req_t *req, char *value);
+int NotifyChange_CoalescePeriod(dm_req_t *req, char *value);
 int Validate_SubsID(dm_req_t *req, char *value);
 int Validate_SubsNotifType(dm_req_t *req, char *value);
 int Validate_SubsRefList_Inner(subs_notify_t notify_type, char *ref_list);
@@ -149,8 +181,18 @@ void ProcessAllBootSubscriptions(void);
 void SendBootNotify(subs_t *sub);
 void ProcessObjectLifeEventSubscription(subs_t *sub);
 void ProcessAllValueChangeSubscriptions(void);
-void ProcessValueChangeSubscription(subs_t *sub);
+void ValueChangeExec(int id);
+uint64_t ProcessValueChangeSubscription(subs_t *sub, uint64_t cur_time_ms);
+void ResolveValueChangeParams(subs_t *sub, uint64_t cur_time_ms);
+void SeedValueChangeParams(subs_t *sub);
+bool DoesSubscriptionUseSearchExpressions(subs_t *sub);
+bool IsChangedParam(unsigned hash, dm_req_instances_t *inst);
+unsigned CalcChangedParamHash(unsigned hash, dm_req_instances_t *inst);
+void GrowChangedParams(void);
+void ClearChangedParams(void);
 void SendValueChangeNotify(subs_t *sub, char *path, char *value);
+void QueueValueChangeNotify(subs_t *sub, char *path, char *value, uint64_t cur_time_ms);
+void SendPendingValueChangeNotifies(subs_t *sub);
 void ResolveAllPathExpressions(int subs_instance, str_vector_t *path_expressions, str_vector_t *resolved_paths, int_vector_t *group_ids, resolve_op_t op, int cont_instance);
 void GetAllPathExpressionParameterValues(subs_t *sub, str_vector_t *path_expressions, kv_vector_t *param_values);
 char *SerializeToJSONObject(kv_vector_t *param_values);
@@ -195,6 +237,7 @@ int DEVICE_SUBSCRIPTION_Init(void)
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_SUBS_ROOT ".{i}.TimeToLive", "0", NULL, NotifyChange_SubsTimeToLive, DM_UINT);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_SUBS_ROOT ".{i}.NotifRetry", "false", NULL, NotifyChange_NotifRetry, DM_BOOL);
     err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_SUBS_ROOT ".{i}.NotifExpiration", "0", NULL, NotifyChange_NotifExpiration, DM_UINT);
+    err |= USP_REGISTER_DBParam_ReadWrite(DEVICE_SUBS_ROOT ".{i}.X_BBF_CoalescePeriod", "0", NULL, NotifyChange_CoalescePeriod, DM_UINT);
 
     // Register unique keys for Subscription table
     char *unique_keys[] = { "ID", "Recipient" };
@@ -223,15 +266,17 @@ int DEVICE_SUBSCRIPTION_Init(void)
 
 
     SUBS_VECTOR_Init(&subscriptions);
+    SUBS_INDEX_Init(&subs_index);
     SUBS_RETRY_Init();
 
     // Initialise ordered vector of object additions/deletions which need to be processed against the subscriptions
     object_life_events.vector = NULL;
     object_life_events.num_entries = 0;
 
-    // Create a timer which will be used to periodically poll for value change
-    // NOTE: We create it here so that it is included in the base memory (before USP_MEM_StartCollection is called)
+    // Create a timer which will be used to periodically update all subscriptions, and a timer to process value change subscriptions
+    // NOTE: We create them here so that they are included in the base memory (before USP_MEM_StartCollection is called)
     SYNC_TIMER_Add(DEVICE_SUBSCRIPTION_Update, 0, END_OF_TIME);
+    SYNC_TIMER_Add(ValueChangeExec, 0, END_OF_TIME);
 
     // If the code gets here, then registration was successful
     return USP_ERR_OK;
@@ -307,6 +352,10 @@ void DEVICE_SUBSCRIPTION_Stop(void)
 {
     SUBS_RETRY_Stop();
     SUBS_VECTOR_Destroy(&subscriptions);
+    SUBS_INDEX_Destroy(&subs_index);
+    USP_SAFE_FREE(changed_params);
+    changed_params_size = 0;
+    num_changed_params = 0;
 }
 
 /*********************************************************************//**
@@ -314,7 +363,7 @@ void DEVICE_SUBSCRIPTION_Stop(void)
 ** DEVICE_SUBSCRIPTION_Update
 **
 ** Periodically called to update all subscriptions
-** The first time this function is called, it registers a sync timer to periodically poll for value change
+** The first time this function is called, it starts processing of value change subscriptions (see ValueChangeExec)
 **
 ** \param   id - (unused) identifier of the sync timer which caused this callback
 **
@@ -324,14 +373,12 @@ void DEVICE_SUBSCRIPTION_Stop(void)
 void DEVICE_SUBSCRIPTION_Update(int id)
 {
     static bool boot_subs_processed = false;
-    time_t cur_time;
     int poll_period;
 
     // Delete all subscriptions which have expired
     DeleteExpiredSubscriptions();
 
     // Process Boot subscriptions only once after power up
-    cur_time = time(NULL);
     if (boot_subs_processed == false)
     {
         ProcessAllBootSubscriptions();
@@ -341,19 +388,23 @@ void DEVICE_SUBSCRIPTION_Update(int id)
         DeleteNonPersistentSubscriptions();
     }
 
-    // Poll all value change subscriptions for change
-    ProcessAllValueChangeSubscriptions();
+    // Determine the initial values of all value change subscriptions, and start the timer which processes them
+    // After this, value change subscriptions are processed whenever parameters are set or are due to be polled
+    if (is_value_change_started == false)
+    {
+        ProcessAllValueChangeSubscriptions();
+    }
 
     // Ensure that objects that require their instances to be refreshed by polling are refreshed
     // (This may result in object creation/deletion events when DEVICE_SUBSCRIPTION_ProcessAllObjectLifeEventSubscriptions is called)
     RefreshInstancesForObjLifetimeSubscriptions();
 
-    // Determine the period for value change polling
+    // Determine the period for updating all subscriptions
     poll_period = VALUE_CHANGE_POLL_PERIOD;
 
 
     // Restart the timer to cause this function to be called periodically
-    SYNC_TIMER_Reload(DEVICE_SUBSCRIPTION_Update, 0, cur_time + poll_period);
+    SYNC_TIMER_ReloadMs(DEVICE_SUBSCRIPTION_Update, 0, poll_period*SECONDS);
 }
 
 /*********************************************************************//**
@@ -375,12 +426,17 @@ void DEVICE_SUBSCRIPTION_ProcessAllOperationCompleteSubscriptions(char *command,
 {
     int i;
     subs_t *sub;
+    int_vector_t candidates;
 
-    // Iterate over all enabled subscriptions, processing each operation complete subscription that matches
+    // Find the enabled operation complete subscriptions which might match this operation
+    INT_VECTOR_Init(&candidates);
+    SUBS_INDEX_FindCandidates(&subs_index, &subscriptions, kSubNotifyType_OperationComplete, command, &candidates);
+
+    // Iterate over these subscriptions, processing each operation complete subscription that matches
     // (there may be more than one subscriber)
-    for (i=0; i < subscriptions.num_entries; i++)
+    for (i=0; i < candidates.num_entries; i++)
     {
-        sub = &subscriptions.vector[i];
+        sub = &subscriptions.vector[ candidates.vector[i] ];
         if ((sub->enable) && (sub->notify_type == kSubNotifyType_OperationComplete))
         {
             // Send the event, if it matches this subscription
@@ -390,6 +446,8 @@ void DEVICE_SUBSCRIPTION_ProcessAllOperationCompleteSubscriptions(char *command,
             }
         }
     }
+
+    INT_VECTOR_Destroy(&candidates);
 }
 
 /*********************************************************************//**
@@ -409,6 +467,7 @@ void DEVICE_SUBSCRIPTION_ProcessAllEventCompleteSubscriptions(char *event_name,
     int i;
     subs_t *sub;
     Usp__Msg *req;
+    int_vector_t candidates;
 
 #ifdef VALIDATE_OUTPUT_ARG_NAMES
     if (output_args != NULL)
@@ -430,11 +489,15 @@ void DEVICE_SUBSCRIPTION_ProcessAllEventCompleteSubscriptions(char *event_name,
     }
 #endif
 
-    // Iterate over all enabled subscriptions, processing each event complete subscription that matches
+    // Find the enabled event subscriptions which might match this event
+    INT_VECTOR_Init(&candidates);
+    SUBS_INDEX_FindCandidates(&subs_index, &subscriptions, kSubNotifyType_Event, event_name, &candidates);
+
+    // Iterate over these subscriptions, processing each event complete subscription that matches
     // (there may be more than one subscriber)
-    for (i=0; i < subscriptions.num_entries; i++)
+    for (i=0; i < candidates.num_entries; i++)
     {
-        sub = &subscriptions.vector[i];
+        sub = &subscriptions.vector[ candidates.vector[i] ];
         if ((sub->enable) && (sub->notify_type == kSubNotifyType_Event))
         {
             // Send the event, if it matches this subscription
@@ -449,6 +512,8 @@ void DEVICE_SUBSCRIPTION_ProcessAllEventCompleteSubscriptions(char *event_name,
             }
         }
     }
+
+    INT_VECTOR_Destroy(&candidates);
 }
 
 /*********************************************************************//**
@@ -552,18 +617,37 @@ void DEVICE_SUBSCRIPTION_ProcessAllObjectLifeEventSubscriptions(void)
     int i;
     subs_t *sub;
     obj_life_event_t *ole;
+    int_vector_t candidates;
 
-    // Iterate over all enabled subscriptions
-    for (i=0; i < subscriptions.num_entries; i++)
+    // Find the enabled object life event subscriptions which might match any of the recent object life events
+    INT_VECTOR_Init(&candidates);
+    for (i=0; i < object_life_events.num_entries; i++)
+    {
+        ole = &object_life_events.vector[i];
+        SUBS_INDEX_FindCandidates(&subs_index, &subscriptions, ole->notify_type, ole->obj_path, &candidates);
+    }
+
+    // Iterate over these subscriptions
+    for (i=0; i < candidates.num_entries; i++)
     {
         // See if this subscription is active, and is an object life event notification
-        sub = &subscriptions.vector[i];
+        sub = &subscriptions.vector[ candidates.vector[i] ];
         if ( (sub->enable) &&
              ((sub->notify_type == kSubNotifyType_ObjectCreation) || (sub->notify_type == kSubNotifyType_ObjectDeletion)) )
         {
             ProcessObjectLifeEventSubscription(sub);
         }
     }
+    INT_VECTOR_Destroy(&candidates);
+
+    // Free the paths resolved by DEVICE_SUBSCRIPTION_ResolveObjectDeletionPaths() for subscriptions that did not match any object life event
+    if (object_deletion_paths_resolved)
+    {
+        for (i=0; i < subscriptions.num_entries; i++)
+        {
+            STR_VECTOR_Destroy(&subscriptions.vector[i].resolved_paths);
+        }
+    }
 
     // Clear the list of object life events, since we have queued any notification messages which they matched
     for (i=0; i < object_life_events.num_entries; i++)
@@ -597,14 +681,19 @@ void DEVICE_SUBSCRIPTION_SendPeriodicEvent(int cont_instance)
     subs_t *sub;
     Usp__Msg *req;
     kv_vector_t output_args;
+    int_vector_t candidates;
 
     // Output arguments for the Periodic event are empty
     KV_VECTOR_Init(&output_args);
 
-    // Iterate over all enabled subscriptions, finding all enabled periodic subscriptions for the specified controller
-    for (i=0; i < subscriptions.num_entries; i++)
+    // Find the enabled event subscriptions which might match the periodic event
+    INT_VECTOR_Init(&candidates);
+    SUBS_INDEX_FindCandidates(&subs_index, &subscriptions, kSubNotifyType_Event, (char *)periodic_event_str, &candidates);
+
+    // Iterate over these subscriptions, finding all enabled periodic subscriptions for the specified controller
+    for (i=0; i < candidates.num_entries; i++)
     {
-        sub = &subscriptions.vector[i];
+        sub = &subscriptions.vector[ candidates.vector[i] ];
         if ((sub->enable) && (sub->notify_type == kSubNotifyType_Event) &&
             (sub->cont_instance == cont_instance))
         {
@@ -620,6 +709,7 @@ void DEVICE_SUBSCRIPTION_SendPeriodicEvent(int cont_instance)
             }
         }
     }
+    INT_VECTOR_Destroy(&candidates);
 }
 
 /*********************************************************************//**
@@ -655,7 +745,7 @@ void DEVICE_SUBSCRIPTION_NotifyControllerDeleted(int cont_instance)
 **
 ** DEVICE_SUBSCRIPTION_Dump
 **
-** Convenience function to dump out the internal subscriptions vector
+** Convenience function to dump out the internal subscriptions vector, and the notification retry statistics
 **
 ** \param   None
 **
@@ -665,6 +755,7 @@ void DEVICE_SUBSCRIPTION_NotifyControllerDeleted(int cont_instance)
 void DEVICE_SUBSCRIPTION_Dump(void)
 {
     SUBS_VECTOR_Dump(&subscriptions);
+    SUBS_RETRY_Dump();
 }
 
 /*********************************************************************//**
@@ -756,6 +847,14 @@ int ProcessSubscriptionAdded(int instance)
         goto exit;
     }
 
+    // Get X_BBF_CoalescePeriod
+    USP_SNPRINTF(path, sizeof(path), "%s.%d.X_BBF_CoalescePeriod", device_subs_root, instance);
+    err = DM_ACCESS_GetUnsigned(path, &sub.coalesce_period);
+    if (err != USP_ERR_OK)
+    {
+        goto exit;
+    }
+
     // Get ReferenceList
     USP_SNPRINTF(path, sizeof(path), "%s.%d.ReferenceList", device_subs_root, instance);
     err = DM_ACCESS_GetStringVector(path, &sub.path_expressions);
@@ -781,13 +880,14 @@ exit:
         // Get the initial value of all parameters, if this is a value change subscription that has just been enabled
         if ((sub.enable==true) && (sub.notify_type == kSubNotifyType_ValueChange))
         {
-            GetAllPathExpressionParameterValues(&sub, &sub.path_expressions, &sub.last_values);
+            SeedValueChangeParams(&sub);
         }
 
         // We have successfully retrieved a subscription, so add it to the vector
         // NOTE: Ownership of the dynamically allocated memory referenced by the temp subscriber structure(sub) passes to the vector
         // So we do not have to call SUBS_VECTOR_DestroySubscriber(&sub)
         SUBS_VECTOR_Add(&subscriptions, &sub);
+        SUBS_INDEX_Invalidate(&subs_index);
     }
     else
     {
@@ -892,6 +992,7 @@ int NotifySubsDeleted(dm_req_t *req)
     {
         SUBS_RETRY_Delete(sub->instance);
         SUBS_VECTOR_Remove(&subscriptions, sub);
+        SUBS_INDEX_Invalidate(&subs_index);
     }
 
     return USP_ERR_OK;
@@ -920,11 +1021,12 @@ int NotifyChange_SubsEnable(dm_req_t *req, char *value)
     {
         cur_enable = sub->enable;
         sub->enable = val_bool;
+        SUBS_INDEX_Invalidate(&subs_index);
 
         // Get the initial value of all parameters, if this is a value change subscription that has just been enabled
         if ((cur_enable == false) && (val_bool == true) && (sub->notify_type == kSubNotifyType_ValueChange))
         {
-            GetAllPathExpressionParameterValues(sub, &sub->path_expressions, &sub->last_values);
+            SeedValueChangeParams(sub);
         }
     }
 
@@ -960,12 +1062,13 @@ int NotifyChange_NotifyType(dm_req_t *req, char *value)
     {
         cur_notify_type = sub->notify_type;
         sub->notify_type = new_notify_type;
+        SUBS_INDEX_Invalidate(&subs_index);
 
         // Get the initial value of all parameters, if this is an enabled subscription which has just changed to be a value change subscription
         if ((sub->enable == true) && (cur_notify_type != kSubNotifyType_ValueChange)
                                   && (new_notify_type == kSubNotifyType_ValueChange))
         {
-            GetAllPathExpressionParameterValues(sub, &sub->path_expressions, &sub->last_values);
+            SeedValueChangeParams(sub);
         }
 
     }
@@ -1026,6 +1129,8 @@ int NotifyChange_SubsRefList(dm_req_t *req, char *value)
     // Then add this new set of path expressions
     // These will take effect at the next poll interval
     TEXT_UTILS_SplitString(value, &sub->path_expressions, ",");
+    sub->vc_resolve_time_ms = 0;
+    SUBS_INDEX_Invalidate(&subs_index);
 
     return USP_ERR_OK;
 }
@@ -1125,6 +1230,35 @@ int NotifyChange_NotifExpiration(dm_req_t *req, char *value)
     return err;
 }
 
+/*********************************************************************//**
+**
+** NotifyChange_CoalescePeriod
+**
+** Function called when the X_BBF_CoalescePeriod for a subscription is changed
+**
+** \param   req - pointer to structure identifying the subscription
+** \param   value - new value of this parameter
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int NotifyChange_CoalescePeriod(dm_req_t *req, char *value)
+{
+    subs_t *sub;
+    int err;
+
+    // Determine which subscription this change affects
+    sub = SUBS_VECTOR_GetSubsByInstance(&subscriptions, inst1);
+    USP_ASSERT(sub != NULL);
+
+    // Update the coalesce period for this subscription.
+    // This will take effect the next time a value change is detected by this subscription
+    // NOTE: Any value changes already waiting to be sent, are sent at the end of the previous coalesce period
+    err = TEXT_UTILS_StringToUnsigned(value, &sub->coalesce_period);
+
+    return err;
+}
+
 /*********************************************************************//**
 **
 ** Validate_SubsID
@@ -1714,7 +1848,9 @@ exit:
 **
 ** ProcessAllValueChangeSubscriptions
 **
-** Called to Periodically poll all value change notifications
+** Processes all value change subscriptions, sending a notification for each monitored parameter whose value has changed
+** Only parameters which have been set since last time, or which are due to be polled, are checked
+** Then restarts the timer to call this function again when the next parameter is due to be polled
 **
 ** \param   None
 **
@@ -1725,16 +1861,48 @@ void ProcessAllValueChangeSubscriptions(void)
 {
     int i;
     subs_t *sub;
+    uint64_t cur_time_ms;
+    uint64_t next_time_ms;
+    uint64_t time_ms;
 
     // Iterate over all enabled subscriptions, processing each value change subscription
+    cur_time_ms = tu_uptime_msecs64();
+    next_time_ms = cur_time_ms + VALUE_CHANGE_POLL_PERIOD*SECONDS;
     for (i=0; i < subscriptions.num_entries; i++)
     {
         sub = &subscriptions.vector[i];
         if ((sub->enable) && (sub->notify_type == kSubNotifyType_ValueChange))
         {
-            ProcessValueChangeSubscription(sub);
+            time_ms = ProcessValueChangeSubscription(sub, cur_time_ms);
+            next_time_ms = MIN(next_time_ms, time_ms);
         }
     }
+
+    // All changed parameters have now been checked against all subscriptions
+    ClearChangedParams();
+    is_value_change_started = true;
+
+    // Restart the timer to call this function when the next parameter is due to be polled
+    time_ms = (next_time_ms > cur_time_ms) ? next_time_ms - cur_time_ms : 0;
+    SYNC_TIMER_ReloadMs(ValueChangeExec, 0, (unsigned) time_ms);
+    value_change_exec_ms = cur_time_ms + time_ms;
+}
+
+/*********************************************************************//**
+**
+** ValueChangeExec
+**
+** Timer callback which processes all value change subscriptions
+** It is called when parameters are due to be polled, and as soon as possible after a parameter has been set
+**
+** \param   id - (unused) identifier of the sync timer which caused this callback
+**
+** \return  None
+**
+**************************************************************************/
+void ValueChangeExec(int id)
+{
+    ProcessAllValueChangeSubscriptions();
 }
 
 /*********************************************************************//**
@@ -1742,55 +1910,494 @@ void ProcessAllValueChangeSubscriptions(void)
 ** ProcessValueChangeSubscription
 **
 ** Processes one enabled subscription for value change
+** Parameters that are polled are only got if they are due to be polled
+** Parameters that are not polled are only got if they have been set since the last time
 **
-** \param   sub - pointer to subscription to poll
+** \param   sub - pointer to subscription to process
+** \param   cur_time_ms - current monotonic time (in ms)
 **
-** \return  None
+** \return  monotonic time (in ms) at which this subscription next needs to be processed (if none of its parameters are set)
 **
 **************************************************************************/
-void ProcessValueChangeSubscription(subs_t *sub)
+uint64_t ProcessValueChangeSubscription(subs_t *sub, uint64_t cur_time_ms)
 {
     int i;
-    kv_vector_t cur_values;
-    kv_pair_t *pair;
     int index;
-    int hint_index;
+    vc_param_t *vp;
+    kv_pair_t *pair;
+    group_get_entry_t *gge;
+    group_get_vector_t ggv;
+    int_vector_t indexes;
+    bool is_due;
     char *value;
+    uint64_t next_time_ms;
+
+    // Resolve the path expressions again, if the set of parameters which they reference may have changed
+    // NOTE: Setting a parameter may change the result of a search expression
+    if ((sub->vc_generation != PATH_RESOLVER_GetGeneration()) || (cur_time_ms >= sub->vc_resolve_time_ms) ||
+        ((num_changed_params > 0) && (DoesSubscriptionUseSearchExpressions(sub))))
+    {
+        ResolveValueChangeParams(sub, cur_time_ms);
+    }
 
-    // Get the current values of all parameters associated with this subscription
-    GetAllPathExpressionParameterValues(sub, &sub->path_expressions, &cur_values);
+    // Form the list of parameters whose value needs to be got
+    // NOTE: indexes contains the index in last_values of each parameter in the group get vector
+    GROUP_GET_VECTOR_Init(&ggv);
+    INT_VECTOR_Init(&indexes);
+    next_time_ms = sub->vc_resolve_time_ms;
+    for (i=0; i < sub->last_values.num_entries; i++)
+    {
+        vp = &sub->vc_params[i];
+        if (vp->poll_period_ms == 0)
+        {
+            is_due = IsChangedParam(vp->hash, &vp->inst);
+        }
+        else
+        {
+            is_due = (cur_time_ms >= vp->next_poll_ms);
+            if (is_due)
+            {
+                vp->next_poll_ms = cur_time_ms + vp->poll_period_ms;
+            }
+            next_time_ms = MIN(next_time_ms, vp->next_poll_ms);
+        }
+
+        if (is_due)
+        {
+            GROUP_GET_VECTOR_Add(&ggv, sub->last_values.vector[i].key, vp->group_id);
+            INT_VECTOR_Add(&indexes, i);
+        }
+    }
+
+    // Exit if no parameters need to be got
+    if (ggv.num_entries == 0)
+    {
+        goto exit;
+    }
+
+    // Get the values of the parameters
+    GROUP_GET_VECTOR_GetValues(&ggv);
 
     // Determine whether any of the values have changed from last time
+    for (i=0; i < ggv.num_entries; i++)
+    {
+        gge = &ggv.vector[i];
+        index = indexes.vector[i];
+        pair = &sub->last_values.vector[index];
+
+        // Intentionally ignoring errors that occurred whilst getting the value by treating the value as an empty string
+        value = ((gge->value != NULL) && (gge->err_code == USP_ERR_OK) && (gge->err_msg == NULL)) ? gge->value : "";
+        if (strcmp(pair->value, value) != 0)
+        {
+            // The value has changed since last time, so send a Value Change NotifyRequest
+            QueueValueChangeNotify(sub, pair->key, value, cur_time_ms);
+
+            // Replace the last value with the current value
+            USP_FREE(pair->value);
+            pair->value = USP_STRDUP(value);
+        }
+    }
+
+exit:
+    GROUP_GET_VECTOR_Destroy(&ggv);
+    INT_VECTOR_Destroy(&indexes);
+
+    // Send all value changes which have been coalesced, if the coalesce period has ended
+    if (sub->pending_notifies.num_entries > 0)
+    {
+        if (cur_time_ms >= sub->coalesce_end_ms)
+        {
+            SendPendingValueChangeNotifies(sub);
+        }
+        else
+        {
+            next_time_ms = MIN(next_time_ms, sub->coalesce_end_ms);
+        }
+    }
+
+    return next_time_ms;
+}
+
+/*********************************************************************//**
+**
+** ResolveValueChangeParams
+**
+** Resolves the path expressions of a value change subscription, updating the list of parameters which it monitors
+** Parameters which were previously monitored keep their last value (and when they are next due to be polled)
+** The initial value of parameters which were not previously monitored is got, but does not trigger a value change
+**
+** \param   sub - pointer to subscription
+** \param   cur_time_ms - current monotonic time (in ms)
+**
+** \return  None
+**
+**************************************************************************/
+void ResolveValueChangeParams(subs_t *sub, uint64_t cur_time_ms)
+{
+    int i;
+    int index;
+    int hint_index;
+    int err;
+    str_vector_t params;
+    int_vector_t group_ids;
+    kv_vector_t cur_values;
+    vc_param_t *cur_vc_params;
+    vc_param_t *vp;
+    kv_pair_t *pair;
+    group_get_entry_t *gge;
+    group_get_vector_t ggv;
+    int_vector_t indexes;
+    dm_hash_t hash;
+    unsigned poll_period;
+
+    // Form a vector list containing all the parameters to monitor (and their associated group_id)
+    ResolveAllPathExpressions(sub->instance, &sub->path_expressions, &params, &group_ids, kResolveOp_SubsValChange, sub->cont_instance);
+    sub->vc_generation = PATH_RESOLVER_GetGeneration();
+    sub->vc_resolve_time_ms = cur_time_ms + VALUE_CHANGE_POLL_PERIOD*SECONDS;
+
+    // Form the new list of parameters, moving across the state of the parameters which were previously monitored
+    // NOTE: indexes contains the index in cur_values of each parameter which was not previously monitored
+    cur_values.num_entries = params.num_entries;
+    cur_values.vector = USP_MALLOC(params.num_entries*sizeof(kv_pair_t));
+    cur_vc_params = USP_MALLOC(params.num_entries*sizeof(vc_param_t));
+    GROUP_GET_VECTOR_Init(&ggv);
+    INT_VECTOR_Init(&indexes);
     hint_index = 0;
-    for (i=0; i < cur_values.num_entries; i++)
+    for (i=0; i < params.num_entries; i++)
     {
         pair = &cur_values.vector[i];
+        vp = &cur_vc_params[i];
+        pair->key = params.vector[i];       // NOTE: Ownership of the string passes to cur_values
 
         // Find the index in the last_values vector matching this parameter
         // NOTE: We pass in a hint based on where we expect to find the matching parameter
         // This hint will be a perfect match if the list of parameters generated by the path expressions have not changed since last time
         index = KV_VECTOR_FindKey(&sub->last_values, pair->key, hint_index);
-        if (index != INVALID)
+        if ((index != INVALID) && (sub->last_values.vector[index].value != NULL))
         {
-            hint_index = index + 1;         // Calculate index for next hint
-            value = sub->last_values.vector[index].value;
-
-            if (strcmp(value, pair->value) != 0)
+            pair->value = sub->last_values.vector[index].value;
+            sub->last_values.vector[index].value = NULL;
+            memcpy(vp, &sub->vc_params[index], sizeof(vc_param_t));
+            vp->group_id = group_ids.vector[i];
+            hint_index = index + 1;
+        }
+        else
+        {
+            // Determine how changes to this parameter are detected
+            // NOTE: If an error occurs, then just poll the parameter
+            err = DATA_MODEL_GetValueChangeInfo(pair->key, &hash, &vp->inst, &poll_period);
+            if (err != USP_ERR_OK)
             {
-                // The value has changed since last time, so send a Value Change NotifyRequest
-                SendValueChangeNotify(sub, pair->key, pair->value);
+                hash = 0;
+                memset(&vp->inst, 0, sizeof(vp->inst));
+                poll_period = VALUE_CHANGE_POLL_PERIOD;
             }
+
+            pair->value = NULL;
+            vp->hash = hash;
+            vp->group_id = group_ids.vector[i];
+            vp->poll_period_ms = poll_period*SECONDS;
+            vp->next_poll_ms = cur_time_ms + vp->poll_period_ms;
+
+            GROUP_GET_VECTOR_Add(&ggv, pair->key, vp->group_id);
+            INT_VECTOR_Add(&indexes, i);
+        }
+    }
+
+    // Get the initial value of all parameters which were not previously monitored
+    GROUP_GET_VECTOR_GetValues(&ggv);
+    for (i=0; i < ggv.num_entries; i++)
+    {
+        gge = &ggv.vector[i];
+        pair = &cur_values.vector[ indexes.vector[i] ];
+
+        // Intentionally ignoring errors that occurred whilst getting the value by using an empty string instead
+        if ((gge->value != NULL) && (gge->err_code == USP_ERR_OK) && (gge->err_msg == NULL))
+        {
+            pair->value = gge->value;
+            gge->value = NULL;
         }
         else
         {
-            // If we do not have a value for the parameter from last time, then this does not trigger a value change
+            pair->value = USP_STRDUP("");
         }
-
     }
 
-    // Finally, replace the last set of values with the current set
+    // Replace the previous list of parameters with the new list
     KV_VECTOR_Destroy(&sub->last_values);
+    USP_SAFE_FREE(sub->vc_params);
     memcpy(&sub->last_values, &cur_values, sizeof(kv_vector_t));
+    sub->vc_params = cur_vc_params;
+
+    // Clean up
+    USP_SAFE_FREE(params.vector);       // NOTE: The strings in the vector are owned by last_values
+    INT_VECTOR_Destroy(&group_ids);
+    GROUP_GET_VECTOR_Destroy(&ggv);
+    INT_VECTOR_Destroy(&indexes);
+}
+
+/*********************************************************************//**
+**
+** SeedValueChangeParams
+**
+** Determines the parameters monitored by a value change subscription and their initial values
+** Called when a value change subscription is enabled
+** If any of the parameters are due to be polled before the ValueChangeExec timer next fires, then the timer is brought forward
+**
+** \param   sub - pointer to subscription
+**
+** \return  None
+**
+**************************************************************************/
+void SeedValueChangeParams(subs_t *sub)
+{
+    int i;
+    vc_param_t *vp;
+    uint64_t cur_time_ms;
+    uint64_t next_time_ms;
+
+    // Forget any previously monitored parameters, and any value changes from when the subscription was last enabled
+    KV_VECTOR_Destroy(&sub->last_values);
+    USP_SAFE_FREE(sub->vc_params);
+    KV_VECTOR_Destroy(&sub->pending_notifies);
+
+    cur_time_ms = tu_uptime_msecs64();
+    ResolveValueChangeParams(sub, cur_time_ms);
+
+    // Exit if value change subscriptions have not started to be processed yet. In this case, the timer is started when they are
+    if (is_value_change_started == false)
+    {
+        return;
+    }
+
+    // Determine when the first of this subscription's polled parameters is due to be polled
+    next_time_ms = value_change_exec_ms;
+    for (i=0; i < sub->last_values.num_entries; i++)
+    {
+        vp = &sub->vc_params[i];
+        if (vp->poll_period_ms != 0)
+        {
+            next_time_ms = MIN(next_time_ms, vp->next_poll_ms);
+        }
+    }
+
+    // Bring the ValueChangeExec timer forward, if necessary
+    if (next_time_ms < value_change_exec_ms)
+    {
+        SYNC_TIMER_ReloadMs(ValueChangeExec, 0, (next_time_ms > cur_time_ms) ? (unsigned)(next_time_ms - cur_time_ms) : 0);
+        value_change_exec_ms = next_time_ms;
+    }
+}
+
+/*********************************************************************//**
+**
+** DoesSubscriptionUseSearchExpressions
+**
+** Determines whether any of the path expressions of a subscription contain a search expression
+** The parameters referenced by these path expressions may change when a parameter is set
+**
+** \param   sub - pointer to subscription
+**
+** \return  true if any of the path expressions contains a search expression
+**
+**************************************************************************/
+bool DoesSubscriptionUseSearchExpressions(subs_t *sub)
+{
+    int i;
+
+    for (i=0; i < sub->path_expressions.num_entries; i++)
+    {
+        if (strchr(sub->path_expressions.vector[i], '[') != NULL)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*********************************************************************//**
+**
+** DEVICE_SUBSCRIPTION_NotifyParamValueChange
+**
+** Called when a parameter has been set, to add it to the set of parameters which value change subscriptions must check
+** NOTE: Only parameters which are not polled need to be notified, but it is harmless to notify any parameter
+**
+** \param   hash - hash of the schema path of the parameter (dm_hash_t)
+** \param   inst - pointer to instance numbers in the path of the parameter
+**
+** \return  None
+**
+**************************************************************************/
+void DEVICE_SUBSCRIPTION_NotifyParamValueChange(unsigned hash, dm_req_instances_t *inst)
+{
+    unsigned index;
+    changed_param_t *cp;
+
+    // Exit if this parameter has already been notified
+    if (IsChangedParam(hash, inst))
+    {
+        return;
+    }
+
+    // Grow the hash table, if adding this entry would make it more than half full
+    if ((num_changed_params+1)*2 > changed_params_size)
+    {
+        GrowChangedParams();
+    }
+
+    // Probe for the first free slot, starting at the slot which this parameter hashes to
+    index = CalcChangedParamHash(hash, inst) & (changed_params_size - 1);
+    while (changed_params[index].is_used)
+    {
+        index = (index + 1) & (changed_params_size - 1);
+    }
+
+    cp = &changed_params[index];
+    cp->is_used = true;
+    cp->hash = hash;
+    memcpy(&cp->inst, inst, sizeof(dm_req_instances_t));
+    num_changed_params++;
+
+    // Process the value change subscriptions as soon as possible (after the current USP message has been processed)
+    if ((is_value_change_started) && (num_changed_params == 1))
+    {
+        SYNC_TIMER_ReloadMs(ValueChangeExec, 0, 0);
+        value_change_exec_ms = tu_uptime_msecs64();
+    }
+}
+
+/*********************************************************************//**
+**
+** IsChangedParam
+**
+** Determines whether the specified parameter has been set since the value change subscriptions were last processed
+**
+** \param   hash - hash of the schema path of the parameter (dm_hash_t)
+** \param   inst - pointer to instance numbers in the path of the parameter
+**
+** \return  true if the parameter has been set
+**
+**************************************************************************/
+bool IsChangedParam(unsigned hash, dm_req_instances_t *inst)
+{
+    unsigned index;
+    changed_param_t *cp;
+
+    // Exit if no parameters have been set
+    if (num_changed_params == 0)
+    {
+        return false;
+    }
+
+    // Probe from the slot which this parameter hashes to, until either the parameter or a free slot is found
+    index = CalcChangedParamHash(hash, inst) & (changed_params_size - 1);
+    while (1)
+    {
+        cp = &changed_params[index];
+        if (cp->is_used == false)
+        {
+            return false;
+        }
+
+        if ((cp->hash == hash) && (cp->inst.order == inst->order) &&
+            (memcmp(cp->inst.instances, inst->instances, inst->order*sizeof(int)) == 0))
+        {
+            return true;
+        }
+
+        index = (index + 1) & (changed_params_size - 1);
+    }
+}
+
+/*********************************************************************//**
+**
+** CalcChangedParamHash
+**
+** Calculates the hash used to index the changed parameters hash table
+**
+** \param   hash - hash of the schema path of the parameter (dm_hash_t)
+** \param   inst - pointer to instance numbers in the path of the parameter
+**
+** \return  hash of the parameter's schema path combined with its instance numbers
+**
+**************************************************************************/
+unsigned CalcChangedParamHash(unsigned hash, dm_req_instances_t *inst)
+{
+    int i;
+
+    for (i=0; i < inst->order; i++)
+    {
+        hash = (hash * 31) + (unsigned) inst->instances[i];
+    }
+
+    // Mix the bits, so that the low order bits used to index the hash table depend on all bits of the hash
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/*********************************************************************//**
+**
+** GrowChangedParams
+**
+** Doubles the number of slots in the changed parameters hash table, rehashing all entries into the new table
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void GrowChangedParams(void)
+{
+    changed_param_t *old_table;
+    unsigned old_size;
+    unsigned i;
+    unsigned index;
+
+    old_table = changed_params;
+    old_size = changed_params_size;
+    changed_params_size = (old_size == 0) ? MIN_CHANGED_PARAMS_SLOTS : 2*old_size;
+    changed_params = USP_MALLOC(changed_params_size*sizeof(changed_param_t));
+    memset(changed_params, 0, changed_params_size*sizeof(changed_param_t));
+
+    // Rehash all entries from the old table into the new table
+    for (i=0; i < old_size; i++)
+    {
+        if (old_table[i].is_used)
+        {
+            index = CalcChangedParamHash(old_table[i].hash, &old_table[i].inst) & (changed_params_size - 1);
+            while (changed_params[index].is_used)
+            {
+                index = (index + 1) & (changed_params_size - 1);
+            }
+            changed_params[index] = old_table[i];
+        }
+    }
+
+    USP_SAFE_FREE(old_table);
+}
+
+/*********************************************************************//**
+**
+** ClearChangedParams
+**
+** Empties the set of changed parameters, once they have been checked against all value change subscriptions
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void ClearChangedParams(void)
+{
+    if (num_changed_params > 0)
+    {
+        memset(changed_params, 0, changed_params_size*sizeof(changed_param_t));
+        num_changed_params = 0;
+    }
 }
 
 /*********************************************************************//**
@@ -1914,6 +2521,71 @@ void SendValueChangeNotify(subs_t *sub, char *path, char *value)
     usp__msg__free_unpacked(req, pbuf_allocator);
 }
 
+/*********************************************************************//**
+**
+** QueueValueChangeNotify
+**
+** Sends a ValueChange notify request message, or if the subscription has a coalesce period,
+** queues the value change until the end of the coalesce period
+** If the same parameter changes more than once during the coalesce period, only its latest value is sent
+**
+** \param   sub - pointer to value change subscription
+** \param   path - path of the data model parameter that changed
+** \param   value - new value of the data model parameter
+** \param   cur_time_ms - current monotonic time (in ms)
+**
+** \return  None
+**
+**************************************************************************/
+void QueueValueChangeNotify(subs_t *sub, char *path, char *value, uint64_t cur_time_ms)
+{
+    // Send the notification immediately, if this subscription does not coalesce value changes
+    if ((sub->coalesce_period == 0) && (sub->pending_notifies.num_entries == 0))
+    {
+        SendValueChangeNotify(sub, path, value);
+        return;
+    }
+
+    // Start the coalesce period, if this is the first value change in it
+    if (sub->pending_notifies.num_entries == 0)
+    {
+        sub->coalesce_end_ms = cur_time_ms + sub->coalesce_period;
+    }
+
+    // Replace the value of this parameter if it has already changed during the coalesce period, otherwise add it
+    if (KV_VECTOR_Replace(&sub->pending_notifies, path, value) == false)
+    {
+        KV_VECTOR_Add(&sub->pending_notifies, path, value);
+    }
+}
+
+/*********************************************************************//**
+**
+** SendPendingValueChangeNotifies
+**
+** Sends all value changes coalesced by the specified subscription, back-to-back in the order that the parameters first changed
+** NOTE: Each value change is sent in its own NotifyRequest, as a USP ValueChange notification only contains a single parameter
+**
+** \param   sub - pointer to value change subscription
+**
+** \return  None
+**
+**************************************************************************/
+void SendPendingValueChangeNotifies(subs_t *sub)
+{
+    int i;
+    kv_pair_t *pair;
+
+    USP_LOG_Info("Sending %d coalesced ValueChange notifications for %s.%d", sub->pending_notifies.num_entries, device_subs_root, sub->instance);
+    for (i=0; i < sub->pending_notifies.num_entries; i++)
+    {
+        pair = &sub->pending_notifies.vector[i];
+        SendValueChangeNotify(sub, pair->key, pair->value);
+    }
+
+    KV_VECTOR_Destroy(&sub->pending_notifies);
+}
+
 /*********************************************************************//**
 **
 ** SendBootNotify
@@ -2208,7 +2880,10 @@ void SendNotify(Usp__Msg *req, subs_t *sub, char *path)
 void SeedLastValueChangeValues(void)
 {
     int i;
+    int index;
     subs_t *sub;
+    kv_pair_t *pair;
+    vc_param_t *vp;
     reboot_info_t info;
 
     // Get the last software version
@@ -2221,7 +2896,21 @@ void SeedLastValueChangeValues(void)
         sub = &subscriptions.vector[i];
         if ((sub->enable) && (sub->notify_type == kSubNotifyType_ValueChange))
         {
-            KV_VECTOR_Replace(&sub->last_values, "Device.DeviceInfo.SoftwareVersion", info.last_software_version);
+            index = KV_VECTOR_FindKey(&sub->last_values, "Device.DeviceInfo.SoftwareVersion", 0);
+            if (index != INVALID)
+            {
+                pair = &sub->last_values.vector[index];
+                USP_FREE(pair->value);
+                pair->value = USP_STRDUP(info.last_software_version);
+
+                // Ensure that the value is checked when the value change subscriptions are first processed
+                vp = &sub->vc_params[index];
+                vp->next_poll_ms = 0;
+                if (vp->poll_period_ms == 0)
+                {
+                    DEVICE_SUBSCRIPTION_NotifyParamValueChange(vp->hash, &vp->inst);
+                }
+            }
         }
     }
 }
@@ -639,6 +639,26 @@ int DM_ACCESS_ValidateIpAddr(dm_req_t *req, char *value)
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** DM_ACCESS_InitExprConst
+**
+** Initialises the structure holding a constant in a search expression, ready for use by the DM_ACCESS_CompareXXX() functions
+**
+** \param   rhs - pointer to structure to initialise
+** \param   value - constant in the search expression, as a string. NOTE: This must exist for the lifetime of the structure
+**
+** \return  None
+**
+**************************************************************************/
+void DM_ACCESS_InitExprConst(expr_const_t *rhs, char *value)
+{
+    rhs->value = value;
+    rhs->number_err = INVALID;
+    rhs->bool_err = INVALID;
+    rhs->datetime_err = INVALID;
+}
+
 /*********************************************************************//**
 **
 ** DM_ACCESS_CompareString
@@ -647,13 +667,13 @@ int DM_ACCESS_ValidateIpAddr(dm_req_t *req, char *value)
 **
 ** \param   lhs - string representing the left hand operand to compare
 ** \param   op - operator to use when comparing the values
-** \param   rhs - string representing the right hand operand to compare
+** \param   rhs - pointer to structure containing the right hand operand to compare
 ** \param   result - pointer to boolean in which to return whether the comparison matched or not
 **
 ** \return  USP_ERR_OK if validated successfully
 **
 **************************************************************************/
-int DM_ACCESS_CompareString(char *lhs, expr_op_t op, char *rhs, bool *result)
+int DM_ACCESS_CompareString(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result)
 {
     int err;
 
@@ -662,14 +682,14 @@ int DM_ACCESS_CompareString(char *lhs, expr_op_t op, char *rhs, bool *result)
     switch(op)
     {
         case kExprOp_Equal:
-            if (strcmp(lhs, rhs)==0)
+            if (strcmp(lhs, rhs->value)==0)
             {
                 *result = true;
             }
             break;
 
         case kExprOp_NotEqual:
-            if (strcmp(lhs, rhs)!=0)
+            if (strcmp(lhs, rhs->value)!=0)
             {
                 *result = true;
             }
@@ -700,13 +720,13 @@ int DM_ACCESS_CompareString(char *lhs, expr_op_t op, char *rhs, bool *result)
 **
 ** \param   lhs - string representing the left hand operand to compare
 ** \param   op - operator to use when comparing the values
-** \param   rhs - string representing the right hand operand to compare
+** \param   rhs - pointer to structure containing the right hand operand to compare. The conversion of the operand is cached in this structure
 ** \param   result - pointer to boolean in which to return whether the comparison matched or not
 **
 ** \return  USP_ERR_OK if validated successfully
 **
 **************************************************************************/
-int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, char *rhs, bool *result)
+int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result)
 {
     long double lh_value;
     long double rh_value;
@@ -724,13 +744,20 @@ int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, char *rhs, bool *result)
 
     // Exit if the right hand operand could not be converted
     // NOTE: This could occur if the search expression contained errors in it
-    num_converted = sscanf(rhs, "%Lf", &rh_value);
-    if (num_converted == 0)
+    // NOTE: The right hand operand is only converted the first time that it is compared as a number
+    if (rhs->number_err == INVALID)
     {
-        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be a number", __FUNCTION__, rhs);
-        return USP_ERR_INVALID_PATH_SYNTAX;
+        num_converted = sscanf(rhs->value, "%Lf", &rhs->number);
+        rhs->number_err = (num_converted == 0) ? USP_ERR_INVALID_PATH_SYNTAX : USP_ERR_OK;
     }
 
+    if (rhs->number_err != USP_ERR_OK)
+    {
+        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be a number", __FUNCTION__, rhs->value);
+        return rhs->number_err;
+    }
+    rh_value = rhs->number;
+
     *result = false;    // Assume that comparison failed to match
     err = USP_ERR_OK;   // Assume that comparison operator was valid
     switch(op)
@@ -793,13 +820,13 @@ int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, char *rhs, bool *result)
 **
 ** \param   lhs - string representing the left hand operand to compare
 ** \param   op - operator to use when comparing the values
-** \param   rhs - string representing the right hand operand to compare
+** \param   rhs - pointer to structure containing the right hand operand to compare. The conversion of the operand is cached in this structure
 ** \param   result - pointer to boolean in which to return whether the comparison matched or not
 **
 ** \return  USP_ERR_OK if validated successfully
 **
 **************************************************************************/
-int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, char *rhs, bool *result)
+int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result)
 {
     bool lh_value;
     bool rh_value;
@@ -816,12 +843,18 @@ int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, char *rhs, bool *result)
 
     // Exit if the right hand operand could not be converted
     // NOTE: This could occur if the search expression contained errors in it
-    err = TEXT_UTILS_StringToBool(rhs, &rh_value);
-    if (err != USP_ERR_OK)
+    // NOTE: The right hand operand is only converted the first time that it is compared as a boolean
+    if (rhs->bool_err == INVALID)
     {
-        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be a boolean", __FUNCTION__, rhs);
+        rhs->bool_err = TEXT_UTILS_StringToBool(rhs->value, &rhs->boolean);
+    }
+
+    if (rhs->bool_err != USP_ERR_OK)
+    {
+        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be a boolean", __FUNCTION__, rhs->value);
         return USP_ERR_INVALID_PATH_SYNTAX;
     }
+    rh_value = rhs->boolean;
 
     *result = false;    // Assume that comparison failed to match
     err = USP_ERR_OK;   // Assume that comparison operator was valid
@@ -865,13 +898,13 @@ int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, char *rhs, bool *result)
 **
 ** \param   lhs - string representing the left hand operand to compare
 ** \param   op - operator to use when comparing the values
-** \param   rhs - string representing the right hand operand to compare
+** \param   rhs - pointer to structure containing the right hand operand to compare. The conversion of the operand is cached in this structure
 ** \param   result - pointer to boolean in which to return whether the comparison matched or not
 **
 ** \return  USP_ERR_OK if validated successfully
 **
 **************************************************************************/
-int DM_ACCESS_CompareDateTime(char *lhs, expr_op_t op, char *rhs, bool *result)
+int DM_ACCESS_CompareDateTime(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result)
 {
     time_t lh_value;
     time_t rh_value;
@@ -888,12 +921,18 @@ int DM_ACCESS_CompareDateTime(char *lhs, expr_op_t op, char *rhs, bool *result)
 
     // Exit if the right hand operand could not be converted
     // NOTE: This could occur if the search expression contained errors in it
-    err = TEXT_UTILS_StringToDateTime(rhs, &rh_value);
-    if (err != USP_ERR_OK)
+    // NOTE: The right hand operand is only converted the first time that it is compared as a dateTime
+    if (rhs->datetime_err == INVALID)
+    {
+        rhs->datetime_err = TEXT_UTILS_StringToDateTime(rhs->value, &rhs->datetime);
+    }
+
+    if (rhs->datetime_err != USP_ERR_OK)
     {
-        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be an ISO8601 dateTime", __FUNCTION__, rhs);
+        USP_ERR_SetMessage("%s: Expecting expression constant ('%s') to be an ISO8601 dateTime", __FUNCTION__, rhs->value);
         return USP_ERR_INVALID_PATH_SYNTAX;
     }
+    rh_value = rhs->datetime;
 
     *result = false;    // Assume that comparison failed to match
     err = USP_ERR_OK;   // Assume that comparison operator was valid
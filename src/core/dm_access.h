@@ -49,6 +49,21 @@
 // The prefix to use when forming the default value of an Alias parameter
 #define DEFAULT_ALIAS_PREFIX "cpe-"
 
+//-------------------------------------------------------------------------
+// Constant in a search expression, compared against the values of many object instances by the DM_ACCESS_CompareXXX() functions
+// The constant is converted at most once to each type it is compared as, rather than once per instance
+// NOTE: The type of a key parameter can differ between instances if the key follows a reference, hence each conversion is cached separately
+typedef struct
+{
+    char *value;            // Constant, as a string. NOTE: This is not owned by this structure
+    int number_err;         // Result of converting the constant to a number, or INVALID if not converted yet
+    long double number;     // Value of the constant as a number
+    int bool_err;           // Result of converting the constant to a boolean, or INVALID if not converted yet
+    bool boolean;           // Value of the constant as a boolean
+    int datetime_err;       // Result of converting the constant to a dateTime, or INVALID if not converted yet
+    time_t datetime;        // Value of the constant as a dateTime
+} expr_const_t;
+
 //-------------------------------------------------------------------------
 // API functions
 int DM_ACCESS_GetString(char *path, char **p_str);
@@ -71,10 +86,11 @@ int DM_ACCESS_ValidateRange_Signed(dm_req_t *req, int min_value, int max_value);
 int DM_ACCESS_ValidateReference(char *reference, char *table, int *instance);
 int DM_ACCESS_ValidateIpAddr(dm_req_t *req, char *value);
 
-int DM_ACCESS_CompareString(char *lhs, expr_op_t op, char *rhs, bool *result);
-int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, char *rhs, bool *result);
-int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, char *rhs, bool *result);
-int DM_ACCESS_CompareDateTime(char *lhs, expr_op_t op, char *rhs, bool *result);
+void DM_ACCESS_InitExprConst(expr_const_t *rhs, char *value);
+int DM_ACCESS_CompareString(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result);
+int DM_ACCESS_CompareNumber(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result);
+int DM_ACCESS_CompareBool(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result);
+int DM_ACCESS_CompareDateTime(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result);
 int DM_ACCESS_RestartAsyncOperation(dm_req_t *req, int instance, bool *is_restart, int *err_code, char *err_msg, int err_msg_len, kv_vector_t *output_args);
 int DM_ACCESS_DontRestartAsyncOperation(dm_req_t *req, int instance, bool *is_restart, int *err_code, char *err_msg, int err_msg_len, kv_vector_t *output_args);
 int DM_ACCESS_PopulateAliasParam(dm_req_t *req, char *buf, int len);
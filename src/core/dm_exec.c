@@ -55,6 +55,7 @@
 #include "device.h"
 #include "msg_handler.h"
 #include "os_utils.h"
+#include "msg_queue.h"
 #include "database.h"
 #include "dm_trans.h"
 #include "nu_ipaddr.h"
@@ -71,12 +72,8 @@
 #endif
 
 //------------------------------------------------------------------------------
-// Unix domain socket pair used to implement a message queue
-// One socket is always used for sending, and the other always used for receiving
-static int dm_mq_sockets[2] = {-1, -1};
-
-#define mq_rx_socket  dm_mq_sockets[0]
-#define mq_tx_socket  dm_mq_sockets[1]
+// Message queue used by other threads to post messages to the data model thread
+static msg_queue_t dm_mq = MSG_QUEUE_UNINITIALISED;
 
 //-------------------------------------------------------------------------
 // Type of message on data model's message queue
@@ -216,6 +213,7 @@ static bool is_notifications_enabled = false;
 void UpdateSockSet(socket_set_t *set);
 void ProcessSocketActivity(socket_set_t *set);
 void ProcessMessageQueueSocketActivity(socket_set_t *set);
+void ProcessDmExecMessage(dm_exec_msg_t *msg);
 void ProcessBinaryUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role, mtp_reply_to_t *mrt);
 
 /*********************************************************************//**
@@ -233,12 +231,11 @@ int DM_EXEC_Init(void)
 {
     int err;
 
-    // Exit if unable to initialize the unix domain socket pair used to implement a message queue
-    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, dm_mq_sockets);
-    if (err != 0)
+    // Exit if unable to initialize the message queue
+    err = MSG_QUEUE_Init(&dm_mq, sizeof(dm_exec_msg_t), DM_EXEC_MSG_QUEUE_SIZE);
+    if (err != USP_ERR_OK)
     {
-        USP_ERR_ERRNO("socketpair", errno);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 
     // Exit if unable to create mutex protecting access to this subsystem
@@ -292,7 +289,6 @@ int USP_SIGNAL_OperationComplete(int instance, int err_code, char *err_msg, kv_v
 {
     dm_exec_msg_t  msg;
     oper_complete_msg_t *ocm;
-    int bytes_sent;
 
     // Exit if this function has been called with a mismatch between err_code and err_msg
     if ( ((err_code == USP_ERR_OK) && (err_msg != NULL)) ||
@@ -303,7 +299,7 @@ int USP_SIGNAL_OperationComplete(int instance, int err_code, char *err_msg, kv_v
     }
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -319,13 +315,7 @@ int USP_SIGNAL_OperationComplete(int instance, int err_code, char *err_msg, kv_v
     ocm->output_args = output_args;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
     return USP_ERR_OK;
 }
@@ -351,10 +341,9 @@ int USP_SIGNAL_DataModelEvent(char *event_name, kv_vector_t *output_args)
 {
     dm_exec_msg_t  msg;
     event_complete_msg_t *ecm;
-    int bytes_sent;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -368,13 +357,7 @@ int USP_SIGNAL_DataModelEvent(char *event_name, kv_vector_t *output_args)
     ecm->output_args = output_args;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
     return USP_ERR_OK;
 }
@@ -399,7 +382,6 @@ int USP_SIGNAL_OperationStatus(int instance, char *status)
 {
     dm_exec_msg_t  msg;
     oper_status_msg_t *osm;
-    int bytes_sent;
 
     // Exit if this function has been called with invalid parameters
     if (status == NULL)
@@ -409,7 +391,7 @@ int USP_SIGNAL_OperationStatus(int instance, char *status)
     }
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -423,13 +405,7 @@ int USP_SIGNAL_OperationStatus(int instance, char *status)
     osm->status = USP_STRDUP(status);
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
     return USP_ERR_OK;
 }
@@ -450,7 +426,6 @@ int USP_SIGNAL_ObjectAdded(char *path)
 {
     dm_exec_msg_t  msg;
     obj_added_msg_t *oam;
-    int bytes_sent;
 
     // Exit if this function has been called with invalid parameters
     if (path == NULL)
@@ -460,7 +435,7 @@ int USP_SIGNAL_ObjectAdded(char *path)
     }
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -473,13 +448,7 @@ int USP_SIGNAL_ObjectAdded(char *path)
     oam->path = USP_STRDUP(path);
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
     return USP_ERR_OK;
 }
@@ -500,7 +469,6 @@ int USP_SIGNAL_ObjectDeleted(char *path)
 {
     dm_exec_msg_t  msg;
     obj_deleted_msg_t *odm;
-    int bytes_sent;
 
     // Exit if this function has been called with invalid parameters
     if (path == NULL)
@@ -510,7 +478,7 @@ int USP_SIGNAL_ObjectDeleted(char *path)
     }
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -523,13 +491,7 @@ int USP_SIGNAL_ObjectDeleted(char *path)
     odm->path = USP_STRDUP(path);
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
     return USP_ERR_OK;
 }
@@ -559,6 +521,12 @@ void DM_EXEC_PostUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role
     UspRecord__Record *rec;
     Usp__Msg *usp;
 
+    // Exit if protocol trace is not enabled, or this message has not been selected by sampling
+    if (PROTO_TRACE_IsSampled(kProtoTraceDir_Received) == false)
+    {
+        return;
+    }
+
     // Exit if unable to unpack the USP record
     rec = usp_record__record__unpack(pbuf_allocator, pbuf_len, pbuf);
     if (rec == NULL)
@@ -567,14 +535,12 @@ void DM_EXEC_PostUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role
         return;
     }
 
-    // Print USP record in human readable form
-    PROTO_TRACE_ProtobufMessage(&rec->base);
-
     // Exit if no USP message contained in USP Record
     if ((rec->record_type_case != USP_RECORD__RECORD__RECORD_TYPE_NO_SESSION_CONTEXT) ||
         (rec->no_session_context == NULL) || (rec->no_session_context->payload.len == 0) || 
         (rec->no_session_context->payload.data==NULL))
     {
+        PROTO_TRACE_UspRecord("Received", rec, NULL, NULL);
         USP_ERR_SetMessage("%s: USP Record contained no USP message (or message was in a E2E session context). Ignoring USP Record", __FUNCTION__);
         usp_record__record__free_unpacked(rec, pbuf_allocator);
         return;
@@ -584,13 +550,14 @@ void DM_EXEC_PostUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role
     usp = usp__msg__unpack(pbuf_allocator, rec->no_session_context->payload.len, rec->no_session_context->payload.data);
     if (usp == NULL)
     {
+        PROTO_TRACE_UspRecord("Received", rec, NULL, NULL);
         USP_ERR_SetMessage("%s: usp__msg__unpack failed", __FUNCTION__);
         usp_record__record__free_unpacked(rec, pbuf_allocator);
         return;
     }
 
-    // Print USP message in human readable form
-    PROTO_TRACE_ProtobufMessage(&usp->base);
+    // Print USP record and message in human readable form
+    PROTO_TRACE_UspRecord("Received", rec, usp, NULL);
 
     // Free unpacked protobuf structures
     usp__msg__free_unpacked(usp, pbuf_allocator);
@@ -600,10 +567,9 @@ void DM_EXEC_PostUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role
 #else
     dm_exec_msg_t  msg;
     process_usp_record_msg_t *pur;
-    int bytes_sent;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return;
@@ -633,13 +599,7 @@ void DM_EXEC_PostUspRecord(unsigned char *pbuf, int pbuf_len, ctrust_role_t role
     pur->mtp_reply_to.wsclient_mtp_instance = mrt->wsclient_mtp_instance;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 #endif
 }
 
@@ -663,10 +623,9 @@ void DM_EXEC_PostStompHandshakeComplete(int stomp_instance, ctrust_role_t role)
 {
     dm_exec_msg_t  msg;
     stomp_complete_msg_t *scm;
-    int bytes_sent;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return;
@@ -680,13 +639,7 @@ void DM_EXEC_PostStompHandshakeComplete(int stomp_instance, ctrust_role_t role)
     scm->role = role;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 }
 
 /*********************************************************************//**
@@ -709,10 +662,9 @@ void DM_EXEC_PostMqttHandshakeComplete(int mqtt_instance, ctrust_role_t role)
 {
     dm_exec_msg_t  msg;
     mqtt_complete_msg_t *mcm;
-    int bytes_sent;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return;
@@ -726,13 +678,7 @@ void DM_EXEC_PostMqttHandshakeComplete(int mqtt_instance, ctrust_role_t role)
     mcm->role = role;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 }
 
 
@@ -751,11 +697,10 @@ void DM_EXEC_PostMqttHandshakeComplete(int mqtt_instance, ctrust_role_t role)
 void DM_EXEC_PostMtpThreadExited(unsigned flags)
 {
     dm_exec_msg_t  msg;
-    int bytes_sent;
     mtp_thread_exited_msg_t *tem;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return;
@@ -768,13 +713,7 @@ void DM_EXEC_PostMtpThreadExited(unsigned flags)
     tem->flags = flags;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 }
 
 
@@ -796,10 +735,9 @@ int DM_EXEC_NotifyBdcTransferResult(int profile_id, bdc_transfer_result_t transf
 {
     dm_exec_msg_t  msg;
     bdc_transfer_result_msg_t *btr;
-    int bytes_sent;
 
     // Exit if message queue is not setup yet
-    if (mq_tx_socket == -1)
+    if (MSG_QUEUE_IsInitialised(&dm_mq) == false)
     {
         USP_LOG_Error("%s is being called before data model has been initialised", __FUNCTION__);
         return USP_ERR_INTERNAL_ERROR;
@@ -813,13 +751,7 @@ int DM_EXEC_NotifyBdcTransferResult(int profile_id, bdc_transfer_result_t transf
     btr->transfer_result = transfer_result;
 
     // Send the message
-    bytes_sent = send(mq_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return USP_ERR_INTERNAL_ERROR;
-    }
+    MSG_QUEUE_Post(&dm_mq, &msg);
 
 
     return USP_ERR_OK;
@@ -900,6 +832,9 @@ void *DM_EXEC_Main(void *args)
     socket_set_t set;
     int enabled_connections = 0;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     // Exit if unable to connect to the unix domain socket used to implement the CLI server
     err = CLI_SERVER_Init();
     if (err != USP_ERR_OK)
@@ -990,7 +925,7 @@ void UpdateSockSet(socket_set_t *set)
     CLI_SERVER_UpdateSocketSet(set);
 
     // Add the message queue receiving socket to the socket set
-    SOCKET_SET_AddSocketToReceiveFrom(mq_rx_socket, MAX_SOCKET_TIMEOUT, set);
+    SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&dm_mq), MAX_SOCKET_TIMEOUT, set);
 
     // Update socket timeout time with the time to the next timer
     delay_ms = SYNC_TIMER_TimeToNext();
@@ -1030,9 +965,37 @@ void ProcessSocketActivity(socket_set_t *set)
 **************************************************************************/
 void ProcessMessageQueueSocketActivity(socket_set_t *set)
 {
-    int err;
-    int bytes_read;
     dm_exec_msg_t  msg;
+
+    // Exit if there is no activity on the message queue socket
+    if (SOCKET_SET_IsReadyToRead(MSG_QUEUE_GetSocket(&dm_mq), set) == 0)
+    {
+        return;
+    }
+
+    // Process all messages on the queue
+    // NOTE: The wakeup must be cleared before reading the messages, otherwise a message posted whilst reading could be missed
+    MSG_QUEUE_ClearWakeup(&dm_mq);
+    while (MSG_QUEUE_Get(&dm_mq, &msg))
+    {
+        ProcessDmExecMessage(&msg);
+    }
+}
+
+/*********************************************************************//**
+**
+** ProcessDmExecMessage
+**
+** Processes a message received on the data model's message queue
+**
+** \param   msg - pointer to message to process
+**
+** \return  None (any errors that occur are handled internally)
+**
+**************************************************************************/
+void ProcessDmExecMessage(dm_exec_msg_t *msg)
+{
+    int err;
     oper_complete_msg_t *ocm;
     event_complete_msg_t *ecm;
     oper_status_msg_t *osm;
@@ -1044,24 +1007,10 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
     bdc_transfer_result_msg_t *btr;
     mtp_reply_to_t *mrt;
 
-    // Exit if there is no activity on the message queue socket
-    if (SOCKET_SET_IsReadyToRead(mq_rx_socket, set) == 0)
-    {
-        return;
-    }
-
-    // Exit if unable to read the full message received
-    bytes_read = recv(mq_rx_socket, &msg, sizeof(msg), 0);
-    if (bytes_read != sizeof(msg))
-    {
-        USP_LOG_Error("%s: recv() did not return a full message", __FUNCTION__);
-        return;
-    }
-
-    switch(msg.type)
+    switch(msg->type)
     {
         case kDmExecMsg_ProcessUspRecord:
-            pur = &msg.params.usp_record;
+            pur = &msg->params.usp_record;
             mrt = &pur->mtp_reply_to;
 
             ProcessBinaryUspRecord(pur->pbuf, pur->pbuf_len, pur->role, mrt);
@@ -1079,7 +1028,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
         case kDmExecMsg_StompHandshakeComplete:
         {
             stomp_complete_msg_t *scm;
-            scm = &msg.params.stomp_complete;
+            scm = &msg->params.stomp_complete;
             DEVICE_CONTROLLER_SetRolesFromStomp(scm->stomp_instance, scm->role);
             DM_EXEC_EnableNotifications();
         }
@@ -1090,14 +1039,14 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
         case kDmExecMsg_MqttHandshakeComplete:
         {
             mqtt_complete_msg_t *mcm;
-            mcm = &msg.params.mqtt_complete;
+            mcm = &msg->params.mqtt_complete;
             DEVICE_CONTROLLER_SetRolesFromMqtt(mcm->mqtt_instance, mcm->role);
             DM_EXEC_EnableNotifications();
         }
             break;
 #endif
         case kDmExecMsg_OperComplete:
-            ocm = &msg.params.oper_complete;
+            ocm = &msg->params.oper_complete;
             DEVICE_REQUEST_OperationComplete(ocm->instance, ocm->err_code, ocm->err_msg, ocm->output_args);
 
             // Free all arguments passed in this message
@@ -1111,7 +1060,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
             break;
 
         case kDmExecMsg_EventComplete:
-            ecm = &msg.params.event_complete;
+            ecm = &msg->params.event_complete;
             DEVICE_SUBSCRIPTION_ProcessAllEventCompleteSubscriptions(ecm->event_name, ecm->output_args);
 
             // Free all arguments passed in this message
@@ -1125,7 +1074,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
             break;
 
         case kDmExecMsg_OperStatus:
-            osm = &msg.params.oper_status;
+            osm = &msg->params.oper_status;
             USP_ASSERT(osm->status != NULL);
             DEVICE_REQUEST_UpdateOperationStatus(osm->instance, osm->status);
 
@@ -1135,7 +1084,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
 
 
         case kDmExecMsg_ObjAdded:
-            oam = &msg.params.obj_added;
+            oam = &msg->params.obj_added;
             err = DATA_MODEL_NotifyInstanceAdded(oam->path);
             if (err == USP_ERR_OK)
             {
@@ -1148,7 +1097,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
             break;
 
         case kDmExecMsg_ObjDeleted:
-            odm = &msg.params.obj_deleted;
+            odm = &msg->params.obj_deleted;
             err = DATA_MODEL_NotifyInstanceDeleted(odm->path);
             if (err == USP_ERR_OK)
             {
@@ -1161,7 +1110,7 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
             break;
 
         case kDmExecMsg_MtpThreadExited:
-            tem = &msg.params.mtp_thread_exited;
+            tem = &msg->params.mtp_thread_exited;
             cumulative_mtp_threads_exited |= tem->flags;
 
             // Form bitmask of all MTP threads which must exit before a scheduled exit can be handled
@@ -1190,12 +1139,12 @@ void ProcessMessageQueueSocketActivity(socket_set_t *set)
             break;
 
         case kDmExecMsg_BdcTransferResult:
-            btr = &msg.params.bdc_transfer_result;
+            btr = &msg->params.bdc_transfer_result;
             DEVICE_BULKDATA_NotifyTransferResult(btr->profile_id, btr->transfer_result);
             break;
 
         default:
-            TERMINATE_BAD_CASE(msg.type);
+            TERMINATE_BAD_CASE(msg->type);
             break;
     }
 }
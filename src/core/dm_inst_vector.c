@@ -41,12 +41,17 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <limits.h>
 
 #include "common_defs.h"
 #include "data_model.h"
 #include "int_vector.h"
 #include "dm_inst_vector.h"
+#include "path_resolver.h"
+#include "sync_timer.h"
+#include "uptime.h"
 
 
 //--------------------------------------------------------------------
@@ -60,13 +65,45 @@ static dm_node_t *refresh_instances_top_node = NULL;
 // Vector, used to hold the new set of instances for the refresh_instances_top_node, within the refresh instances callback
 static dm_instances_vector_t refreshed_instances_vector = { 0 };
 
+//--------------------------------------------------------------------
+// Set if the refreshed_instances_vector is still sorted. Instances reported out of order by the refresh instances callback
+// are appended to the end of the vector, and the vector is sorted once, after the callback has returned
+static bool is_refreshed_instances_sorted = true;
+
+#ifdef REFRESH_INSTANCES_IN_BACKGROUND
+//--------------------------------------------------------------------
+// Top-level multi-instance objects which are refreshed in the background. The index into this array is the id of the object's sync timer
+static dm_node_t **background_refresh_nodes = NULL;
+static int num_background_refresh_nodes = 0;
+#endif
+
+//--------------------------------------------------------------------
+// Number of entries initially allocated in an instances vector. Thereafter the number of entries allocated doubles each time the vector is full
+#define MIN_INST_VECTOR_ENTRIES 8
+
+//--------------------------------------------------------------------
+// Minimum time that the instances returned by a refresh instances vendor hook are cached for, even if the hook returns an expiry period of 0
+// This prevents the vendor hook being called repeatedly whilst processing a single USP message
+#define MIN_REFRESH_INSTANCES_EXPIRY_MS 1000
+
 //--------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void AddObjectInstanceIfPermitted(dm_instances_t *inst, str_vector_t *sv, combined_role_t *combined_role);
 int RefreshInstVector(dm_node_t *node, bool notify_subscriptions);
 int RefreshInstVectorEntry(char *path);
 bool IsExistInInstVector(dm_instances_t *match, dm_instances_vector_t *div);
-void AddToInstVector(dm_instances_t *inst, dm_instances_vector_t *div);
+bool AddToInstVector(dm_instances_t *inst, dm_instances_vector_t *div);
+bool IsInstVectorEqual(dm_instances_vector_t *div1, dm_instances_vector_t *div2);
+void AppendToInstVector(dm_instances_t *inst, dm_instances_vector_t *div);
+void GrowInstVector(dm_instances_vector_t *div);
+void SortRefreshedInstances(dm_instances_vector_t *div);
+int CompareInstVectorEntries(const void *entry1, const void *entry2);
+int CompareInstances(dm_instances_t *inst, dm_instances_t *match, int num_nodes, int num_instances);
+void FindInstVectorRange(dm_instances_vector_t *div, dm_instances_t *match, int num_nodes, int num_instances, int *start, int *end);
+#ifdef REFRESH_INSTANCES_IN_BACKGROUND
+void ScheduleBackgroundRefresh(dm_node_t *top_node, uint64_t expiry_period_ms);
+void BackgroundRefreshExec(int id);
+#endif
 
 /*********************************************************************//**
 **
@@ -83,6 +120,7 @@ void DM_INST_VECTOR_Init(dm_instances_vector_t *div)
 {
     div->vector = NULL;
     div->num_entries = 0;
+    div->max_entries = 0;
 }
 
 /*********************************************************************//**
@@ -105,6 +143,26 @@ void DM_INST_VECTOR_Destroy(dm_instances_vector_t *div)
 
     div->vector = NULL;
     div->num_entries = 0;
+    div->max_entries = 0;
+}
+
+/*********************************************************************//**
+**
+** DM_INST_VECTOR_Stop
+**
+** Frees all memory used by this module, other than the instance vectors themselves
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void DM_INST_VECTOR_Stop(void)
+{
+#ifdef REFRESH_INSTANCES_IN_BACKGROUND
+    USP_SAFE_FREE(background_refresh_nodes);
+    num_background_refresh_nodes = 0;
+#endif
 }
 
 /*********************************************************************//**
@@ -122,8 +180,6 @@ void DM_INST_VECTOR_Destroy(dm_instances_vector_t *div)
 **************************************************************************/
 int DM_INST_VECTOR_Add(dm_instances_t *inst)
 {
-    int i;
-    dm_instances_t *oi;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -141,20 +197,13 @@ int DM_INST_VECTOR_Add(dm_instances_t *inst)
     USP_ASSERT(top_node->type == kDMNodeType_Object_MultiInstance);
     div = &top_node->registered.object_info.inst_vector;
 
-    // See if this instance already exists
-    for (i=0; i < div->num_entries; i++)
+    // Add the instance to the correct top-level node instance vector, invalidating cached path resolutions if it was added
+    // NOTE: AddToInstVector() does not add the instance again, if it already exists
+    if (AddToInstVector(inst, div))
     {
-        // If this instance of the object already exists then exit, nothing more to do
-        oi = &div->vector[i];
-        if (memcmp(oi, inst, sizeof(dm_instances_t)) == 0)
-        {
-            return USP_ERR_OK;
-        }
+        PATH_RESOLVER_InvalidateCache();
     }
 
-    // Add the instance to the correct top-level node instance vector
-    AddToInstVector(inst, div);
-
     return USP_ERR_OK;
 }
 
@@ -175,10 +224,8 @@ int DM_INST_VECTOR_Add(dm_instances_t *inst)
 **************************************************************************/
 void DM_INST_VECTOR_Remove(dm_instances_t *inst)
 {
-    int i;
-    int j;
-    int order;
-    dm_instances_t *oi;
+    int start;
+    int end;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -195,33 +242,17 @@ void DM_INST_VECTOR_Remove(dm_instances_t *inst)
     USP_ASSERT(top_node->type == kDMNodeType_Object_MultiInstance);
     div = &top_node->registered.object_info.inst_vector;
 
-    // Find this instance and all child nested instances and delete them
-    j = 0;
-    order = inst->order;
-    for (i=0; i < div->num_entries; i++)
-    {
-        oi = &div->vector[i];
-        if ((oi->order >= order) &&
-            (memcmp(oi->nodes, inst->nodes, order*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
-        {
-            // Delete this node. Nothing to do in this iteration of the loop - this value will be overwritten by further
-        }
-        else
-        {
-            // Copy down later entries in the array, over ones which have been removed
-            if (j < i)
-            {
-                memcpy(&div->vector[j], oi, sizeof(dm_instances_t));
-            }
-
-            j++;
-        }
-    }
+    // Find this instance and all child nested instances
+    FindInstVectorRange(div, inst, inst->order, inst->order, &start, &end);
 
+    // Delete them, by copying down later entries in the array over them
     // NOTE: Don't bother reallocating the memory for the array (it could now be smaller).
-    // It will be resized next time an instance is added.
-    div->num_entries = j;
+    if (end > start)
+    {
+        memmove(&div->vector[start], &div->vector[end], (div->num_entries - end)*sizeof(dm_instances_t));
+        div->num_entries -= (end - start);
+        PATH_RESOLVER_InvalidateCache();
+    }
 }
 
 /*********************************************************************//**
@@ -286,11 +317,10 @@ int DM_INST_VECTOR_IsExist(dm_instances_t *match, bool *exists)
 **************************************************************************/
 int DM_INST_VECTOR_GetNextInstance(dm_node_t *node, dm_instances_t *inst, int *next_instance)
 {
-    int i;
     int order;
-    int instance;
-    int highest_instance=0;       // highest instance number encountered so far
-    dm_instances_t *oi;
+    int start;
+    int end;
+    int highest_instance=0;       // highest instance number of the specified object
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -298,26 +328,17 @@ int DM_INST_VECTOR_GetNextInstance(dm_node_t *node, dm_instances_t *inst, int *n
     USP_ASSERT(order < MAX_DM_INSTANCE_ORDER);
     inst->nodes[order] = node;
 
-    // Determine which top level multi-instance node's DM instances array to iterate over
+    // Determine which top level multi-instance node's DM instances array to search
     top_node = inst->nodes[0];
     USP_ASSERT(top_node != NULL);
     USP_ASSERT(top_node->type == kDMNodeType_Object_MultiInstance);
     div = &top_node->registered.object_info.inst_vector;
 
-    // Iterate over the table of instance numbers, determining the highest instance number for the specified object
-    for (i=0; i < div->num_entries; i++)
+    // Find the range of entries for the specified object. As these are sorted by instance number, the last entry contains the highest instance number
+    FindInstVectorRange(div, inst, order+1, order, &start, &end);
+    if (end > start)
     {
-        oi = &div->vector[i];
-        if ((oi->order == order+1) &&
-            (memcmp(oi->nodes, inst->nodes, (order+1)*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
-        {
-            instance = oi->instances[order];
-            if (instance > highest_instance)
-            {
-                highest_instance = instance;
-            }
-        }
+        highest_instance = div->vector[end-1].instances[order];
     }
 
     *next_instance = highest_instance+1;
@@ -344,8 +365,9 @@ int DM_INST_VECTOR_GetNumInstances(dm_node_t *node, dm_instances_t *inst, int *n
     int i;
     int order;
     int count;
+    int start;
+    int end;
     int err;
-    dm_instances_t *oi;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -366,14 +388,12 @@ int DM_INST_VECTOR_GetNumInstances(dm_node_t *node, dm_instances_t *inst, int *n
         return err;
     }
 
-    // Iterate over the table of instance numbers, counting the number of instances which match the object and its parent instance numbers
+    // Iterate over the range of entries for the object and its parent instance numbers, counting the instances of the object (not its children)
     count = 0;
-    for (i=0; i < div->num_entries; i++)
+    FindInstVectorRange(div, inst, order+1, order, &start, &end);
+    for (i=start; i < end; i++)
     {
-        oi = &div->vector[i];
-        if ((oi->order == order+1) &&
-            (memcmp(oi->nodes, inst->nodes, (order+1)*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
+        if (div->vector[i].order == order+1)
         {
             count++;
         }
@@ -404,8 +424,8 @@ int DM_INST_VECTOR_GetInstances(dm_node_t *node, dm_instances_t *inst, int_vecto
     int i;
     int order;
     int instance;
-    dm_instances_t *oi;
-    int index;
+    int start;
+    int end;
     int err;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
@@ -428,22 +448,16 @@ int DM_INST_VECTOR_GetInstances(dm_node_t *node, dm_instances_t *inst, int_vecto
         goto exit;
     }
 
-    // Iterate over the instances array, finding the objects which match, and their instances
-    for (i=0; i < div->num_entries; i++)
+    // Iterate over the range of entries for the object, adding its instance numbers
+    // NOTE: As the range is sorted by instance number, entries for the same instance (and its children) are adjacent,
+    //       so each instance number only needs comparing against the last one added
+    FindInstVectorRange(div, inst, order+1, order, &start, &end);
+    for (i=start; i < end; i++)
     {
-        oi = &div->vector[i];
-        if ((oi->order >= order+1) &&
-            (memcmp(oi->nodes, inst->nodes, (order+1)*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
+        instance = div->vector[i].instances[order];
+        if ((iv->num_entries == 0) || (iv->vector[iv->num_entries-1] != instance))
         {
-            instance = oi->instances[order];
-
-            // Add the instance to the array (if it has not been added already)
-            index = INT_VECTOR_Find(iv, instance);
-            if (index == INVALID)
-            {
-                INT_VECTOR_Add(iv, instance);
-            }
+            INT_VECTOR_Add(iv, instance);
         }
     }
 
@@ -531,6 +545,33 @@ void DM_INST_VECTOR_Dump(dm_instances_vector_t *div)
     }
 }
 
+/*********************************************************************//**
+**
+** DM_INST_VECTOR_DumpRefreshStats
+**
+** Prints out the statistics for the cache of instances of a top-level multi-instance object with a refresh instances vendor hook
+**
+** \param   top_node - pointer to top-level multi-instance object
+**
+** \return  None
+**
+**************************************************************************/
+void DM_INST_VECTOR_DumpRefreshStats(dm_node_t *top_node)
+{
+    dm_object_info_t *info;
+    dm_refresh_stats_t *stats;
+    unsigned num_accesses;
+
+    info = &top_node->registered.object_info;
+    stats = &info->refresh_stats;
+    num_accesses = stats->num_hits + stats->num_refreshes - stats->num_background_refreshes;
+
+    USP_DUMP("%s: refreshes=%u (background=%u), cache hits=%u/%u (%u%%), average refresh time=%u ms, maximum refresh time=%u ms",
+             top_node->path, stats->num_refreshes, stats->num_background_refreshes,
+             stats->num_hits, num_accesses, (num_accesses == 0) ? 0 : (unsigned)((100ULL * stats->num_hits) / num_accesses),
+             (stats->num_refreshes == 0) ? 0 : (unsigned)(stats->total_refresh_ms / stats->num_refreshes), stats->max_refresh_ms);
+}
+
 /*********************************************************************//**
 **
 ** DM_INST_VECTOR_GetAllInstancePaths_Unqualified
@@ -552,8 +593,9 @@ int DM_INST_VECTOR_GetAllInstancePaths_Unqualified(dm_node_t *node, dm_instances
 {
     int i;
     int order;
+    int start;
+    int end;
     int err;
-    dm_instances_t *oi;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -574,16 +616,11 @@ int DM_INST_VECTOR_GetAllInstancePaths_Unqualified(dm_node_t *node, dm_instances
         goto exit;
     }
 
-    // Iterate over the instances array, finding all objects which match, and their instances
-    for (i=0; i < div->num_entries; i++)
+    // Iterate over the range of entries for the object, adding all instances of it and its children
+    FindInstVectorRange(div, inst, order+1, order, &start, &end);
+    for (i=start; i < end; i++)
     {
-        oi = &div->vector[i];
-        if ((oi->order >= order+1) &&
-            (memcmp(oi->nodes, inst->nodes, (order+1)*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
-        {
-            AddObjectInstanceIfPermitted(oi, sv, combined_role);
-        }
+        AddObjectInstanceIfPermitted(&div->vector[i], sv, combined_role);
     }
 
     err = USP_ERR_OK;
@@ -614,8 +651,9 @@ int DM_INST_VECTOR_GetAllInstancePaths_Qualified(dm_instances_t *inst, str_vecto
 {
     int i;
     int order;
+    int start;
+    int end;
     int err;
-    dm_instances_t *oi;
     dm_node_t *top_node;
     dm_instances_vector_t *div;
 
@@ -636,16 +674,11 @@ int DM_INST_VECTOR_GetAllInstancePaths_Qualified(dm_instances_t *inst, str_vecto
         return err;
     }
 
-    // Iterate over the instances array, finding all objects which match, and their instances
-    for (i=0; i < div->num_entries; i++)
+    // Iterate over the range of entries for the object instance, adding it and all of its child instances
+    FindInstVectorRange(div, inst, order, order, &start, &end);
+    for (i=start; i < end; i++)
     {
-        oi = &div->vector[i];
-        if ((oi->order >= order) &&
-            (memcmp(oi->nodes, inst->nodes, order*sizeof(dm_node_t *)) == 0) &&
-            (memcmp(oi->instances, inst->instances, order*sizeof(int)) == 0))
-        {
-            AddObjectInstanceIfPermitted(oi, sv, combined_role);
-        }
+        AddObjectInstanceIfPermitted(&div->vector[i], sv, combined_role);
     }
 
     return USP_ERR_OK;
@@ -671,6 +704,7 @@ int DM_INST_VECTOR_RefreshInstance(char *path)
     dm_instances_t inst;
     bool is_qualified_instance;
     bool exists;
+    int n;
 
     // Exit if unable to find node representing this object
     node = DM_PRIV_GetNodeFromPath(path, &inst, &is_qualified_instance);
@@ -704,6 +738,14 @@ int DM_INST_VECTOR_RefreshInstance(char *path)
         return USP_ERR_OK;
     }
 
+    // If the vendor has reported instances out of order, then just append this instance to the vector
+    // NOTE: Duplicate instances, and instances whose parents do not exist, are removed when the vector is sorted, after the callback has returned
+    if (is_refreshed_instances_sorted == false)
+    {
+        AppendToInstVector(&inst, &refreshed_instances_vector);
+        return USP_ERR_OK;
+    }
+
     // Exit if instance already exists - nothing to do
     exists = IsExistInInstVector(&inst, &refreshed_instances_vector);
     if (exists)
@@ -726,7 +768,14 @@ int DM_INST_VECTOR_RefreshInstance(char *path)
     }
 
     // Add this to the refreshed instances vector
-    AddToInstVector(&inst, &refreshed_instances_vector);
+    // NOTE: If this instance is out of order, it is appended rather than inserted, to avoid moving the tail of the vector
+    // on every insert (which would make refreshing N instances reported in an arbitrary order O(N^2))
+    n = refreshed_instances_vector.num_entries;
+    if ((n > 0) && (CompareInstVectorEntries(&refreshed_instances_vector.vector[n-1], &inst) > 0))
+    {
+        is_refreshed_instances_sorted = false;
+    }
+    AppendToInstVector(&inst, &refreshed_instances_vector);
 
     return USP_ERR_OK;
 }
@@ -812,16 +861,20 @@ int RefreshInstVector(dm_node_t *top_node, bool notify_subscriptions)
     dm_node_t *node;
     char path[MAX_DM_PATH];
     dm_object_info_t *info;
-    time_t cur_time;
+    uint64_t cur_time_ms;
+    unsigned refresh_ms;
     int expiry_period;
+    uint64_t expiry_period_ms;
     int err;
     int len;
     int i;
 
     // Exit if this function is being called re-entrantly
     // This may be the case, as the refresh instances vendor callback ends up calling DM_INST_VECTOR_RefreshInstance()
+    // NOTE: Any path resolution in progress must not be cached, as the instances it used may be being refreshed
     if (refresh_instances_top_node != NULL)
     {
+        PATH_RESOLVER_LimitCacheValidity(0);
         return USP_ERR_OK;
     }
 
@@ -834,9 +887,12 @@ int RefreshInstVector(dm_node_t *top_node, bool notify_subscriptions)
     }
 
     // Exit if it's not yet time to refresh the instance vector
-    cur_time = time(NULL);
-    if (cur_time <= info->refresh_instances_expiry_time)
+    cur_time_ms = tu_uptime_msecs64();
+    if (cur_time_ms < info->refresh_instances_expiry_ms)
     {
+        info->refresh_stats.num_hits++;
+        info->refresh_instances_accessed = true;
+        PATH_RESOLVER_LimitCacheValidity(info->refresh_instances_expiry_ms);
         return USP_ERR_OK;
     }
 
@@ -853,18 +909,45 @@ int RefreshInstVector(dm_node_t *top_node, bool notify_subscriptions)
     // Exit if unable to get the refreshed instances into the refreshed_instances_vector
     refresh_instances_top_node = top_node;      // Indicate to DM_INST_VECTOR_RefreshInstance() the top level node which is meant to be being refreshed
     DM_INST_VECTOR_Init(&refreshed_instances_vector);
+    is_refreshed_instances_sorted = true;
+    expiry_period = 0;
     err = info->refresh_instances_cb(info->group_id, path, &expiry_period);
+
+    // Update the statistics for the cost of calling the vendor hook
+    refresh_ms = (unsigned) (tu_uptime_msecs64() - cur_time_ms);
+    info->refresh_stats.num_refreshes++;
+    info->refresh_stats.total_refresh_ms += refresh_ms;
+    if (refresh_ms > info->refresh_stats.max_refresh_ms)
+    {
+        info->refresh_stats.max_refresh_ms = refresh_ms;
+    }
+
+    // Exit if the vendor hook failed
     if (err != USP_ERR_OK)
     {
         USP_ERR_ReplaceEmptyMessage("%s: Refresh Instances callback for %s failed", __FUNCTION__, top_node->path);
         DM_INST_VECTOR_Destroy(&refreshed_instances_vector);
         refresh_instances_top_node = NULL;
+        PATH_RESOLVER_LimitCacheValidity(0);
         return USP_ERR_INTERNAL_ERROR;
     }
 
+    // Sort the refreshed instances, if the vendor hook reported them out of order
+    if (is_refreshed_instances_sorted == false)
+    {
+        SortRefreshedInstances(&refreshed_instances_vector);
+    }
+
     // Update the expiry time
-    cur_time = time(NULL);
-    info->refresh_instances_expiry_time = cur_time + expiry_period;
+    expiry_period_ms = (expiry_period > 0) ? (uint64_t)expiry_period*SECONDS : 0;
+    expiry_period_ms = MAX(expiry_period_ms, MIN_REFRESH_INSTANCES_EXPIRY_MS);
+    info->refresh_instances_expiry_ms = tu_uptime_msecs64() + expiry_period_ms;
+    info->refresh_instances_accessed = false;
+    PATH_RESOLVER_LimitCacheValidity(info->refresh_instances_expiry_ms);
+
+#ifdef REFRESH_INSTANCES_IN_BACKGROUND
+    ScheduleBackgroundRefresh(top_node, expiry_period_ms);
+#endif
 
     // Skip determining add added/deleted instances, if we don't need to notify subscriptions because
     // we're getting the baseline set of object instances at bootup
@@ -924,6 +1007,12 @@ int RefreshInstVector(dm_node_t *top_node, bool notify_subscriptions)
     DM_INST_VECTOR_Destroy(&deleted_instances);
 
 exit:
+    // Invalidate cached path resolutions, if any instances were added or deleted
+    if (IsInstVectorEqual(&info->inst_vector, &refreshed_instances_vector) == false)
+    {
+        PATH_RESOLVER_InvalidateCache();
+    }
+
     // Replace the old instances with the new instances, deleting the old instances first
     DM_INST_VECTOR_Destroy(&info->inst_vector);
     memcpy(&info->inst_vector, &refreshed_instances_vector, sizeof(dm_instances_vector_t));
@@ -945,51 +1034,423 @@ exit:
 **
 **************************************************************************/
 bool IsExistInInstVector(dm_instances_t *match, dm_instances_vector_t *div)
+{
+    int start;
+    int end;
+
+    // The instance exists if there are any entries for it (or its children)
+    FindInstVectorRange(div, match, match->order, match->order, &start, &end);
+
+    return (end > start) ? true : false;
+}
+
+/*********************************************************************//**
+**
+** AddToInstVector
+**
+** Adds the specified object instance into the specified instances vector, at the position which keeps the vector sorted
+** NOTE: The instance is not added again, if it already exists
+**
+** \param   inst - pointer to instances structure describing the object instance
+** \param   div - pointer to dm_instances vector structure to add to
+**
+** \return  true if the instance was added, false if it already existed
+**
+**************************************************************************/
+bool AddToInstVector(dm_instances_t *inst, dm_instances_vector_t *div)
+{
+    int index;
+    int end;
+
+    // Find the position to insert the instance at
+    // NOTE: Instances are usually added in ascending order, so check for appending to the end of the vector first
+    index = div->num_entries;
+    if ((index > 0) && (CompareInstances(&div->vector[index-1], inst, inst->order, inst->order) >= 0))
+    {
+        // The new instance sorts before the last entry, so find where it should go
+        // NOTE: The start of the range is the first entry which is either the instance itself, or one of its children, or sorts after it
+        FindInstVectorRange(div, inst, inst->order, inst->order, &index, &end);
+
+        // Exit if this instance already exists - nothing more to do
+        if ((index < div->num_entries) && (div->vector[index].order == inst->order) &&
+            (CompareInstances(&div->vector[index], inst, inst->order, inst->order) == 0))
+        {
+            return false;
+        }
+    }
+
+    // Increase the size of the dm_instances_vector array, if necessary
+    GrowInstVector(div);
+
+    // Make space for this object instance, then store it
+    if (index < div->num_entries)
+    {
+        memmove(&div->vector[index+1], &div->vector[index], (div->num_entries - index)*sizeof(dm_instances_t));
+    }
+    memcpy(&div->vector[index], inst, sizeof(dm_instances_t));
+    div->num_entries++;
+
+    return true;
+}
+
+/*********************************************************************//**
+**
+** IsInstVectorEqual
+**
+** Determines whether the specified (sorted) instances vectors contain the same object instances
+**
+** \param   div1 - pointer to first dm_instances vector structure to compare
+** \param   div2 - pointer to second dm_instances vector structure to compare
+**
+** \return  true if the instances vectors contain the same object instances
+**
+**************************************************************************/
+bool IsInstVectorEqual(dm_instances_vector_t *div1, dm_instances_vector_t *div2)
+{
+    int i;
+
+    if (div1->num_entries != div2->num_entries)
+    {
+        return false;
+    }
+
+    for (i=0; i < div1->num_entries; i++)
+    {
+        if (CompareInstVectorEntries(&div1->vector[i], &div2->vector[i]) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*********************************************************************//**
+**
+** AppendToInstVector
+**
+** Appends the specified object instance to the end of the specified instances vector, without keeping the vector sorted
+** This is used to bulk add instances to the refreshed_instances_vector. The vector must be sorted before it is searched.
+**
+** \param   inst - pointer to instances structure describing the object instance
+** \param   div - pointer to dm_instances vector structure to add to
+**
+** \return  None
+**
+**************************************************************************/
+void AppendToInstVector(dm_instances_t *inst, dm_instances_vector_t *div)
+{
+    GrowInstVector(div);
+    memcpy(&div->vector[div->num_entries], inst, sizeof(dm_instances_t));
+    div->num_entries++;
+}
+
+/*********************************************************************//**
+**
+** GrowInstVector
+**
+** Increases the size of the specified instances vector's array, if it does not have room for another entry
+** NOTE: The array grows geometrically, so that adding N instances is not O(N^2)
+**
+** \param   div - pointer to dm_instances vector structure to grow
+**
+** \return  None
+**
+**************************************************************************/
+void GrowInstVector(dm_instances_vector_t *div)
+{
+    int new_size;
+
+    if (div->num_entries < div->max_entries)
+    {
+        return;
+    }
+
+    new_size = (div->max_entries == 0) ? MIN_INST_VECTOR_ENTRIES : 2*div->max_entries;
+    div->vector = USP_REALLOC(div->vector, new_size*sizeof(dm_instances_t));
+    div->max_entries = new_size;
+}
+
+/*********************************************************************//**
+**
+** SortRefreshedInstances
+**
+** Sorts the instances reported by a refresh instances callback, which were reported out of order
+** Duplicate instances are removed, as are instances whose parent instances were not reported
+**
+** \param   div - pointer to dm_instances vector structure to sort
+**
+** \return  None
+**
+**************************************************************************/
+void SortRefreshedInstances(dm_instances_vector_t *div)
 {
     int i;
+    int num_kept;
     dm_instances_t *inst;
+    dm_instances_vector_t kept;
+    dm_node_t *node;
+    char path[MAX_DM_PATH];
+    bool exists;
 
-    // Iterate over the array of object instances
+    qsort(div->vector, div->num_entries, sizeof(dm_instances_t), CompareInstVectorEntries);
+
+    // Iterate over all instances, copying down the ones to keep
+    // NOTE: Parents sort before their children, so a parent instance is always kept before its children are checked
+    num_kept = 0;
     for (i=0; i < div->num_entries; i++)
     {
         inst = &div->vector[i];
-        if (inst->order >= match->order)
+
+        // Skip duplicate instances
+        if ((num_kept > 0) && (CompareInstVectorEntries(&div->vector[num_kept-1], inst) == 0))
         {
-            if ( (memcmp(inst->nodes, match->nodes, (match->order)*sizeof(dm_node_t *)) == 0) &&
-                 (memcmp(inst->instances, match->instances, (match->order)*sizeof(int)) == 0) )
+            continue;
+        }
+
+        // Skip instances whose parent instances have not been kept
+        if (inst->order > 1)
+        {
+            kept.vector = div->vector;
+            kept.num_entries = num_kept;
+            inst->order--;
+            exists = IsExistInInstVector(inst, &kept);
+            inst->order++;
+            if (exists == false)
             {
-                // All specified object instances match
-                return true;
+                node = inst->nodes[inst->order-1];
+                if (DM_PRIV_FormInstantiatedPath(node->path, inst, path, sizeof(path)) == USP_ERR_OK)
+                {
+                    USP_LOG_Warning("%s: Ignoring USP_RefreshInstance(%s) as its parent objects do not exist", __FUNCTION__, path);
+                }
+                continue;
             }
         }
+
+        if (num_kept != i)
+        {
+            memcpy(&div->vector[num_kept], inst, sizeof(dm_instances_t));
+        }
+        num_kept++;
     }
 
-    // If the code gets here, then no instances matched
-    return false;
+    div->num_entries = num_kept;
 }
 
 /*********************************************************************//**
 **
-** AddToInstVector
+** CompareInstVectorEntries
 **
-** Adds the specified object instance into the specified instances vector
+** qsort() comparison function, which orders entries in an instances vector
+** Entries are ordered as described in CompareInstances(), with an entry for a parent ordered before the entries for its children
 **
-** \param   inst - pointer to instances structure describing the object instance
-** \param   div - pointer to dm_instances vector structure to add to
+** \param   entry1 - pointer to first entry to compare
+** \param   entry2 - pointer to second entry to compare
+**
+** \return  negative if entry1 sorts before entry2, 0 if the entries are the same, positive if entry1 sorts after entry2
+**
+**************************************************************************/
+int CompareInstVectorEntries(const void *entry1, const void *entry2)
+{
+    dm_instances_t *first = (dm_instances_t *) entry1;
+    dm_instances_t *second = (dm_instances_t *) entry2;
+    int result;
+
+    // If the leading nodes and instance numbers are the same, then entry1 is either the same as entry2, or a child of it
+    result = CompareInstances(first, second, second->order, second->order);
+    if (result == 0)
+    {
+        result = first->order - second->order;
+    }
+
+    return result;
+}
+
+/*********************************************************************//**
+**
+** CompareInstances
+**
+** Compares the specified entry in an instances vector against the leading node and instance numbers of the instance to match
+** Entries are ordered by (nodes[0], instances[0], nodes[1], instances[1], ...), with an entry that is a
+** parent of another entry being ordered before it. This means that all entries for an object, or an object instance,
+** (and all of their children) form a contiguous range in the sorted vector
+** Nodes are ordered by the order in which they were registered in the schema (not by address), so that the instances
+** of sibling objects are ordered the same way on every run
+**
+** \param   inst - pointer to entry in instances vector
+** \param   match - pointer to instances structure to compare against
+** \param   num_nodes - number of leading nodes in match[] to compare
+** \param   num_instances - number of leading instance numbers in match[] to compare. This must be num_nodes or num_nodes-1
+**
+** \return  negative if the entry sorts before the match, 0 if the entry matches, positive if the entry sorts after the match
+**
+**************************************************************************/
+int CompareInstances(dm_instances_t *inst, dm_instances_t *match, int num_nodes, int num_instances)
+{
+    int i;
+
+    for (i=0; i < num_nodes; i++)
+    {
+        // If the entry is a parent of the match, it sorts before it
+        if (i >= inst->order)
+        {
+            return -1;
+        }
+
+        if (inst->nodes[i] != match->nodes[i])
+        {
+            return (inst->nodes[i]->reg_seq < match->nodes[i]->reg_seq) ? -1 : 1;
+        }
+
+        if ((i < num_instances) && (inst->instances[i] != match->instances[i]))
+        {
+            return (inst->instances[i] < match->instances[i]) ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+/*********************************************************************//**
+**
+** FindInstVectorRange
+**
+** Finds the range of entries in the instances vector which match the leading node and instance numbers of the specified instance
+**
+** \param   div - pointer to dm_instances vector structure to search in
+** \param   match - pointer to instances structure describing the instances to match against
+** \param   num_nodes - number of leading nodes in match[] to compare
+** \param   num_instances - number of leading instance numbers in match[] to compare. This must be num_nodes or num_nodes-1
+** \param   start - pointer to variable in which to return the index of the first matching entry
+**                  (or the index at which the match would be inserted, if there are no matching entries)
+** \param   end - pointer to variable in which to return the index after the last matching entry
 **
 ** \return  None
 **
 **************************************************************************/
-void AddToInstVector(dm_instances_t *inst, dm_instances_vector_t *div)
+void FindInstVectorRange(dm_instances_vector_t *div, dm_instances_t *match, int num_nodes, int num_instances, int *start, int *end)
 {
-    int size;
+    int low;
+    int high;
+    int mid;
+
+    // Find the first entry which does not sort before the match
+    low = 0;
+    high = div->num_entries;
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        if (CompareInstances(&div->vector[mid], match, num_nodes, num_instances) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    *start = low;
 
-    // Increase the size of the dm_instances_vector array
-    size = (div->num_entries+1) * sizeof(dm_instances_t);
-    div->vector = USP_REALLOC(div->vector, size);
+    // Find the first entry which sorts after the match
+    high = div->num_entries;
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        if (CompareInstances(&div->vector[mid], match, num_nodes, num_instances) <= 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    *end = low;
+}
 
-    // And store this object instance
-    memcpy(&div->vector[div->num_entries], inst, sizeof(dm_instances_t));
-    div->num_entries++;
+#ifdef REFRESH_INSTANCES_IN_BACKGROUND
+/*********************************************************************//**
+**
+** ScheduleBackgroundRefresh
+**
+** Starts a timer to refresh the instances of the specified top-level multi-instance object shortly before they expire
+** This prevents the latency of the refresh instances vendor hook being added to the USP message which next accesses the instances
+**
+** \param   top_node - pointer to top-level multi-instance object
+** \param   expiry_period_ms - number of milliseconds from now at which the instances expire
+**
+** \return  None
+**
+**************************************************************************/
+void ScheduleBackgroundRefresh(dm_node_t *top_node, uint64_t expiry_period_ms)
+{
+    int i;
+    unsigned delay_ms;
+
+    // Exit if the instances expire too soon to be worth refreshing ahead of time
+    if (expiry_period_ms <= REFRESH_INSTANCES_LEAD_TIME_MS)
+    {
+        return;
+    }
+
+    // NOTE: Very long expiry periods are limited to the maximum delay supported by the sync timer. This just causes the instances to be refreshed early
+    delay_ms = (unsigned) MIN(expiry_period_ms - REFRESH_INSTANCES_LEAD_TIME_MS, UINT_MAX);
+
+    // Find the timer associated with this object
+    for (i=0; i < num_background_refresh_nodes; i++)
+    {
+        if (background_refresh_nodes[i] == top_node)
+        {
+            SYNC_TIMER_ReloadMs(BackgroundRefreshExec, i, delay_ms);
+            return;
+        }
+    }
+
+    // If the code gets here, then this is the first time that this object has been scheduled, so add a timer for it
+    background_refresh_nodes = USP_REALLOC(background_refresh_nodes, (num_background_refresh_nodes+1)*sizeof(dm_node_t *));
+    background_refresh_nodes[num_background_refresh_nodes] = top_node;
+    SYNC_TIMER_AddMs(BackgroundRefreshExec, num_background_refresh_nodes, delay_ms);
+    num_background_refresh_nodes++;
 }
 
+/*********************************************************************//**
+**
+** BackgroundRefreshExec
+**
+** Called by the sync timer shortly before the instances of a top-level multi-instance object expire
+** If the instances have been accessed since they were last refreshed, then they are refreshed now
+** Otherwise they are left to expire, and will be refreshed when they are next accessed
+**
+** \param   id - index of the top-level multi-instance object in background_refresh_nodes[]
+**
+** \return  None
+**
+**************************************************************************/
+void BackgroundRefreshExec(int id)
+{
+    dm_node_t *top_node;
+    dm_object_info_t *info;
+    int err;
+
+    USP_ASSERT((id >= 0) && (id < num_background_refresh_nodes));
+    top_node = background_refresh_nodes[id];
+    info = &top_node->registered.object_info;
+
+    // Exit if the instances are not in use
+    if (info->refresh_instances_accessed == false)
+    {
+        return;
+    }
+
+    // Force the instances to be refreshed now, notifying subscriptions of any instances added or deleted
+    info->refresh_instances_expiry_ms = 0;
+    err = RefreshInstVector(top_node, true);
+    if (err != USP_ERR_OK)
+    {
+        USP_LOG_Warning("%s: Background refresh of %s failed. Instances will be refreshed on next access", __FUNCTION__, top_node->path);
+        return;
+    }
+
+    info->refresh_stats.num_background_refreshes++;
+}
+#endif
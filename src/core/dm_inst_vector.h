@@ -47,6 +47,7 @@
 // API
 void DM_INST_VECTOR_Init(dm_instances_vector_t *div);
 void DM_INST_VECTOR_Destroy(dm_instances_vector_t *div);
+void DM_INST_VECTOR_Stop(void);
 int DM_INST_VECTOR_Add(dm_instances_t *inst);
 void DM_INST_VECTOR_Remove(dm_instances_t *inst);
 int DM_INST_VECTOR_IsExist(dm_instances_t *match, bool *exists);
@@ -57,6 +58,7 @@ int DM_INST_VECTOR_GetAllInstancePaths_Unqualified(dm_node_t *node, dm_instances
 int DM_INST_VECTOR_GetAllInstancePaths_Qualified(dm_instances_t *inst, str_vector_t *sv, combined_role_t *combined_role);
 void DM_INST_VECTOR_RefreshBaselineInstances(dm_node_t *parent);
 void DM_INST_VECTOR_Dump(dm_instances_vector_t *div);
+void DM_INST_VECTOR_DumpRefreshStats(dm_node_t *top_node);
 int DM_INST_VECTOR_RefreshInstance(char *path);
 int DM_INST_VECTOR_RefreshTopLevelObjectInstances(dm_node_t *node);
 
@@ -292,6 +292,9 @@ int DM_TRANS_Commit(void)
                     req.val_union = dt->val_union;
                     err = notify_set_cb(&req, dt->value);
                 }
+
+                // Notify external controllers
+                DEVICE_SUBSCRIPTION_NotifyParamValueChange(node->hash, &dt->inst);
                 break;
 
             case kDMOp_Add:
@@ -0,0 +1,585 @@
+/*
+ *
+ * Copyright (C) 2021, Broadband Forum
+ * Copyright (C) 2021  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file dns_resolver.c
+ *
+ * Asynchronous DNS resolver with a cache of recently resolved hostnames
+ * Lookups are performed by a pool of resolver threads, so that a slow DNS server does not block the
+ * thread requesting the lookup (and all other connections serviced by that thread)
+ * The thread requesting the lookup is woken up (via a callback) when the lookup has completed,
+ * and then obtains the result from the cache by calling DNS_RESOLVER_Lookup() again
+ *
+ * NOTE: getaddrinfo() does not provide the TTL of DNS records, so the TTL is obtained by a separate query of the record,
+ *       after the result of the lookup has been made available to the waiting threads
+ *       Results are cached for the TTL, capped at DNS_CACHE_TIMEOUT, and are evicted if connecting to the address fails
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common_defs.h"
+#include "dns_resolver.h"
+#include "os_utils.h"
+
+// NOTE: arpa/nameser.h defines MIN() and MAX() (via sys/param.h), so its definitions are used in this file
+#undef MIN
+#undef MAX
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+//------------------------------------------------------------------------------
+// Minimum time (in seconds) that a result is cached for, regardless of TTL
+// This ensures that the threads woken up when the lookup completes are able to obtain the result
+#define MIN_DNS_CACHE_TIMEOUT 2
+
+//------------------------------------------------------------------------------
+// State of an entry in the DNS cache
+typedef enum
+{
+    kDnsEntry_Unused,       // This entry is not in use
+    kDnsEntry_Queued,       // The hostname is waiting for a resolver thread to perform the lookup
+    kDnsEntry_Resolving,    // A resolver thread is performing the lookup
+    kDnsEntry_Resolved,     // The lookup succeeded. The entry is valid until the expiry time
+    kDnsEntry_Failed,       // The lookup failed. The failure is cached until the expiry time
+} dns_entry_state_t;
+
+//------------------------------------------------------------------------------
+// Entry in the DNS cache
+typedef struct
+{
+    dns_entry_state_t state;
+    char *host;                     // Hostname to lookup
+    bool prefer_ipv6;               // Dual stack preference used for the lookup
+    nu_ipaddr_t bind_addr;          // Local interface IP address that the lookup was restricted to (zero address if not restricted)
+    nu_ipaddr_t addr;               // Resolved IP address (only valid if state is kDnsEntry_Resolved)
+    time_t expiry_time;             // Time at which the cached result must be looked up again
+    time_t last_used;               // Time at which the result was last used. Used to determine which entry to replace, if the cache is full
+    dns_wakeup_cb_t *wakeup_cbs;    // Array of callbacks to call when the lookup has completed (one per thread requesting lookups of this host)
+    int num_wakeup_cbs;
+} dns_entry_t;
+
+static dns_entry_t dns_cache[DNS_CACHE_MAX_ENTRIES];
+
+//------------------------------------------------------------------------------
+// Mutex protecting the DNS cache, and condition variable signalled when a hostname is queued for lookup
+static pthread_mutex_t dns_access_mutex;
+static pthread_cond_t dns_queued_cond;
+
+//------------------------------------------------------------------------------
+// Number of resolver threads which have been created, and the number of those waiting for a lookup to perform
+// Resolver threads are created on demand, up to DNS_RESOLVER_MAX_THREADS
+static int num_resolver_threads = 0;
+static int num_idle_resolver_threads = 0;
+
+//------------------------------------------------------------------------------
+// Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
+void *DnsResolverMain(void *args);
+dns_entry_t *FindDnsEntry(char *host, bool prefer_ipv6, nu_ipaddr_t *bind_addr);
+dns_entry_t *AllocDnsEntry(void);
+void QueueDnsLookup(dns_entry_t *de);
+void AddDnsWakeupCb(dns_entry_t *de, dns_wakeup_cb_t wakeup_cb);
+int GetDnsRecordTtl(char *host, nu_ipaddr_t *addr);
+
+/*********************************************************************//**
+**
+** DNS_RESOLVER_Init
+**
+** Initialises this component
+**
+** \param   None
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int DNS_RESOLVER_Init(void)
+{
+    int err;
+
+    memset(dns_cache, 0, sizeof(dns_cache));
+
+    err = OS_UTILS_InitMutex(&dns_access_mutex);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+
+    err = pthread_cond_init(&dns_queued_cond, NULL);
+    if (err != 0)
+    {
+        USP_ERR_ERRNO("pthread_cond_init", err);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** DNS_RESOLVER_Lookup
+**
+** Looks up the IP address of the specified host, without blocking
+** If the host is in the cache, then the cached result is returned immediately
+** Otherwise the lookup is queued for a resolver thread to perform, and kDnsResult_Pending is returned
+** When the lookup completes, the wakeup callback is called, and the caller should then call this function again to obtain the result
+** NOTE: This function may be called from any thread
+**
+** \param   host - pointer to string containing hostname to lookup
+** \param   prefer_ipv6 - Set to true if we prefer an IPv6 address (and device is dual stack, so we have a choice)
+** \param   acs_ipaddr_to_bind_to - IP address of local interface that will be used to contact the host (don't care = NULL or the zero address)
+** \param   dst - pointer to structure in which to return the IP address of the host
+** \param   wakeup_cb - function to call when a pending lookup has completed
+**
+** \return  kDnsResult_Resolved if the IP address was returned in dst
+**
+**************************************************************************/
+dns_result_t DNS_RESOLVER_Lookup(char *host, bool prefer_ipv6, nu_ipaddr_t *acs_ipaddr_to_bind_to, nu_ipaddr_t *dst, dns_wakeup_cb_t wakeup_cb)
+{
+    dns_entry_t *de;
+    nu_ipaddr_t bind_addr;
+    dns_result_t result = kDnsResult_Pending;
+    time_t cur_time;
+
+    // Normalise the local interface address, so that it can be used as part of the cache key
+    if (acs_ipaddr_to_bind_to != NULL)
+    {
+        memcpy(&bind_addr, acs_ipaddr_to_bind_to, sizeof(bind_addr));
+    }
+    else
+    {
+        nu_ipaddr_set_zero(&bind_addr);
+    }
+
+    OS_UTILS_LockMutex(&dns_access_mutex);
+    cur_time = time(NULL);
+
+    de = FindDnsEntry(host, prefer_ipv6, &bind_addr);
+    if (de == NULL)
+    {
+        // Exit if there are too many lookups in progress to start another
+        de = AllocDnsEntry();
+        if (de == NULL)
+        {
+            USP_LOG_Error("%s: Unable to lookup %s (too many lookups in progress)", __FUNCTION__, host);
+            result = kDnsResult_Failed;
+            goto exit;
+        }
+
+        de->host = USP_STRDUP(host);
+        de->prefer_ipv6 = prefer_ipv6;
+        memcpy(&de->bind_addr, &bind_addr, sizeof(bind_addr));
+        QueueDnsLookup(de);
+    }
+    else if (((de->state == kDnsEntry_Resolved) || (de->state == kDnsEntry_Failed)) && (cur_time >= de->expiry_time))
+    {
+        // Cached result has expired, so look it up again
+        QueueDnsLookup(de);
+    }
+
+    de->last_used = cur_time;
+    switch(de->state)
+    {
+        case kDnsEntry_Resolved:
+            memcpy(dst, &de->addr, sizeof(nu_ipaddr_t));
+            result = kDnsResult_Resolved;
+            break;
+
+        case kDnsEntry_Failed:
+            result = kDnsResult_Failed;
+            break;
+
+        default:
+            AddDnsWakeupCb(de, wakeup_cb);
+            result = kDnsResult_Pending;
+            break;
+    }
+
+exit:
+    OS_UTILS_UnlockMutex(&dns_access_mutex);
+    return result;
+}
+
+/*********************************************************************//**
+**
+** DNS_RESOLVER_Invalidate
+**
+** Evicts the cached IP address of the specified host, so that the next call to DNS_RESOLVER_Lookup() looks it up again
+** This is called when connecting to the cached IP address failed, as the host may have moved to a different IP address
+** NOTE: This function may be called from any thread
+**
+** \param   host - pointer to string containing hostname whose cached IP address is no longer valid
+**
+** \return  None
+**
+**************************************************************************/
+void DNS_RESOLVER_Invalidate(char *host)
+{
+    int i;
+    dns_entry_t *de;
+
+    OS_UTILS_LockMutex(&dns_access_mutex);
+    for (i=0; i<DNS_CACHE_MAX_ENTRIES; i++)
+    {
+        de = &dns_cache[i];
+        if ((de->state == kDnsEntry_Resolved) && (strcmp(de->host, host) == 0))
+        {
+            de->expiry_time = 0;
+        }
+    }
+    OS_UTILS_UnlockMutex(&dns_access_mutex);
+}
+
+/*********************************************************************//**
+**
+** DnsResolverMain
+**
+** Main loop of a resolver thread
+** Performs queued lookups, blocking until there is a lookup to perform
+**
+** \param   args - arguments (currently unused)
+**
+** \return  None
+**
+**************************************************************************/
+void *DnsResolverMain(void *args)
+{
+    int i;
+    int err;
+    dns_entry_t *de;
+    char *host;
+    bool prefer_ipv6;
+    nu_ipaddr_t bind_addr;
+    nu_ipaddr_t addr;
+    dns_wakeup_cb_t *wakeup_cbs;
+    int num_wakeup_cbs;
+    int ttl;
+    time_t resolved_time;
+
+    OS_UTILS_LockMutex(&dns_access_mutex);
+    while (FOREVER)
+    {
+        // Find the next queued lookup, waiting until there is one
+        de = NULL;
+        for (i=0; i<DNS_CACHE_MAX_ENTRIES; i++)
+        {
+            if (dns_cache[i].state == kDnsEntry_Queued)
+            {
+                de = &dns_cache[i];
+                break;
+            }
+        }
+
+        if (de == NULL)
+        {
+            num_idle_resolver_threads++;
+            pthread_cond_wait(&dns_queued_cond, &dns_access_mutex);
+            num_idle_resolver_threads--;
+            continue;
+        }
+
+        // Perform the lookup without holding the mutex, so that other threads are not blocked
+        // NOTE: The entry cannot be reused by another host whilst it is in the resolving state
+        de->state = kDnsEntry_Resolving;
+        host = USP_STRDUP(de->host);
+        prefer_ipv6 = de->prefer_ipv6;
+        memcpy(&bind_addr, &de->bind_addr, sizeof(bind_addr));
+        OS_UTILS_UnlockMutex(&dns_access_mutex);
+
+        err = tw_ulib_diags_lookup_host(host, AF_UNSPEC, prefer_ipv6, &bind_addr, &addr);
+        if (err != USP_ERR_OK)
+        {
+            USP_LOG_Error("%s: Failed to resolve %s", __FUNCTION__, host);
+        }
+
+        // Store the result in the cache
+        // NOTE: A successful result is initially cached for the maximum time, and the expiry time is reduced
+        //       to the TTL of the DNS record (if known) afterwards, so that the threads waiting for this lookup
+        //       are not delayed by the TTL query
+        OS_UTILS_LockMutex(&dns_access_mutex);
+        resolved_time = time(NULL);
+        if (err == USP_ERR_OK)
+        {
+            de->state = kDnsEntry_Resolved;
+            memcpy(&de->addr, &addr, sizeof(addr));
+            de->expiry_time = resolved_time + DNS_CACHE_TIMEOUT;
+        }
+        else
+        {
+            de->state = kDnsEntry_Failed;
+            de->expiry_time = resolved_time + DNS_NEGATIVE_CACHE_TIMEOUT;
+        }
+
+        // Wakeup all threads waiting for this lookup
+        // NOTE: The callbacks are called without holding the mutex, as they may call back into this module
+        num_wakeup_cbs = de->num_wakeup_cbs;
+        wakeup_cbs = de->wakeup_cbs;
+        de->num_wakeup_cbs = 0;
+        de->wakeup_cbs = NULL;
+
+        OS_UTILS_UnlockMutex(&dns_access_mutex);
+        for (i=0; i<num_wakeup_cbs; i++)
+        {
+            wakeup_cbs[i]();
+        }
+        USP_SAFE_FREE(wakeup_cbs);
+
+        // Limit the time that the result is cached for to the TTL of the DNS record (if known)
+        ttl = (err == USP_ERR_OK) ? GetDnsRecordTtl(host, &addr) : INVALID;
+        OS_UTILS_LockMutex(&dns_access_mutex);
+        if ((ttl != INVALID) && (ttl < DNS_CACHE_TIMEOUT))
+        {
+            ttl = MAX(ttl, MIN_DNS_CACHE_TIMEOUT);
+
+            // NOTE: The entry may have been invalidated or reused whilst the TTL was being queried
+            if ((de->state == kDnsEntry_Resolved) && (strcmp(de->host, host) == 0) && (memcmp(&de->addr, &addr, sizeof(addr)) == 0))
+            {
+                de->expiry_time = MIN(de->expiry_time, resolved_time + ttl);
+            }
+        }
+        USP_FREE(host);
+    }
+
+    // Code should never get here
+    OS_UTILS_UnlockMutex(&dns_access_mutex);
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+** FindDnsEntry
+**
+** Finds the cache entry for the specified lookup
+** NOTE: This function must be called with dns_access_mutex held
+**
+** \param   host - hostname to lookup
+** \param   prefer_ipv6 - dual stack preference for the lookup
+** \param   bind_addr - local interface IP address that the lookup is restricted to (zero address if not restricted)
+**
+** \return  pointer to cache entry, or NULL if not found
+**
+**************************************************************************/
+dns_entry_t *FindDnsEntry(char *host, bool prefer_ipv6, nu_ipaddr_t *bind_addr)
+{
+    int i;
+    dns_entry_t *de;
+
+    for (i=0; i<DNS_CACHE_MAX_ENTRIES; i++)
+    {
+        de = &dns_cache[i];
+        if ((de->state != kDnsEntry_Unused) && (de->prefer_ipv6 == prefer_ipv6) &&
+            (strcmp(de->host, host) == 0) && (memcmp(&de->bind_addr, bind_addr, sizeof(nu_ipaddr_t)) == 0))
+        {
+            return de;
+        }
+    }
+
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+** AllocDnsEntry
+**
+** Allocates a cache entry, replacing the least recently used completed entry if the cache is full
+** NOTE: This function must be called with dns_access_mutex held
+**
+** \param   None
+**
+** \return  pointer to (cleared) cache entry, or NULL if all entries have lookups in progress
+**
+**************************************************************************/
+dns_entry_t *AllocDnsEntry(void)
+{
+    int i;
+    dns_entry_t *de;
+    dns_entry_t *lru = NULL;
+
+    for (i=0; i<DNS_CACHE_MAX_ENTRIES; i++)
+    {
+        de = &dns_cache[i];
+        if (de->state == kDnsEntry_Unused)
+        {
+            return de;
+        }
+
+        // Entries with lookups in progress cannot be replaced
+        if ((de->state == kDnsEntry_Resolved) || (de->state == kDnsEntry_Failed))
+        {
+            if ((lru == NULL) || (de->last_used < lru->last_used))
+            {
+                lru = de;
+            }
+        }
+    }
+
+    if (lru != NULL)
+    {
+        USP_FREE(lru->host);
+        memset(lru, 0, sizeof(dns_entry_t));
+    }
+
+    return lru;
+}
+
+/*********************************************************************//**
+**
+** QueueDnsLookup
+**
+** Queues the specified cache entry to be looked up by a resolver thread, creating a resolver thread if none are idle
+** NOTE: This function must be called with dns_access_mutex held
+**
+** \param   de - pointer to cache entry to lookup
+**
+** \return  None
+**
+**************************************************************************/
+void QueueDnsLookup(dns_entry_t *de)
+{
+    int err;
+
+    de->state = kDnsEntry_Queued;
+
+    // Create another resolver thread, if all existing threads are busy performing lookups
+    // This allows lookups of different hosts to be performed in parallel
+    if ((num_idle_resolver_threads == 0) && (num_resolver_threads < DNS_RESOLVER_MAX_THREADS))
+    {
+        err = OS_UTILS_CreateThread(DnsResolverMain, NULL);
+        if (err == USP_ERR_OK)
+        {
+            num_resolver_threads++;
+        }
+    }
+
+    pthread_cond_signal(&dns_queued_cond);
+}
+
+/*********************************************************************//**
+**
+** AddDnsWakeupCb
+**
+** Adds the specified callback to the list of callbacks to call when the lookup completes (if not already present)
+** NOTE: This function must be called with dns_access_mutex held
+**
+** \param   de - pointer to cache entry being looked up
+** \param   wakeup_cb - callback to add
+**
+** \return  None
+**
+**************************************************************************/
+void AddDnsWakeupCb(dns_entry_t *de, dns_wakeup_cb_t wakeup_cb)
+{
+    int i;
+
+    if (wakeup_cb == NULL)
+    {
+        return;
+    }
+
+    for (i=0; i<de->num_wakeup_cbs; i++)
+    {
+        if (de->wakeup_cbs[i] == wakeup_cb)
+        {
+            return;
+        }
+    }
+
+    de->wakeup_cbs = USP_REALLOC(de->wakeup_cbs, (de->num_wakeup_cbs+1)*sizeof(dns_wakeup_cb_t));
+    de->wakeup_cbs[de->num_wakeup_cbs] = wakeup_cb;
+    de->num_wakeup_cbs++;
+}
+
+/*********************************************************************//**
+**
+** GetDnsRecordTtl
+**
+** Queries the DNS server for the TTL of the record which resolved the specified host to the specified IP address
+** NOTE: This is necessary because getaddrinfo() does not return the TTL
+** NOTE: This function is called after the result of the lookup has been made available, as it may block
+**
+** \param   host - hostname which was looked up
+** \param   addr - IP address that the host resolved to (determines whether the A or AAAA record is queried)
+**
+** \return  TTL (in seconds) of the record, or INVALID if it could not be determined (eg host is in /etc/hosts)
+**
+**************************************************************************/
+int GetDnsRecordTtl(char *host, nu_ipaddr_t *addr)
+{
+    int i;
+    int len;
+    int err;
+    sa_family_t family;
+    unsigned char answer[NS_PACKETSZ];
+    ns_msg msg;
+    ns_rr rr;
+    struct in_addr in_addr;
+    struct in6_addr in6_addr;
+    int ttl = INVALID;
+
+    err = nu_ipaddr_get_family(addr, &family);
+    if (err != USP_ERR_OK)
+    {
+        return INVALID;
+    }
+
+    // Exit if the host is an IP literal or the local host, as these are not resolved using the DNS server
+    if ((inet_pton(AF_INET, host, &in_addr) == 1) || (inet_pton(AF_INET6, host, &in6_addr) == 1) || (strcmp(host, "localhost") == 0))
+    {
+        return INVALID;
+    }
+
+    // Exit if the DNS server did not return the record (eg the host was resolved using /etc/hosts)
+    len = res_query(host, ns_c_in, (family == AF_INET6) ? ns_t_aaaa : ns_t_a, answer, sizeof(answer));
+    if ((len <= 0) || (ns_initparse(answer, len, &msg) != 0))
+    {
+        return INVALID;
+    }
+
+    // Use the smallest TTL of all records in the answer (this includes any CNAME records in the chain)
+    for (i=0; i < ns_msg_count(msg, ns_s_an); i++)
+    {
+        if (ns_parserr(&msg, ns_s_an, i, &rr) == 0)
+        {
+            if ((ttl == INVALID) || (ns_rr_ttl(rr) < (unsigned)ttl))
+            {
+                ttl = (int) ns_rr_ttl(rr);
+            }
+        }
+    }
+
+    return ttl;
+}
@@ -0,0 +1,69 @@
+/*
+ *
+ * Copyright (C) 2021, Broadband Forum
+ * Copyright (C) 2021  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file dns_resolver.h
+ *
+ * Asynchronous DNS resolver with a cache of recently resolved hostnames
+ *
+ */
+
+#ifndef DNS_RESOLVER_H
+#define DNS_RESOLVER_H
+
+#include <stdbool.h>
+
+#include "nu_ipaddr.h"
+
+//------------------------------------------------------------------------------
+// Result of a DNS lookup
+typedef enum
+{
+    kDnsResult_Resolved,    // The hostname has been resolved. The IP address has been returned
+    kDnsResult_Pending,     // The hostname is being resolved. The wakeup callback will be called when the lookup has completed
+    kDnsResult_Failed,      // The hostname could not be resolved
+} dns_result_t;
+
+//------------------------------------------------------------------------------
+// Callback called (from a resolver thread) when a pending lookup has completed
+// Typically this is used to wakeup the thread which requested the lookup, so that it can call DNS_RESOLVER_Lookup() again
+typedef void (*dns_wakeup_cb_t)(void);
+
+//------------------------------------------------------------------------------
+// API
+int DNS_RESOLVER_Init(void);
+dns_result_t DNS_RESOLVER_Lookup(char *host, bool prefer_ipv6, nu_ipaddr_t *acs_ipaddr_to_bind_to, nu_ipaddr_t *dst, dns_wakeup_cb_t wakeup_cb);
+void DNS_RESOLVER_Invalidate(char *host);
+
+#endif
@@ -82,7 +82,7 @@ Usp__Msg *ERROR_RESP_CreateSingle(char *msg_id, int err_code, Usp__Msg *src_msg,
     // Free the current USP response message (if one exists)
     if (src_msg != NULL)
     {
-        usp__msg__free_unpacked(src_msg, pbuf_allocator);
+        usp__msg__free_unpacked(src_msg, pbuf_arena_allocator);  // NOTE: The arena allocator also frees heap allocated responses
     }
 
     return resp;
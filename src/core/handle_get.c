@@ -155,7 +155,7 @@ void MSG_HANDLER_HandleGet(Usp__Msg *usp, char *controller_endpoint, mtp_reply_t
 
 exit:
     MSG_HANDLER_QueueMessage(controller_endpoint, resp, mrt);
-    usp__msg__free_unpacked(resp, pbuf_allocator);
+    usp__msg__free_unpacked(resp, pbuf_arena_allocator);
 }
 
 /*********************************************************************//**
@@ -357,7 +357,7 @@ Usp__GetResp__ResolvedPathResult *FindResolvedPath(Usp__GetResp__RequestedPathRe
 **
 ** Dynamically creates an GetResponse object
 ** NOTE: The object is created without any requested_path_results
-** NOTE: The object should be deleted using usp__msg__free_unpacked()
+** NOTE: The object is allocated from the arena (if active), and should be deleted using usp__msg__free_unpacked(resp, pbuf_arena_allocator)
 **
 ** \param   msg_id - string containing the message id of the get request, which initiated this response
 **
@@ -374,24 +374,24 @@ Usp__Msg *CreateGetResp(char *msg_id)
     Usp__GetResp *get_resp;
 
     // Allocate memory to store the USP message
-    resp = USP_MALLOC(sizeof(Usp__Msg));
+    resp = USP_ARENA_MALLOC(sizeof(Usp__Msg));
     usp__msg__init(resp);
 
-    header = USP_MALLOC(sizeof(Usp__Header));
+    header = USP_ARENA_MALLOC(sizeof(Usp__Header));
     usp__header__init(header);
 
-    body = USP_MALLOC(sizeof(Usp__Body));
+    body = USP_ARENA_MALLOC(sizeof(Usp__Body));
     usp__body__init(body);
 
-    response = USP_MALLOC(sizeof(Usp__Response));
+    response = USP_ARENA_MALLOC(sizeof(Usp__Response));
     usp__response__init(response);
 
-    get_resp = USP_MALLOC(sizeof(Usp__GetResp));
+    get_resp = USP_ARENA_MALLOC(sizeof(Usp__GetResp));
     usp__get_resp__init(get_resp);
 
     // Connect the structures together
     resp->header = header;
-    header->msg_id = USP_STRDUP(msg_id);
+    header->msg_id = USP_ARENA_STRDUP(msg_id);
     header->msg_type = USP__HEADER__MSG_TYPE__GET_RESP;
 
     resp->body = body;
@@ -429,20 +429,20 @@ AddGetResp_ReqPathRes(Usp__Msg *resp, char *requested_path, int err_code, char *
     int new_num;    // new number of requested_path_results
 
     // Allocate memory to store the requested_path_result
-    req_path_result = USP_MALLOC(sizeof(Usp__GetResp__RequestedPathResult));
+    req_path_result = USP_ARENA_MALLOC(sizeof(Usp__GetResp__RequestedPathResult));
     usp__get_resp__requested_path_result__init(req_path_result);
 
     // Increase the size of the vector containing pointers to the requested_path_results
     get_resp = resp->body->response->get_resp;
     new_num = get_resp->n_req_path_results + 1;
-    get_resp->req_path_results = USP_REALLOC(get_resp->req_path_results, new_num*sizeof(void *));
+    get_resp->req_path_results = USP_ARENA_REALLOC(get_resp->req_path_results, new_num*sizeof(void *));
     get_resp->n_req_path_results = new_num;
     get_resp->req_path_results[new_num-1] = req_path_result;
 
     // Initialise the requested_path_result
-    req_path_result->requested_path = USP_STRDUP(requested_path);
+    req_path_result->requested_path = USP_ARENA_STRDUP(requested_path);
     req_path_result->err_code = err_code;
-    req_path_result->err_msg = USP_STRDUP(err_msg);
+    req_path_result->err_msg = USP_ARENA_STRDUP(err_msg);
     req_path_result->n_resolved_path_results = 0;     // Start from an empty list
     req_path_result->resolved_path_results = NULL;
 
@@ -469,17 +469,17 @@ Usp__GetResp__ResolvedPathResult *AddReqPathRes_ResolvedPathResult(Usp__GetResp_
     int new_num;    // new number of entries in the result_params
 
     // Allocate memory to store the resolved_path_result entry
-    resolved_path_res_entry = USP_MALLOC(sizeof(Usp__GetResp__ResolvedPathResult));
+    resolved_path_res_entry = USP_ARENA_MALLOC(sizeof(Usp__GetResp__ResolvedPathResult));
     usp__get_resp__resolved_path_result__init(resolved_path_res_entry);
 
     // Increase the size of the vector containing pointers to the map entries
     new_num = req_path_result->n_resolved_path_results + 1;
-    req_path_result->resolved_path_results = USP_REALLOC(req_path_result->resolved_path_results, new_num*sizeof(void *));
+    req_path_result->resolved_path_results = USP_ARENA_REALLOC(req_path_result->resolved_path_results, new_num*sizeof(void *));
     req_path_result->n_resolved_path_results = new_num;
     req_path_result->resolved_path_results[new_num-1] = resolved_path_res_entry;
 
     // Initialise the resolved_path_result
-    resolved_path_res_entry->resolved_path = USP_STRDUP(obj_path);
+    resolved_path_res_entry->resolved_path = USP_ARENA_STRDUP(obj_path);
     resolved_path_res_entry->n_result_params = 0;
     resolved_path_res_entry->result_params = NULL;
 
@@ -508,18 +508,18 @@ AddResolvedPathRes_ParamsEntry(Usp__GetResp__ResolvedPathResult *resolved_path_r
     int new_num;    // new number of entries in the result_params
 
     // Allocate memory to store the result_params entry
-    res_params_entry = USP_MALLOC(sizeof(Usp__GetResp__ResolvedPathResult__ResultParamsEntry));
+    res_params_entry = USP_ARENA_MALLOC(sizeof(Usp__GetResp__ResolvedPathResult__ResultParamsEntry));
     usp__get_resp__resolved_path_result__result_params_entry__init(res_params_entry);
 
     // Increase the size of the vector containing pointers to the map entries
     new_num = resolved_path_res->n_result_params + 1;
-    resolved_path_res->result_params = USP_REALLOC(resolved_path_res->result_params, new_num*sizeof(void *));
+    resolved_path_res->result_params = USP_ARENA_REALLOC(resolved_path_res->result_params, new_num*sizeof(void *));
     resolved_path_res->n_result_params = new_num;
     resolved_path_res->result_params[new_num-1] = res_params_entry;
 
     // Initialise the result_params_entry
-    res_params_entry->key = USP_STRDUP(param_name);
-    res_params_entry->value = USP_STRDUP(value);
+    res_params_entry->key = USP_ARENA_STRDUP(param_name);
+    res_params_entry->value = USP_ARENA_STRDUP(value);
 
     return res_params_entry;
 }
@@ -57,6 +57,7 @@
 #include "mtp_exec.h"
 #include "dm_exec.h"
 #include "bdc_exec.h"
+#include "dns_resolver.h"
 #include "wsclient.h"
 #include "data_model.h"
 #include "dm_access.h"
@@ -70,6 +71,7 @@
 #include "stomp.h"
 #include "retry_wait.h"
 #include "nu_macaddr.h"
+#include "proto_trace.h"
 
 
 #ifndef OVERRIDE_MAIN
@@ -149,6 +151,12 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    err = PROTO_TRACE_Init();
+    if (err != USP_ERR_OK)
+    {
+        return -1;
+    }
+
     // Iterate over all command line options
     while (FOREVER)
     {
@@ -299,6 +307,13 @@ int main(int argc, char *argv[])
         goto exit;
     }
 
+    // Exit if unable to start the thread which writes log messages, so that the other threads do not block on logging I/O
+    err = USP_LOG_StartWriter();
+    if (err != USP_ERR_OK)
+    {
+        goto exit;
+    }
+
     // Exit if unable to spawn off a thread to service the MTPs
 #ifndef DISABLE_STOMP
     err = OS_UTILS_CreateThread(MTP_EXEC_StompMain, NULL);
@@ -392,6 +407,7 @@ int MAIN_Start(char *db_file, bool enable_mem_info)
     err = DM_EXEC_Init();
     err |= MTP_EXEC_Init();
     err |= BDC_EXEC_Init();
+    err |= DNS_RESOLVER_Init();
     if (err != USP_ERR_OK)
     {
         return err;
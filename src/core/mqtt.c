@@ -71,7 +71,11 @@
 #define ASSIGNED_CLIENT_IDENTIFIER 18
 #define REQUEST_RESPONSE_INFORMATION 25
 #define RESPONSE_INFORMATION 26
+#define RECEIVE_MAXIMUM 33
+#define TOPIC_ALIAS_MAXIMUM 34
+#define TOPIC_ALIAS 35
 #define USER_PROPERTY 38
+#define SHARED_SUBSCRIPTION_AVAILABLE 42
 
 
 //------------------------------------------------------------------------------
@@ -96,6 +100,18 @@ typedef enum
     kMqttState_Max
 } mqtt_state_t;
 
+//------------------------------------------------------------------------------
+// Cached MQTT v5.0 publish properties for a destination topic
+// The property list is built once per connection, rather than on every publish
+typedef struct
+{
+    char *topic;                 // Destination topic that these properties are for. NULL if this entry is unused
+    int alias;                   // Topic alias assigned to this topic for the current connection, or 0 if not using a topic alias
+    bool is_alias_established;   // Set once a message containing both the topic name and the topic alias has been published,
+                                 // after which subsequent messages can be published with only the (shorter) topic alias
+    mosquitto_property *props;   // Pre-built property list to use when publishing to this topic
+} mqtt_publish_dest_t;
+
 mqtt_state_t mqtt_up_states[] = { kMqttState_Running };
 mqtt_state_t mqtt_down_states[] = { kMqttState_Idle, kMqttState_AwaitingConnect, kMqttState_SendingConnect };
 
@@ -107,6 +123,19 @@ typedef struct
     mqtt_subscription_t subscriptions[MAX_MQTT_SUBSCRIPTIONS];
     double_linked_list_t usp_record_send_queue;
 
+    // USP records which have been published, but not yet acknowledged by the broker (identified by their mosquitto mid)
+    // NOTE: Entries are kept in the order that they were published
+    double_linked_list_t usp_record_inflight_queue;
+    int num_inflight;               // Number of entries in usp_record_inflight_queue
+    int max_inflight;               // Maximum number of entries allowed in usp_record_inflight_queue for the current connection
+
+    // Cached publish properties (MQTT v5.0 only). These are discarded whenever the connection is (re)established
+    mqtt_publish_dest_t publish_dests[MAX_MQTT_PUBLISH_DESTS];
+    mosquitto_property *publish_props;  // Property list (without topic alias) used for destinations not in publish_dests[]
+    int broker_topic_alias_max;     // Topic Alias Maximum advertised by the broker in the CONNACK (0 = topic aliases not allowed)
+    bool is_shared_sub_available;   // Set if the broker supports shared subscriptions (as advertised in the CONNACK)
+    int num_topic_aliases;          // Number of topic aliases assigned for the current connection
+
     // From the broker
     mqtt_subscription_t response_subscription;
 
@@ -162,6 +191,8 @@ int EnableMosquitto(mqtt_client_t *client);
 #define MoveState(state, to, event) MoveState_Private(state, to, event, __FUNCTION__)
 void MoveState_Private(mqtt_state_t *state, mqtt_state_t to, const char *event, const char *func);
 void HandleMqttError(mqtt_client_t *client, mqtt_failure_t failure_code, const char* message);
+void RequeueInflightMessages(mqtt_client_t *client);
+void DetermineControllerTrust(mqtt_client_t *client);
 
 //------------------------------------------------------------------------------------
 // Callbacks
@@ -232,7 +263,7 @@ int AddUserProperties(mosquitto_property **props)
     return USP_ERR_OK;
 }
 
-int AddConnectProperties(mosquitto_property **props)
+int AddConnectProperties(mqtt_client_t *client, mosquitto_property **props)
 {
     if (AddUserProperties(props) != USP_ERR_OK)
     {
@@ -244,9 +275,147 @@ int AddConnectProperties(mosquitto_property **props)
         return USP_ERR_INTERNAL_ERROR;
     }
 
+    // Allow the broker to use topic aliases when publishing to us, if configured
+    // NOTE: Incoming topic aliases are resolved by libmosquitto
+    if (client->conn_params.topic_alias_max > 0)
+    {
+        if (mosquitto_property_add_int16(props, TOPIC_ALIAS_MAXIMUM, (uint16_t)client->conn_params.topic_alias_max) != MOSQ_ERR_SUCCESS)
+        {
+            return USP_ERR_INTERNAL_ERROR;
+        }
+    }
+
     return USP_ERR_OK;
 }
 
+void ResetPublishDests(mqtt_client_t *client)
+{
+    int i;
+    mqtt_publish_dest_t *dest;
+
+    for (i = 0; i < MAX_MQTT_PUBLISH_DESTS; i++)
+    {
+        dest = &client->publish_dests[i];
+        USP_SAFE_FREE(dest->topic);
+        if (dest->props != NULL)
+        {
+            mosquitto_property_free_all(&dest->props);
+        }
+        dest->alias = 0;
+        dest->is_alias_established = false;
+    }
+
+    if (client->publish_props != NULL)
+    {
+        mosquitto_property_free_all(&client->publish_props);
+    }
+
+    client->num_topic_aliases = 0;
+}
+
+int BuildPublishProperties(mqtt_client_t *client, int alias, mosquitto_property **props)
+{
+    mosquitto_property *proplist = NULL;
+    int err = USP_ERR_OK;
+
+    // Setup proplist flags for v5
+    if (mosquitto_property_add_string(&proplist, CONTENT_TYPE, "application/vnd.bbf.usp.msg") != MOSQ_ERR_SUCCESS)
+    {
+        USP_LOG_Error("%s: Failed to add content type string", __FUNCTION__);
+        err = USP_ERR_INTERNAL_ERROR;
+        goto exit;
+    }
+
+    if (mosquitto_property_add_string(&proplist, RESPONSE_TOPIC, client->response_subscription.topic) != MOSQ_ERR_SUCCESS)
+    {
+        USP_LOG_Error("%s: Failed to add response topic string", __FUNCTION__);
+        err = USP_ERR_INTERNAL_ERROR;
+        goto exit;
+    }
+
+    if (alias > 0)
+    {
+        if (mosquitto_property_add_int16(&proplist, TOPIC_ALIAS, (uint16_t)alias) != MOSQ_ERR_SUCCESS)
+        {
+            USP_LOG_Error("%s: Failed to add topic alias", __FUNCTION__);
+            err = USP_ERR_INTERNAL_ERROR;
+            goto exit;
+        }
+    }
+
+    // Check all properties
+    if (mosquitto_property_check_all(PUBLISH, proplist) != MOSQ_ERR_SUCCESS)
+    {
+        USP_LOG_Error("%s: property check failed.", __FUNCTION__);
+        err = USP_ERR_INTERNAL_ERROR;
+        goto exit;
+    }
+
+exit:
+    if (err != USP_ERR_OK)
+    {
+        mosquitto_property_free_all(&proplist);
+        proplist = NULL;
+    }
+
+    *props = proplist;
+    return err;
+}
+
+mqtt_publish_dest_t *FindPublishDest(mqtt_client_t *client, char *topic)
+{
+    int i;
+    mqtt_publish_dest_t *dest;
+    mqtt_publish_dest_t *unused_dest = NULL;
+
+    // Return the cached entry for this topic, if one exists
+    for (i = 0; i < MAX_MQTT_PUBLISH_DESTS; i++)
+    {
+        dest = &client->publish_dests[i];
+        if (dest->topic == NULL)
+        {
+            if (unused_dest == NULL)
+            {
+                unused_dest = dest;
+            }
+        }
+        else if (strcmp(dest->topic, topic) == 0)
+        {
+            return dest;
+        }
+    }
+
+    // Exit if there are no free entries. The caller will use the non-aliased property list instead
+    if (unused_dest == NULL)
+    {
+        return NULL;
+    }
+
+    // Assign the next topic alias to this destination, if the broker allows us any more
+    dest = unused_dest;
+    dest->alias = 0;
+    dest->is_alias_established = false;
+    if (client->num_topic_aliases < client->broker_topic_alias_max)
+    {
+        client->num_topic_aliases++;
+        dest->alias = client->num_topic_aliases;
+    }
+
+    // Exit if unable to build the property list for this destination
+    if (BuildPublishProperties(client, dest->alias, &dest->props) != USP_ERR_OK)
+    {
+        if (dest->alias > 0)
+        {
+            client->num_topic_aliases--;
+        }
+        dest->alias = 0;
+        return NULL;
+    }
+
+    dest->topic = USP_STRDUP(topic);
+    return dest;
+}
+
 void SetupCallbacks(mqtt_client_t *client)
 {
     // Register all the generic callbacks
@@ -374,6 +543,14 @@ int EnableMosquitto(mqtt_client_t *client)
         return USP_ERR_UNSUPPORTED_PARAM;
     }
 
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000 // libmosquitto version 1.6.0
+    // Allow libmosquitto to have as many messages in-flight as our in-flight window
+    if (mosquitto_int_option(client->mosq, MOSQ_OPT_SEND_MAXIMUM, MQTT_MAX_INFLIGHT_PUBLISHES) != MOSQ_ERR_SUCCESS)
+    {
+        USP_LOG_Warning("%s: Failed to set mosquitto send maximum to %d", __FUNCTION__, MQTT_MAX_INFLIGHT_PUBLISHES);
+    }
+#endif
+
     SetupCallbacks(client);
     return USP_ERR_OK;
 }
@@ -428,6 +605,44 @@ int ConnectSetEncryption(mqtt_client_t *client)
     return USP_ERR_OK;
 }
 
+void DetermineControllerTrust(mqtt_client_t *client)
+{
+    if (client->cert_chain != NULL)
+    {
+        int err = DEVICE_SECURITY_GetControllerTrust(client->cert_chain, &client->role);
+        if (err != USP_ERR_OK)
+        {
+            USP_LOG_Error("%s: Failed to get the controller trust with err: %d", __FUNCTION__, err);
+        }
+        else
+        {
+            USP_LOG_Debug("%s: Successfully got the cert chain!", __FUNCTION__);
+        }
+
+#if LIBMOSQUITTO_VERSION_NUMBER >= 2000000 // libmosquitto version 2.0.0
+        // Cache the role alongside the TLS session, so that it may be restored if the session is resumed
+        SSL *ssl = mosquitto_ssl_get(client->mosq);
+        if ((err == USP_ERR_OK) && (ssl != NULL))
+        {
+            DEVICE_SECURITY_SetSessionRole(ssl, client->role);
+        }
+#endif
+        return;
+    }
+
+#if LIBMOSQUITTO_VERSION_NUMBER >= 2000000 // libmosquitto version 2.0.0
+    // The verify callback is not called when a TLS session is resumed, so use the role determined when the session was negotiated
+    SSL *ssl = mosquitto_ssl_get(client->mosq);
+    if ((ssl != NULL) && (DEVICE_SECURITY_GetResumedSessionRole(ssl, &client->role)))
+    {
+        USP_LOG_Debug("%s: Using controller trust of resumed TLS session", __FUNCTION__);
+        return;
+    }
+#endif
+
+    USP_LOG_Error("%s: No cert chain, so cannot get controller trust", __FUNCTION__);
+}
+
 int ConnectV5(mqtt_client_t *client)
 {
     // Setup the proplist
@@ -436,7 +651,7 @@ int ConnectV5(mqtt_client_t *client)
     int err = USP_ERR_OK;
 
     // Add all properties required for the connection
-    if (AddConnectProperties(&proplist) != USP_ERR_OK)
+    if (AddConnectProperties(client, &proplist) != USP_ERR_OK)
     {
         err = USP_ERR_INTERNAL_ERROR;
         goto error;
@@ -492,6 +707,9 @@ int Connect(mqtt_client_t *client)
 
             return err;
         }
+
+        // libmosquitto creates and connects the SSL connection internally, so identify the broker (for TLS session resumption) via the SSL context
+        DEVICE_SECURITY_SetCtxSessionKey(client->ssl_ctx, client->conn_params.host, client->conn_params.port);
     }
 
     if (version == kMqttProtocol_5_0)
@@ -519,7 +737,29 @@ int Connect(mqtt_client_t *client)
     return err;
 }
 
-int SubscribeV5(mqtt_client_t *client, mqtt_subscription_t *sub)
+char *GetSubscriptionTopicFilter(mqtt_client_t *client, mqtt_subscription_t *sub, char *buf, int len)
+{
+    char *group = client->conn_params.shared_subscription_group;
+
+    // Exit if this is not the response topic subscription, or it is not configured to be shared
+    // (shared subscriptions are only supported by MQTT 5.0)
+    // NOTE: Only the topic filter we subscribe to is changed. The response topic sent in published messages is unchanged
+    if ((sub != &client->response_subscription) || (group == NULL) || (*group == '\0') ||
+        (client->conn_params.version != kMqttProtocol_5_0))
+    {
+        return sub->topic;
+    }
+
+    USP_SNPRINTF(buf, len, "%s%s/%s", MQTT_SHARED_SUBSCRIPTION_PREFIX, group, sub->topic);
+    return buf;
+}
+
+bool IsSharedSubscription(char *topic)
+{
+    return (strncmp(topic, MQTT_SHARED_SUBSCRIPTION_PREFIX, sizeof(MQTT_SHARED_SUBSCRIPTION_PREFIX)-1) == 0);
+}
+
+int SubscribeV5(mqtt_client_t *client, mqtt_subscription_t *sub, char *topic)
 {
     int err = USP_ERR_OK;
     mosquitto_property *proplist = NULL;
@@ -530,10 +770,11 @@ int SubscribeV5(mqtt_client_t *client, mqtt_subscription_t *sub)
         goto error;
     }
 
-    if (mosquitto_subscribe_v5(client->mosq, &sub->mid, sub->topic, sub->qos,
+    // NOTE: The subscription options must be left at their defaults for shared subscriptions (the No Local option is not allowed)
+    if (mosquitto_subscribe_v5(client->mosq, &sub->mid, topic, sub->qos,
                 0 /*Options, default */, proplist) != MOSQ_ERR_SUCCESS)
     {
-        USP_LOG_Error("%s: Failed to subscribe to %s with v5", __FUNCTION__, sub->topic);
+        USP_LOG_Error("%s: Failed to subscribe to %s with v5", __FUNCTION__, topic);
 
         err = USP_ERR_INTERNAL_ERROR;
         goto error;
@@ -560,18 +801,30 @@ int Subscribe(mqtt_client_t *client, mqtt_subscription_t *sub)
 
     int err = USP_ERR_OK;
     int version = client->conn_params.version;
+    char buf[MAX_DM_PATH];
+    char *topic;
+
+    topic = GetSubscriptionTopicFilter(client, sub, buf, sizeof(buf));
+
+    // Exit if the broker has told us that it does not support shared subscriptions
+    if ((IsSharedSubscription(topic)) && (client->is_shared_sub_available == false))
+    {
+        USP_LOG_Error("%s: Broker does not support shared subscriptions. Not subscribing to %s", __FUNCTION__, topic);
+        sub->state = kMqttSubState_Error;
+        return USP_ERR_INTERNAL_ERROR;
+    }
 
     sub->state = kMqttSubState_Subscribing;
-    USP_LOG_Debug("%s: Sending subscribe to %s %d %d", __FUNCTION__, sub->topic, sub->mid, sub->qos);
+    USP_LOG_Debug("%s: Sending subscribe to %s %d %d", __FUNCTION__, topic, sub->mid, sub->qos);
     if (version == kMqttProtocol_5_0)
     {
-        err = SubscribeV5(client, sub);
+        err = SubscribeV5(client, sub, topic);
     }
     else
     {
-        if (mosquitto_subscribe(client->mosq, &sub->mid, sub->topic, sub->qos) != MOSQ_ERR_SUCCESS)
+        if (mosquitto_subscribe(client->mosq, &sub->mid, topic, sub->qos) != MOSQ_ERR_SUCCESS)
         {
-            USP_LOG_Error("%s: Failed to subscribe to %s", __FUNCTION__, sub->topic);
+            USP_LOG_Error("%s: Failed to subscribe to %s", __FUNCTION__, topic);
             err = USP_ERR_INTERNAL_ERROR;
         }
     }
@@ -583,6 +836,10 @@ int UnsubscribeV5(mqtt_client_t *client, mqtt_subscription_t *sub)
 {
     mosquitto_property *proplist = NULL;
     int err = USP_ERR_OK;
+    char buf[MAX_DM_PATH];
+    char *topic;
+
+    topic = GetSubscriptionTopicFilter(client, sub, buf, sizeof(buf));
 
     if (AddUserProperties(&proplist) != USP_ERR_OK)
     {
@@ -590,9 +847,9 @@ int UnsubscribeV5(mqtt_client_t *client, mqtt_subscription_t *sub)
         goto error;
     }
 
-    if (mosquitto_unsubscribe_v5(client->mosq, &sub->mid, sub->topic, proplist) != MOSQ_ERR_SUCCESS)
+    if (mosquitto_unsubscribe_v5(client->mosq, &sub->mid, topic, proplist) != MOSQ_ERR_SUCCESS)
     {
-        USP_LOG_Error("%s: Failed to unsubscribe to %s with v5", __FUNCTION__, sub->topic);
+        USP_LOG_Error("%s: Failed to unsubscribe to %s with v5", __FUNCTION__, topic);
         err = USP_ERR_INTERNAL_ERROR;
     }
 
@@ -617,6 +874,10 @@ int Unsubscribe(mqtt_client_t *client, mqtt_subscription_t *sub)
 
     int version = client->conn_params.version;
     int err = USP_ERR_OK;
+    char buf[MAX_DM_PATH];
+    char *topic;
+
+    topic = GetSubscriptionTopicFilter(client, sub, buf, sizeof(buf));
 
     sub->state = kMqttSubState_Unsubscribing;
     if (version == kMqttProtocol_5_0)
@@ -625,9 +886,9 @@ int Unsubscribe(mqtt_client_t *client, mqtt_subscription_t *sub)
     }
     else
     {
-        if (mosquitto_unsubscribe(client->mosq, &sub->mid, sub->topic) != MOSQ_ERR_SUCCESS)
+        if (mosquitto_unsubscribe(client->mosq, &sub->mid, topic) != MOSQ_ERR_SUCCESS)
         {
-            USP_LOG_Error("%s: Failed to subscribe to %s", __FUNCTION__, sub->topic);
+            USP_LOG_Error("%s: Failed to subscribe to %s", __FUNCTION__, topic);
             err = USP_ERR_INTERNAL_ERROR;
         }
     }
@@ -674,44 +935,49 @@ int SubscribeToAll(mqtt_client_t *client)
 
 int PublishV5(mqtt_client_t *client, mqtt_send_item_t *msg)
 {
-    int err = USP_ERR_OK;
-    mosquitto_property *proplist = NULL;
+    mqtt_publish_dest_t *dest;
+    mosquitto_property *proplist;
+    char *topic = msg->topic;
 
-    // Setup proplist flags for v5
-    if (mosquitto_property_add_string(&proplist, CONTENT_TYPE, "application/vnd.bbf.usp.msg") != MOSQ_ERR_SUCCESS)
+    // Get the pre-built property list for this destination
+    dest = FindPublishDest(client, msg->topic);
+    if (dest != NULL)
     {
-        USP_LOG_Error("%s: Failed to add content type string", __FUNCTION__);
-        err = USP_ERR_INTERNAL_ERROR;
-        goto error;
-    }
+        proplist = dest->props;
 
-    if (mosquitto_property_add_string(&proplist, RESPONSE_TOPIC, client->response_subscription.topic) != MOSQ_ERR_SUCCESS)
-    {
-        USP_LOG_Error("%s: Failed to add response topic string", __FUNCTION__);
-        err = USP_ERR_INTERNAL_ERROR;
-        goto error;
+        // Omit the topic name, if the broker already knows the topic alias for this destination
+        if (dest->is_alias_established)
+        {
+            topic = "";
+        }
     }
-
-    // Check all properties
-    if (mosquitto_property_check_all(PUBLISH, proplist) != MOSQ_ERR_SUCCESS)
+    else
     {
-        USP_LOG_Error("%s: property check failed.", __FUNCTION__);
-        err = USP_ERR_INTERNAL_ERROR;
-        goto error;
+        // Destination cache is full, so use the property list without a topic alias
+        if (client->publish_props == NULL)
+        {
+            if (BuildPublishProperties(client, 0, &client->publish_props) != USP_ERR_OK)
+            {
+                return USP_ERR_INTERNAL_ERROR;
+            }
+        }
+        proplist = client->publish_props;
     }
 
-    int mosq_err = mosquitto_publish_v5(client->mosq, &msg->mid, msg->topic, msg->pbuf_len, msg->pbuf, msg->qos, false /* retain */, proplist);
+    int mosq_err = mosquitto_publish_v5(client->mosq, &msg->mid, topic, msg->pbuf_len, msg->pbuf, msg->qos, false /* retain */, proplist);
     if (mosq_err != MOSQ_ERR_SUCCESS)
     {
         USP_LOG_Error("%s: Failed to publish to v5 with error %d", __FUNCTION__, mosq_err);
-        err = USP_ERR_INTERNAL_ERROR;
-        goto error;
+        return USP_ERR_INTERNAL_ERROR;
     }
 
-error:
-    // Free all properties now we're done with them.
-    mosquitto_property_free_all(&proplist);
-    return err;
+    // The topic alias mapping is now known to the broker, as messages are sent in the order that they are published
+    if ((dest != NULL) && (dest->alias > 0))
+    {
+        dest->is_alias_established = true;
+    }
+
+    return USP_ERR_OK;
 }
 
 int Publish(mqtt_client_t *client, mqtt_send_item_t *msg)
@@ -759,6 +1025,9 @@ int DisconnectClient(mqtt_client_t *client)
     // No more socket after disconnect
     client->socket_fd = INVALID;
 
+    // No acknowledgements will be received for messages in-flight, so they will need to be sent again
+    RequeueInflightMessages(client);
+
     return err;
 }
 
@@ -813,6 +1082,14 @@ void MoveState_Private(mqtt_state_t *state, mqtt_state_t to, const char *event,
     *state = to;
 }
 
+void RemoveMqttSendItem(double_linked_list_t *queue, mqtt_send_item_t *item)
+{
+    USP_SAFE_FREE(item->topic);
+    USP_SAFE_FREE(item->pbuf);
+    DLLIST_Unlink(queue, item);
+    USP_SAFE_FREE(item);
+}
+
 void PopClientUspQueue(mqtt_client_t *client)
 {
     // Remove the head of the client usp queue
@@ -824,12 +1101,46 @@ void PopClientUspQueue(mqtt_client_t *client)
         mqtt_send_item_t *head = (mqtt_send_item_t *) client->usp_record_send_queue.head;
         if (head != NULL)
         {
-            USP_SAFE_FREE(head->topic);
-            USP_SAFE_FREE(head->pbuf);
-            DLLIST_Unlink(&client->usp_record_send_queue, head);
-            USP_SAFE_FREE(head);
+            RemoveMqttSendItem(&client->usp_record_send_queue, head);
+        }
+    }
+}
+
+void RequeueInflightMessages(mqtt_client_t *client)
+{
+    mqtt_send_item_t *item;
+
+    // Move all unacknowledged messages back to the front of the send queue, keeping their original order,
+    // so that they are published again (in the same order) once the connection has been re-established
+    // NOTE: The mid is no longer valid, as the mosquitto instance is recreated when reconnecting
+    while (client->usp_record_inflight_queue.tail != NULL)
+    {
+        item = (mqtt_send_item_t *) client->usp_record_inflight_queue.tail;
+        item->mid = INVALID;
+        DLLIST_Unlink(&client->usp_record_inflight_queue, item);
+        DLLIST_LinkToHead(&client->usp_record_send_queue, item);
+    }
+
+    client->num_inflight = 0;
+}
+
+mqtt_send_item_t *FindInflightMessageByMid(mqtt_client_t *client, int mid)
+{
+    mqtt_send_item_t *item;
+
+    // NOTE: Acknowledgements normally arrive in the order that the messages were published, so this search normally stops at the head
+    item = (mqtt_send_item_t *) client->usp_record_inflight_queue.head;
+    while (item != NULL)
+    {
+        if (item->mid == mid)
+        {
+            return item;
         }
+
+        item = (mqtt_send_item_t *) item->link.next;
     }
+
+    return NULL;
 }
 
 void ReceiveMqttMessage(mqtt_client_t *client, const struct mosquitto_message *message, char *response_topic)
@@ -867,7 +1178,20 @@ int SendQueueHead(mqtt_client_t *client)
             return USP_ERR_INTERNAL_ERROR;
         }
 
+        // Move the message to the in-flight queue before publishing it, so that it can be found by its mid,
+        // even if the publish callback is called before mosquitto_publish() returns
+        DLLIST_MoveLink(&client->usp_record_inflight_queue, &client->usp_record_send_queue, q_msg);
+        client->num_inflight++;
+
         err = Publish(client, q_msg);
+        if (err != USP_ERR_OK)
+        {
+            // Put the message back at the head of the send queue, so that it is retried later
+            DLLIST_Unlink(&client->usp_record_inflight_queue, q_msg);
+            DLLIST_LinkToHead(&client->usp_record_send_queue, q_msg);
+            client->num_inflight--;
+            q_msg->mid = INVALID;
+        }
     }
     else
     {
@@ -878,11 +1202,26 @@ int SendQueueHead(mqtt_client_t *client)
     return err;
 }
 
-bool IsUspRecordInMqttQueue(mqtt_client_t *client, unsigned char *pbuf, int pbuf_len)
+void SendQueuedMessages(mqtt_client_t *client)
+{
+    // Publish messages from the head of the send queue, until the in-flight window is full
+    // NOTE: Messages are published in the order that they were queued, and MQTT delivers messages published
+    // on the same connection (with the same QoS) in order, so the ordering of USP records is preserved
+    while ((client->usp_record_send_queue.head != NULL) && (client->num_inflight < client->max_inflight))
+    {
+        if (SendQueueHead(client) != USP_ERR_OK)
+        {
+            USP_LOG_Error("%s: Failed to send head of the queue, leaving there to try again", __FUNCTION__);
+            break;
+        }
+    }
+}
+
+bool IsUspRecordInMqttList(double_linked_list_t *queue, unsigned char *pbuf, int pbuf_len)
 {
     mqtt_send_item_t *q_msg;
 
-    q_msg = (mqtt_send_item_t *) client->usp_record_send_queue.head;
+    q_msg = (mqtt_send_item_t *) queue->head;
     while (q_msg != NULL)
     {
         if ((q_msg->pbuf_len == pbuf_len) && (memcmp(q_msg->pbuf, pbuf, pbuf_len)==0))
@@ -896,6 +1235,16 @@ bool IsUspRecordInMqttQueue(mqtt_client_t *client, unsigned char *pbuf, int pbuf
     return false;
 }
 
+bool IsUspRecordInMqttQueue(mqtt_client_t *client, unsigned char *pbuf, int pbuf_len)
+{
+    if (IsUspRecordInMqttList(&client->usp_record_send_queue, pbuf, pbuf_len))
+    {
+        return true;
+    }
+
+    return IsUspRecordInMqttList(&client->usp_record_inflight_queue, pbuf, pbuf_len);
+}
+
 mqtt_client_t *FindMqttClientByInstance(int instance)
 {
     int i;
@@ -1031,6 +1380,7 @@ void ParamReplace(mqtt_conn_params_t *dest, mqtt_conn_params_t *src)
     dest->client_id = USP_STRDUP(src->client_id);
     dest->name = USP_STRDUP(src->name);
     dest->response_information = USP_STRDUP(src->response_information);
+    dest->shared_subscription_group = USP_STRDUP(src->shared_subscription_group);
 
 # if 0
     // TODO: Removed as these are not currently used.
@@ -1054,6 +1404,7 @@ void MQTT_DestroyConnParams(mqtt_conn_params_t *params)
     USP_SAFE_FREE(params->client_id);
     USP_SAFE_FREE(params->name);
     USP_SAFE_FREE(params->response_information);
+    USP_SAFE_FREE(params->shared_subscription_group);
 
 # if 0
     // TODO: Removed as these are not currently used.
@@ -1179,22 +1530,7 @@ void ConnectV5Callback(struct mosquitto *mosq, void *userdata, int result, int f
     }
     else
     {
-        if (client->cert_chain != NULL)
-        {
-            int err = DEVICE_SECURITY_GetControllerTrust(client->cert_chain, &client->role);
-            if (err != USP_ERR_OK)
-            {
-                USP_LOG_Error("%s: Failed to get the controller trust with err: %d", __FUNCTION__, err);
-            }
-            else
-            {
-                USP_LOG_Debug("%s: Successfully got the cert chain!", __FUNCTION__);
-            }
-        }
-        else
-        {
-            USP_LOG_Error("%s: No cert chain, so cannot get controller trust", __FUNCTION__);
-        }
+        DetermineControllerTrust(client);
 
         // Pick up client id, as per R-MQTT.9
         char *client_id_ptr = NULL;
@@ -1258,6 +1594,38 @@ void ConnectV5Callback(struct mosquitto *mosq, void *userdata, int result, int f
         }
         USP_LOG_Debug("%s: Received client id \"%s\"", __FUNCTION__, client->conn_params.client_id);
 
+        // Determine how many topic aliases the broker allows us to use
+        uint16_t topic_alias_max;
+        client->broker_topic_alias_max = 0;
+        if (mosquitto_property_read_int16(props, TOPIC_ALIAS_MAXIMUM, &topic_alias_max, false) != NULL)
+        {
+            USP_LOG_Debug("%s: Broker allows %d topic aliases", __FUNCTION__, topic_alias_max);
+            client->broker_topic_alias_max = topic_alias_max;
+        }
+
+        // Determine whether the broker supports shared subscriptions (if not specified, they are supported)
+        uint8_t shared_sub_available;
+        client->is_shared_sub_available = true;
+        if (mosquitto_property_read_byte(props, SHARED_SUBSCRIPTION_AVAILABLE, &shared_sub_available, false) != NULL)
+        {
+            client->is_shared_sub_available = (shared_sub_available != 0);
+        }
+
+        // Discard any publish properties cached for a previous connection, as the response topic may have changed,
+        // and topic aliases only last for the duration of a connection
+        ResetPublishDests(client);
+
+        // Limit the number of in-flight messages to the broker's Receive Maximum (if it specified one)
+        uint16_t receive_max;
+        if (mosquitto_property_read_int16(props, RECEIVE_MAXIMUM, &receive_max, false) != NULL)
+        {
+            if ((receive_max > 0) && (receive_max < client->max_inflight))
+            {
+                USP_LOG_Debug("%s: Limiting in-flight messages to broker's Receive Maximum (%d)", __FUNCTION__, receive_max);
+                client->max_inflight = receive_max;
+            }
+        }
+
         ResetRetryCount(client);
 
         MoveState(&client->state, kMqttState_Running, "Connect Callback Received");
@@ -1296,22 +1664,7 @@ void ConnectCallback(struct mosquitto *mosq, void *userdata, int result)
     }
     else
     {
-        if (client->cert_chain != NULL)
-        {
-            int err = DEVICE_SECURITY_GetControllerTrust(client->cert_chain, &client->role);
-            if (err != USP_ERR_OK)
-            {
-                USP_LOG_Error("%s: Failed to get the controller trust with err: %d", __FUNCTION__, err);
-            }
-            else
-            {
-                USP_LOG_Debug("%s: Successfully got the cert chain!", __FUNCTION__);
-            }
-        }
-        else
-        {
-            USP_LOG_Error("%s: No cert chain, so cannot get controller trust", __FUNCTION__);
-        }
+        DetermineControllerTrust(client);
 
 
         ResetRetryCount(client);
@@ -1432,6 +1785,18 @@ void PublishCallback(struct mosquitto* mosq, void *userdata, int mid /*message i
         USP_LOG_Warning("%s: Received publish in wrong state: %s", __FUNCTION__, mqtt_state_names[client->state]);
     }
 
+    // The message has been acknowledged by the broker, so free it, opening the in-flight window for the next message
+    mqtt_send_item_t *item = FindInflightMessageByMid(client, mid);
+    if (item != NULL)
+    {
+        RemoveMqttSendItem(&client->usp_record_inflight_queue, item);
+        client->num_inflight--;
+    }
+    else
+    {
+        USP_LOG_Warning("%s: No in-flight message with MID %d", __FUNCTION__, mid);
+    }
+
 exit:
     OS_UTILS_UnlockMutex(&mqtt_access_mutex);
 
@@ -1667,6 +2032,8 @@ void InitClient(mqtt_client_t *client, int index)
     client->verify_callback = mqtt_verify_callbacks[index];
     client->socket_fd = INVALID;
     client->ssl_ctx = NULL;   // NOTE: The SSL context is created in MQTT_Start()
+    client->num_inflight = 0;
+    client->max_inflight = MQTT_MAX_INFLIGHT_PUBLISHES;
     ResetRetryCount(client);
 
     for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++)
@@ -1690,6 +2057,7 @@ void DestroyClient(mqtt_client_t *client)
     }
 
     MQTT_SubscriptionDestroy(&client->response_subscription);
+    ResetPublishDests(client);
 
     if (client->cert_chain != NULL)
     {
@@ -1780,6 +2148,12 @@ int MQTT_Start(void)
         // Explicitly disallow SSLv2, as it is insecure. See https://arxiv.org/pdf/1407.2168.pdf
         // NOTE: Even without this, SSLv2 ciphers don't seem to appear in the cipher list. Just added in case someone is using an older version of OpenSSL.
         SSL_CTX_set_options(client->ssl_ctx, SSL_OP_NO_SSLv2);
+
+#if LIBMOSQUITTO_VERSION_NUMBER >= 2000000 // libmosquitto version 2.0.0
+        // Allow reconnects to the broker to resume the previous TLS session, avoiding a full handshake
+        // NOTE: Only enabled if the controller trust role of a resumed session can be restored (see DetermineControllerTrust)
+        DEVICE_SECURITY_EnableSessionCache(client->ssl_ctx);
+#endif
     }
 
 exit:
@@ -1818,6 +2192,14 @@ int EnableClient(mqtt_client_t* client)
     MQTT_SubscriptionDestroy(&resp_sub);
 
 
+    // Reset the in-flight window. It may be reduced by the broker when the connection is established
+    client->max_inflight = MQTT_MAX_INFLIGHT_PUBLISHES;
+
+    // Topic aliases are not allowed until the broker has advertised its Topic Alias Maximum in the CONNACK
+    ResetPublishDests(client);
+    client->broker_topic_alias_max = 0;
+    client->is_shared_sub_available = true;
+
     int err = EnableMosquitto(client);
     if (err != USP_ERR_OK)
     {
@@ -2103,16 +2485,9 @@ void MQTT_UpdateAllSockSet(socket_set_t *set)
                 case kMqttState_Running:
                     if (client->usp_record_send_queue.head)
                     {
-                        if (SendQueueHead(client) == USP_ERR_OK)
-                        {
-                            PopClientUspQueue(client);
-                        }
-                        else
-                        {
-                            USP_LOG_Error("%s: Failed to send head of the queue, leaving there to try again", __FUNCTION__);
-                        }
+                        SendQueuedMessages(client);
                     }
-                    else if (client->scheduled_action == kScheduledAction_Activated)
+                    else if ((client->scheduled_action == kScheduledAction_Activated) && (client->num_inflight == 0))
                     {
                         // Responses would be sent if here
                         USP_LOG_Debug("%s: Schedule reconnect ready!", __FUNCTION__);
@@ -2341,8 +2716,8 @@ bool MQTT_AreAllResponsesSent(void)
         client = &mqtt_clients[i];
         if (client->conn_params.instance != INVALID)
         {
-            // Check if the queue is empty
-            responses_sent = (client->usp_record_send_queue.head == NULL);
+            // Check if the queue is empty, and all sent messages have been acknowledged
+            responses_sent = (client->usp_record_send_queue.head == NULL) && (client->num_inflight == 0);
         }
         if (!responses_sent)
         {
@@ -2509,4 +2884,47 @@ int MQTT_ScheduleResubscription(int instance, mqtt_subscription_t *subscription)
     return err;
 }
 
+bool MQTT_IsValidShareName(char *share_name)
+{
+    // The ShareName must not be empty, and must not contain '/', '+' or '#' (MQTT v5.0 section 4.8.2)
+    if ((*share_name == '\0') || (strpbrk(share_name, "/+#") != NULL))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool MQTT_IsValidTopicFilter(char *topic)
+{
+    char *share_name;
+    char *filter;
+    char buf[MAX_DM_PATH];
+
+    // Exit if this is not a shared subscription. Other topic filters are validated by the broker
+    if (IsSharedSubscription(topic) == false)
+    {
+        return true;
+    }
+
+    // Split the topic into ShareName and TopicFilter
+    USP_STRNCPY(buf, &topic[sizeof(MQTT_SHARED_SUBSCRIPTION_PREFIX)-1], sizeof(buf));
+    share_name = buf;
+    filter = strchr(buf, '/');
+    if (filter == NULL)
+    {
+        return false;
+    }
+    *filter = '\0';
+    filter++;
+
+    // Exit if either the ShareName or the TopicFilter are invalid
+    if ((MQTT_IsValidShareName(share_name) == false) || (*filter == '\0'))
+    {
+        return false;
+    }
+
+    return true;
+}
+
 #endif
@@ -44,6 +44,10 @@
 
 #include <stdbool.h>
 
+// Prefix of an MQTT v5.0 shared subscription topic filter ie "$share/<ShareName>/<TopicFilter>"
+// Messages matching a shared subscription are load balanced by the broker across all clients subscribed with the same ShareName
+#define MQTT_SHARED_SUBSCRIPTION_PREFIX "$share/"
+
 typedef struct
 {
     unsigned connect_retrytime;
@@ -127,6 +131,11 @@ typedef struct
     bool request_response_info;
     bool request_problem_info;
     char* response_information;
+    unsigned int topic_alias_max;   // Maximum topic alias that the broker may use when publishing to us (v5.0 only)
+
+    // If not empty, the response topic is subscribed to as a shared subscription with this share name
+    // This allows multiple controller processes (using the same response topic) to have their received messages load balanced by the broker
+    char* shared_subscription_group;
 
 #if 0
     // These items are not currently used.
@@ -136,7 +145,6 @@ typedef struct
     unsigned int session_expiry;
     unsigned int receive_max;
     unsigned int max_packet_size;
-    unsigned int topic_alias_max;
     bool will_enable;
     unsigned int will_qos;
     bool will_retain;
@@ -424,6 +432,31 @@ void MQTT_InitConnParams(mqtt_conn_params_t* params);
 void MQTT_DestroyConnParams(mqtt_conn_params_t* params);
 
 
+/*********************************************************************//**
+** MQTT_IsValidTopicFilter
+**
+** Determines whether the specified topic filter is valid to subscribe to
+** In particular, this validates the format of shared subscriptions ie "$share/<ShareName>/<TopicFilter>"
+**
+** \param topic - topic filter to validate
+**
+** \return true if the topic filter is valid
+**
+**************************************************************************/
+bool MQTT_IsValidTopicFilter(char *topic);
+
+/*********************************************************************//**
+** MQTT_IsValidShareName
+**
+** Determines whether the specified string is valid to use as the ShareName of a shared subscription
+**
+** \param share_name - share name to validate
+**
+** \return true if the share name is valid
+**
+**************************************************************************/
+bool MQTT_IsValidShareName(char *share_name);
+
 /*********************************************************************//**
 ** MQTT_SubscriptionReplace
 **
@@ -66,6 +66,13 @@ static combined_role_t cur_msg_combined_role = { ROLE_DEFAULT, ROLE_DEFAULT};
 // Role to use with current USP message
 static controller_info_t cur_msg_controller_info;
 
+//------------------------------------------------------------------------
+// Definitions used when serializing the no_session_context field of a USP record (see usp-record.proto)
+#define USP_RECORD_NO_SESSION_CONTEXT_FIELD 7   // Field number of no_session_context in Record
+#define USP_RECORD_PAYLOAD_FIELD 2              // Field number of payload in NoSessionContextRecord
+#define PROTOBUF_LEN_DELIMITED_TAG(field)  (((field) << 3) | 2)   // Tag of a length delimited field (wire type 2)
+#define MAX_PROTOBUF_VARINT_LEN 5               // Maximum number of bytes in a varint encoding a 32 bit value
+
 //------------------------------------------------------------------------
 // Array used to convert from an enumeration to it's string representation
 static enum_entry_t usp_msg_types[] = {
@@ -95,6 +102,8 @@ static enum_entry_t usp_msg_types[] = {
 //------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 int HandleUspMessage(Usp__Msg *usp, char *controller_endpoint, mtp_reply_to_t *mrt);
+unsigned char *SerializeUspRecord(char *endpoint_id, Usp__Msg *usp, unsigned char *pbuf, int pbuf_len, int *p_len);
+int PackProtobufVarint(unsigned value, unsigned char *buf);
 int ValidateUspRecord(UspRecord__Record *rec);
 void CacheControllerRoleForCurMsg(char *endpoint_id, ctrust_role_t role, mtp_protocol_t protocol);
 
@@ -118,11 +127,15 @@ int MSG_HANDLER_HandleBinaryRecord(unsigned char *pbuf, int pbuf_len, ctrust_rol
     int err;
     UspRecord__Record *rec;
 
+    // Allocate the unpacked USP record, message and the response to it from the arena. These are all released in one go at the end of this function
+    USP_MEM_ArenaStart();
+
     // Exit if unable to unpack the USP record
-    rec = usp_record__record__unpack(pbuf_allocator, pbuf_len, pbuf);
+    rec = usp_record__record__unpack(pbuf_arena_allocator, pbuf_len, pbuf);
     if (rec == NULL)
     {
         USP_ERR_SetMessage("%s: usp_record__session_record__unpack failed. Ignoring USP Message", __FUNCTION__);
+        USP_MEM_ArenaReset();
         return USP_ERR_RECORD_NOT_PARSED;
     }
 
@@ -133,15 +146,14 @@ int MSG_HANDLER_HandleBinaryRecord(unsigned char *pbuf, int pbuf_len, ctrust_rol
         goto exit;
     }
 
-    // Print USP record in human readable form
-    PROTO_TRACE_ProtobufMessage(&rec->base);
-
     // Process the encapsulated USP message
-    err = MSG_HANDLER_HandleBinaryMessage(rec->no_session_context->payload.data, rec->no_session_context->payload.len, role, rec->from_id, mrt);
+    // NOTE: The USP record is traced along with the USP message, once the message has been unpacked
+    err = MSG_HANDLER_HandleBinaryMessage(rec->no_session_context->payload.data, rec->no_session_context->payload.len, role, rec->from_id, mrt, rec);
 
 exit:
-    // Free the unpacked USP record
-    usp_record__record__free_unpacked(rec, pbuf_allocator);
+    // Free the unpacked USP record, then release all memory allocated from the arena
+    usp_record__record__free_unpacked(rec, pbuf_arena_allocator);
+    USP_MEM_ArenaReset();
 
     return err;
 }
@@ -157,19 +169,24 @@ exit:
 ** \param   role - Role allowed for this message
 ** \param   controller_endpoint - endpoint which sent this message
 ** \param   mrt - details of where response to this USP message should be sent
+** \param   rec - pointer to USP record which contained this USP message (used for protocol trace)
 **
 ** \return  USP_ERR_OK if successful, USP_ERR_MESSAGE_NOT_UNDERSTOOD if unable to unpack the USP Record
 **
 **************************************************************************/
-int MSG_HANDLER_HandleBinaryMessage(unsigned char *pbuf, int pbuf_len, ctrust_role_t role, char *controller_endpoint, mtp_reply_to_t *mrt)
+int MSG_HANDLER_HandleBinaryMessage(unsigned char *pbuf, int pbuf_len, ctrust_role_t role, char *controller_endpoint, mtp_reply_to_t *mrt, UspRecord__Record *rec)
 {
     int err;
     Usp__Msg *usp;
 
     // Exit if unable to unpack the USP message
-    usp = usp__msg__unpack(pbuf_allocator, pbuf_len, pbuf);
+    usp = usp__msg__unpack(pbuf_arena_allocator, pbuf_len, pbuf);
     if (usp == NULL)
     {
+        if (PROTO_TRACE_IsSampled(kProtoTraceDir_Received))
+        {
+            PROTO_TRACE_UspRecord("Received", rec, NULL, NULL);
+        }
         USP_ERR_SetMessage("%s: usp__msg__unpack failed", __FUNCTION__);
         return USP_ERR_MESSAGE_NOT_UNDERSTOOD;
     }
@@ -177,8 +194,11 @@ int MSG_HANDLER_HandleBinaryMessage(unsigned char *pbuf, int pbuf_len, ctrust_ro
     // Set the role that the controller should use when handling this message
     CacheControllerRoleForCurMsg(controller_endpoint, role, mrt->protocol);
 
-    // Print USP message in human readable form
-    PROTO_TRACE_ProtobufMessage(&usp->base);
+    // Print USP record and message in human readable form
+    if (PROTO_TRACE_IsSampled(kProtoTraceDir_Received))
+    {
+        PROTO_TRACE_UspRecord("Received", rec, usp, NULL);
+    }
 
     // Exit if unable to process the message
     err = HandleUspMessage(usp, controller_endpoint, mrt);
@@ -192,7 +212,7 @@ int MSG_HANDLER_HandleBinaryMessage(unsigned char *pbuf, int pbuf_len, ctrust_ro
 
 exit:
     // Free the unpacked USP message
-    usp__msg__free_unpacked(usp, pbuf_allocator);
+    usp__msg__free_unpacked(usp, pbuf_arena_allocator);
 
     return err;
 }
@@ -230,8 +250,8 @@ void MSG_HANDLER_LogMessageToSend(Usp__Header__MsgType usp_msg_type, unsigned ch
                 host,
                 DEVICE_MTP_EnumToString(protocol) );
 
-    // Exit if protocol trace is not enabled
-    if (enable_protocol_trace == false)
+    // Exit if protocol trace is not enabled, or this message has not been selected by sampling
+    if (PROTO_TRACE_IsSampled(kProtoTraceDir_Sent) == false)
     {
         return;
     }
@@ -277,17 +297,8 @@ void MSG_HANDLER_LogMessageToSend(Usp__Header__MsgType usp_msg_type, unsigned ch
 
     USP_LOG_Info("to_id=%s\nfrom_id=%s", rec->to_id, rec->from_id);
 
-    // Print STOMP header (if message is being sent out on STOMP)
-    if (stomp_header != NULL)
-    {
-        USP_PROTOCOL("%s", stomp_header);                      // STOMP Header
-    }
-
-    // Print USP record in human readable form
-    PROTO_TRACE_ProtobufMessage(&rec->base);
-
-    // Print USP message in human readable form
-    PROTO_TRACE_ProtobufMessage(&usp->base);
+    // Print STOMP header (if message is being sent out on STOMP), USP record and USP message in human readable form
+    PROTO_TRACE_UspRecord("Sending", rec, usp, (char *)stomp_header);
 
     // Free the protobuf structures
     usp__msg__free_unpacked(usp, pbuf_allocator);
@@ -322,6 +333,7 @@ void MSG_HANDLER_HandleUnknownMsgType(Usp__Msg *usp, char *controller_endpoint,
 ** MSG_HANDLER_QueueMessage
 **
 ** Serializes a USP message to a buffer, then queues it, to be sent to a controller
+** NOTE: The USP message is serialized directly into the buffer containing the USP record, avoiding an intermediate copy
 **
 ** \param   endpoint_id - controller to send the message to
 ** \param   usp - pointer to protobuf-c structure describing the USP message to send
@@ -332,9 +344,8 @@ void MSG_HANDLER_HandleUnknownMsgType(Usp__Msg *usp, char *controller_endpoint,
 **************************************************************************/
 int MSG_HANDLER_QueueMessage(char *endpoint_id, Usp__Msg *usp, mtp_reply_to_t *mrt)
 {
-    unsigned char *pbuf;
-    int pbuf_len;
-    int size;
+    unsigned char *buf;
+    int len;
     int err;
 
     // Exit if parameters not specified
@@ -344,19 +355,19 @@ int MSG_HANDLER_QueueMessage(char *endpoint_id, Usp__Msg *usp, mtp_reply_to_t *m
         return USP_ERR_INTERNAL_ERROR;
     }
 
-    // Serialize the USP message into a buffer
-    pbuf_len = usp__msg__get_packed_size(usp);
-    pbuf = USP_MALLOC(pbuf_len);
-    size = usp__msg__pack(usp, pbuf);
-    USP_ASSERT(size == pbuf_len);          // If these are not equal, then we may have had a buffer overrun, so terminate
-
-    // Encapsulate this message in a USP record, then queue the record, to send to a controller
-    err = MSG_HANDLER_QueueUspRecord(usp->header->msg_type, endpoint_id, pbuf, pbuf_len, usp->header->msg_id, mrt, END_OF_TIME);
+    // Serialize the USP message directly into a USP record
+    buf = SerializeUspRecord(endpoint_id, usp, NULL, 0, &len);
 
-    // Free the serialized USP message
-    USP_FREE(pbuf);
+    // Exit if unable to queue the record, to send to a controller
+    // NOTE: If successful, ownership of the buffer passes to the MTP layer. If not successful, buffer is freed here
+    err = DEVICE_CONTROLLER_QueueBinaryMessage(usp->header->msg_type, endpoint_id, buf, len, usp->header->msg_id, mrt, END_OF_TIME);
+    if (err != USP_ERR_OK)
+    {
+        USP_FREE(buf);
+        return err;
+    }
 
-    return err;
+    return USP_ERR_OK;
 }
 
 /*********************************************************************//**
@@ -380,11 +391,8 @@ int MSG_HANDLER_QueueMessage(char *endpoint_id, Usp__Msg *usp, mtp_reply_to_t *m
 **************************************************************************/
 int MSG_HANDLER_QueueUspRecord(Usp__Header__MsgType usp_msg_type, char *endpoint_id, unsigned char *pbuf, int pbuf_len, char *usp_msg_id, mtp_reply_to_t *mrt, time_t expiry_time)
 {
-    UspRecord__Record rec;
-    UspRecord__NoSessionContextRecord ctx;
     unsigned char *buf;
     int len;
-    int size;
     int err;
 
     // Exit if no controller setup to send the message to
@@ -393,7 +401,54 @@ int MSG_HANDLER_QueueUspRecord(Usp__Header__MsgType usp_msg_type, char *endpoint
         return USP_ERR_OK;
     }
 
-    // Fill in the USP Record structure
+    // Serialize the USP record (with encapsulated USP message) into a buffer
+    buf = SerializeUspRecord(endpoint_id, NULL, pbuf, pbuf_len, &len);
+
+    // Exit if unable to queue the message, to send to a controller
+    // NOTE: If successful, ownership of the buffer passes to the MTP layer. If not successful, buffer is freed here
+    err = DEVICE_CONTROLLER_QueueBinaryMessage(usp_msg_type, endpoint_id, buf, len, usp_msg_id, mrt, expiry_time);
+    if (err != USP_ERR_OK)
+    {
+        USP_FREE(buf);
+        return err;
+    }
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** SerializeUspRecord
+**
+** Serializes a USP record (with encapsulated USP message) into a single dynamically allocated buffer
+** The USP message is either serialized directly into the buffer (if usp is given), or copied from an already serialized buffer (pbuf)
+**
+** The record is serialized in one pass, by first packing the record header fields (using protobuf-c), then appending
+** the no_session_context field. This works because no_session_context is the last field in a serialized record
+** and the payload is the only field in a NoSessionContextRecord
+**
+** \param   endpoint_id - controller to send the message to
+** \param   usp - pointer to protobuf-c structure describing the USP message to serialize, or NULL if the message has already been serialized
+** \param   pbuf - pointer to buffer containing serialized USP message (if usp is NULL)
+** \param   pbuf_len - length of protobuf encoded USP message (if usp is NULL)
+** \param   p_len - pointer to variable in which to return the length of the serialized USP record
+**
+** \return  pointer to dynamically allocated buffer containing the serialized USP record
+**
+**************************************************************************/
+unsigned char *SerializeUspRecord(char *endpoint_id, Usp__Msg *usp, unsigned char *pbuf, int pbuf_len, int *p_len)
+{
+    UspRecord__Record rec;
+    unsigned char tmp[MAX_PROTOBUF_VARINT_LEN];
+    unsigned char *buf;
+    unsigned char *p;
+    int header_len;
+    int payload_len;
+    int ctx_len;
+    int len;
+    int size;
+
+    // Fill in the USP Record structure, leaving out the no_session_context field, as that is serialized by this function
     // NOTE: This is all statically allocated (or owned elsewhere), so no need to free
     usp_record__record__init(&rec);
     rec.version = AGENT_CURRENT_PROTOCOL_VERSION;
@@ -404,29 +459,71 @@ int MSG_HANDLER_QueueUspRecord(Usp__Header__MsgType usp_msg_type, char *endpoint
     rec.mac_signature.len = 0;
     rec.sender_cert.data = NULL;
     rec.sender_cert.len = 0;
-    rec.record_type_case = USP_RECORD__RECORD__RECORD_TYPE_NO_SESSION_CONTEXT;
+    rec.record_type_case = USP_RECORD__RECORD__RECORD_TYPE__NOT_SET;
 
-    usp_record__no_session_context_record__init(&ctx);
-    ctx.payload.data = pbuf;
-    ctx.payload.len = pbuf_len;
-    rec.no_session_context = &ctx;
+    // Calculate the size of each part of the serialized record
+    // NOTE: A zero length payload is not serialized, as it is the default value of a proto3 bytes field
+    header_len = usp_record__record__get_packed_size(&rec);
+    payload_len = (usp != NULL) ? usp__msg__get_packed_size(usp) : pbuf_len;
+    ctx_len = (payload_len == 0) ? 0 : 1 + PackProtobufVarint(payload_len, tmp) + payload_len;
+    len = header_len + 1 + PackProtobufVarint(ctx_len, tmp) + ctx_len;
 
-    // Serialize the protobuf record structure into a buffer
-    len = usp_record__record__get_packed_size(&rec);
+    // Serialize the record header fields
     buf = USP_MALLOC(len);
     size = usp_record__record__pack(&rec, buf);
-    USP_ASSERT(size == len);          // If these are not equal, then we may have had a buffer overrun, so terminate
+    USP_ASSERT(size == header_len);   // If these are not equal, then we may have had a buffer overrun, so terminate
 
-    // Exit if unable to queue the message, to send to a controller
-    // NOTE: If successful, ownership of the buffer passes to the MTP layer. If not successful, buffer is freed here
-    err = DEVICE_CONTROLLER_QueueBinaryMessage(usp_msg_type, endpoint_id, buf, len, usp_msg_id, mrt, expiry_time);
-    if (err != USP_ERR_OK)
+    // Serialize the no_session_context field
+    p = &buf[header_len];
+    *p++ = PROTOBUF_LEN_DELIMITED_TAG(USP_RECORD_NO_SESSION_CONTEXT_FIELD);
+    p += PackProtobufVarint(ctx_len, p);
+
+    // Serialize the payload field of the NoSessionContextRecord, packing the USP message directly into it (if not already serialized)
+    if (payload_len != 0)
     {
-        USP_FREE(buf);
-        return err;
+        *p++ = PROTOBUF_LEN_DELIMITED_TAG(USP_RECORD_PAYLOAD_FIELD);
+        p += PackProtobufVarint(payload_len, p);
+        if (usp != NULL)
+        {
+            size = usp__msg__pack(usp, p);
+            USP_ASSERT(size == payload_len);   // If these are not equal, then we may have had a buffer overrun, so terminate
+        }
+        else
+        {
+            memcpy(p, pbuf, payload_len);
+        }
+        p += payload_len;
     }
+    USP_ASSERT(p - buf == len);
 
-    return USP_ERR_OK;
+    *p_len = len;
+    return buf;
+}
+
+/*********************************************************************//**
+**
+** PackProtobufVarint
+**
+** Serializes an unsigned integer as a protobuf varint
+**
+** \param   value - value to serialize
+** \param   buf - pointer to buffer in which to serialize the value. This must be at least MAX_PROTOBUF_VARINT_LEN bytes long
+**
+** \return  Number of bytes written to the buffer
+**
+**************************************************************************/
+int PackProtobufVarint(unsigned value, unsigned char *buf)
+{
+    int len = 0;
+
+    while (value >= 0x80)
+    {
+        buf[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+
+    return len;
 }
 
 /*********************************************************************//**
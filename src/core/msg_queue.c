@@ -0,0 +1,306 @@
+/*
+ *
+ * Copyright (C) 2021, Broadband Forum
+ * Copyright (C) 2021  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file msg_queue.c
+ *
+ * Lock-free multi-producer, single-consumer message queue used to pass messages between threads
+ * Messages are copied into a fixed size ring buffer, with each slot guarded by a sequence number
+ * which indicates whether the slot is free to write, or contains a message ready to read.
+ * Producer threads claim a slot by atomically incrementing the tail sequence number.
+ *
+ * The consumer thread is woken up via an eventfd, which it adds to its socket set.
+ * The eventfd is only signalled if the consumer has not already been signalled, so posting a burst of
+ * messages costs only a single system call. After waking up, the consumer must clear the wakeup,
+ * then read all messages from the queue.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "common_defs.h"
+#include "msg_queue.h"
+
+//------------------------------------------------------------------------------
+// Macros to access the sequence number and message contents of a slot in the ring buffer
+#define SLOT_PTR(mq, seq)   (&(mq)->slots[((seq) & ((mq)->num_slots-1)) * (mq)->slot_size])
+#define SLOT_SEQ(slot)      ((unsigned *)(slot))
+#define SLOT_MSG(slot)      ((slot) + sizeof(uint64_t))
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_Init
+**
+** Initialises a message queue
+**
+** \param   mq - pointer to message queue to initialise
+** \param   msg_size - size of each message carried by the queue
+** \param   num_slots - maximum number of messages that may be queued (rounded up to a power of 2)
+**                      or 0 if the queue is only used to wakeup the consumer thread
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int MSG_QUEUE_Init(msg_queue_t *mq, unsigned msg_size, unsigned num_slots)
+{
+    unsigned i;
+    unsigned char *slot;
+
+    memset(mq, 0, sizeof(msg_queue_t));
+
+    // Exit if unable to create the eventfd used to wakeup the consumer thread
+    mq->event_fd = eventfd(0, EFD_NONBLOCK);
+    if (mq->event_fd == -1)
+    {
+        USP_ERR_ERRNO("eventfd", errno);
+        mq->event_fd = INVALID;
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Exit if this queue only carries wakeups
+    if (num_slots == 0)
+    {
+        return USP_ERR_OK;
+    }
+
+    // Round up the number of slots to a power of 2, so that sequence numbers wrap around cleanly
+    mq->num_slots = 1;
+    while (mq->num_slots < num_slots)
+    {
+        mq->num_slots <<= 1;
+    }
+
+    // Each slot starts with its sequence number, followed by the message (aligned to 8 bytes)
+    mq->msg_size = msg_size;
+    mq->slot_size = (sizeof(uint64_t) + msg_size + 7) & ~7;
+    mq->slots = USP_MALLOC(mq->num_slots * mq->slot_size);
+
+    // Mark all slots as free to write
+    for (i=0; i < mq->num_slots; i++)
+    {
+        slot = SLOT_PTR(mq, i);
+        *SLOT_SEQ(slot) = i;
+    }
+
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_IsInitialised
+**
+** Determines whether the specified message queue has been initialised
+**
+** \param   mq - pointer to message queue
+**
+** \return  true if the message queue has been initialised
+**
+**************************************************************************/
+bool MSG_QUEUE_IsInitialised(msg_queue_t *mq)
+{
+    return (mq->event_fd != INVALID);
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_GetSocket
+**
+** Returns the file descriptor which the consumer thread should add to its socket set, to wait for messages
+**
+** \param   mq - pointer to message queue
+**
+** \return  file descriptor
+**
+**************************************************************************/
+int MSG_QUEUE_GetSocket(msg_queue_t *mq)
+{
+    return mq->event_fd;
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_Post
+**
+** Copies the specified message onto the message queue, and wakes up the consumer thread
+** NOTE: This function may be called from any thread
+** NOTE: If the queue is full, this function waits for the consumer thread to read a message
+**
+** \param   mq - pointer to message queue
+** \param   msg - pointer to message to post. This must be of the size given when the queue was initialised
+**
+** \return  None
+**
+**************************************************************************/
+void MSG_QUEUE_Post(msg_queue_t *mq, void *msg)
+{
+    unsigned pos;
+    unsigned seq;
+    unsigned char *slot;
+    int diff;
+
+    USP_ASSERT(mq->num_slots > 0);
+
+    // Claim the slot at the tail of the queue
+    pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+    while (1)
+    {
+        slot = SLOT_PTR(mq, pos);
+        seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+        diff = (int)(seq - pos);
+        if (diff == 0)
+        {
+            // Slot is free to write. Exit the loop if we successfully claimed it (otherwise pos is updated to the current tail)
+            if (__atomic_compare_exchange_n(&mq->tail, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Queue is full, so wait for the consumer thread to read a message
+            MSG_QUEUE_Wakeup(mq);
+            sched_yield();
+            pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            // Another producer claimed this slot, so try again with the current tail
+            pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Copy the message into the slot, then publish it to the consumer
+    memcpy(SLOT_MSG(slot), msg, mq->msg_size);
+    __atomic_store_n(SLOT_SEQ(slot), pos+1, __ATOMIC_RELEASE);
+
+    MSG_QUEUE_Wakeup(mq);
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_Wakeup
+**
+** Wakes up the consumer thread from its select(), if it has not already been signalled to wakeup
+** NOTE: This function may be called from any thread
+**
+** \param   mq - pointer to message queue
+**
+** \return  None
+**
+**************************************************************************/
+void MSG_QUEUE_Wakeup(msg_queue_t *mq)
+{
+    uint64_t val = 1;
+    int bytes_sent;
+
+    // Exit if the consumer thread has already been signalled, and has not yet woken up
+    // NOTE: The atomic exchange also ensures that any message posted before calling this function is visible to the consumer when it clears the wakeup
+    if (__atomic_exchange_n(&mq->wakeup_pending, 1, __ATOMIC_SEQ_CST) != 0)
+    {
+        return;
+    }
+
+    bytes_sent = write(mq->event_fd, &val, sizeof(val));
+    if (bytes_sent != sizeof(val))
+    {
+        char buf[USP_ERR_MAXLEN];
+        USP_LOG_Error("%s(%d): write failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
+    }
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_ClearWakeup
+**
+** Called by the consumer thread after it has been woken up, to allow it to be woken up again
+** NOTE: After calling this function, the consumer thread must read all messages from the queue
+**       (as messages posted before this call do not cause another wakeup)
+**
+** \param   mq - pointer to message queue
+**
+** \return  None
+**
+**************************************************************************/
+void MSG_QUEUE_ClearWakeup(msg_queue_t *mq)
+{
+    uint64_t val;
+    int bytes_read;
+
+    bytes_read = read(mq->event_fd, &val, sizeof(val));
+    if ((bytes_read != sizeof(val)) && (errno != EAGAIN))
+    {
+        USP_LOG_Error("%s: read() did not return the eventfd counter", __FUNCTION__);
+    }
+
+    (void)__atomic_exchange_n(&mq->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+}
+
+/*********************************************************************//**
+**
+** MSG_QUEUE_Get
+**
+** Reads the next message from the message queue
+** NOTE: This function must only be called by the consumer thread
+**
+** \param   mq - pointer to message queue
+** \param   msg - pointer to buffer in which to return the message. This must be of the size given when the queue was initialised
+**
+** \return  true if a message was read, false if the queue is empty
+**
+**************************************************************************/
+bool MSG_QUEUE_Get(msg_queue_t *mq, void *msg)
+{
+    unsigned char *slot;
+    unsigned seq;
+
+    // Exit if the slot at the head of the queue has not been written yet
+    slot = SLOT_PTR(mq, mq->head);
+    seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+    if (seq != mq->head+1)
+    {
+        return false;
+    }
+
+    // Copy the message out of the slot, then mark the slot as free to write (when the sequence number wraps around to it)
+    memcpy(msg, SLOT_MSG(slot), mq->msg_size);
+    __atomic_store_n(SLOT_SEQ(slot), mq->head + mq->num_slots, __ATOMIC_RELEASE);
+    mq->head++;
+
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ *
+ * Copyright (C) 2021, Broadband Forum
+ * Copyright (C) 2021  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file msg_queue.h
+ *
+ * Lock-free multi-producer, single-consumer message queue used to pass messages between threads
+ *
+ */
+
+#ifndef MSG_QUEUE_H
+#define MSG_QUEUE_H
+
+#include <stdbool.h>
+
+//------------------------------------------------------------------------------
+// Structure representing a message queue
+// NOTE: The consumer thread waits for messages by adding event_fd to its socket set
+typedef struct
+{
+    int event_fd;           // eventfd signalled to wakeup the consumer thread, or INVALID if the queue has not been initialised
+    int wakeup_pending;     // Set if event_fd has been signalled, but the consumer has not yet woken up. Used to avoid signalling event_fd for every message posted
+    unsigned msg_size;      // Size of each message carried by the queue
+    unsigned slot_size;     // Size of each slot in the ring buffer (sequence number followed by the message)
+    unsigned num_slots;     // Number of slots in the ring buffer (a power of 2), or 0 if the queue only carries wakeups
+    unsigned char *slots;   // Ring buffer of slots
+    unsigned head;          // Sequence number of the next slot to read. Only accessed by the consumer thread
+    unsigned tail;          // Sequence number of the next slot to write. Atomically claimed by producer threads
+} msg_queue_t;
+
+//------------------------------------------------------------------------------
+// Static initialiser for a message queue, allowing code to determine whether the queue has been initialised yet
+#define MSG_QUEUE_UNINITIALISED  { INVALID, 0, 0, 0, 0, NULL, 0, 0 }
+
+//------------------------------------------------------------------------------
+// API
+int MSG_QUEUE_Init(msg_queue_t *mq, unsigned msg_size, unsigned num_slots);
+bool MSG_QUEUE_IsInitialised(msg_queue_t *mq);
+int MSG_QUEUE_GetSocket(msg_queue_t *mq);
+void MSG_QUEUE_Post(msg_queue_t *mq, void *msg);
+void MSG_QUEUE_Wakeup(msg_queue_t *mq);
+void MSG_QUEUE_ClearWakeup(msg_queue_t *mq);
+bool MSG_QUEUE_Get(msg_queue_t *mq, void *msg);
+
+#endif
@@ -47,6 +47,7 @@
 #include "mtp_exec.h"
 #include "dm_exec.h"
 #include "os_utils.h"
+#include "msg_queue.h"
 
 #ifndef DISABLE_STOMP
 #include "stomp.h"
@@ -70,12 +71,8 @@ scheduled_action_t mtp_exit_scheduled = kScheduledAction_Off;
 
 #ifndef DISABLE_STOMP
 //------------------------------------------------------------------------------
-// Unix domain socket pair used to implement a wakeup message queue
-// One socket is always used for sending, and the other always used for receiving
-static int mtp_stomp_mq_sockets[2] = {-1, -1};
-
-#define mq_stomp_rx_socket  mtp_stomp_mq_sockets[0]
-#define mq_stomp_tx_socket  mtp_stomp_mq_sockets[1]
+// Queue used to wakeup the MTP thread (it carries no messages, only wakeups)
+static msg_queue_t mtp_stomp_mq = MSG_QUEUE_UNINITIALISED;
 
 //------------------------------------------------------------------------------
 // Flag set to true if the MTP thread has exited
@@ -85,12 +82,8 @@ bool is_stomp_mtp_thread_exited = false;
 
 #ifdef ENABLE_COAP
 //------------------------------------------------------------------------------
-// Unix domain socket pair used to implement a wakeup message queue
-// One socket is always used for sending, and the other always used for receiving
-static int mtp_coap_mq_sockets[2] = {-1, -1};
-
-#define mq_coap_rx_socket  mtp_coap_mq_sockets[0]
-#define mq_coap_tx_socket  mtp_coap_mq_sockets[1]
+// Queue used to wakeup the MTP thread (it carries no messages, only wakeups)
+static msg_queue_t mtp_coap_mq = MSG_QUEUE_UNINITIALISED;
 
 //------------------------------------------------------------------------------
 // Flag set to true if the MTP thread has exited
@@ -100,12 +93,8 @@ bool is_coap_mtp_thread_exited = false;
 
 #ifdef ENABLE_MQTT
 //------------------------------------------------------------------------------
-// Unix domain socket pair used to implement a wakeup message queue
-// One socket is always used for sending, and the other always used for receiving
-static int mtp_mqtt_mq_sockets[2] = {-1, -1};
-
-#define mq_mqtt_rx_socket  mtp_mqtt_mq_sockets[0]
-#define mq_mqtt_tx_socket  mtp_mqtt_mq_sockets[1]
+// Queue used to wakeup the MTP thread (it carries no messages, only wakeups)
+static msg_queue_t mtp_mqtt_mq = MSG_QUEUE_UNINITIALISED;
 
 //------------------------------------------------------------------------------
 // Flag set to true if the MTP thread has exited
@@ -113,15 +102,11 @@ static int mtp_mqtt_mq_sockets[2] = {-1, -1};
 bool is_mqtt_mtp_thread_exited = false;
 #endif
 
-//------------------------------------------------------------------------------
-// Message to post on wakeup message queue
-#define WAKEUP_MESSAGE 'W'
-
 //------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void UpdateMtpSockSet(socket_set_t *set);
 void ProcessMtpSocketActivity(socket_set_t *set);
-void ProcessMtpWakeupQueueSocketActivity(socket_set_t *set, int sock);
+void ProcessMtpWakeupQueueSocketActivity(socket_set_t *set, msg_queue_t *mq);
 
 /*********************************************************************//**
 **
@@ -142,32 +127,29 @@ int MTP_EXEC_Init(void)
     (void)err;
 
 #ifndef DISABLE_STOMP
-    // Exit if unable to initialize the unix domain socket pair used to implement a wakeup message queue
-    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, mtp_stomp_mq_sockets);
-    if (err != 0)
+    // Exit if unable to initialize the wakeup queue
+    err = MSG_QUEUE_Init(&mtp_stomp_mq, 0, 0);
+    if (err != USP_ERR_OK)
     {
-        USP_ERR_ERRNO("socketpair", errno);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 #endif
 
 #ifdef ENABLE_COAP
-    // Exit if unable to initialize the unix domain socket pair used to implement a wakeup message queue
-    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, mtp_coap_mq_sockets);
-    if (err != 0)
+    // Exit if unable to initialize the wakeup queue
+    err = MSG_QUEUE_Init(&mtp_coap_mq, 0, 0);
+    if (err != USP_ERR_OK)
     {
-        USP_ERR_ERRNO("socketpair", errno);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 #endif
 
 #ifdef ENABLE_MQTT
-    // Exit if unable to initialize the unix domain socket pair used to implement a wakeup message queue
-    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, mtp_mqtt_mq_sockets);
-    if (err != 0)
+    // Exit if unable to initialize the wakeup queue
+    err = MSG_QUEUE_Init(&mtp_mqtt_mq, 0, 0);
+    if (err != USP_ERR_OK)
     {
-        USP_ERR_ERRNO("socketpair", errno);
-        return USP_ERR_INTERNAL_ERROR;
+        return err;
     }
 #endif
 
@@ -188,17 +170,8 @@ int MTP_EXEC_Init(void)
 **************************************************************************/
 void MTP_EXEC_StompWakeup(void)
 {
-    char msg = WAKEUP_MESSAGE;
-    int bytes_sent;
-
-    // Send the message
-    bytes_sent = send(mq_stomp_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    // NOTE: Multiple wakeups posted before the MTP thread wakes up are coalesced into a single wakeup
+    MSG_QUEUE_Wakeup(&mtp_stomp_mq);
 }
 #endif
 
@@ -216,17 +189,8 @@ void MTP_EXEC_StompWakeup(void)
 **************************************************************************/
 void MTP_EXEC_CoapWakeup(void)
 {
-    char msg = WAKEUP_MESSAGE;
-    int bytes_sent;
-
-    // Send the message
-    bytes_sent = send(mq_coap_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    // NOTE: Multiple wakeups posted before the MTP thread wakes up are coalesced into a single wakeup
+    MSG_QUEUE_Wakeup(&mtp_coap_mq);
 }
 #endif
 
@@ -244,17 +208,8 @@ void MTP_EXEC_CoapWakeup(void)
 **************************************************************************/
 void MTP_EXEC_MqttWakeup(void)
 {
-    char msg = WAKEUP_MESSAGE;
-    int bytes_sent;
-
-    // Send the message
-    bytes_sent = send(mq_mqtt_tx_socket, &msg, sizeof(msg), 0);
-    if (bytes_sent != sizeof(msg))
-    {
-        char buf[USP_ERR_MAXLEN];
-        USP_LOG_Error("%s(%d): send failed : (err=%d) %s", __FUNCTION__, __LINE__, errno, USP_ERR_ToString(errno, buf, sizeof(buf)) );
-        return;
-    }
+    // NOTE: Multiple wakeups posted before the MTP thread wakes up are coalesced into a single wakeup
+    MSG_QUEUE_Wakeup(&mtp_mqtt_mq);
 }
 #endif
 /*********************************************************************//**
@@ -368,12 +323,15 @@ void *MTP_EXEC_StompMain(void *args)
     int num_sockets;
     socket_set_t set;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     while(FOREVER)
     {
         // Create the set of all sockets to receive/transmit on (with timeout)
         SOCKET_SET_Clear(&set);
         STOMP_UpdateAllSockSet(&set);
-        SOCKET_SET_AddSocketToReceiveFrom(mq_stomp_rx_socket, MAX_SOCKET_TIMEOUT, &set);
+        SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&mtp_stomp_mq), MAX_SOCKET_TIMEOUT, &set);
 
         // Wait for read/write activity on sockets or timeout
         num_sockets = SOCKET_SET_Select(&set);
@@ -391,7 +349,7 @@ void *MTP_EXEC_StompMain(void *args)
                 // No controllers with any activity, but we still may need to process a timeout, so fall-through
             default:
                 // Process the wakeup queue
-                ProcessMtpWakeupQueueSocketActivity(&set, mq_stomp_rx_socket);
+                ProcessMtpWakeupQueueSocketActivity(&set, &mtp_stomp_mq);
 
                 // Process activity on all STOMP message queues
                 STOMP_ProcessAllSocketActivity(&set);
@@ -435,12 +393,15 @@ void *MTP_EXEC_MqttMain(void *args)
     int num_sockets;
     socket_set_t set;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     while(FOREVER)
     {
         // Create the set of all sockets to receive/transmit on (with timeout)
         SOCKET_SET_Clear(&set);
         MQTT_UpdateAllSockSet(&set);
-        SOCKET_SET_AddSocketToReceiveFrom(mq_mqtt_rx_socket, MAX_SOCKET_TIMEOUT, &set);
+        SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&mtp_mqtt_mq), MAX_SOCKET_TIMEOUT, &set);
 
         // Wait for read/write activity on sockets or timeout
         num_sockets = SOCKET_SET_Select(&set);
@@ -457,7 +418,7 @@ void *MTP_EXEC_MqttMain(void *args)
                 // No controllers with any activity, but we still may need to process a timeout, so fall-through
             default:
                 // Process the wakeup queue
-                ProcessMtpWakeupQueueSocketActivity(&set, mq_mqtt_rx_socket);
+                ProcessMtpWakeupQueueSocketActivity(&set, &mtp_mqtt_mq);
 
                 // Process activity on all MQTT message queues
                 MQTT_ProcessAllSocketActivity(&set);
@@ -501,12 +462,15 @@ void *MTP_EXEC_CoapMain(void *args)
     int num_sockets;
     socket_set_t set;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     while(FOREVER)
     {
         // Create the set of all sockets to receive/transmit on (with timeout)
         SOCKET_SET_Clear(&set);
         COAP_UpdateAllSockSet(&set);
-        SOCKET_SET_AddSocketToReceiveFrom(mq_coap_rx_socket, MAX_SOCKET_TIMEOUT, &set);
+        SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&mtp_coap_mq), MAX_SOCKET_TIMEOUT, &set);
 
         // Wait for read/write activity on sockets or timeout
         num_sockets = SOCKET_SET_Select(&set);
@@ -526,7 +490,7 @@ void *MTP_EXEC_CoapMain(void *args)
                 // No controllers with any activity, but we still may need to process a timeout, so fall-through
             default:
                 // Process the wakeup queue
-                ProcessMtpWakeupQueueSocketActivity(&set, mq_coap_rx_socket);
+                ProcessMtpWakeupQueueSocketActivity(&set, &mtp_coap_mq);
 
                 // Process activity on all COAP message queues
                 COAP_ProcessAllSocketActivity(&set);
@@ -558,34 +522,23 @@ void *MTP_EXEC_CoapMain(void *args)
 ** ProcessMtpWakeupQueueSocketActivity
 **
 ** Processes any activity on the message queue receiving socket
-** NOTE: There are separate sockets for STOMP and CoAP MTP tasks, but both use this function for processing
+** NOTE: There are separate wakeup queues for each MTP thread, but all use this function for processing
 **
 ** \param   set - pointer to socket set structure containing sockets with activity on them
-** \param   sock - socket on which the wakeup message is received
+** \param   mq - wakeup queue of the MTP thread
 **
 ** \return  None (any errors that occur are handled internally)
 **
 **************************************************************************/
-void ProcessMtpWakeupQueueSocketActivity(socket_set_t *set, int sock)
+void ProcessMtpWakeupQueueSocketActivity(socket_set_t *set, msg_queue_t *mq)
 {
-    int bytes_read;
-    char msg;
-
-    // Exit if there is no activity on the wakeup message queue socket
-    if (SOCKET_SET_IsReadyToRead(sock, set) == 0)
-    {
-        return;
-    }
-
-    // Exit if unable to purge this wakeup message from the queue
-    bytes_read = recv(sock, &msg, sizeof(msg), 0);
-    if (bytes_read != sizeof(msg))
+    // Exit if there is no activity on the wakeup queue socket
+    if (SOCKET_SET_IsReadyToRead(MSG_QUEUE_GetSocket(mq), set) == 0)
     {
-        USP_LOG_Error("%s: recv() did not return a full message", __FUNCTION__);
         return;
     }
 
-    // Throw the message away, it's only purpose is to break the select()
-    USP_ASSERT(msg == WAKEUP_MESSAGE);
+    // Clear the wakeup, it's only purpose is to break the select()
+    MSG_QUEUE_ClearWakeup(mq);
 }
 
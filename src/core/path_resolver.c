@@ -52,6 +52,7 @@
 #include "expr_vector.h"
 #include "text_utils.h"
 #include "group_get_vector.h"
+#include "uptime.h"
 
 //-------------------------------------------------------------------------
 // State variable associated with the resolver. This is passed to all recursive resolver functions
@@ -80,11 +81,37 @@ typedef struct
                             // or INVALID if controller does not have read permission for that {instance, key} pair
     group_get_vector_t ggv; // group get vector for the valid parameters
     int_vector_t key_types; // integer vector for valid key types
+    expr_const_t *key_consts; // array of the constants in the expressions in keys[] (same index), or NULL if not compiled yet
 } search_param_t;
 
 //--------------------------------------------------------------------
 // Typedef for the compare callback
-typedef int (*dm_cmp_cb_t)(char *lhs, expr_op_t op, char *rhs, bool *result);
+typedef int (*dm_cmp_cb_t)(char *lhs, expr_op_t op, expr_const_t *rhs, bool *result);
+
+//-------------------------------------------------------------------------
+// Cache of the results of resolving path expressions, indexed by the hash of the path expression
+// Entries are only valid whilst resolver_cache_generation is unchanged (it is incremented whenever the schema, object instances
+// or permissions change) and until the instances of any object with a refresh instances vendor hook used in the resolution expire
+// NOTE: The cache is only accessed from the data model thread
+typedef struct
+{
+    char *path;             // Path expression resolved, or NULL if this entry is unused
+    resolve_op_t op;        // Operation that the path expression was resolved for
+    unsigned flags;         // Flags that the path expression was resolved with
+    bool is_internal_role;  // Set if the path expression was resolved with INTERNAL_ROLE, in which case role is not used
+    combined_role_t role;   // Role that the path expression was resolved with
+    bool has_group_ids;     // Set if the group_ids of the resolved paths were requested (and hence are stored in gv)
+    unsigned generation;    // Value of resolver_cache_generation when the path expression was resolved
+    uint64_t valid_until_ms;// Monotonic time (in ms) after which this entry must not be used
+    int separator_count;    // Value to return in separator_split
+    str_vector_t sv;        // Resolved paths
+    int_vector_t gv;        // Group_ids of resolved paths (if has_group_ids is set)
+} resolver_cache_entry_t;
+
+static resolver_cache_entry_t *resolver_cache = NULL;   // Allocated on first use, containing PATH_RESOLVER_CACHE_SIZE entries
+static unsigned resolver_cache_generation = 0;
+static uint64_t resolver_cache_valid_until_ms;          // Expiry time of the path expression currently being resolved
+static int resolver_depth = 0;                          // Number of nested calls to PATH_RESOLVER_ResolvePath() in progress
 
 //-------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
@@ -111,7 +138,12 @@ int ResolveIntermediateReferences(str_vector_t *params, resolver_state_t *state,
 bool GroupReferencedParameters(str_vector_t *params, resolver_state_t *state, int_vector_t *perm, group_get_vector_t *ggv, int *err);
 void InitSearchParam(search_param_t *sp);
 void DestroySearchParam(search_param_t *sp);
+void CompileSearchKeys(search_param_t *sp);
 void RefreshInstances_LifecycleSubscriptionEndingInPartialPath(char *path);
+bool IsResolverCacheable(char *path, str_vector_t *sv, int_vector_t *gv);
+resolver_cache_entry_t *FindResolverCacheEntry(char *path, resolve_op_t op, combined_role_t *combined_role, unsigned flags, bool has_group_ids);
+void AddResolverCacheEntry(char *path, resolve_op_t op, combined_role_t *combined_role, unsigned flags, str_vector_t *sv, int_vector_t *gv, int separator_count, unsigned generation);
+void DestroyResolverCacheEntry(resolver_cache_entry_t *rce);
 
 /*********************************************************************//**
 **
@@ -216,7 +248,11 @@ int PATH_RESOLVER_ResolvePath(char *path, str_vector_t *sv, int_vector_t *gv, re
     char resolved[MAX_DM_PATH];
     char unresolved[MAX_DM_PATH];
     int err;
+    int i;
     resolver_state_t state;
+    resolver_cache_entry_t *rce;
+    bool is_cacheable;
+    unsigned generation;
 
     // Use of the gv argument is only valid for paths that describe parameters
     USP_ASSERT((gv==NULL) || (op==kResolveOp_Get) || (op==kResolveOp_Set) || (op==kResolveOp_SubsValChange) || (op==kResolveOp_GetBulkData));
@@ -228,6 +264,30 @@ int PATH_RESOLVER_ResolvePath(char *path, str_vector_t *sv, int_vector_t *gv, re
         return USP_ERR_INVALID_PATH_SYNTAX;
     }
 
+    // Exit if the path expression has been resolved before, and nothing has changed that would alter its resolution
+    is_cacheable = IsResolverCacheable(path, sv, gv);
+    if (is_cacheable)
+    {
+        rce = FindResolverCacheEntry(path, op, combined_role, flags, (gv != NULL));
+        if (rce != NULL)
+        {
+            for (i=0; i < rce->sv.num_entries; i++)
+            {
+                STR_VECTOR_Add(sv, rce->sv.vector[i]);
+                if (gv != NULL)
+                {
+                    INT_VECTOR_Add(gv, rce->gv.vector[i]);
+                }
+            }
+
+            if (separator_split != NULL)
+            {
+                *separator_split = rce->separator_count;
+            }
+            return USP_ERR_OK;
+        }
+    }
+
     // Take a copy of the path expression, so that the code below may alter the unresolved buffer
     USP_STRNCPY(unresolved, path, sizeof(unresolved));
 
@@ -240,7 +300,23 @@ int PATH_RESOLVER_ResolvePath(char *path, str_vector_t *sv, int_vector_t *gv, re
     state.combined_role = combined_role;
     state.flags = flags;
 
+    // Start tracking the validity of the resolution, if it may be cached
+    // NOTE: Any nested resolutions (eg caused by refreshing instances) may only reduce the validity of the outermost resolution
+    if (is_cacheable)
+    {
+        resolver_cache_valid_until_ms = INVALID_MSECS;
+    }
+    generation = resolver_cache_generation;
+
+    resolver_depth++;
     err = ExpandPath(resolved, unresolved, &state);
+    resolver_depth--;
+
+    // Cache the resolved paths
+    if ((is_cacheable) && (err == USP_ERR_OK))
+    {
+        AddResolverCacheEntry(path, op, combined_role, flags, sv, gv, state.separator_count, generation);
+    }
 
     // Return the point at which to split the path
     if (separator_split != NULL)
@@ -251,6 +327,260 @@ int PATH_RESOLVER_ResolvePath(char *path, str_vector_t *sv, int_vector_t *gv, re
     return err;
 }
 
+/*********************************************************************//**
+**
+** PATH_RESOLVER_InvalidateCache
+**
+** Called when the schema, the instances of any object, or the permissions of any role have changed
+** This invalidates all cached path expression resolutions
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void PATH_RESOLVER_InvalidateCache(void)
+{
+    resolver_cache_generation++;
+}
+
+/*********************************************************************//**
+**
+** PATH_RESOLVER_GetGeneration
+**
+** Returns a value which changes whenever the schema, the instances of any object, or the permissions of any role have changed
+** Callers which keep their own resolved paths can use this to determine whether they need to resolve their path expressions again
+**
+** \param   None
+**
+** \return  current generation of the path resolver
+**
+**************************************************************************/
+unsigned PATH_RESOLVER_GetGeneration(void)
+{
+    return resolver_cache_generation;
+}
+
+/*********************************************************************//**
+**
+** PATH_RESOLVER_LimitCacheValidity
+**
+** Called when resolving a path expression uses instances which are only valid until the specified time
+** This ensures that the cached resolution is not used after that time
+**
+** \param   expiry_ms - monotonic time (in ms) after which the instances used must be refreshed, or 0 if the resolution must not be cached
+**
+** \return  None
+**
+**************************************************************************/
+void PATH_RESOLVER_LimitCacheValidity(uint64_t expiry_ms)
+{
+    if (expiry_ms < resolver_cache_valid_until_ms)
+    {
+        resolver_cache_valid_until_ms = expiry_ms;
+    }
+}
+
+/*********************************************************************//**
+**
+** PATH_RESOLVER_Destroy
+**
+** Frees all memory used by the path resolver cache
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void PATH_RESOLVER_Destroy(void)
+{
+    int i;
+
+    if (resolver_cache == NULL)
+    {
+        return;
+    }
+
+    for (i=0; i < PATH_RESOLVER_CACHE_SIZE; i++)
+    {
+        DestroyResolverCacheEntry(&resolver_cache[i]);
+    }
+
+    USP_FREE(resolver_cache);
+    resolver_cache = NULL;
+}
+
+/*********************************************************************//**
+**
+** IsResolverCacheable
+**
+** Determines whether the resolution of the specified path expression may be cached
+** Only path expressions whose resolution depends solely on the schema, the object instances and the permissions are cached.
+** Search expressions and reference following depend on parameter values, which (for vendor parameters) may change without the USP Agent knowing
+**
+** \param   path - pointer to path expression to resolve
+** \param   sv - pointer to string vector to return the resolved paths in
+** \param   gv - pointer to vector in which to return the group_id of the parameters, or NULL if the caller is not interested in this
+**
+** \return  true if the resolution may be cached
+**
+**************************************************************************/
+bool IsResolverCacheable(char *path, str_vector_t *sv, int_vector_t *gv)
+{
+    // Exit if the cache is disabled
+    if (PATH_RESOLVER_CACHE_SIZE == 0)
+    {
+        return false;
+    }
+
+    // Exit if this is a nested resolution. Only the outermost resolution is cached
+    if (resolver_depth > 0)
+    {
+        return false;
+    }
+
+    // Exit if the caller is only checking whether the path expression is valid,
+    // or is appending to a non-empty vector (in which case the paths resolved depend on those already in the vector)
+    if ((sv == NULL) || (sv->num_entries != 0) || ((gv != NULL) && (gv->num_entries != 0)))
+    {
+        return false;
+    }
+
+    // Exit if the path expression contains a search expression or reference follow
+    if (strpbrk(path, "[+") != NULL)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*********************************************************************//**
+**
+** FindResolverCacheEntry
+**
+** Finds a valid cached resolution of the specified path expression
+**
+** \param   path - pointer to path expression to resolve
+** \param   op - operation being performed that requires path resolution
+** \param   combined_role - role to use when performing the resolution
+** \param   flags - flags controlling resolving of the path eg GET_ALL_INSTANCES
+** \param   has_group_ids - set if the group_ids of the resolved paths are required
+**
+** \return  pointer to cache entry, or NULL if no valid cached resolution exists
+**
+**************************************************************************/
+resolver_cache_entry_t *FindResolverCacheEntry(char *path, resolve_op_t op, combined_role_t *combined_role, unsigned flags, bool has_group_ids)
+{
+    resolver_cache_entry_t *rce;
+
+    // Exit if nothing has been cached yet
+    if (resolver_cache == NULL)
+    {
+        return NULL;
+    }
+
+    // Exit if the entry at this hash position is not for this resolution
+    rce = &resolver_cache[ TEXT_UTILS_CalcHash(path) % PATH_RESOLVER_CACHE_SIZE ];
+    if ((rce->path == NULL) || (rce->op != op) || (rce->flags != flags) || (rce->has_group_ids != has_group_ids) ||
+        (rce->is_internal_role != (combined_role == INTERNAL_ROLE)) ||
+        ((combined_role != INTERNAL_ROLE) && (memcmp(&rce->role, combined_role, sizeof(combined_role_t)) != 0)) ||
+        (strcmp(rce->path, path) != 0))
+    {
+        return NULL;
+    }
+
+    // Exit if the entry is no longer valid
+    if ((rce->generation != resolver_cache_generation) || (tu_uptime_msecs64() >= rce->valid_until_ms))
+    {
+        return NULL;
+    }
+
+    return rce;
+}
+
+/*********************************************************************//**
+**
+** AddResolverCacheEntry
+**
+** Caches the resolution of the specified path expression, replacing any existing entry at the same hash position
+**
+** \param   path - pointer to path expression that was resolved
+** \param   op - operation that the path expression was resolved for
+** \param   combined_role - role that the path expression was resolved with
+** \param   flags - flags that the path expression was resolved with
+** \param   sv - pointer to string vector containing the resolved paths
+** \param   gv - pointer to vector containing the group_id of the resolved paths, or NULL if not required
+** \param   separator_count - value to return in separator_split
+** \param   generation - value of resolver_cache_generation when the resolution started
+**
+** \return  None
+**
+**************************************************************************/
+void AddResolverCacheEntry(char *path, resolve_op_t op, combined_role_t *combined_role, unsigned flags, str_vector_t *sv, int_vector_t *gv, int separator_count, unsigned generation)
+{
+    resolver_cache_entry_t *rce;
+    int i;
+
+    // Exit if the resolution is already out of date (eg instances were refreshed during it), or must not be cached
+    if ((generation != resolver_cache_generation) || (resolver_cache_valid_until_ms <= tu_uptime_msecs64()))
+    {
+        return;
+    }
+
+    // Allocate the cache, if this is the first entry being added
+    if (resolver_cache == NULL)
+    {
+        resolver_cache = USP_MALLOC(PATH_RESOLVER_CACHE_SIZE * sizeof(resolver_cache_entry_t));
+        memset(resolver_cache, 0, PATH_RESOLVER_CACHE_SIZE * sizeof(resolver_cache_entry_t));
+    }
+
+    // Replace the existing entry
+    rce = &resolver_cache[ TEXT_UTILS_CalcHash(path) % PATH_RESOLVER_CACHE_SIZE ];
+    DestroyResolverCacheEntry(rce);
+
+    rce->path = USP_STRDUP(path);
+    rce->op = op;
+    rce->flags = flags;
+    rce->is_internal_role = (combined_role == INTERNAL_ROLE);
+    if (combined_role != INTERNAL_ROLE)
+    {
+        memcpy(&rce->role, combined_role, sizeof(combined_role_t));
+    }
+    rce->has_group_ids = (gv != NULL);
+    rce->generation = generation;
+    rce->valid_until_ms = resolver_cache_valid_until_ms;
+    rce->separator_count = separator_count;
+
+    STR_VECTOR_Clone(&rce->sv, sv->vector, sv->num_entries);
+    if (gv != NULL)
+    {
+        USP_ASSERT(gv->num_entries == sv->num_entries);
+        for (i=0; i < gv->num_entries; i++)
+        {
+            INT_VECTOR_Add(&rce->gv, gv->vector[i]);
+        }
+    }
+}
+
+/*********************************************************************//**
+**
+** DestroyResolverCacheEntry
+**
+** Frees all memory used by the specified cache entry, marking it as unused
+**
+** \param   rce - pointer to cache entry
+**
+** \return  None
+**
+**************************************************************************/
+void DestroyResolverCacheEntry(resolver_cache_entry_t *rce)
+{
+    USP_SAFE_FREE(rce->path);
+    STR_VECTOR_Destroy(&rce->sv);
+    INT_VECTOR_Destroy(&rce->gv);
+}
+
 /*********************************************************************//**
 **
 ** ExpandPath
@@ -1143,6 +1473,10 @@ int ResolveUniqueKey(char *resolved, char *unresolved, resolver_state_t *state)
     GROUP_GET_VECTOR_GetValues(&sp.ggv);
     GROUP_GET_VECTOR_GetValues(&ref_sp.ggv);
 
+    // Convert the constants in the key expressions once, rather than for every instance
+    CompileSearchKeys(&sp);
+    CompileSearchKeys(&ref_sp);
+
     // Iterate over all instances of the object present in the data model
     for (i=0; i < instances.num_entries; i++)
     {
@@ -1382,7 +1716,8 @@ int DoUniqueKeysMatch(int index, search_param_t *sp, bool *is_match)
 
         // Exit if an error occurred when comparing the values
         // This could occur if the operator was invalid for the specified type, or type conversion failed
-        err = cmp_cb(gge->value, ec->op, ec->value, &result);
+        // NOTE: The constant in the key expression is only converted the first time that it is compared as each type
+        err = cmp_cb(gge->value, ec->op, &sp->key_consts[i], &result);
         if (err != USP_ERR_OK)
         {
             return err;
@@ -1400,6 +1735,35 @@ int DoUniqueKeysMatch(int index, search_param_t *sp, bool *is_match)
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** CompileSearchKeys
+**
+** Prepares the constants in the key expressions of the search parameter set for comparison against the values of many object instances
+** NOTE: The constants are converted lazily by the DM_ACCESS_CompareXXX() functions, as only then is the type of the key parameter known
+**
+** \param   sp - pointer to search parameter set
+**
+** \return  None
+**
+**************************************************************************/
+void CompileSearchKeys(search_param_t *sp)
+{
+    int i;
+
+    // Exit if there are no keys to compile
+    if (sp->keys.num_entries == 0)
+    {
+        return;
+    }
+
+    sp->key_consts = USP_MALLOC(sp->keys.num_entries * sizeof(expr_const_t));
+    for (i=0; i < sp->keys.num_entries; i++)
+    {
+        DM_ACCESS_InitExprConst(&sp->key_consts[i], sp->keys.vector[i].value);
+    }
+}
+
 /*********************************************************************//**
 **
 ** ExpandNextSubPath
@@ -2185,6 +2549,7 @@ void InitSearchParam(search_param_t *sp)
     INT_VECTOR_Init(&sp->ggv_indexes);
     GROUP_GET_VECTOR_Init(&sp->ggv);
     INT_VECTOR_Init(&sp->key_types);
+    sp->key_consts = NULL;
 }
 
 /*********************************************************************//**
@@ -2204,4 +2569,5 @@ void DestroySearchParam(search_param_t *sp)
     INT_VECTOR_Destroy(&sp->ggv_indexes);
     GROUP_GET_VECTOR_Destroy(&sp->ggv);
     INT_VECTOR_Destroy(&sp->key_types);
+    USP_SAFE_FREE(sp->key_consts);
 }
@@ -41,6 +41,7 @@
 #ifndef PATH_RESOLVER_H
 #define PATH_RESOLVER_H
 
+#include <stdint.h>
 #include "str_vector.h"
 
 // Enumeration determining what we are attempting to resolve with the path expression
@@ -74,6 +75,10 @@ typedef enum
 // API
 int PATH_RESOLVER_ResolveDevicePath(char *path, str_vector_t *sv, int_vector_t *gv, resolve_op_t op, int *separator_split, combined_role_t *combined_role, unsigned flags);
 int PATH_RESOLVER_ResolvePath(char *path, str_vector_t *sv, int_vector_t *gv, resolve_op_t op, int *separator_split, combined_role_t *combined_role, unsigned flags);
+void PATH_RESOLVER_InvalidateCache(void);
+unsigned PATH_RESOLVER_GetGeneration(void);
+void PATH_RESOLVER_LimitCacheValidity(uint64_t expiry_ms);
+void PATH_RESOLVER_Destroy(void);
 
 
 
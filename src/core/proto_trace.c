@@ -44,14 +44,158 @@
 
 #include "common_defs.h"
 #include "proto_trace.h"
+#include "msg_handler.h"
+#include "os_utils.h"
 
 // Number of spaces to use for each indentation block when printing messages in JSON format
 #define INDENTATION 2
 
+//------------------------------------------------------------------------------------
+// Variables controlling which USP messages are traced, and in which format
+// Only 1 in proto_trace_sample_rate USP messages (in each direction) are traced. If a filter is set, then only USP messages whose
+// message type or from/to endpoint matches the filter are traced in full. All others are traced in compact format.
+static proto_trace_mode_t proto_trace_mode = kProtoTraceMode_Full;
+static unsigned proto_trace_sample_rate = 1;
+static unsigned proto_trace_sample_count[kProtoTraceDir_Max] = { 0 };   // Separate counters, so that sampling of request/response traffic does not always select the same direction
+static char proto_trace_filter[MAX_DM_SHORT_VALUE_LEN] = { 0 };     // Empty string indicates no filter
+
+// Mutex protecting access to proto_trace_filter, as it is read by the MTP threads and written by the data model thread
+static pthread_mutex_t proto_trace_access_mutex;
+
 //------------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void PrintProtobufCMessageRecursive(ProtobufCMessage *msg, int indent);
 void PrintProtobufFieldRecursive(const ProtobufCFieldDescriptor *fields, void *p_value, int indent);
+void PrintCompactUspRecord(const char *direction, UspRecord__Record *rec, Usp__Msg *usp);
+bool IsFullTraceRequired(UspRecord__Record *rec, Usp__Msg *usp);
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_Init
+**
+** Initialises this component
+**
+** \param   None
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int PROTO_TRACE_Init(void)
+{
+    return OS_UTILS_InitMutex(&proto_trace_access_mutex);
+}
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_IsSampled
+**
+** Determines whether the next USP message in the specified direction should be traced
+** This is called before unpacking a USP record just for tracing, so that the cost of unpacking is not incurred for USP messages which are not traced
+**
+** \param   dir - whether the USP message was received or is being sent
+**
+** \return  true if protocol trace is enabled and the next USP message has been selected by sampling
+**
+**************************************************************************/
+bool PROTO_TRACE_IsSampled(proto_trace_dir_t dir)
+{
+    unsigned count;
+
+    // Exit if protocol trace not enabled
+    if (enable_protocol_trace==false)
+    {
+        return false;
+    }
+
+    // NOTE: This function is called by the data model thread (for received messages) and the MTP threads (for sent messages)
+    count = __atomic_fetch_add(&proto_trace_sample_count[dir], 1, __ATOMIC_RELAXED);
+    return ((count % proto_trace_sample_rate) == 0);
+}
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_UspRecord
+**
+** Traces the specified USP record and the USP message contained in it, in either full or compact format
+** NOTE: The caller must have called PROTO_TRACE_IsSampled() to determine whether to call this function
+**
+** \param   direction - string describing whether the message was sent or received
+** \param   rec - pointer to unpacked USP record
+** \param   usp - pointer to unpacked USP message contained in the USP record, or NULL if it could not be unpacked
+** \param   mtp_header - pointer to MTP header (eg STOMP frame header) to print before the USP record when tracing in full, or NULL if none
+**
+** \return  None
+**
+**************************************************************************/
+void PROTO_TRACE_UspRecord(const char *direction, UspRecord__Record *rec, Usp__Msg *usp, char *mtp_header)
+{
+    if (IsFullTraceRequired(rec, usp))
+    {
+        if (mtp_header != NULL)
+        {
+            USP_PROTOCOL("%s", mtp_header);
+        }
+        PROTO_TRACE_ProtobufMessage(&rec->base);
+        if (usp != NULL)
+        {
+            PROTO_TRACE_ProtobufMessage(&usp->base);
+        }
+    }
+    else
+    {
+        PrintCompactUspRecord(direction, rec, usp);
+    }
+}
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_SetMode
+**
+** Sets the format in which USP messages are traced
+**
+** \param   mode - format in which USP messages are traced
+**
+** \return  None
+**
+**************************************************************************/
+void PROTO_TRACE_SetMode(proto_trace_mode_t mode)
+{
+    proto_trace_mode = mode;
+}
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_SetSampleRate
+**
+** Sets the rate at which USP messages are sampled for tracing
+**
+** \param   rate - 1 in this number of USP messages are traced. 0 is treated as 1 (all messages traced)
+**
+** \return  None
+**
+**************************************************************************/
+void PROTO_TRACE_SetSampleRate(unsigned rate)
+{
+    proto_trace_sample_rate = (rate == 0) ? 1 : rate;
+}
+
+/*********************************************************************//**
+**
+** PROTO_TRACE_SetFilter
+**
+** Sets the filter selecting USP messages to trace in full
+**
+** \param   filter - USP message type (eg 'GET') or endpoint_id to match, or NULL or empty string to remove the filter
+**
+** \return  None
+**
+**************************************************************************/
+void PROTO_TRACE_SetFilter(char *filter)
+{
+    OS_UTILS_LockMutex(&proto_trace_access_mutex);
+    USP_STRNCPY(proto_trace_filter, (filter != NULL) ? filter : "", sizeof(proto_trace_filter));
+    OS_UTILS_UnlockMutex(&proto_trace_access_mutex);
+}
 
 /*********************************************************************//**
 **
@@ -76,6 +220,91 @@ void PROTO_TRACE_ProtobufMessage(ProtobufCMessage *base)
     USP_PROTOCOL("\n");
 }
 
+/*********************************************************************//**
+**
+** IsFullTraceRequired
+**
+** Determines whether the specified USP record should be traced in full, or in compact format
+**
+** \param   rec - pointer to unpacked USP record
+** \param   usp - pointer to unpacked USP message contained in the USP record, or NULL if it could not be unpacked
+**
+** \return  true if the USP record should be traced in full
+**
+**************************************************************************/
+bool IsFullTraceRequired(UspRecord__Record *rec, Usp__Msg *usp)
+{
+    bool is_full;
+    char *msg_type;
+
+    OS_UTILS_LockMutex(&proto_trace_access_mutex);
+
+    // If no filter is set, then the trace mode determines the format
+    if (proto_trace_filter[0] == '\0')
+    {
+        is_full = (proto_trace_mode == kProtoTraceMode_Full);
+        goto exit;
+    }
+
+    // Otherwise, only USP messages matching the filter are traced in full
+    is_full = ((strcmp(rec->from_id, proto_trace_filter) == 0) || (strcmp(rec->to_id, proto_trace_filter) == 0));
+    if ((is_full == false) && (usp != NULL) && (usp->header != NULL))
+    {
+        msg_type = MSG_HANDLER_UspMsgTypeToString(usp->header->msg_type);
+        is_full = (strcasecmp(msg_type, proto_trace_filter) == 0);
+    }
+
+exit:
+    OS_UTILS_UnlockMutex(&proto_trace_access_mutex);
+    return is_full;
+}
+
+/*********************************************************************//**
+**
+** PrintCompactUspRecord
+**
+** Prints a one line summary of the specified USP record and the USP message contained in it
+**
+** \param   direction - string describing whether the message was sent or received
+** \param   rec - pointer to unpacked USP record
+** \param   usp - pointer to unpacked USP message contained in the USP record, or NULL if it could not be unpacked
+**
+** \return  None
+**
+**************************************************************************/
+void PrintCompactUspRecord(const char *direction, UspRecord__Record *rec, Usp__Msg *usp)
+{
+    char *msg_type = "UNKNOWN";
+    char *msg_id = "";
+    int size = 0;
+    Usp__Error *error = NULL;
+
+    if ((rec->record_type_case == USP_RECORD__RECORD__RECORD_TYPE_NO_SESSION_CONTEXT) && (rec->no_session_context != NULL))
+    {
+        size = rec->no_session_context->payload.len;
+    }
+
+    if ((usp != NULL) && (usp->header != NULL))
+    {
+        msg_type = MSG_HANDLER_UspMsgTypeToString(usp->header->msg_type);
+        msg_id = usp->header->msg_id;
+    }
+
+    if ((usp != NULL) && (usp->body != NULL) && (usp->body->msg_body_case == USP__BODY__MSG_BODY_ERROR))
+    {
+        error = usp->body->error;
+    }
+
+    if (error != NULL)
+    {
+        USP_PROTOCOL("%s %s msg_id=%s from=%s to=%s size=%d err_code=%u err_msg=%s", direction, msg_type, msg_id, rec->from_id, rec->to_id, size, error->err_code, error->err_msg);
+    }
+    else
+    {
+        USP_PROTOCOL("%s %s msg_id=%s from=%s to=%s size=%d", direction, msg_type, msg_id, rec->from_id, rec->to_id, size);
+    }
+}
+
 /*********************************************************************//**
 **
 ** PrintProtobufCMessageRecursive
@@ -42,10 +42,36 @@
 #define PROTO_TRACE_H
 
 #include <protobuf-c/protobuf-c.h>
+#include "usp-msg.pb-c.h"
+#include "usp-record.pb-c.h"
+
+//------------------------------------------------------------------------------
+// Enumeration of the formats in which USP messages are traced
+typedef enum
+{
+    kProtoTraceMode_Full,       // Every field of the USP record and message is printed
+    kProtoTraceMode_Compact,    // A one line summary is printed for each USP message
+} proto_trace_mode_t;
+
+//------------------------------------------------------------------------------
+// Enumeration of the directions in which USP messages are traced. Each direction is sampled independently
+typedef enum
+{
+    kProtoTraceDir_Received,
+    kProtoTraceDir_Sent,
+
+    kProtoTraceDir_Max          // This should always be the last entry in this enumeration. It is used to size arrays
+} proto_trace_dir_t;
 
 //------------------------------------------------------------------------------
 // API Functions
+int PROTO_TRACE_Init(void);
 void PROTO_TRACE_ProtobufMessage(ProtobufCMessage *msg);
+bool PROTO_TRACE_IsSampled(proto_trace_dir_t dir);
+void PROTO_TRACE_UspRecord(const char *direction, UspRecord__Record *rec, Usp__Msg *usp, char *mtp_header);
+void PROTO_TRACE_SetMode(proto_trace_mode_t mode);
+void PROTO_TRACE_SetSampleRate(unsigned rate);
+void PROTO_TRACE_SetFilter(char *filter);
 
 
 #endif
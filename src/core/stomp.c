@@ -73,10 +73,12 @@
 #include "text_utils.h"
 #include "device.h"
 #include "nu_ipaddr.h"
+#include "dns_resolver.h"
 #include "os_utils.h"
 #include "dm_exec.h"
 #include "nu_macaddr.h"
 #include "retry_wait.h"
+#include "uptime.h"
 
 
 //------------------------------------------------------------------------------
@@ -96,6 +98,7 @@ typedef enum
     kStompState_SendingSubscribeFrame,      // Sending the subscribe frame, to subscribe to this Agent's queue
     kStompState_Running,                    // Normal steady state: Connection is ready to send and receive USP messages
     kStompState_Retrying,                   // An error has occurred. We have dropped the TCP connection and will attempt a reconnect at some time in the future
+    kStompState_Resolving,                  // Waiting for the IP address of the STOMP server to be looked up (asynchronously)
 
     kStompState_Max
 } stomp_state_t;
@@ -109,7 +112,8 @@ char *state_names[kStompState_Max] =
     "AwaitingConnectedFrame",   // kStompState_AwaitingConnectedFrame
     "SendingSubscribeFrame",    // kStompState_SendingSubscribeFrame
     "Running",                  // kStompState_Running
-    "Retrying"                  // kStompState_Retrying
+    "Retrying",                 // kStompState_Retrying
+    "Resolving"                 // kStompState_Resolving
 };
 
 //------------------------------------------------------------------------------
@@ -144,7 +148,7 @@ typedef struct
     bool enable_encryption;
     char *virtual_host;
     bool enable_heartbeats;
-    unsigned incoming_heartbeat_period;  // in ms. NOTE: the negotiated heartbeat_period is stored in seconds
+    unsigned incoming_heartbeat_period;  // in ms
     unsigned outgoing_heartbeat_period;  // in ms
     stomp_retry_params_t retry;         // Parameters associated with retrying the connection
     char *provisionned_queue;           // Name of stomp queue to subscribe to (in Device.LocalAgent.MTP.{i}.STOMP.Destination)
@@ -153,9 +157,9 @@ typedef struct
     // State variables
     stomp_state_t state;    // current state of this STOMP connection
     time_t last_status_change; // Time at which the status of the connection changed (as seen by Device.STOMP.Connection.{i}.LastChangeDate
-    time_t  stomp_handshake_timeout;   // Absolute Time by which the STOMP connection should have performed initial STOMP handshake (ie STOMP, CONNECTED, SUBSCRIBE frame sequence)
+    uint64_t stomp_handshake_timeout;  // Monotonic time (in ms) by which the STOMP connection should have performed initial STOMP handshake (ie STOMP, CONNECTED, SUBSCRIBE frame sequence)
     int retry_count;        // Number of times that the connection has been tried, and has failed. Starts from 0.
-    time_t retry_time;      // If state is kStompState_Retrying, then this is the unix time at which the retry should be attempted
+    uint64_t retry_time;    // If state is kStompState_Retrying, then this is the monotonic time (in ms) at which the retry should be attempted
     stomp_failure_t failure_code; // If the STOMP connection fails, this gets set to the last cause of failure
     scheduled_action_t  schedule_reconnect;  // Sets whether a STOMP reconnect is scheduled after the send queue has cleared
 
@@ -170,13 +174,13 @@ typedef struct
 
     char *subscribe_dest;   // STOMP destination to subscribe to (received from the STOMP server in the CONNECTED frame).
                             // This overrides Device.LocalAgent.MTP.{i}.STOMP.Destination.
-    int agent_heartbeat_period;   // Negotiated number of seconds between sending out heartbeats (if no other message has been sent in the meantime)
+    int agent_heartbeat_period;   // Negotiated number of milliseconds between sending out heartbeats (if no other message has been sent in the meantime)
                                   // Or zero if heartbeats should not be sent
-    int server_heartbeat_period;   // Negotiated number of seconds between receiving heartbeats (if no other message has been sent in the meantime)
+    int server_heartbeat_period;   // Negotiated number of milliseconds between receiving heartbeats (if no other message has been sent in the meantime)
                                   // Or zero if heartbeats are not expected to be received from the server
-    time_t next_heartbeat_time;  // Absolute time at which next agent heartbeat should be sent, or INVALID_TIME if heartbeats are not being sent
+    uint64_t next_heartbeat_time;  // Monotonic time (in ms) at which next agent heartbeat should be sent, or INVALID_MSECS if heartbeats are not being sent
 
-    time_t last_received_time; // Last time at which a heartbeat or a USP message was received from the server, or INVALID_TIME if nothing received yet (eg connection is in retrying state)
+    uint64_t last_received_time; // Monotonic time (in ms) at which a heartbeat or a USP message was last received from the server, or INVALID_MSECS if nothing received yet (eg connection is in retrying state)
 
     unsigned char *rxframe;   // pointer to buffer, used to concatenate message fragments until a complete message has been received
     int rxframe_msglen;       // number of message bytes copied into rxframe
@@ -221,7 +225,7 @@ typedef struct
 
 //------------------------------------------------------------------------------
 // Variables associated with determining whether the Management IP address has changed (used by UpdateMgmtInterface)
-static time_t next_mgmt_if_poll_time = 0;   // Absolute time at which to next poll for IP address change
+static uint64_t next_mgmt_if_poll_time = 0; // Monotonic time (in ms) at which to next poll for IP address change
 #ifdef CONNECT_ONLY_OVER_WAN_INTERFACE
 char last_mgmt_ip_addr[NU_IPADDRSTRLEN] = { 0 };
 #endif
@@ -267,6 +271,7 @@ int UpdateMgmtInterface(void);
 void UpdateWANInterface(bool is_first_time);
 stomp_connection_t *FindStompConnByInst(int instance);
 void StartStompConnection(stomp_connection_t *sc);
+void ConnectToStompServer(stomp_connection_t *sc);
 void StopStompConnection(stomp_connection_t *sc, bool purge_queued_messages);
 void InitStompConnection(stomp_connection_t *sc);
 int PerformStompSslConnect(stomp_connection_t *sc);
@@ -381,6 +386,9 @@ int STOMP_Start(void)
         goto exit;
     }
 
+    // Allow reconnects to the server to resume the previous TLS session, avoiding a full handshake
+    DEVICE_SECURITY_EnableSessionCache(stomp_ssl_ctx);
+
     // If code gets here then it was successful
     err = USP_ERR_OK;
 
@@ -406,8 +414,8 @@ void STOMP_UpdateAllSockSet(socket_set_t *set)
     stomp_connection_t *sc;
     bool responses_sent;
     int timeout;
-    time_t cur_time;
-    time_t expected_heartbeat_time;
+    uint64_t cur_time;
+    uint64_t expected_heartbeat_time;
 
     OS_UTILS_LockMutex(&stomp_access_mutex);
 
@@ -421,7 +429,7 @@ void STOMP_UpdateAllSockSet(socket_set_t *set)
 
     // Determine whether IP address has changed (if time to poll it)
     timeout = UpdateMgmtInterface();
-    SOCKET_SET_UpdateTimeout(timeout*SECONDS, set);
+    SOCKET_SET_UpdateTimeout(timeout, set);
 
     // Iterate over all STOMP connections, updating the ones that are enabled
     for (i=0; i<MAX_STOMP_CONNECTIONS; i++)
@@ -478,22 +486,22 @@ void STOMP_UpdateAllSockSet(socket_set_t *set)
             }
 
             // Handle STOMP server heartbeat timeouts
-            if ((sc->server_heartbeat_period != 0) && (sc->last_received_time != INVALID_TIME))
+            if ((sc->server_heartbeat_period != 0) && (sc->last_received_time != INVALID_MSECS))
             {
                 // If a STOMP server heartbeat timeout has occurred...
-                cur_time = time(NULL);
-                expected_heartbeat_time = sc->last_received_time + sc->server_heartbeat_period + STOMP_SERVER_HEARTBEAT_GRACE_PERIOD;
+                cur_time = tu_uptime_msecs64();
+                expected_heartbeat_time = sc->last_received_time + sc->server_heartbeat_period + STOMP_SERVER_HEARTBEAT_GRACE_PERIOD*SECONDS;
                 if (cur_time >= expected_heartbeat_time)
                 {
                     // Cause a retry to occur
-                    USP_LOG_Error("ERROR: STOMP server heartbeat not received (cur_time=%d, last_received_time=%d)", (int)cur_time, (int)sc->last_received_time);
+                    USP_LOG_Error("ERROR: STOMP server heartbeat not received (nothing received for %d ms)", (int)(cur_time - sc->last_received_time));
                     HandleStompSocketError(sc, kStompFailure_Timeout);
                 }
                 else
                 {
                     // Otherwise, update timeout, so that it at least occurs when the STOMP server heartbeat timeout would fire
-                    timeout = (int)(expected_heartbeat_time - cur_time);
-                    SOCKET_SET_UpdateTimeout(timeout*SECONDS, set);
+                    timeout = tu_msecs_until(expected_heartbeat_time, cur_time);
+                    SOCKET_SET_UpdateTimeout(timeout, set);
                 }
             }
 
@@ -690,7 +698,7 @@ exit:
 ** STOMP_EnableConnection
 **
 ** TCP Connects to the specified STOMP connection
-** On exit, the state will be either kStompState_SendingStompFrame (success) or kStompState_Retrying (failure)
+** On exit, the state will be either kStompState_Resolving (waiting for DNS), kStompState_SendingStompFrame (success) or kStompState_Retrying (failure)
 **
 ** \param   sp - pointer to data model parameters specifying the STOMP connection
 ** \param   stomp_queue - destination queue to use for this device (ie the agent's queue)
@@ -1142,6 +1150,7 @@ char *STOMP_GetConnectionStatus(int instance, time_t *last_change_date)
 
         default:
         case kStompState_Idle:
+        case kStompState_Resolving:
         case kStompState_SendingStompFrame:
         case kStompState_AwaitingConnectedFrame:
         case kStompState_SendingSubscribeFrame:
@@ -1218,7 +1227,7 @@ exit:
 ** StartStompConnection
 **
 ** TCP Connects to the specified STOMP connection
-** On exit, the state will be either kStompState_SendingStompFrame (success) or kStompState_Retrying (failure)
+** On exit, the state will be either kStompState_Resolving (waiting for DNS), kStompState_SendingStompFrame (success) or kStompState_Retrying (failure)
 **
 ** \param   sc - pointer to STOMP connection
 **
@@ -1227,20 +1236,6 @@ exit:
 **************************************************************************/
 void StartStompConnection(stomp_connection_t *sc)
 {
-    int err;
-    char buf[NU_IPADDRSTRLEN];
-    bool prefer_ipv6;
-    nu_ipaddr_t dst;
-    struct sockaddr_storage saddr;
-    socklen_t saddr_len;
-    sa_family_t family;
-    fd_set writefds;
-    struct timeval timeout;
-    int num_sockets;
-    int so_err;
-    socklen_t so_len = sizeof(so_err);
-    nu_ipaddr_t local_mgmt_addr;
-    stomp_failure_t stomp_err = kStompFailure_OtherError;
     char *mgmt_interface = "any";   // Used only for debug purposes
 
     // Copy across the next connection parameters to use into the working state
@@ -1257,6 +1252,42 @@ void StartStompConnection(stomp_connection_t *sc)
     // Initialise state
     InitStompConnection(sc);
 
+    // Start looking up the IP address of the STOMP server
+    // NOTE: If the IP address is not cached, then ConnectToStompServer() is called again (from UpdateStompConnectionSockSet) when the lookup completes
+    sc->state = kStompState_Resolving;
+    ConnectToStompServer(sc);
+}
+
+/*********************************************************************//**
+**
+** ConnectToStompServer
+**
+** TCP Connects to the STOMP server, once its IP address has been looked up
+** On exit, the state will be either kStompState_Resolving (lookup still pending), kStompState_SendingStompFrame (success) or kStompState_Retrying (failure)
+**
+** \param   sc - pointer to STOMP connection
+**
+** \return  None. If the connection failed, it will be retried later
+**
+**************************************************************************/
+void ConnectToStompServer(stomp_connection_t *sc)
+{
+    int err;
+    char buf[NU_IPADDRSTRLEN];
+    bool prefer_ipv6;
+    nu_ipaddr_t dst;
+    dns_result_t dns_result;
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    sa_family_t family;
+    fd_set writefds;
+    struct timeval timeout;
+    int num_sockets;
+    int so_err;
+    socklen_t so_len = sizeof(so_err);
+    nu_ipaddr_t local_mgmt_addr;
+    stomp_failure_t stomp_err = kStompFailure_OtherError;
+
     // Get the preference for IPv4 or IPv6, if dual stack
     prefer_ipv6 = DEVICE_LOCAL_AGENT_GetDualStackPreference();
 
@@ -1280,9 +1311,16 @@ void StartStompConnection(stomp_connection_t *sc)
     nu_ipaddr_set_zero(&local_mgmt_addr);
 #endif
 
+    // Exit if the IP address of the STOMP server is still being looked up
+    // The MTP thread is woken up when the lookup completes, and this function is then called again
+    dns_result = DNS_RESOLVER_Lookup(sc->host, prefer_ipv6, &local_mgmt_addr, &dst, MTP_EXEC_StompWakeup);
+    if (dns_result == kDnsResult_Pending)
+    {
+        return;
+    }
+
     // Exit if unable to determine the IP address of the STOMP server
-    err = tw_ulib_diags_lookup_host(sc->host, AF_UNSPEC, prefer_ipv6, &local_mgmt_addr, &dst);
-    if (err != USP_ERR_OK)
+    if (dns_result != kDnsResult_Resolved)
     {
         stomp_err = kStompFailure_ServerDNS;
         goto exit;
@@ -1435,6 +1473,12 @@ exit:
     if (stomp_err != kStompFailure_None)
     {
         USP_LOG_Error("ERROR: STOMP failed whilst attempting to connect to (host=%s, port=%d)", sc->host, sc->port);
+
+        // Look up the IP address of the STOMP server again on the next retry, in case the server has moved to a different IP address
+        if (stomp_err == kStompFailure_Connect)
+        {
+            DNS_RESOLVER_Invalidate(sc->host);
+        }
         HandleStompSocketError(sc, stomp_err);
     }
 }
@@ -1485,8 +1529,8 @@ void StopStompConnection(stomp_connection_t *sc, bool purge_queued_messages)
     USP_SAFE_FREE(sc->subscribe_dest);
     sc->agent_heartbeat_period = 0;
     sc->server_heartbeat_period = 0;
-    sc->next_heartbeat_time = INVALID_TIME;
-    sc->last_received_time = INVALID_TIME;
+    sc->next_heartbeat_time = INVALID_MSECS;
+    sc->last_received_time = INVALID_MSECS;
     sc->mgmt_ip_addr[0] = '\0';
     sc->mgmt_if_name[0] = '\0';
 
@@ -1528,13 +1572,13 @@ void StopStompConnection(stomp_connection_t *sc, bool purge_queued_messages)
 **************************************************************************/
 void InitStompConnection(stomp_connection_t *sc)
 {
-    time_t cur_time;
+    uint64_t cur_time;
 
-    cur_time = time(NULL);
+    cur_time = tu_uptime_msecs64();
     sc->state = kStompState_Idle;
     sc->retry_time = 0;
-    #define STOMP_HANDSHAKE_TIMEOUT 10 // Total time allowed to perform the STOMP handshake sequence (ie STOMP, CONNECTED, SUBSCRIBE frames)
-    sc->stomp_handshake_timeout = cur_time + STOMP_HANDSHAKE_TIMEOUT;
+    #define STOMP_HANDSHAKE_TIMEOUT 10 // Total time allowed (in seconds) to perform the STOMP handshake sequence (ie STOMP, CONNECTED, SUBSCRIBE frames)
+    sc->stomp_handshake_timeout = cur_time + STOMP_HANDSHAKE_TIMEOUT*SECONDS;
 
     sc->schedule_reconnect = kScheduledAction_Off;
     sc->schedule_resubscribe = kScheduledAction_Off;
@@ -1548,8 +1592,8 @@ void InitStompConnection(stomp_connection_t *sc)
 
     sc->agent_heartbeat_period = 0;
     sc->server_heartbeat_period = 0;
-    sc->next_heartbeat_time = INVALID_TIME;
-    sc->last_received_time = INVALID_TIME;
+    sc->next_heartbeat_time = INVALID_MSECS;
+    sc->last_received_time = INVALID_MSECS;
 
     sc->rxframe = NULL;
     sc->rxframe_msglen = 0;
@@ -1565,7 +1609,7 @@ void InitStompConnection(stomp_connection_t *sc)
     // Store the time at which we started connecting, unless we want to preserve the time at which an error first occurred
     if (sc->failure_code == kStompFailure_None)
     {
-        sc->last_status_change = cur_time;
+        sc->last_status_change = time(NULL);
     }
 
 }
@@ -1605,6 +1649,9 @@ int PerformStompSslConnect(stomp_connection_t *sc)
         return err;
     }
 
+    // Offer a previously negotiated session to the server, to avoid a full handshake on reconnect
+    DEVICE_SECURITY_SetSessionKey(sc->ssl, sc->host, sc->port);
+
     // Exit if unable to attach the socket to our SSL connection
     err = SSL_set_fd(sc->ssl, sc->socket_fd);
     if (err != 1)
@@ -1641,6 +1688,12 @@ int PerformStompSslConnect(stomp_connection_t *sc)
         {
             return err;
         }
+        DEVICE_SECURITY_SetSessionRole(sc->ssl, sc->role);
+    }
+    else
+    {
+        // No certificate chain is collected when a session is resumed, so use the role determined when the session was negotiated
+        DEVICE_SECURITY_GetResumedSessionRole(sc->ssl, &sc->role);
     }
 
     // Allow SSL_write() to write a partial message ie not block if it cannot write the full message
@@ -1665,19 +1718,19 @@ int PerformStompSslHandshake(stomp_connection_t *sc)
 {
     int err;
     int result;
-    time_t timeout_time;
+    uint64_t timeout_time;
     int timeout_ms;
     socket_set_t set;
     int num_sockets;
 
     #define STOMP_SSL_HANDSHAKE_TIMEOUT 10  // in seconds
-    timeout_time = time(NULL) + STOMP_SSL_HANDSHAKE_TIMEOUT;
+    timeout_time = tu_uptime_msecs64() + STOMP_SSL_HANDSHAKE_TIMEOUT*SECONDS;
 
     while(true)
     {
         // Exit if connect timed out (calculating the amount of time left)
-        timeout_ms = (timeout_time - time(NULL)) * 1000;
-        if (timeout_ms < 0)
+        timeout_ms = tu_msecs_until(timeout_time, tu_uptime_msecs64());
+        if (timeout_ms == 0)
         {
             USP_LOG_Error("%s: SSL handshake timed out", __FUNCTION__);
             return USP_ERR_INTERNAL_ERROR;
@@ -1750,8 +1803,8 @@ int PerformStompSslHandshake(stomp_connection_t *sc)
 void UpdateStompConnectionSockSet(stomp_connection_t *sc, socket_set_t *set)
 {
     int err;
-    time_t cur_time;
-    time_t timeout;
+    uint64_t cur_time;
+    int timeout;
 
     // If we have timed out whilst attempting to perform the initial STOMP handshake (STOMP+CONNECTED+SUBSCRIBE frames)
     // then abort and retry the connection. This probably means the server is down
@@ -1759,7 +1812,7 @@ void UpdateStompConnectionSockSet(stomp_connection_t *sc, socket_set_t *set)
         (sc->state==kStompState_AwaitingConnectedFrame) ||
         (sc->state==kStompState_SendingSubscribeFrame))
     {
-        cur_time = time(NULL);
+        cur_time = tu_uptime_msecs64();
         if (cur_time >= sc->stomp_handshake_timeout)
         {
             USP_LOG_Error("%s: STOMP timed out (in state=%s) whilst performing initial STOMP handshake to (host=%s, port=%d)", __FUNCTION__, state_names[sc->state], sc->host, sc->port);
@@ -1776,17 +1829,17 @@ void UpdateStompConnectionSockSet(stomp_connection_t *sc, socket_set_t *set)
 
         case kStompState_SendingStompFrame:
             timeout = CalcTimeoutToStompHandshakeFailure(sc);
-            SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout*SECONDS, set);
+            SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout, set);
             break;
 
         case kStompState_AwaitingConnectedFrame:
             timeout = CalcTimeoutToStompHandshakeFailure(sc);
-            SOCKET_SET_AddSocketToReceiveFrom(sc->socket_fd, timeout*SECONDS, set);
+            SOCKET_SET_AddSocketToReceiveFrom(sc->socket_fd, timeout, set);
             break;
 
         case kStompState_SendingSubscribeFrame:
             timeout = CalcTimeoutToStompHandshakeFailure(sc);
-            SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout*SECONDS, set);
+            SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout, set);
             break;
 
         case kStompState_Running:
@@ -1797,25 +1850,34 @@ void UpdateStompConnectionSockSet(stomp_connection_t *sc, socket_set_t *set)
             }
             break;
 
+        case kStompState_Resolving:
+            // Continue connecting, if the lookup of the STOMP server's IP address has completed
+            ConnectToStompServer(sc);
+
+            // Add this socket, if the connection has started successfully
+            if (sc->state == kStompState_SendingStompFrame)
+            {
+                SOCKET_SET_AddSocketToSendTo(sc->socket_fd, 0, set);
+            }
+            break;
+
         case kStompState_Retrying:
-            cur_time = time(NULL);
-            timeout = sc->retry_time - cur_time;
-            if (timeout <= 0)
+            timeout = tu_msecs_until(sc->retry_time, tu_uptime_msecs64());
+            if (timeout == 0)
             {
                 // It's time to retry
                 StartStompConnection(sc);
-                timeout = 0;
 
                 // Add this socket, if the connection has started successfully
                 if (sc->state == kStompState_SendingStompFrame)
                 {
-                    SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout*SECONDS, set);
+                    SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout, set);
                 }
             }
             else
             {
                 // Wait until it's time to retry
-                SOCKET_SET_UpdateTimeout(timeout*SECONDS, set);   // Retry in 5 seconds time
+                SOCKET_SET_UpdateTimeout(timeout, set);
             }
             break;
 
@@ -1842,8 +1904,7 @@ void UpdateStompConnectionSockSet(stomp_connection_t *sc, socket_set_t *set)
 int HandleStompRunningState(stomp_connection_t *sc, socket_set_t *set)
 {
     int err;
-    time_t timeout;
-    time_t cur_time;
+    int timeout;
 
     // If not currently transmitting a frame, then see if there are any more to send
     if (sc->txframe == NULL)
@@ -1858,24 +1919,20 @@ int HandleStompRunningState(stomp_connection_t *sc, socket_set_t *set)
     }
 
     // Calculate timeout to next heartbeat
-    timeout = 3600;                 // Default timeout with no heartbeats
-    if (sc->next_heartbeat_time != INVALID_TIME)
+    timeout = MAX_SOCKET_TIMEOUT;   // Default timeout with no heartbeats
+    if (sc->next_heartbeat_time != INVALID_MSECS)
     {
-        cur_time = time(NULL);
-        timeout = sc->next_heartbeat_time - cur_time;
-        if (timeout < 0)
-        {
-            timeout = 0;    // This is only necessary for the case of message processing taking longer than the heartbeat time
-        }
+        // NOTE: The timeout is zero if message processing took longer than the heartbeat time
+        timeout = tu_msecs_until(sc->next_heartbeat_time, tu_uptime_msecs64());
     }
 
     // Always listening, in this state
-    SOCKET_SET_AddSocketToReceiveFrom(sc->socket_fd, timeout*SECONDS, set);
+    SOCKET_SET_AddSocketToReceiveFrom(sc->socket_fd, timeout, set);
 
     // Want to transmit message (or heartbeat) if one is pending
     if ((sc->txframe != NULL) || (timeout == 0))
     {
-        SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout*SECONDS, set);
+        SOCKET_SET_AddSocketToSendTo(sc->socket_fd, timeout, set);
     }
 
     return USP_ERR_OK;
@@ -1998,8 +2055,9 @@ void ProcessStompConnectionSocketActivity(stomp_connection_t *sc, socket_set_t *
             break;
 
         case kStompState_Retrying:
-            // We would not expect any socket activity whilst in this state
-            // Code implementing the retry mechanism is present in UpdateStompConnectionSockSet()
+        case kStompState_Resolving:
+            // We would not expect any socket activity whilst in these states
+            // Code implementing the retry mechanism and DNS lookup completion is present in UpdateStompConnectionSockSet()
             break;
 
         default:
@@ -2013,27 +2071,17 @@ void ProcessStompConnectionSocketActivity(stomp_connection_t *sc, socket_set_t *
 **
 ** CalcTimeoutToStompHandshakeFailure
 **
-** Calculates the delay (in seconds) left until the initial STOMP handshake has timed out
+** Calculates the delay (in ms) left until the initial STOMP handshake has timed out
 ** The initial STOMP handshake is the sequence with frames STOMP, CONNECTED & SUBSCRIBE
 **
 ** \param   sc - pointer to STOMP connection
 **
-** \return  Number of seconds left of initial STOMP handshake timeout
+** \return  Number of milliseconds left of initial STOMP handshake timeout
 **
 **************************************************************************/
 int CalcTimeoutToStompHandshakeFailure(stomp_connection_t *sc)
 {
-    time_t cur_time;
-    int timeout;
-
-    cur_time = time(NULL);
-    timeout = sc->stomp_handshake_timeout - cur_time;
-    if (timeout < 0)
-    {
-        timeout = 0;
-    }
-
-    return timeout;
+    return tu_msecs_until(sc->stomp_handshake_timeout, tu_uptime_msecs64());
 }
 
 /*********************************************************************//**
@@ -2052,20 +2100,16 @@ int CalcTimeoutToStompHandshakeFailure(stomp_connection_t *sc)
 **************************************************************************/
 void UpdateAgentHeartbeat(stomp_connection_t *sc)
 {
-    time_t cur_time;
-    time_t delta_time;
     int num_bytes_sent;
 
     // Exit if heartbeats not enabled yet
-    if (sc->next_heartbeat_time == INVALID_TIME)
+    if (sc->next_heartbeat_time == INVALID_MSECS)
     {
         return;
     }
 
     // Exit if it's not yet time to send a heartbeat
-    cur_time = time(NULL);
-    delta_time = sc->next_heartbeat_time - cur_time;
-    if (delta_time > 0)
+    if (tu_uptime_msecs64() < sc->next_heartbeat_time)
     {
         return;
     }
@@ -2184,6 +2228,7 @@ int TransmitStompMessage(stomp_connection_t *sc)
         case kStompState_AwaitingConnectedFrame:
         case kStompState_Running:
         case kStompState_Retrying:
+        case kStompState_Resolving:
             // No change in state
             break;
     }
@@ -2338,7 +2383,7 @@ int ReceiveStompMessageInner(stomp_connection_t *sc, unsigned char *buf, int num
     }
 
     // Log the time at which the last message fragment was received (this is an alternative to receiving the STOMP server heartbeat)
-    sc->last_received_time = time(NULL);
+    sc->last_received_time = tu_uptime_msecs64();
 
     // Increase size of rx buffer, if required
     new_len = sc->rxframe_msglen + num_bytes;
@@ -2588,7 +2633,7 @@ void RemoveReceivedHeartBeats(stomp_connection_t *sc)
     {
         USP_LOG_Debug("Received %d heartbeats at time %d", heartbeat_bytes, (int)time(NULL));
         RemoveMessageFromRxBuf(sc, heartbeat_bytes);
-        sc->last_received_time = time(NULL);  // NOTE: Not strictly necessary as it will already have been set in ReceiveStompMessageInner()
+        sc->last_received_time = tu_uptime_msecs64();  // NOTE: Not strictly necessary as it will already have been set in ReceiveStompMessageInner()
     }
 }
 
@@ -3029,9 +3074,8 @@ void ParseConnectedFrame(stomp_connection_t *sc, unsigned char *msg, int msg_len
             else
             {
                 // Case of outgoing heartbeats enabled
-                // Convert outgoing heartbeat period to nearest second (rounded down)
                 period_ms = MAX(sc->outgoing_heartbeat_period, sy);
-                sc->agent_heartbeat_period = (period_ms >= 1000) ? period_ms/1000 : 1;
+                sc->agent_heartbeat_period = period_ms;
             }
 
             // Handle negotiated server heartbeat period
@@ -3043,9 +3087,8 @@ void ParseConnectedFrame(stomp_connection_t *sc, unsigned char *msg, int msg_len
             else
             {
                 // Case of incoming heartbeats enabled
-                // Convert incoming heartbeat period to nearest second (rounded down)
                 period_ms = MAX(sc->incoming_heartbeat_period, sx);
-                sc->server_heartbeat_period = (period_ms >= 1000) ? period_ms/1000 : 1;
+                sc->server_heartbeat_period = period_ms;
             }
         }
         else
@@ -3165,7 +3208,7 @@ void HandleStompSocketError(stomp_connection_t *sc, stomp_failure_t failure_code
     }
 
     USP_LOG_Info("Retrying STOMP connection to (host %s, port %d) in %d seconds (retry_count=%d).", sc->host, sc->port, wait_time, sc->retry_count);
-    sc->retry_time = time(NULL) + wait_time;
+    sc->retry_time = tu_uptime_msecs64() + (uint64_t)wait_time*SECONDS;
 }
 
 /*********************************************************************//**
@@ -3649,9 +3692,9 @@ char *AddrInfoToStr(struct addrinfo *addr, char *buf, int len)
 **************************************************************************/
 void UpdateNextHeartbeatTime(stomp_connection_t *sc)
 {
-    time_t cur_time;
+    uint64_t cur_time;
 
-    cur_time = time(NULL);
+    cur_time = tu_uptime_msecs64();
 
     // Update the next time to perform a heartbeat
     if (sc->agent_heartbeat_period != 0)
@@ -3662,7 +3705,7 @@ void UpdateNextHeartbeatTime(stomp_connection_t *sc)
     else
     {
         // Outgoing heartbeats disabled
-        sc->next_heartbeat_time = INVALID_TIME;
+        sc->next_heartbeat_time = INVALID_MSECS;
     }
 }
 
@@ -3675,20 +3718,20 @@ void UpdateNextHeartbeatTime(stomp_connection_t *sc)
 **
 ** \param   None
 **
-** \return  Number of seconds remaining until next time to poll the WAN interface for IP address change
+** \return  Number of milliseconds remaining until next time to poll the WAN interface for IP address change
 **
 **************************************************************************/
 int UpdateMgmtInterface(void)
 {
-    time_t cur_time;
+    uint64_t cur_time;
     int timeout;
     static bool is_first_time = true; // The first time this function is called, it just sets up the IP address and next_mgmt_if_poll_time
 
     // Exit if it's not yet time to poll the IP address
-    cur_time = time(NULL);
+    cur_time = tu_uptime_msecs64();
     if (is_first_time == false)
     {
-        timeout = next_mgmt_if_poll_time - cur_time;
+        timeout = tu_msecs_until(next_mgmt_if_poll_time, cur_time);
         if (timeout > 0)
         {
             goto exit;
@@ -3703,7 +3746,7 @@ int UpdateMgmtInterface(void)
 
     // Set next time to poll for IP address change
     #define MGMT_IP_ADDR_POLL_PERIOD 5
-    timeout = MGMT_IP_ADDR_POLL_PERIOD;
+    timeout = MGMT_IP_ADDR_POLL_PERIOD*SECONDS;
     next_mgmt_if_poll_time = cur_time + timeout;
     is_first_time = false;
 
@@ -0,0 +1,429 @@
+/*
+ *
+ * Copyright (C) 2019, Broadband Forum
+ * Copyright (C) 2016-2019  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file subs_index.c
+ *
+ * Implements an index of subscriptions, keyed by notification type and the fixed prefix of their path expressions
+ * The index is used to quickly find the subscriptions which might match an event, operation or object life event,
+ * without having to resolve the path expressions of every subscription
+ *
+ * For each type of notification, the index is a trie of path segments. Each enabled subscription is stored at the node(s)
+ * corresponding to the fixed prefix of its path expressions (ie the path segments before the first wildcard, search expression
+ * or the last segment). A path can only be matched by a subscription stored at one of the nodes visited when walking the trie
+ * using the path's segments. Path expressions containing reference following are stored at the root node, as the dereferenced
+ * path may be anywhere in the data model
+ *
+ * The index is rebuilt from the subscriptions vector lazily, the first time that it is used after it has been invalidated
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "common_defs.h"
+#include "subs_index.h"
+
+//------------------------------------------------------------------------------
+// Characters which indicate that a path segment is not fixed (wildcard, search expression)
+static const char *non_fixed_segment_chars = "*[#";
+
+//------------------------------------------------------------------------------
+// Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
+void BuildSubsIndex(subs_index_t *si, subs_vector_t *suv);
+void AddPathExpressionToSubsIndex(subs_index_node_t *root, char *path_expr, int subs_index);
+subs_index_node_t *FindSubsIndexChild(subs_index_node_t *node, char *segment, int len);
+subs_index_node_t *AddSubsIndexChild(subs_index_node_t *node, char *segment, int len);
+void DestroySubsIndexNode(subs_index_node_t *node);
+void AddSubsIndexes(int_vector_t *dest, int_vector_t *src);
+int CompareSubsIndex(const void *a, const void *b);
+
+/*********************************************************************//**
+**
+** SUBS_INDEX_Init
+**
+** Initialises a subscription index structure
+**
+** \param   si - pointer to structure to initialise
+**
+** \return  None
+**
+**************************************************************************/
+void SUBS_INDEX_Init(subs_index_t *si)
+{
+    memset(si, 0, sizeof(subs_index_t));
+    si->is_valid = false;
+}
+
+/*********************************************************************//**
+**
+** SUBS_INDEX_Destroy
+**
+** Deallocates all memory associated with the subscription index
+**
+** \param   si - pointer to structure to destroy all dynamically allocated memory it contains
+**
+** \return  None
+**
+**************************************************************************/
+void SUBS_INDEX_Destroy(subs_index_t *si)
+{
+    int i;
+
+    for (i=0; i < kSubNotifyType_Max; i++)
+    {
+        DestroySubsIndexNode(&si->roots[i]);
+    }
+
+    SUBS_INDEX_Init(si);
+}
+
+/*********************************************************************//**
+**
+** SUBS_INDEX_Invalidate
+**
+** Called whenever a subscription is added, deleted or changed, to cause the index to be rebuilt the next time it is used
+** NOTE: The index stores the position of each subscription in the subscriptions vector, so it must also be invalidated
+**       whenever subscriptions are added to or removed from the vector
+**
+** \param   si - pointer to subscription index
+**
+** \return  None
+**
+**************************************************************************/
+void SUBS_INDEX_Invalidate(subs_index_t *si)
+{
+    si->is_valid = false;
+}
+
+/*********************************************************************//**
+**
+** SUBS_INDEX_FindCandidates
+**
+** Finds all enabled subscriptions of the specified type which might match the specified path
+** The caller must still check each subscription (by resolving its path expressions), as the index only filters subscriptions
+**
+** \param   si - pointer to subscription index
+** \param   suv - pointer to subscriptions vector which the index refers to
+** \param   notify_type - type of notification
+** \param   path - data model path of the event, operation or object
+** \param   subs_indexes - pointer to vector in which to add the index (in the subscriptions vector) of each matching subscription
+**                         On return, the vector is sorted in ascending order, without duplicates
+**                         NOTE: The vector must have been initialised by the caller, and may already contain entries
+**
+** \return  None
+**
+**************************************************************************/
+void SUBS_INDEX_FindCandidates(subs_index_t *si, subs_vector_t *suv, subs_notify_t notify_type, char *path, int_vector_t *subs_indexes)
+{
+    subs_index_node_t *node;
+    char *segment;
+    char *p;
+    int len;
+    int i;
+    int num_unique;
+
+    // Rebuild the index, if any subscriptions have changed since it was last built
+    if (si->is_valid == false)
+    {
+        BuildSubsIndex(si, suv);
+    }
+
+    // Walk the trie, adding all subscriptions stored at each node which matches the next segment of the path
+    USP_ASSERT((notify_type >= 0) && (notify_type < kSubNotifyType_Max));
+    node = &si->roots[notify_type];
+    segment = path;
+    while (node != NULL)
+    {
+        AddSubsIndexes(subs_indexes, &node->subs_indexes);
+
+        // Exit if there are no more segments in the path
+        if (*segment == '\0')
+        {
+            break;
+        }
+
+        // Move to the child node matching the next segment of the path (if one exists)
+        p = strchr(segment, '.');
+        len = (p != NULL) ? p - segment : strlen(segment);
+        node = FindSubsIndexChild(node, segment, len);
+        segment += (p != NULL) ? len + 1 : len;
+    }
+
+    // Sort the subscriptions into the order they occur in the subscriptions vector, removing duplicates
+    // NOTE: Duplicates occur if a subscription has more than one path expression which matches
+    if (subs_indexes->num_entries > 1)
+    {
+        qsort(subs_indexes->vector, subs_indexes->num_entries, sizeof(int), CompareSubsIndex);
+        num_unique = 1;
+        for (i=1; i < subs_indexes->num_entries; i++)
+        {
+            if (subs_indexes->vector[i] != subs_indexes->vector[num_unique-1])
+            {
+                subs_indexes->vector[num_unique] = subs_indexes->vector[i];
+                num_unique++;
+            }
+        }
+        subs_indexes->num_entries = num_unique;
+    }
+}
+
+/*********************************************************************//**
+**
+** BuildSubsIndex
+**
+** Builds the index from all enabled subscriptions in the subscriptions vector
+**
+** \param   si - pointer to subscription index
+** \param   suv - pointer to subscriptions vector
+**
+** \return  None
+**
+**************************************************************************/
+void BuildSubsIndex(subs_index_t *si, subs_vector_t *suv)
+{
+    int i;
+    int j;
+    subs_t *sub;
+
+    SUBS_INDEX_Destroy(si);
+
+    for (i=0; i < suv->num_entries; i++)
+    {
+        sub = &suv->vector[i];
+        if ((sub->enable) && (sub->notify_type > kSubNotifyType_None) && (sub->notify_type < kSubNotifyType_Max))
+        {
+            for (j=0; j < sub->path_expressions.num_entries; j++)
+            {
+                AddPathExpressionToSubsIndex(&si->roots[sub->notify_type], sub->path_expressions.vector[j], i);
+            }
+        }
+    }
+
+    si->is_valid = true;
+}
+
+/*********************************************************************//**
+**
+** AddPathExpressionToSubsIndex
+**
+** Adds the specified subscription to the node of the trie corresponding to the fixed prefix of the specified path expression
+** The fixed prefix excludes the last segment of the path expression, and all segments from the first segment
+** containing a wildcard or search expression
+** NOTE: Path expressions containing reference following are added to the root node, as the dereferenced path
+**       may be anywhere in the data model, so they must be a candidate for all paths
+**
+** \param   root - pointer to root node of the trie
+** \param   path_expr - path expression of the subscription
+** \param   subs_index - index of the subscription in the subscriptions vector
+**
+** \return  None
+**
+**************************************************************************/
+void AddPathExpressionToSubsIndex(subs_index_node_t *root, char *path_expr, int subs_index)
+{
+    subs_index_node_t *node;
+    subs_index_node_t *child;
+    char *segment;
+    char *p;
+    int len;
+    int i;
+
+    // Exit if the path expression contains reference following, adding the subscription to the root node
+    node = root;
+    if (strchr(path_expr, '+') != NULL)
+    {
+        goto exit;
+    }
+
+    segment = path_expr;
+    while ((p = strchr(segment, '.')) != NULL)
+    {
+        // Exit the loop if this segment is not fixed
+        len = p - segment;
+        for (i=0; i < len; i++)
+        {
+            if (strchr(non_fixed_segment_chars, segment[i]) != NULL)
+            {
+                goto exit;
+            }
+        }
+
+        // Move to the child node for this segment, adding it if it does not already exist
+        child = FindSubsIndexChild(node, segment, len);
+        if (child == NULL)
+        {
+            child = AddSubsIndexChild(node, segment, len);
+        }
+        node = child;
+        segment = p + 1;
+    }
+
+exit:
+    // Add the subscription to the node, if it has not already been added (by another of its path expressions)
+    if ((node->subs_indexes.num_entries == 0) || (node->subs_indexes.vector[node->subs_indexes.num_entries-1] != subs_index))
+    {
+        INT_VECTOR_Add(&node->subs_indexes, subs_index);
+    }
+}
+
+/*********************************************************************//**
+**
+** FindSubsIndexChild
+**
+** Finds the child node matching the specified path segment
+**
+** \param   node - pointer to node to search the children of
+** \param   segment - pointer to start of path segment (not NULL terminated)
+** \param   len - number of characters in the path segment
+**
+** \return  pointer to matching child node, or NULL if no child node matches
+**
+**************************************************************************/
+subs_index_node_t *FindSubsIndexChild(subs_index_node_t *node, char *segment, int len)
+{
+    int i;
+    subs_index_node_t *child;
+
+    for (i=0; i < node->num_children; i++)
+    {
+        child = &node->children[i];
+        if ((strncmp(child->segment, segment, len) == 0) && (child->segment[len] == '\0'))
+        {
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+** AddSubsIndexChild
+**
+** Adds a child node for the specified path segment
+** NOTE: This may move the existing children of the node in memory
+**
+** \param   node - pointer to node to add a child to
+** \param   segment - pointer to start of path segment (not NULL terminated)
+** \param   len - number of characters in the path segment
+**
+** \return  pointer to child node added
+**
+**************************************************************************/
+subs_index_node_t *AddSubsIndexChild(subs_index_node_t *node, char *segment, int len)
+{
+    subs_index_node_t *child;
+
+    node->children = USP_REALLOC(node->children, (node->num_children+1)*sizeof(subs_index_node_t));
+    child = &node->children[node->num_children];
+    node->num_children++;
+
+    memset(child, 0, sizeof(subs_index_node_t));
+    child->segment = USP_MALLOC(len+1);
+    memcpy(child->segment, segment, len);
+    child->segment[len] = '\0';
+    INT_VECTOR_Init(&child->subs_indexes);
+
+    return child;
+}
+
+/*********************************************************************//**
+**
+** DestroySubsIndexNode
+**
+** Deallocates all memory associated with the specified node of the trie, and all of its children
+**
+** \param   node - pointer to node to destroy
+**
+** \return  None
+**
+**************************************************************************/
+void DestroySubsIndexNode(subs_index_node_t *node)
+{
+    int i;
+
+    for (i=0; i < node->num_children; i++)
+    {
+        DestroySubsIndexNode(&node->children[i]);
+    }
+
+    USP_SAFE_FREE(node->children);
+    USP_SAFE_FREE(node->segment);
+    INT_VECTOR_Destroy(&node->subs_indexes);
+    node->num_children = 0;
+}
+
+/*********************************************************************//**
+**
+** AddSubsIndexes
+**
+** Appends all subscription indexes in one vector to another vector
+**
+** \param   dest - pointer to vector to add the subscription indexes to
+** \param   src - pointer to vector containing the subscription indexes to add
+**
+** \return  None
+**
+**************************************************************************/
+void AddSubsIndexes(int_vector_t *dest, int_vector_t *src)
+{
+    if (src->num_entries == 0)
+    {
+        return;
+    }
+
+    dest->vector = USP_REALLOC(dest->vector, (dest->num_entries + src->num_entries)*sizeof(int));
+    memcpy(&dest->vector[dest->num_entries], src->vector, src->num_entries*sizeof(int));
+    dest->num_entries += src->num_entries;
+}
+
+/*********************************************************************//**
+**
+** CompareSubsIndex
+**
+** qsort() comparison function used to sort subscription indexes into ascending order
+**
+** \param   a - pointer to first subscription index
+** \param   b - pointer to second subscription index
+**
+** \return  negative, zero or positive if a is less than, equal to or greater than b
+**
+**************************************************************************/
+int CompareSubsIndex(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+
+    return (ia > ib) - (ia < ib);
+}
@@ -0,0 +1,73 @@
+/*
+ *
+ * Copyright (C) 2019, Broadband Forum
+ * Copyright (C) 2016-2019  CommScope, Inc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file subs_index.h
+ *
+ * Implements an index of subscriptions, keyed by notification type and the fixed prefix of their path expressions
+ *
+ */
+#ifndef SUBS_INDEX_H
+#define SUBS_INDEX_H
+
+#include "common_defs.h"
+#include "int_vector.h"
+#include "subs_vector.h"
+
+//------------------------------------------------------------------------------
+// Node of the trie of path segments
+typedef struct subs_index_node_tag
+{
+    char *segment;                          // Name of the path segment represented by this node (NULL for the root node)
+    int num_children;                       // Number of child nodes
+    struct subs_index_node_tag *children;   // Array of child nodes (one for each path segment following this one)
+    int_vector_t subs_indexes;              // Indexes (in the subscriptions vector) of subscriptions with a path expression whose fixed prefix ends at this node
+} subs_index_node_t;
+
+//------------------------------------------------------------------------------
+// Index of subscriptions
+typedef struct
+{
+    bool is_valid;                              // Set if the index matches the subscriptions vector. Cleared whenever a subscription is changed
+    subs_index_node_t roots[kSubNotifyType_Max];// Root of the trie for each type of notification
+} subs_index_t;
+
+//-----------------------------------------------------------------------------------------
+// Subscription Index API
+void SUBS_INDEX_Init(subs_index_t *si);
+void SUBS_INDEX_Destroy(subs_index_t *si);
+void SUBS_INDEX_Invalidate(subs_index_t *si);
+void SUBS_INDEX_FindCandidates(subs_index_t *si, subs_vector_t *suv, subs_notify_t notify_type, char *path, int_vector_t *subs_indexes);
+
+#endif
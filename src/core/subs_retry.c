@@ -49,11 +49,22 @@
 #include "device.h"
 #include "sync_timer.h"
 #include "retry_wait.h"
+#include "text_utils.h"
+#include "dllist.h"
+
+//------------------------------------------------------------------------
+// Number of buckets in the hash tables used to find retry entries (must be a power of 2)
+#define SUBS_RETRY_HASH_BUCKETS 1024
 
 //------------------------------------------------------------------------
 // Structure containing NotifyRequest message to retry sending and associated state machine
-typedef struct
+typedef struct subs_retry_tag
 {
+    double_link_t link;         // Doubly linked list pointers, linking all entries in the order they were added. NOTE: This must be first in the structure
+    struct subs_retry_tag *next_by_msg_id; // Next entry in the same bucket of the hash table indexed by msg_id
+    struct subs_retry_tag *next_by_key;    // Next entry in the same bucket of the hash table indexed by instance and differentiator
+    int heap_index;             // Index of this entry in the heap of entries ordered by the time at which they are next due to be processed
+
     int instance;               // Instance number of subscription that generated this message in Device.LocalAgent.Subscription.{i}
     char *msg_id;               // message_id allocated by this agent to uniquely identify this message
     char *subscription_id;      // id allocated by the controller, to uniquely identify the subscription
@@ -73,14 +84,41 @@ typedef struct
 } subs_retry_t;
 
 //------------------------------------------------------------------------
-// Array of subscription messages that should receive a response from the controller, or be retried
+// Min-heap of all messages that should receive a response from the controller, or be retried
+// Ordered by the time at which each message is next due to be processed (retried or expired). See RetryDueTime()
+static subs_retry_t **retry_heap = NULL;
+static int num_retries = 0;
+static int retry_heap_size = 0;         // Number of entries allocated in retry_heap
+
+//------------------------------------------------------------------------
+// Hash tables used to find messages by msg_id (when a NotifyResponse is received),
+// and by subscription instance and differentiator (when a message replaces a previous message)
+static subs_retry_t *msg_id_table[SUBS_RETRY_HASH_BUCKETS];
+static subs_retry_t *key_table[SUBS_RETRY_HASH_BUCKETS];
+
+//------------------------------------------------------------------------
+// List of all messages, in the order they were added. Used to evict the oldest message, when the retry list is full
+static double_linked_list_t retry_age_list;
+
+//------------------------------------------------------------------------
+// Total size of all serialized USP messages in the retry list
+static int total_pbuf_len = 0;
+
+//------------------------------------------------------------------------
+// Statistics, displayed by the 'dump subscriptions' CLI command
 typedef struct
 {
-    int num_entries;
-    subs_retry_t *vector;
-} subs_retry_vector_t;
-
-static subs_retry_vector_t subs_retry;
+    unsigned num_added;         // Number of messages added to the retry list
+    unsigned num_replaced;      // Number of messages which were replaced by a later message from the same subscription (and differentiator)
+    unsigned num_acknowledged;  // Number of messages removed because a NotifyResponse was received
+    unsigned num_retries;       // Number of times a message has been resent
+    unsigned num_expired;       // Number of messages removed because their retry period expired
+    unsigned num_evicted;       // Number of messages removed because the retry list was full
+    unsigned num_deleted;       // Number of messages removed because their subscription was deleted, or their controller was disabled or deleted
+    int max_retries;            // Maximum number of messages in the retry list at any one time
+} subs_retry_stats_t;
+
+static subs_retry_stats_t subs_retry_stats;
 
 //------------------------------------------------------------------------
 // Time at which first message to be retried, is to be retried
@@ -90,16 +128,26 @@ static time_t first_retry_time = END_OF_TIME;
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void SubsRetryExec(int id);
 subs_retry_t *FindRetryEntry(int instance, char *differentiator);
+subs_retry_t *FindRetryEntryByMsgId(char *msg_id);
 time_t CalcNextSubsRetryTime(subs_retry_t *sr);
+void RemoveSubsRetryEntry(subs_retry_t *sr);
 void DestroySubsRetryEntry(subs_retry_t *sr);
+void EvictOldestSubsRetryEntries(int pbuf_len);
 void UpdateFirstRetryTime(void);
-void GarbageCollectSubsRetry(void);
+unsigned CalcMsgIdBucket(char *msg_id);
+unsigned CalcKeyBucket(int instance, char *differentiator);
+time_t RetryDueTime(subs_retry_t *sr);
+void HeapPush(subs_retry_t *sr);
+void HeapRemove(subs_retry_t *sr);
+void HeapSiftUp(int index);
+void HeapSiftDown(int index);
+void HeapSwap(int i, int j);
 
 /*********************************************************************//**
 **
 ** SUBS_RETRY_Init
 **
-** Initialises the vector of subscriptions to retry
+** Initialises the list of subscriptions to retry
 **
 ** \param   None
 **
@@ -108,8 +156,15 @@ void GarbageCollectSubsRetry(void);
 **************************************************************************/
 void SUBS_RETRY_Init(void)
 {
-    subs_retry.num_entries = 0;
-    subs_retry.vector = NULL;
+    retry_heap = NULL;
+    num_retries = 0;
+    retry_heap_size = 0;
+    memset(msg_id_table, 0, sizeof(msg_id_table));
+    memset(key_table, 0, sizeof(key_table));
+    DLLIST_Init(&retry_age_list);
+    total_pbuf_len = 0;
+    memset(&subs_retry_stats, 0, sizeof(subs_retry_stats));
+
     SYNC_TIMER_Add(SubsRetryExec, 0, END_OF_TIME);
 }
 
@@ -127,19 +182,19 @@ void SUBS_RETRY_Init(void)
 void SUBS_RETRY_Stop(void)
 {
     int i;
-    subs_retry_t *sr;
 
-    for (i=0; i<subs_retry.num_entries; i++)
+    for (i=0; i<num_retries; i++)
     {
-        sr = &subs_retry.vector[i];
-        USP_SAFE_FREE(sr->msg_id);
-        USP_SAFE_FREE(sr->subscription_id);
-        USP_SAFE_FREE(sr->dest_endpoint);
-        USP_SAFE_FREE(sr->differentiator);
-        USP_SAFE_FREE(sr->pbuf);
+        DestroySubsRetryEntry(retry_heap[i]);
     }
 
-    USP_SAFE_FREE(subs_retry.vector);
+    USP_SAFE_FREE(retry_heap);
+    num_retries = 0;
+    retry_heap_size = 0;
+    memset(msg_id_table, 0, sizeof(msg_id_table));
+    memset(key_table, 0, sizeof(key_table));
+    DLLIST_Init(&retry_age_list);
+    total_pbuf_len = 0;
 }
 
 /*********************************************************************//**
@@ -147,6 +202,7 @@ void SUBS_RETRY_Stop(void)
 ** SUBS_RETRY_Add
 **
 ** Adds the specified message to the list of messages to be retried if a response is not obtained
+** If the list is full (see MAX_SUBS_RETRY_ENTRIES and MAX_SUBS_RETRY_BYTES), then the oldest messages are removed from it
 **
 ** \param   instance - Instance number of Subscription in Device.LocalAgent.Subscription.{i}
 ** \param   msg_id - message_id allocated by this agent to uniquely identify this message
@@ -167,45 +223,44 @@ void SUBS_RETRY_Add(int instance, char *msg_id, char *subscription_id, char *des
                     unsigned char *pbuf, int pbuf_len, time_t retry_expiry_time)
 {
     int err;
-    int new_num_entries;
+    unsigned bucket;
     subs_retry_t *sr;
     unsigned min_wait_interval;
     unsigned interval_multiplier;
 
+    // See if this retry needs to replace an existing retry
+    // This could be the case if a NotifyResponse has not been received, and the parameter's value has changed again
+    sr = FindRetryEntry(instance, differentiator);
+
     // Exit if this controller has been disabled or deleted.
     // In this case, we do not bother retrying, and we make sure that we delete the existing entry (if one exists)
     err = DEVICE_CONTROLLER_GetSubsRetryParams(dest_endpoint, &min_wait_interval, &interval_multiplier);
     if (err != USP_ERR_OK)
     {
-        sr = FindRetryEntry(instance, differentiator);
         if (sr != NULL)
         {
             USP_LOG_Warning("%s: Aborting sending subscription_id=%s because controller is disabled or deleted", __FUNCTION__, subscription_id);
-            DestroySubsRetryEntry(sr);
-            GarbageCollectSubsRetry();
-            return;
+            RemoveSubsRetryEntry(sr);
+            subs_retry_stats.num_deleted++;
+            UpdateFirstRetryTime();
         }
+        USP_FREE(pbuf);
+        return;
     }
 
-    // See if this retry needs to replace an existing retry
-    // This could be the case if a NotifyResponse has not been received, and the parameter's value has changed again
-    sr = FindRetryEntry(instance, differentiator);
-    if (sr == NULL)
+    // Remove the existing retry, as it is replaced by this one
+    if (sr != NULL)
     {
-        // Add new retry entry
-        new_num_entries = subs_retry.num_entries + 1;
-        subs_retry.vector = USP_REALLOC(subs_retry.vector, new_num_entries*sizeof(subs_retry_t));
-        sr = &subs_retry.vector[ subs_retry.num_entries ];
-        subs_retry.num_entries = new_num_entries;
-    }
-    else
-    {
-        // Replace an existing entry. First free memory associated with current entry - but leave the entry allocated,
-        // as we will replace it
-        DestroySubsRetryEntry(sr);
+        RemoveSubsRetryEntry(sr);
+        subs_retry_stats.num_replaced++;
     }
 
+    // Ensure that there is room in the list for this retry
+    EvictOldestSubsRetryEntries(pbuf_len);
+
     // Fill in this entry
+    sr = USP_MALLOC(sizeof(subs_retry_t));
+    memset(sr, 0, sizeof(subs_retry_t));
     sr->instance = instance;
     sr->msg_id = USP_STRDUP(msg_id);
     sr->subscription_id = USP_STRDUP(subscription_id);
@@ -230,6 +285,25 @@ void SUBS_RETRY_Add(int instance, char *msg_id, char *subscription_id, char *des
     sr->next_retry_time = CalcNextSubsRetryTime(sr);
     USP_LOG_Info("Retrying sending notification (retry_count=%d) in %d seconds.", sr->retry_count, (int)(sr->next_retry_time-time(NULL)) );
 
+    // Add this entry to the hash tables, the heap, and the end of the age list
+    bucket = CalcMsgIdBucket(sr->msg_id);
+    sr->next_by_msg_id = msg_id_table[bucket];
+    msg_id_table[bucket] = sr;
+
+    bucket = CalcKeyBucket(sr->instance, sr->differentiator);
+    sr->next_by_key = key_table[bucket];
+    key_table[bucket] = sr;
+
+    HeapPush(sr);
+    DLLIST_LinkToTail(&retry_age_list, sr);
+    total_pbuf_len += pbuf_len;
+
+    subs_retry_stats.num_added++;
+    if (num_retries > subs_retry_stats.max_retries)
+    {
+        subs_retry_stats.max_retries = num_retries;
+    }
+
     // Update time until next retry is sent
     UpdateFirstRetryTime();
 }
@@ -249,29 +323,25 @@ void SUBS_RETRY_Add(int instance, char *msg_id, char *subscription_id, char *des
 **************************************************************************/
 void SUBS_RETRY_Remove(char *msg_id, char *subscription_id)
 {
-    int i;
     subs_retry_t *sr;
 
-    // Iterate over all retry entries, finding the first entry that matches the one the controller is responding to
+    // Find the entry that matches the one the controller is responding to
     // NOTE: USP Spec 1.2 clarified that subscription_id should be ignored, so only msg_id needs to match
-    for (i=0; i < subs_retry.num_entries; i++)
+    sr = FindRetryEntryByMsgId(msg_id);
+    if (sr == NULL)
     {
-        sr = &subs_retry.vector[i];
-        if (strcmp(sr->msg_id, msg_id) == 0)
-        {
-            // Remove this entry. We have had a response from the controller, so do not have to retry it anymore
-            USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (NotifyResponse received)", __FUNCTION__, msg_id);
-            DestroySubsRetryEntry(sr);
-            GarbageCollectSubsRetry();
-
-            // Update time until next retry is sent
-            UpdateFirstRetryTime();
-            return;
-        }
+        // No matching NotifyRequest has been found to cancel, so just log this fact
+        USP_LOG_Warning("%s: Ignoring NotifyResponse. Unknown msg_id=%s, subscription_id=%s", __FUNCTION__, msg_id, subscription_id);
+        return;
     }
 
-    // If the code gets here, no matching NotifyRequest has been found to cancel, so just log this fact
-    USP_LOG_Warning("%s: Ignoring NotifyResponse. Unknown msg_id=%s, subscription_id=%s", __FUNCTION__, msg_id, subscription_id);
+    // Remove this entry. We have had a response from the controller, so do not have to retry it anymore
+    USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (NotifyResponse received)", __FUNCTION__, msg_id);
+    RemoveSubsRetryEntry(sr);
+    subs_retry_stats.num_acknowledged++;
+
+    // Update time until next retry is sent
+    UpdateFirstRetryTime();
 }
 
 /*********************************************************************//**
@@ -288,28 +358,48 @@ void SUBS_RETRY_Remove(char *msg_id, char *subscription_id)
 **************************************************************************/
 void SUBS_RETRY_Delete(int instance)
 {
-    int i;
     subs_retry_t *sr;
+    subs_retry_t *next;
 
     // Iterate over all retries, removing all entries which were generated by the subscription
-    for (i=0; i < subs_retry.num_entries; i++)
+    sr = (subs_retry_t *) retry_age_list.head;
+    while (sr != NULL)
     {
-        sr = &subs_retry.vector[i];
+        next = (subs_retry_t *) sr->link.next;
         if (sr->instance == instance)
         {
-            // Mark this entry for deletion
             USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (Subscription deleted)", __FUNCTION__, sr->msg_id);
-            DestroySubsRetryEntry(sr);
+            RemoveSubsRetryEntry(sr);
+            subs_retry_stats.num_deleted++;
         }
+        sr = next;
     }
 
-    // Remove all entries marked for deletion
-    GarbageCollectSubsRetry();
-
     // Update time until next retry is sent
     UpdateFirstRetryTime();
 }
 
+/*********************************************************************//**
+**
+** SUBS_RETRY_Dump
+**
+** Prints out the state of the retry list and its statistics
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void SUBS_RETRY_Dump(void)
+{
+    subs_retry_stats_t *stats = &subs_retry_stats;
+
+    USP_DUMP("Notification retries: %d pending (%d bytes), max=%d", num_retries, total_pbuf_len, stats->max_retries);
+    USP_DUMP("added=%u, replaced=%u, acknowledged=%u, resent=%u, expired=%u, evicted=%u, deleted=%u",
+             stats->num_added, stats->num_replaced, stats->num_acknowledged, stats->num_retries,
+             stats->num_expired, stats->num_evicted, stats->num_deleted);
+}
+
 /*********************************************************************//**
 **
 ** SubsRetryExec
@@ -317,6 +407,7 @@ void SUBS_RETRY_Delete(int instance)
 ** Retry sending all messages that have reached the time they need to be resent
 ** and calculate the time at which the next retry message should be sent
 ** This function is called back from a timer when it is time for a periodic notification to fire
+** NOTE: Only the messages which are due are visited, as they are at the top of the heap
 **
 ** \param   id - (unused) identifier of the sync timer which caused this callback
 **
@@ -325,7 +416,6 @@ void SUBS_RETRY_Delete(int instance)
 **************************************************************************/
 void SubsRetryExec(int id)
 {
-    int i;
     subs_retry_t *sr;
     time_t cur_time;
     char buf[MAX_ISO8601_LEN];
@@ -334,46 +424,46 @@ void SubsRetryExec(int id)
     cur_time = time(NULL);
     USP_ASSERT(cur_time >= first_retry_time);
 
-    // Iterate over all retry entries, retrying all of those for which it is time to retry
-    // Also calculate the time until the next retry should occur
-    for (i=0; i < subs_retry.num_entries; i++)
+    // Process all retry entries which are due, retrying all of those for which it is time to retry
+    while ((num_retries > 0) && (RetryDueTime(retry_heap[0]) <= cur_time))
     {
-        // Mark this retry entry for deletion if it has reached the time where we give up retrying
-        sr = &subs_retry.vector[i];
+        // Remove this retry entry if it has reached the time where we give up retrying
+        sr = retry_heap[0];
         if (cur_time >= sr->retry_expiry_time)
         {
             USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (retry period expired at %s)", __FUNCTION__, sr->msg_id, iso8601_cur_time(buf, sizeof(buf)) );
-            DestroySubsRetryEntry(sr);
+            RemoveSubsRetryEntry(sr);
+            subs_retry_stats.num_expired++;
+            continue;
+        }
+
+        // Try resending the saved serialized USP message
+        MSG_HANDLER_QueueUspRecord(USP__HEADER__MSG_TYPE__NOTIFY, sr->dest_endpoint, sr->pbuf, sr->pbuf_len, sr->msg_id, &mtp_reply_to, sr->retry_expiry_time);
+        subs_retry_stats.num_retries++;
+
+        // Calculate next time until this message is retried
+        // NOTE: The next retry is always at least 1 second later, so that it is not retried again by this loop
+        sr->retry_count++;
+        sr->next_retry_time = CalcNextSubsRetryTime(sr);
+        if (sr->next_retry_time <= cur_time)
+        {
+            sr->next_retry_time = cur_time + 1;
+        }
+
+        // Remove this retry entry if the next retry is after the expiry time
+        if (sr->next_retry_time >= sr->retry_expiry_time)
+        {
+            USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (next retry would be after expiry time)", __FUNCTION__, sr->msg_id);
+            RemoveSubsRetryEntry(sr);
+            subs_retry_stats.num_expired++;
         }
         else
         {
-            // Determine if it is time to try resending the message
-            if (cur_time >= sr->next_retry_time)
-            {
-                // Try resending the saved serialized USP message
-                MSG_HANDLER_QueueUspRecord(USP__HEADER__MSG_TYPE__NOTIFY, sr->dest_endpoint, sr->pbuf, sr->pbuf_len, sr->msg_id, &mtp_reply_to, sr->retry_expiry_time);
-
-                // Calculate next time until this message is retried
-                sr->retry_count++;
-                sr->next_retry_time = CalcNextSubsRetryTime(sr);
-
-                // Mark this retry entry for deletion if the next retry is after the expiry time
-                if (sr->next_retry_time >= sr->retry_expiry_time)
-                {
-                    USP_LOG_Info("%s: Removing Notification retry for msg_id=%s (next retry would be after expiry time)", __FUNCTION__, sr->msg_id);
-                    DestroySubsRetryEntry(sr);
-                }
-                else
-                {
-                    USP_LOG_Info("%s: Retrying to send NotifyRequest with msg_id=%s. Next retry [%d] in %d seconds.", iso8601_cur_time(buf, sizeof(buf)), sr->msg_id, sr->retry_count, (int)(sr->next_retry_time-cur_time) );
-                }
-            }
+            USP_LOG_Info("%s: Retrying to send NotifyRequest with msg_id=%s. Next retry [%d] in %d seconds.", iso8601_cur_time(buf, sizeof(buf)), sr->msg_id, sr->retry_count, (int)(sr->next_retry_time-cur_time) );
+            HeapSiftDown(sr->heap_index);
         }
     }
 
-    // Now remove all entries in the vector which have been marked for deletion
-    GarbageCollectSubsRetry();
-
     // Restart the timer to cause this function to be called again when the next retry should occur
     UpdateFirstRetryTime();
 }
@@ -382,38 +472,90 @@ void SubsRetryExec(int id)
 **
 ** FindRetryEntry
 **
-** Finds the entry in the retry vector which matches the specified incoming message
+** Finds the entry in the retry list which matches the specified incoming message
+** NOTE: An entry with a NULL differentiator matches any differentiator from the same subscription
 **
 ** \param   instance - Instance number of Subscription in Device.LocalAgent.Subscription.{i}
 ** \param   differentiator - string used to differentiate multiple messages being generated from the same subscription
 **                           eg for a value change subscription, multiple messages are differentiated by data model path
 **                           NOTE: This value might be NULL if the type of subscription cannot generate multiple messages
 **
-** \return  None
+** \return  pointer to matching entry, or NULL if no match was found
 **
 **************************************************************************/
 subs_retry_t *FindRetryEntry(int instance, char *differentiator)
 {
-    int i;
     subs_retry_t *sr;
 
-    // Iterate over all retries, finding the one which matches the incoming message
-    for (i=0; i < subs_retry.num_entries; i++)
+    unsigned bucket;
+    unsigned null_bucket;
+
+    // Iterate over all retries in the hash bucket, finding the one which matches the incoming message
+    bucket = CalcKeyBucket(instance, differentiator);
+    sr = key_table[bucket];
+    while (sr != NULL)
     {
-        sr = &subs_retry.vector[i];
         if (sr->instance == instance)
         {
-            if ((sr->differentiator == NULL) || (strcmp(sr->differentiator, differentiator)==0))
+            if ((sr->differentiator == NULL) || ((differentiator != NULL) && (strcmp(sr->differentiator, differentiator)==0)))
             {
                 return sr;
             }
         }
+        sr = sr->next_by_key;
+    }
+
+    // Exit if there are no other entries with a NULL differentiator that could match
+    // NOTE: Entries with a NULL differentiator are stored in the same bucket as an empty differentiator
+    null_bucket = CalcKeyBucket(instance, NULL);
+    if (null_bucket == bucket)
+    {
+        return NULL;
+    }
+
+    // Otherwise, an entry with a NULL differentiator from the same subscription also matches
+    sr = key_table[null_bucket];
+    while (sr != NULL)
+    {
+        if ((sr->instance == instance) && (sr->differentiator == NULL))
+        {
+            return sr;
+        }
+        sr = sr->next_by_key;
     }
 
     // If the code gets here, then no match was found
     return NULL;
 }
 
+/*********************************************************************//**
+**
+** FindRetryEntryByMsgId
+**
+** Finds the entry in the retry list with the specified msg_id
+**
+** \param   msg_id - string identifying the NotifyRequest message sent by this agent
+**
+** \return  pointer to matching entry, or NULL if no match was found
+**
+**************************************************************************/
+subs_retry_t *FindRetryEntryByMsgId(char *msg_id)
+{
+    subs_retry_t *sr;
+
+    sr = msg_id_table[ CalcMsgIdBucket(msg_id) ];
+    while (sr != NULL)
+    {
+        if (strcmp(sr->msg_id, msg_id) == 0)
+        {
+            return sr;
+        }
+        sr = sr->next_by_msg_id;
+    }
+
+    return NULL;
+}
+
 /*********************************************************************//**
 **
 ** CalcNextSubsRetryTime
@@ -454,31 +596,85 @@ time_t CalcNextSubsRetryTime(subs_retry_t *sr)
 **************************************************************************/
 void UpdateFirstRetryTime(void)
 {
-    int i;
+    // The first entry to fire is at the top of the heap
+    first_retry_time = (num_retries > 0) ? RetryDueTime(retry_heap[0]) : END_OF_TIME;
+
+    // Restart the timer to send the first retry
+    SYNC_TIMER_Reload(SubsRetryExec, 0, first_retry_time);
+}
+
+/*********************************************************************//**
+**
+** EvictOldestSubsRetryEntries
+**
+** Removes the oldest entries from the retry list, until there is room to add a message of the specified size
+**
+** \param   pbuf_len - length of the serialized USP message which is going to be added
+**
+** \return  None
+**
+**************************************************************************/
+void EvictOldestSubsRetryEntries(int pbuf_len)
+{
     subs_retry_t *sr;
-    time_t first;
 
-    // Iterate over all retry entries, finding the first time that any of them fire
-    first = END_OF_TIME;
-    for (i=0; i < subs_retry.num_entries; i++)
+    while ((num_retries >= MAX_SUBS_RETRY_ENTRIES) || ((num_retries > 0) && (total_pbuf_len + pbuf_len > MAX_SUBS_RETRY_BYTES)))
     {
-        sr = &subs_retry.vector[i];
-        if (sr->next_retry_time < first)
-        {
-            first = sr->next_retry_time;
-        }
+        sr = (subs_retry_t *) retry_age_list.head;
+        USP_ASSERT(sr != NULL);
+        USP_LOG_Warning("%s: Removing Notification retry for msg_id=%s (retry list is full)", __FUNCTION__, sr->msg_id);
+        RemoveSubsRetryEntry(sr);
+        subs_retry_stats.num_evicted++;
     }
+}
 
-    // Restart the timer to send the first retry
-    first_retry_time = first;
-    SYNC_TIMER_Reload(SubsRetryExec, 0, first_retry_time);
+/*********************************************************************//**
+**
+** RemoveSubsRetryEntry
+**
+** Removes the specified entry from the retry list, freeing it
+** NOTE: The caller must call UpdateFirstRetryTime() afterwards, if the entry might have been the first to fire
+**
+** \param   sr - pointer to entry to remove
+**
+** \return  None
+**
+**************************************************************************/
+void RemoveSubsRetryEntry(subs_retry_t *sr)
+{
+    subs_retry_t **p;
+
+    // Unlink the entry from the hash table indexed by msg_id
+    p = &msg_id_table[ CalcMsgIdBucket(sr->msg_id) ];
+    while (*p != sr)
+    {
+        USP_ASSERT(*p != NULL);
+        p = &(*p)->next_by_msg_id;
+    }
+    *p = sr->next_by_msg_id;
+
+    // Unlink the entry from the hash table indexed by instance and differentiator
+    p = &key_table[ CalcKeyBucket(sr->instance, sr->differentiator) ];
+    while (*p != sr)
+    {
+        USP_ASSERT(*p != NULL);
+        p = &(*p)->next_by_key;
+    }
+    *p = sr->next_by_key;
+
+    // Remove the entry from the heap and the age list
+    HeapRemove(sr);
+    DLLIST_Unlink(&retry_age_list, sr);
+    total_pbuf_len -= sr->pbuf_len;
+
+    DestroySubsRetryEntry(sr);
 }
 
 /*********************************************************************//**
 **
 ** DestroySubsRetryEntry
 **
-** Frees all memory associated with a retry entry, and marks it for deletion
+** Frees all memory associated with a retry entry, including the entry itself
 **
 ** \param   sr - pointer to entry to free all memory of
 **
@@ -493,49 +689,208 @@ void DestroySubsRetryEntry(subs_retry_t *sr)
     USP_FREE(sr->dest_endpoint);
     USP_SAFE_FREE(sr->differentiator);
     USP_FREE(sr->pbuf);
+    USP_FREE(sr);
+}
 
-    // Mark entry for deletion
-    memset(sr, 0, sizeof(subs_retry_t));
-    sr->instance = INVALID;
+/*********************************************************************//**
+**
+** CalcMsgIdBucket
+**
+** Calculates the bucket in msg_id_table[] containing the entry with the specified msg_id
+**
+** \param   msg_id - string identifying the NotifyRequest message sent by this agent
+**
+** \return  index of bucket
+**
+**************************************************************************/
+unsigned CalcMsgIdBucket(char *msg_id)
+{
+    return TEXT_UTILS_CalcHash(msg_id) & (SUBS_RETRY_HASH_BUCKETS-1);
 }
 
 /*********************************************************************//**
 **
-** GarbageCollectSubsRetry
+** CalcKeyBucket
 **
-** Removes all entries in the subs_retry vector which have been marked for deletion
-** NOTE: All dynamically allocated memory that they referenced will already have been destroyed (by DestroySubsRetryEntry),
-**       so we do not have to do it here
+** Calculates the bucket in key_table[] containing the entry with the specified subscription instance and differentiator
 **
-** \param   msg_id - string identifying the NotifyRequest message sent by this agent, that the controller is responding to
-** \param   subscription_id - string set by the controller in Device.LocalAgent.Subscription.{i].ID
+** \param   instance - Instance number of Subscription in Device.LocalAgent.Subscription.{i}
+** \param   differentiator - string used to differentiate multiple messages being generated from the same subscription (may be NULL)
+**
+** \return  index of bucket
+**
+**************************************************************************/
+unsigned CalcKeyBucket(int instance, char *differentiator)
+{
+    unsigned hash;
+
+    hash = TEXT_UTILS_CalcHash((differentiator != NULL) ? differentiator : "");
+    hash ^= (unsigned)instance * 0x9E3779B1;
+
+    return hash & (SUBS_RETRY_HASH_BUCKETS-1);
+}
+
+/*********************************************************************//**
+**
+** RetryDueTime
+**
+** Returns the time at which the specified entry next needs to be processed by SubsRetryExec()
+** This is when it is next retried, or when it expires, whichever is first
+**
+** \param   sr - pointer to entry
+**
+** \return  time at which the entry is due
+**
+**************************************************************************/
+time_t RetryDueTime(subs_retry_t *sr)
+{
+    return MIN(sr->next_retry_time, sr->retry_expiry_time);
+}
+
+/*********************************************************************//**
+**
+** HeapPush
+**
+** Adds the specified entry to the heap
+**
+** \param   sr - pointer to entry to add
 **
 ** \return  None
 **
 **************************************************************************/
-void GarbageCollectSubsRetry(void)
+void HeapPush(subs_retry_t *sr)
 {
-    int i, j;
-    subs_retry_t *sr;
+    // Grow the heap (geometrically), if it is full
+    if (num_retries == retry_heap_size)
+    {
+        retry_heap_size = (retry_heap_size == 0) ? 16 : 2*retry_heap_size;
+        retry_heap = USP_REALLOC(retry_heap, retry_heap_size*sizeof(subs_retry_t *));
+    }
+
+    retry_heap[num_retries] = sr;
+    sr->heap_index = num_retries;
+    num_retries++;
+
+    HeapSiftUp(sr->heap_index);
+}
+
+/*********************************************************************//**
+**
+** HeapRemove
+**
+** Removes the specified entry from the heap
+**
+** \param   sr - pointer to entry to remove
+**
+** \return  None
+**
+**************************************************************************/
+void HeapRemove(subs_retry_t *sr)
+{
+    int index;
+
+    // Move the last entry in the heap into the place of the entry being removed, then restore the heap order
+    index = sr->heap_index;
+    USP_ASSERT((index >= 0) && (index < num_retries) && (retry_heap[index] == sr));
+    num_retries--;
+    if (index != num_retries)
+    {
+        retry_heap[index] = retry_heap[num_retries];
+        retry_heap[index]->heap_index = index;
+        HeapSiftUp(index);
+        HeapSiftDown(retry_heap[index]->heap_index);
+    }
+    sr->heap_index = INVALID;
+}
+
+/*********************************************************************//**
+**
+** HeapSiftUp
+**
+** Moves the specified heap entry up the heap, until it is not due before its parent
+**
+** \param   index - index of the entry in the heap
+**
+** \return  None
+**
+**************************************************************************/
+void HeapSiftUp(int index)
+{
+    int parent;
 
-    // Remove all entries in the vector which have been marked for deletion by DestroySubsRetryEntry()
-    // Iterate over all subscriptions, compacting the vector (Garbage collecting)
-    j = 0;
-    for (i=0; i < subs_retry.num_entries; i++)
+    while (index > 0)
     {
-        sr = &subs_retry.vector[i];
-        if (sr->instance != INVALID)
+        parent = (index - 1) / 2;
+        if (RetryDueTime(retry_heap[parent]) <= RetryDueTime(retry_heap[index]))
         {
-            // Copy down later entries in the array, over ones which have been removed
-            if (j < i)
-            {
-                memcpy(&subs_retry.vector[j], sr, sizeof(subs_retry_t));
-            }
-            j++;
+            break;
         }
+
+        HeapSwap(index, parent);
+        index = parent;
     }
+}
+
+/*********************************************************************//**
+**
+** HeapSiftDown
+**
+** Moves the specified heap entry down the heap, until it is not due after either of its children
+**
+** \param   index - index of the entry in the heap
+**
+** \return  None
+**
+**************************************************************************/
+void HeapSiftDown(int index)
+{
+    int child;
+
+    while (1)
+    {
+        // Determine the child which is due first
+        child = 2*index + 1;
+        if (child >= num_retries)
+        {
+            break;
+        }
+
+        if ((child+1 < num_retries) && (RetryDueTime(retry_heap[child+1]) < RetryDueTime(retry_heap[child])))
+        {
+            child++;
+        }
+
+        // Exit if the entry is not due after the child
+        if (RetryDueTime(retry_heap[index]) <= RetryDueTime(retry_heap[child]))
+        {
+            break;
+        }
 
-    // Store the number of valid entries left in the vector
-    subs_retry.num_entries = j;
+        HeapSwap(index, child);
+        index = child;
+    }
 }
 
+/*********************************************************************//**
+**
+** HeapSwap
+**
+** Swaps two entries in the heap
+**
+** \param   i - index of first entry in the heap
+** \param   j - index of second entry in the heap
+**
+** \return  None
+**
+**************************************************************************/
+void HeapSwap(int i, int j)
+{
+    subs_retry_t *tmp;
+
+    tmp = retry_heap[i];
+    retry_heap[i] = retry_heap[j];
+    retry_heap[j] = tmp;
+
+    retry_heap[i]->heap_index = i;
+    retry_heap[j]->heap_index = j;
+}
@@ -49,6 +49,7 @@ void SUBS_RETRY_Add(int instance, char *msg_id, char *subscription_id, char *des
                     unsigned char *pbuf, int pbuf_len, time_t retry_expiry_time);
 void SUBS_RETRY_Remove(char *msg_id, char *subscription_id);
 void SUBS_RETRY_Delete(int instance);
+void SUBS_RETRY_Dump(void);
 
 
 #endif
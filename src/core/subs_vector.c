@@ -164,6 +164,8 @@ void SUBS_VECTOR_DestroySubscriber(subs_t *sub)
 
     STR_VECTOR_Destroy(&sub->path_expressions);
     KV_VECTOR_Destroy(&sub->last_values);
+    USP_SAFE_FREE(sub->vc_params);
+    KV_VECTOR_Destroy(&sub->pending_notifies);
     STR_VECTOR_Destroy(&sub->resolved_paths);
 }
 
@@ -291,6 +293,7 @@ void SUBS_VECTOR_Dump(subs_vector_t *suv)
         USP_DUMP("notification_retry=%d", sub->notification_retry);
         USP_DUMP("notify_type=%s", TEXT_UTILS_EnumToString(sub->notify_type, notify_types, NUM_ELEM(notify_types)) );
         USP_DUMP("expiry_time=%s", iso8601_from_unix_time(sub->expiry_time, buf, sizeof(buf)) );
+        USP_DUMP("coalesce_period=%u ms (pending=%d)", sub->coalesce_period, sub->pending_notifies.num_entries);
 
         // Log all path expressions
         for (j=0; j < sub->path_expressions.num_entries; j++)
@@ -301,7 +304,7 @@ void SUBS_VECTOR_Dump(subs_vector_t *suv)
         // Log all last values
         for (j=0; j < sub->last_values.num_entries; j++)
         {
-            USP_DUMP("last_values[%d] %s => %s", j, sub->last_values.vector[j].key, sub->last_values.vector[j].value);
+            USP_DUMP("last_values[%d] %s => %s (poll_period=%u ms)", j, sub->last_values.vector[j].key, sub->last_values.vector[j].value, sub->vc_params[j].poll_period_ms);
         }
         USP_DUMP("-");
 
@@ -43,10 +43,12 @@
 #define SUBS_VECTOR_H
 
 #include <time.h>
+#include <stdint.h>
 
 #include "common_defs.h"
 #include "str_vector.h"
 #include "kv_vector.h"
+#include "usp_api.h"
 
 //------------------------------------------------------------------------------
 // Enumeration of types of subscriptions
@@ -63,6 +65,17 @@ typedef enum
     kSubNotifyType_Max                  // This should always be the last value in this enumeration. It is used to statically size arrays based on one entry for each active enumeration
 } subs_notify_t;
 
+//------------------------------------------------------------------------------
+// State of a parameter monitored by a value change subscription
+typedef struct
+{
+    unsigned hash;                      // Hash of the schema path of the parameter (dm_hash_t)
+    dm_req_instances_t inst;            // Instance numbers in the path of the parameter
+    int group_id;                       // Group_id of the parameter (used when getting its value)
+    unsigned poll_period_ms;            // Period between polling the value of the parameter, or 0 if changes are notified by DEVICE_SUBSCRIPTION_NotifyParamValueChange()
+    uint64_t next_poll_ms;              // Monotonic time at which the parameter should next be polled (only used if poll_period_ms is non-zero)
+} vc_param_t;
+
 //------------------------------------------------------------------------------
 // Element of subscription vector
 typedef struct
@@ -77,6 +90,12 @@ typedef struct
     time_t expiry_time;                 // Time at which this subscription should be stopped and removed from the DB
     unsigned retry_expiry_period;       // Device.LocalAgent.Subscription.{i}.NotifExpiration
     kv_vector_t last_values;            // List of parameters+values from last time that the subscription was polled (if the subscription is a value change subscription)
+    vc_param_t *vc_params;              // Value change state of each parameter in last_values (same index)
+    unsigned vc_generation;             // Generation of the path resolver when the path expressions of this value change subscription were last resolved
+    uint64_t vc_resolve_time_ms;        // Monotonic time at which the path expressions of this value change subscription should next be resolved
+    unsigned coalesce_period;           // Device.LocalAgent.Subscription.{i}.X_BBF_CoalescePeriod (in ms). 0 means value changes are sent immediately
+    kv_vector_t pending_notifies;       // Value changes waiting to be sent at the end of the coalesce period (latest value of each parameter)
+    uint64_t coalesce_end_ms;           // Monotonic time at which the current coalesce period ends (only valid if pending_notifies is not empty)
     str_vector_t resolved_paths;       // Used to cache the resolved paths of an object deletion subscription before the object has been deleted from the data model
 } subs_t;
 
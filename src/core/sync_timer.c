@@ -47,13 +47,16 @@
 #include "common_defs.h"
 #include "sync_timer.h"
 #include "usp_api.h"
+#include "uptime.h"
 
 //--------------------------------------------------------------------------------------
 // Structure describing a timer
 typedef struct
 {
     bool       enabled;         // Cleared after a timeout has fired, to prevent it firing again until an updated time has been registered
-    time_t     next_timeout;    // time at which this timer should next fire
+    bool       is_monotonic;    // Set if this timer was started with a delay in ms (SYNC_TIMER_AddMs/ReloadMs), rather than at an absolute wall clock time
+    time_t     next_timeout;    // time at which this timer should next fire. Only used if is_monotonic==false
+    uint64_t   next_timeout_ms; // monotonic time (in ms) at which this timer should next fire. Only used if is_monotonic==true
     timer_cb_t timer_cb;        // function to call when timer period has expired.
     int        id;              // unique identifier for this callback (allocated by caller of this library) within the namespace of the callback
 } sync_timer_t;
@@ -72,6 +75,9 @@ static timer_vector_t sync_timers;
 // Variable that is always updated to reflect the time at which the next timer should fire
 static time_t first_sync_timer_time;
 
+//--------------------------------------------------------------------------------------
+// Variable that is always updated to reflect the monotonic time (in ms) at which the next millisecond resolution timer should fire
+static uint64_t first_sync_timer_ms;
 
 
 //------------------------------------------------------------------------------
@@ -95,6 +101,7 @@ void SYNC_TIMER_Init(void)
     sync_timers.vector = NULL;
     sync_timers.num_entries = 0;
     first_sync_timer_time = END_OF_TIME;
+    first_sync_timer_ms = INVALID_MSECS;
 }
 
 /*********************************************************************//**
@@ -154,7 +161,9 @@ int SYNC_TIMER_Add(timer_cb_t timer_cb, int id, time_t callback_time)
     st = &sync_timers.vector[ sync_timers.num_entries ];
     st->timer_cb = timer_cb;
     st->id = id;
+    st->is_monotonic = false;
     st->next_timeout = callback_time;
+    st->next_timeout_ms = INVALID_MSECS;
     st->enabled = true;
 
     sync_timers.num_entries = new_num_entries;
@@ -194,6 +203,7 @@ int SYNC_TIMER_Reload(timer_cb_t timer_cb, int id, time_t callback_time)
     // Reload the timer
     st = &sync_timers.vector[index];
     st->enabled = true;
+    st->is_monotonic = false;
     st->next_timeout = callback_time;
 
     // Update the time at which the next timer should fire
@@ -202,6 +212,72 @@ int SYNC_TIMER_Reload(timer_cb_t timer_cb, int id, time_t callback_time)
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** SYNC_TIMER_AddMs
+**
+** Adds a new timer which will callback the specified function after the specified delay
+** Unlike SYNC_TIMER_Add(), the delay has millisecond resolution and is unaffected by changes to the wall clock
+**
+** \param   timer_cb - callback function to call when timer expires - This also identifies a namespace for the id
+** \param   id - unique identifier for this sync timer, within the namespace of the callback
+** \param   delay_ms - number of milliseconds from now at which the callback should fire
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int SYNC_TIMER_AddMs(timer_cb_t timer_cb, int id, unsigned delay_ms)
+{
+    int err;
+
+    // NOTE: The timer is added using SYNC_TIMER_Add() because USP_MEM_StartCollection() expects the timer vector to have been allocated by that function
+    err = SYNC_TIMER_Add(timer_cb, id, END_OF_TIME);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+
+    return SYNC_TIMER_ReloadMs(timer_cb, id, delay_ms);
+}
+
+/*********************************************************************//**
+**
+** SYNC_TIMER_ReloadMs
+**
+** Restarts the specified timer to fire after the specified delay
+**
+** \param   timer_cb - callback function to call when timer expires - This also identifies a namespace for the id
+** \param   id - unique identifier for this sync timer, within the namespace of the callback
+** \param   delay_ms - number of milliseconds from now at which the callback should fire
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int SYNC_TIMER_ReloadMs(timer_cb_t timer_cb, int id, unsigned delay_ms)
+{
+    sync_timer_t *st;
+    int index;
+
+    // Exit if timer could not be found
+    index = FindSyncTimer(timer_cb, id);
+    if (index == INVALID)
+    {
+        USP_ERR_SetMessage("%s: Unable to find timer registered with callback=%p, id=%d", __FUNCTION__, timer_cb, id);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Reload the timer
+    st = &sync_timers.vector[index];
+    st->enabled = true;
+    st->is_monotonic = true;
+    st->next_timeout_ms = tu_uptime_msecs64() + delay_ms;
+
+    // Update the time at which the next timer should fire
+    UpdateFirstSyncTimerTime();
+
+    return USP_ERR_OK;
+}
+
 /*********************************************************************//**
 **
 ** SYNC_TIMER_Remove
@@ -249,13 +325,14 @@ int SYNC_TIMER_Remove(timer_cb_t timer_cb, int id)
 **
 ** \param   None
 **
-** \return  time in seconds until next timer should fire
+** \return  time in ms until next timer should fire
 **
 **************************************************************************/
 int SYNC_TIMER_TimeToNext(void)
 {
     time_t cur_time;
     int delta;
+    int delta_ms;
 
     // Calculate the time delta from now to the time at which the first timer should fire
     cur_time = time(NULL);
@@ -267,14 +344,20 @@ int SYNC_TIMER_TimeToNext(void)
         delta = 0;
     }
 
-    // Exit with largest delay possible, if actual delay wanted is larger than that
-    if (delta > (INT_MAX/1000))
+    // Convert to ms, limiting to the largest delay possible, if actual delay wanted is larger than that
+    delta = (delta > (INT_MAX/1000)) ? INT_MAX : delta * 1000;
+
+    // Use the delay until the first millisecond resolution timer instead, if that fires earlier
+    if (first_sync_timer_ms != INVALID_MSECS)
     {
-        return INT_MAX;
+        delta_ms = tu_msecs_until(first_sync_timer_ms, tu_uptime_msecs64());
+        if (delta_ms < delta)
+        {
+            delta = delta_ms;
+        }
     }
 
-    // Return time in ms
-    return delta * 1000;
+    return delta;
 }
 
 /*********************************************************************//**
@@ -292,12 +375,15 @@ void SYNC_TIMER_Execute(void)
 {
     int i;
     time_t cur_time;
+    uint64_t cur_time_ms;
     sync_timer_t *st;
     timer_cb_t timer_cb;
+    bool has_expired;
 
     // Exit if it is not yet time for any of the timers to fire
     cur_time = time(NULL);
-    if (cur_time < first_sync_timer_time)
+    cur_time_ms = tu_uptime_msecs64();
+    if ((cur_time < first_sync_timer_time) && (cur_time_ms < first_sync_timer_ms))
     {
         return;
     }
@@ -307,7 +393,8 @@ void SYNC_TIMER_Execute(void)
     {
         // Determine if this timer should fire
         st = &sync_timers.vector[i];
-        if ((st->enabled) && (cur_time >= st->next_timeout))
+        has_expired = (st->is_monotonic) ? (cur_time_ms >= st->next_timeout_ms) : (cur_time >= st->next_timeout);
+        if ((st->enabled) && (has_expired))
         {
             // Mark the timer as fired, if the callback wants the timer to continue, then it can call SYNC_TIMER_Reload()
             st->enabled = false;
@@ -390,9 +477,11 @@ void UpdateFirstSyncTimerTime(void)
     int i;
     sync_timer_t *st;
     time_t first;
+    uint64_t first_ms;
 
     // Iterate over all timers
     first = END_OF_TIME;
+    first_ms = INVALID_MSECS;
     for (i=0; i < sync_timers.num_entries; i++)
     {
         // Skip this timer if it is not enabled
@@ -403,11 +492,19 @@ void UpdateFirstSyncTimerTime(void)
         }
 
         // Update the time at which the first timer fires
-        if (st->next_timeout < first)
+        if (st->is_monotonic)
+        {
+            if (st->next_timeout_ms < first_ms)
+            {
+                first_ms = st->next_timeout_ms;
+            }
+        }
+        else if (st->next_timeout < first)
         {
             first = st->next_timeout;
         }
     }
 
     first_sync_timer_time = first;
+    first_sync_timer_ms = first_ms;
 }
@@ -54,6 +54,8 @@ void SYNC_TIMER_Init(void);
 void SYNC_TIMER_Destroy(void);
 int SYNC_TIMER_Add(timer_cb_t timer_cb, int id, time_t callback_time);
 int SYNC_TIMER_Reload(timer_cb_t timer_cb, int id, time_t callback_time);
+int SYNC_TIMER_AddMs(timer_cb_t timer_cb, int id, unsigned delay_ms);
+int SYNC_TIMER_ReloadMs(timer_cb_t timer_cb, int id, unsigned delay_ms);
 int SYNC_TIMER_Remove(timer_cb_t timer_cb, int id);
 int SYNC_TIMER_TimeToNext(void);
 void SYNC_TIMER_Execute(void);
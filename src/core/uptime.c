@@ -90,3 +90,55 @@ tu_uptime_secs(void)
 	return (uint32_t)t;
 }
 
+/*********************************************************************//**
+**
+** tu_uptime_msecs64
+**
+** Returns the number of milli-seconds since the kernel was rebooted, without wrapping
+** This is the timebase used by all millisecond resolution timers
+**
+** \param   None
+**
+** \return  Number of milli-seconds
+**
+**************************************************************************/
+uint64_t
+tu_uptime_msecs64(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (uint64_t)(ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************//**
+**
+** tu_msecs_until
+**
+** Returns the number of milli-seconds from now until the specified deadline
+** This is suitable for passing as a timeout to the SOCKET_SET functions
+**
+** \param   deadline - monotonic time (in ms) at which the timer expires
+** \param   now - current monotonic time (in ms)
+**
+** \return  Number of milli-seconds, or 0 if the deadline has already passed
+**
+**************************************************************************/
+int
+tu_msecs_until(uint64_t deadline, uint64_t now)
+{
+	uint64_t delta;
+
+	if (deadline <= now)
+	{
+		return 0;
+	}
+
+	delta = deadline - now;
+	if (delta > INT32_MAX)
+	{
+		return INT32_MAX;
+	}
+
+	return (int)delta;
+}
@@ -40,11 +40,19 @@
  */
 
 #ifndef UPTIME_H
+#define UPTIME_H
 
 #include <sys/types.h>
 #include <stdint.h>
 
+//------------------------------------------------------------------------------
+// Monotonic time (in milliseconds) used by timers which must not be affected by changes to the wall clock
+// INVALID_MSECS is used to denote a timer which is not running
+#define INVALID_MSECS  ((uint64_t)-1)
+
 uint32_t tu_uptime_msecs(void);
 uint32_t tu_uptime_secs(void);
+uint64_t tu_uptime_msecs64(void);
+int tu_msecs_until(uint64_t deadline, uint64_t now);
 
 #endif
@@ -469,6 +469,7 @@ void USP_ERR_Terminate(char *fmt, ...)
         USP_LOG_Puts(kLogType_Debug, "Exiting USP Agent");
     }
 
+    USP_LOG_Flush();
     abort();    // call abort() rather than exit() so that a core dump is created
 }
 
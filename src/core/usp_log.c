@@ -47,6 +47,7 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <openssl/err.h>
 
 #ifdef HAVE_EXECINFO_H
@@ -57,6 +58,9 @@
 #include "cli.h"
 #include "usp_api.h"
 #include "data_model.h"  // for vendor_hook_callbacks
+#include "os_utils.h"
+#include "msg_queue.h"
+#include "socket_set.h"
 
 //------------------------------------------------------------------------------------
 // File to send logging output to
@@ -67,10 +71,59 @@ static FILE *log_fd;
 log_level_t usp_log_level = kLogLevel_Error;    // Verbosity level
 bool enable_protocol_trace = false;             // Whether protocol tracing should be sent out or not
 
+//------------------------------------------------------------------------------------
+// Asynchronous logging
+// Once USP_LOG_StartWriter() has been called, each thread writes its log messages into its own ring buffer, without taking any locks.
+// A dedicated writer thread drains all ring buffers to the log destination, so that the logging thread does not block on I/O.
+// If a thread's ring buffer is full, the message is dropped, and a count of the dropped messages is logged later by the writer thread.
+// NOTE: Messages from a single thread are logged in order, but messages from different threads may be interleaved differently than they were logged
+// NOTE: Logging to the CLI and dumps of the data model (kLogType_Dump) remain synchronous
+
+// Each message in a ring buffer is preceded by this header. A header with type LOG_RING_PADDING marks unused space at the end of the buffer
+typedef struct
+{
+    unsigned len;           // Length of the string following the header, including NULL terminator
+    unsigned log_type;      // Type of information which the message contains
+} log_record_hdr_t;
+
+#define LOG_RING_PADDING    0xFFFFFFFF
+#define LOG_WRITER_TIMEOUT  (1*SECONDS)  // Maximum time that the writer thread waits before checking for ring buffers of exited threads
+#define LOG_RECORD_ALIGN(x) (((x) + sizeof(log_record_hdr_t) - 1) & ~(sizeof(log_record_hdr_t) - 1))
+
+// Ring buffer of log messages written by a single thread
+typedef struct log_ring_tag
+{
+    struct log_ring_tag *next;  // Next ring buffer in the list of all ring buffers. Protected by log_writer_mutex
+    unsigned head;              // Free running offset of the next byte to read. Only written by the writer thread
+    unsigned tail;              // Free running offset of the next byte to write. Only written by the thread owning this ring buffer
+    unsigned num_dropped;       // Number of messages dropped because this ring buffer was full
+    int is_orphaned;            // Set when the thread owning this ring buffer exits, so that the writer thread frees it after draining it
+    unsigned char buf[USP_LOG_RING_SIZE];
+} log_ring_t;
+
+static __thread log_ring_t *thread_log_ring = NULL;    // Ring buffer owned by the calling thread
+static log_ring_t *log_rings = NULL;                    // List of all ring buffers
+static pthread_key_t log_ring_key;                      // Used to mark a thread's ring buffer as orphaned when the thread exits
+static bool is_log_async = false;                       // Set once the writer thread has been started
+
+// Mutex serialising writes to the log destination, and protecting the list of ring buffers
+static pthread_mutex_t log_writer_mutex;
+
+// Message queue used to wakeup the writer thread, when a message has been written into a ring buffer
+static msg_queue_t log_mq = MSG_QUEUE_UNINITIALISED;
+
 //------------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void LogMessageToFile(FILE *fd, const char *str);
 void CloseLog(void);
+void FlushLog(void);
+void *LogWriterMain(void *args);
+log_ring_t *GetThreadLogRing(void);
+bool PushLogRecord(log_ring_t *ring, log_type_t log_type, const char *str);
+void DrainAllLogRings(void);
+void DrainLogRing(log_ring_t *ring);
+void LogRecordSync(log_type_t log_type, const char *str);
+void OrphanLogRing(void *arg);
 
 /*********************************************************************//**
 **
@@ -87,6 +140,78 @@ void USP_LOG_Init(void)
 {
     // Default to logging to stdout
     log_fd = stdout;
+
+    // NOTE: Errors are ignored here, as logging cannot be reported if logging failed to initialise
+    (void)OS_UTILS_InitMutex(&log_writer_mutex);
+}
+
+/*********************************************************************//**
+**
+** USP_LOG_StartWriter
+**
+** Starts the thread which writes log messages to the log destination
+** From now on, log messages are written asynchronously (see comment at top of this file)
+**
+** \param   None
+**
+** \return  USP_ERR_OK if successful
+**
+**************************************************************************/
+int USP_LOG_StartWriter(void)
+{
+    int err;
+
+    // Exit if unable to create the message queue used to wakeup the writer thread
+    err = MSG_QUEUE_Init(&log_mq, 0, 0);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+
+    // Exit if unable to create the key used to detect when a thread owning a ring buffer exits
+    err = pthread_key_create(&log_ring_key, OrphanLogRing);
+    if (err != 0)
+    {
+        USP_ERR_ERRNO("pthread_key_create", err);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Exit if unable to start the writer thread
+    err = OS_UTILS_CreateThread(LogWriterMain, NULL);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+
+    // Ensure that all log messages are written, if the executable exits
+    atexit(USP_LOG_Flush);
+
+    is_log_async = true;
+    return USP_ERR_OK;
+}
+
+/*********************************************************************//**
+**
+** USP_LOG_Flush
+**
+** Writes all log messages in the ring buffers of all threads to the log destination
+** This is called before the executable exits, to ensure that the last log messages are not lost
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void USP_LOG_Flush(void)
+{
+    if (is_log_async == false)
+    {
+        return;
+    }
+
+    OS_UTILS_LockMutex(&log_writer_mutex);
+    DrainAllLogRings();
+    OS_UTILS_UnlockMutex(&log_writer_mutex);
 }
 
 /*********************************************************************//**
@@ -102,6 +227,10 @@ void USP_LOG_Init(void)
 **************************************************************************/
 int USP_LOG_SetFile(const char *file)
 {
+    int err = USP_ERR_OK;
+
+    OS_UTILS_LockMutex(&log_writer_mutex);
+
     // Close the current log file
     CloseLog();
 
@@ -109,25 +238,29 @@ int USP_LOG_SetFile(const char *file)
     if ((file == NULL) || strcmp(file, "syslog")==0)
     {
         log_fd = NULL;
-        return USP_ERR_OK;
+        goto exit;
     }
 
     // Exit if stdout
     if (strcmp(file, "stdout")==0)
     {
         log_fd = stdout;
-        return USP_ERR_OK;
+        goto exit;
     }
 
     // Otherwise open the named file
     log_fd = fopen(file, "w");
     if (log_fd == NULL)
     {
-        USP_ERR_ERRNO("fopen", errno);
+        err = errno;
+        OS_UTILS_UnlockMutex(&log_writer_mutex);
+        USP_ERR_ERRNO("fopen", err);
         return USP_ERR_INTERNAL_ERROR;
     }
 
-    return USP_ERR_OK;
+exit:
+    OS_UTILS_UnlockMutex(&log_writer_mutex);
+    return err;
 }
 
 /*********************************************************************//**
@@ -420,17 +553,37 @@ void USP_LOG_Printf(log_type_t log_type, const char *fmt, ...)
 **************************************************************************/
 void USP_LOG_Puts(log_type_t log_type, const char *str)
 {
+    log_ring_t *ring;
+
     switch(log_type)
     {
         case kLogType_Debug:
-            if (dump_to_cli)
+        case kLogType_Protocol:
+            if ((log_type == kLogType_Debug) && (dump_to_cli))
             {
                 CLI_SERVER_SendResponse(str);
                 CLI_SERVER_SendResponse("\n");
+                break;
+            }
+
+            if ((log_type == kLogType_Protocol) && (enable_protocol_trace == false))
+            {
+                break;
+            }
+
+            // Write the message into this thread's ring buffer, if logging asynchronously
+            // Messages which are too long for a ring buffer record (eg from USP_LOG_String) are written synchronously instead
+            ring = ((is_log_async) && (strlen(str) < USP_LOG_MAXLEN)) ? GetThreadLogRing() : NULL;
+            if (ring != NULL)
+            {
+                if (PushLogRecord(ring, log_type, str))
+                {
+                    MSG_QUEUE_Wakeup(&log_mq);
+                }
             }
             else
             {
-                LogMessageToFile(log_fd, str);
+                LogRecordSync(log_type, str);
             }
             break;
 
@@ -442,14 +595,7 @@ void USP_LOG_Puts(log_type_t log_type, const char *str)
             }
             else
             {
-                LogMessageToFile(log_fd, str);
-            }
-            break;
-
-        case kLogType_Protocol:
-            if (enable_protocol_trace)
-            {
-                LogMessageToFile(log_fd, str);
+                LogRecordSync(log_type, str);
             }
             break;
     }
@@ -461,6 +607,7 @@ void USP_LOG_Puts(log_type_t log_type, const char *str)
 **
 ** Logs the specified message to the specified file
 ** NOTE: This function automatically inserts a trailing '\n'
+** NOTE: The caller is responsible for flushing the file (see FlushLog)
 **
 ** \param   fd - file to log the string to, or NULL if logging to syslog
 ** \param   str - pointer to string to log
@@ -480,7 +627,6 @@ void LogMessageToFile(FILE *fd, const char *str)
     else
     {
         fprintf(fd, "%s\n", str);
-        fflush(fd);
     }
 
     // Send the message to the vendor hook
@@ -491,6 +637,305 @@ void LogMessageToFile(FILE *fd, const char *str)
     }
 }
 
+/*********************************************************************//**
+**
+** LogRecordSync
+**
+** Synchronously logs the specified message to the log destination
+** If logging asynchronously, all messages in the ring buffers are written first, so that earlier messages are not logged after this one
+**
+** \param   log_type - type of information which the string contains
+** \param   str - pointer to string to log
+**
+** \return  None
+**
+**************************************************************************/
+void LogRecordSync(log_type_t log_type, const char *str)
+{
+    OS_UTILS_LockMutex(&log_writer_mutex);
+    if (is_log_async)
+    {
+        DrainAllLogRings();
+    }
+    LogMessageToFile(log_fd, str);
+    FlushLog();
+    OS_UTILS_UnlockMutex(&log_writer_mutex);
+}
+
+/*********************************************************************//**
+**
+** LogWriterMain
+**
+** Main loop of the thread which writes log messages in the ring buffers to the log destination
+**
+** \param   args - arguments (currently unused)
+**
+** \return  None
+**
+**************************************************************************/
+void *LogWriterMain(void *args)
+{
+    socket_set_t set;
+    int num_sockets;
+
+    while(FOREVER)
+    {
+        // Wait until a message has been written into a ring buffer
+        // NOTE: The timeout ensures that ring buffers of exited threads are freed, even if no further messages are logged
+        SOCKET_SET_Clear(&set);
+        SOCKET_SET_AddSocketToReceiveFrom(MSG_QUEUE_GetSocket(&log_mq), LOG_WRITER_TIMEOUT, &set);
+        num_sockets = SOCKET_SET_Select(&set);
+        if (num_sockets > 0)
+        {
+            MSG_QUEUE_ClearWakeup(&log_mq);
+        }
+
+        OS_UTILS_LockMutex(&log_writer_mutex);
+        DrainAllLogRings();
+        OS_UTILS_UnlockMutex(&log_writer_mutex);
+    }
+
+    return NULL;
+}
+
+/*********************************************************************//**
+**
+** GetThreadLogRing
+**
+** Returns the ring buffer owned by the calling thread, creating it if it does not already exist
+** NOTE: The ring buffer is allocated using malloc() directly, so that it is not reported as a memory leak
+**       and so that logging does not recurse into the USP memory functions
+**
+** \param   None
+**
+** \return  pointer to the ring buffer, or NULL if it could not be created
+**
+**************************************************************************/
+log_ring_t *GetThreadLogRing(void)
+{
+    log_ring_t *ring;
+
+    // Exit if this thread already has a ring buffer
+    if (thread_log_ring != NULL)
+    {
+        return thread_log_ring;
+    }
+
+    // Exit if unable to allocate a ring buffer. The caller logs synchronously instead
+    ring = malloc(sizeof(log_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->num_dropped = 0;
+    ring->is_orphaned = 0;
+
+    // Add the ring buffer to the list drained by the writer thread
+    OS_UTILS_LockMutex(&log_writer_mutex);
+    ring->next = log_rings;
+    log_rings = ring;
+    OS_UTILS_UnlockMutex(&log_writer_mutex);
+
+    // Arrange for the ring buffer to be marked as orphaned when this thread exits
+    (void)pthread_setspecific(log_ring_key, ring);
+    thread_log_ring = ring;
+
+    return ring;
+}
+
+/*********************************************************************//**
+**
+** PushLogRecord
+**
+** Writes the specified message into the specified ring buffer
+** NOTE: This function must only be called by the thread owning the ring buffer. It does not take any locks.
+** NOTE: The caller must ensure that the message is shorter than USP_LOG_MAXLEN
+**
+** \param   ring - pointer to ring buffer owned by the calling thread
+** \param   log_type - type of information which the string contains
+** \param   str - pointer to string to log
+**
+** \return  true if the message was written, false if it was dropped because the ring buffer was full
+**
+**************************************************************************/
+bool PushLogRecord(log_ring_t *ring, log_type_t log_type, const char *str)
+{
+    log_record_hdr_t *hdr;
+    unsigned len;
+    unsigned record_size;
+    unsigned head;
+    unsigned tail;
+    unsigned offset;
+    unsigned contiguous;
+    unsigned needed;
+
+    len = strlen(str) + 1;
+    record_size = LOG_RECORD_ALIGN(sizeof(log_record_hdr_t) + len);
+
+    // Determine the space needed in the ring buffer. If the record does not fit in the space before the end of the buffer,
+    // that space is skipped, and the record is written at the start of the buffer
+    tail = ring->tail;
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    offset = tail & (USP_LOG_RING_SIZE-1);
+    contiguous = USP_LOG_RING_SIZE - offset;
+    needed = (contiguous < record_size) ? contiguous + record_size : record_size;
+
+    // Exit if the ring buffer does not have enough space for this message
+    if (USP_LOG_RING_SIZE - (tail - head) < needed)
+    {
+        __atomic_add_fetch(&ring->num_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    // Mark the space at the end of the buffer as unused, if the record does not fit in it
+    if (contiguous < record_size)
+    {
+        hdr = (log_record_hdr_t *) &ring->buf[offset];
+        hdr->len = contiguous - sizeof(log_record_hdr_t);
+        hdr->log_type = LOG_RING_PADDING;
+        tail += contiguous;
+        offset = 0;
+    }
+
+    // Write the record
+    hdr = (log_record_hdr_t *) &ring->buf[offset];
+    hdr->len = len;
+    hdr->log_type = log_type;
+    memcpy(&hdr[1], str, len-1);
+    ((char *)&hdr[1])[len-1] = '\0';
+
+    // Publish the record to the writer thread
+    __atomic_store_n(&ring->tail, tail + record_size, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/*********************************************************************//**
+**
+** DrainAllLogRings
+**
+** Writes all messages in all ring buffers to the log destination, freeing the ring buffers of threads which have exited
+** NOTE: This function must be called with log_writer_mutex taken
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void DrainAllLogRings(void)
+{
+    log_ring_t *ring;
+    log_ring_t **prev_link;
+    int is_orphaned;
+
+    prev_link = &log_rings;
+    ring = log_rings;
+    while (ring != NULL)
+    {
+        // NOTE: The orphaned flag must be read before draining, so that all messages written by the exited thread are drained before the ring buffer is freed
+        is_orphaned = __atomic_load_n(&ring->is_orphaned, __ATOMIC_ACQUIRE);
+        DrainLogRing(ring);
+
+        if (is_orphaned)
+        {
+            *prev_link = ring->next;
+            free(ring);
+            ring = *prev_link;
+        }
+        else
+        {
+            prev_link = &ring->next;
+            ring = ring->next;
+        }
+    }
+
+    // Flush once, after all messages have been written, rather than after each message
+    FlushLog();
+}
+
+/*********************************************************************//**
+**
+** DrainLogRing
+**
+** Writes all messages in the specified ring buffer to the log destination
+** NOTE: This function must be called with log_writer_mutex taken
+**
+** \param   ring - pointer to ring buffer to drain
+**
+** \return  None
+**
+**************************************************************************/
+void DrainLogRing(log_ring_t *ring)
+{
+    log_record_hdr_t *hdr;
+    unsigned head;
+    unsigned tail;
+    unsigned num_dropped;
+    char buf[64];
+
+    // Log the number of messages dropped, if any
+    num_dropped = __atomic_exchange_n(&ring->num_dropped, 0, __ATOMIC_RELAXED);
+    if (num_dropped > 0)
+    {
+        USP_SNPRINTF(buf, sizeof(buf), "...[%u log messages dropped]...", num_dropped);
+        LogMessageToFile(log_fd, buf);
+    }
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        hdr = (log_record_hdr_t *) &ring->buf[head & (USP_LOG_RING_SIZE-1)];
+        if (hdr->log_type != LOG_RING_PADDING)
+        {
+            LogMessageToFile(log_fd, (char *)&hdr[1]);
+        }
+
+        // Release the space occupied by the record back to the thread owning the ring buffer
+        head += LOG_RECORD_ALIGN(sizeof(log_record_hdr_t) + hdr->len);
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/*********************************************************************//**
+**
+** OrphanLogRing
+**
+** Called when a thread owning a ring buffer exits, to mark the ring buffer for freeing by the writer thread
+**
+** \param   arg - pointer to ring buffer owned by the exiting thread
+**
+** \return  None
+**
+**************************************************************************/
+void OrphanLogRing(void *arg)
+{
+    log_ring_t *ring = (log_ring_t *) arg;
+
+    __atomic_store_n(&ring->is_orphaned, 1, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************//**
+**
+** FlushLog
+**
+** Flushes the current log file, if it is stdout or a file on the filesystem
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void FlushLog(void)
+{
+    if (log_fd != NULL)
+    {
+        fflush(log_fd);
+    }
+}
+
 /*********************************************************************//**
 **
 ** CloseLog
@@ -66,6 +66,8 @@ typedef enum
 //------------------------------------------------------------------------------------
 // API
 void USP_LOG_Init(void);
+int USP_LOG_StartWriter(void);
+void USP_LOG_Flush(void);
 int USP_LOG_SetFile(const char *file);
 void USP_LOG_Callstack(void);
 void USP_LOG_HexBuffer(const char *title, const unsigned char *buf, int len);
@@ -89,7 +91,7 @@ extern bool enable_callstack_debug;
 #define USP_DUMP(...)       USP_LOG_Printf(kLogType_Dump, __VA_ARGS__)
 
 // Macro used to print out STOMP frames
-#define USP_PROTOCOL(...)   USP_LOG_Printf(kLogType_Protocol, __VA_ARGS__)
+#define USP_PROTOCOL(...)   if (enable_protocol_trace) { USP_LOG_Printf(kLogType_Protocol, __VA_ARGS__); }
 
 // Maximum number of characters in a single log statement
 #define USP_LOG_MAXLEN  (10*1024)
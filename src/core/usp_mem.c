@@ -89,13 +89,30 @@ bool collect_memory_info = false;
 bool print_leak_report = false;
 unsigned baseline_memory_usage = 0;           // 0 indicates that the memory usage could not be obtained
 
+//------------------------------------------------------------------------------------
+// Hash table of memory info entries, keyed by the pointer to the allocated memory
+// It uses open addressing with linear probing. A free slot has ptr==NULL.
+// The number of slots is always a power of 2, and the table is doubled in size when it becomes more than 3/4 full
 static minfo_t *minfo = NULL;
+static unsigned minfo_table_size = 0;       // Number of slots in the minfo[] hash table
+static unsigned num_minfo_entries = 0;      // Number of slots in the minfo[] hash table which are in use
+static unsigned callstack_sample_count = 0; // Counter used to determine which allocations have their callstack recorded
+
+#define MINFO_INITIAL_TABLE_SIZE 16384      // NOTE: Performing a get on 'Device.' can use a lot of entries
 //------------------------------------------------------------------------------------
 // Forward declarations. Note these are not static, because we need them in the symbol table for USP_LOG_Callstack() to show them
 void *Protobuf_Alloc(void *allocator_data, size_t size);
 void Protobuf_Free(void *allocator_data, void *pointer);
-minfo_t *FindFreeMemInfo(void);
+void *ProtobufArena_Alloc(void *allocator_data, size_t size);
+void ProtobufArena_Free(void *allocator_data, void *pointer);
+void *ArenaAlloc(size_t size);
+bool IsArenaPtr(void *ptr);
+minfo_t *AddMemInfo(void *ptr, const char *func, int line, int size);
 minfo_t *FindMemInfoByPtr(void *ptr);
+void RemoveMemInfo(minfo_t *mi);
+void GrowMemInfoTable(void);
+unsigned CalcMemInfoHash(void *ptr, unsigned table_size);
+void RecordMemInfoCallers(minfo_t *mi);
 void PrintMemInfoEntry(minfo_t *mi, char *str, int index);
 void GetCallers(char **callers, int num_callers);
 unsigned GetMemUsage(void);
@@ -113,6 +130,111 @@ static ProtobufCAllocator protobuf_allocator =
 // Pointer to protobuf allocator which is externally visible
 void *pbuf_allocator = (void *)&protobuf_allocator;
 
+//------------------------------------------------------------------------------------
+// Arena allocator used for the protobuf structures associated with the USP message currently being processed by the data model thread
+// (ie the unpacked request and the response being built). Allocations are bump allocated from a list of chunks,
+// and are all released at once by USP_MEM_ArenaReset(), after the message has been processed.
+// The chunks are recycled for the next message.
+// NOTE: Outside of USP_MEM_ArenaStart()/USP_MEM_ArenaReset(), arena allocations fall back to the heap
+// NOTE: Freeing a pointer which was allocated from the heap (rather than from the arena) frees it from the heap.
+//       This allows protobuf structures containing a mix of arena and heap allocated memory to be freed using usp__msg__free_unpacked()
+static ProtobufCAllocator protobuf_arena_allocator =
+{
+    ProtobufArena_Alloc,
+    ProtobufArena_Free,
+    NULL   // Opaque pointer passed to above 2 functions. Currently unused by those functions.
+};
+
+// Pointer to protobuf arena allocator which is externally visible
+void *pbuf_arena_allocator = (void *)&protobuf_arena_allocator;
+
+//------------------------------------------------------------------------------------
+// Chunk of memory from which arena allocations are made
+typedef struct arena_chunk_tag
+{
+    struct arena_chunk_tag *next;   // Next chunk in the list of chunks. The head of the list is the chunk currently being allocated from
+    size_t size;                    // Number of bytes available for allocation in this chunk
+    size_t used;                    // Number of bytes allocated from this chunk
+    size_t last_alloc;              // Offset of the last allocation made from this chunk. Used to grow the last allocation in place
+    unsigned char data[];           // Memory available for allocation
+} arena_chunk_t;
+
+static arena_chunk_t *arena_chunks = NULL;       // Chunks containing allocations for the current USP message
+static arena_chunk_t *arena_free_chunks = NULL;  // Empty chunks, retained for use by the next USP message
+static bool is_arena_active = false;
+
+//------------------------------------------------------------------------------------
+// Each arena allocation is preceded by a header containing the size of the allocation (needed by USP_MEM_ArenaRealloc)
+// and a tag word at the end of the header, which identifies the allocation as being from the arena (see IsArenaPtr)
+// The header size is chosen to maintain the alignment of the allocation
+#define ARENA_ALIGNMENT   16
+#define ARENA_HDR_SIZE    ARENA_ALIGNMENT
+#define ARENA_ALIGN(x)    (((x) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1))
+#define ARENA_ALLOC_SIZE(ptr)  (*(size_t *)((unsigned char *)(ptr) - ARENA_HDR_SIZE))
+#define ARENA_ALLOC_TAG(ptr)   (*(uint32_t *)((unsigned char *)(ptr) - sizeof(uint32_t)))
+#define ARENA_TAG         0xA4E4A7A5    // NOTE: Chosen so that it is not a plausible value for the size field in the header of a heap allocation
+
+#ifdef USP_MEM_SLAB_ALLOCATOR
+//------------------------------------------------------------------------------------
+// Slab allocator used for small allocations made via USP_MALLOC/USP_STRDUP/USP_REALLOC
+// Small allocations are rounded up to one of a fixed set of size classes, and carved out of large chunks obtained from malloc()
+// Freed blocks are kept on a free list for their size class, and never returned to malloc(), which avoids heap fragmentation.
+// Threads which have called USP_MEM_EnableThreadCache() keep a private cache of free blocks for each size class,
+// so that they only need to take the slab mutex when transferring a batch of blocks to or from the global free lists
+// NOTE: All memory allocated by USP_MALLOC must be freed by USP_FREE (never by free()), as every allocation is preceded by a header
+static const unsigned slab_class_sizes[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+#define NUM_SLAB_CLASSES  NUM_ELEM(slab_class_sizes)
+#define MAX_SLAB_ALLOC_SIZE 256     // Allocations larger than this are made directly from malloc()
+#define SLAB_HEAP_CLASS   0xFF      // Size class stored in the header of allocations made directly from malloc()
+
+// Each allocation is preceded by a header containing its size class. The header size is chosen to maintain the alignment of the allocation
+#define SLAB_HDR_SIZE     16
+#define SLAB_CLASS(ptr)   (*(unsigned *)((unsigned char *)(ptr) - SLAB_HDR_SIZE))
+
+// Lookup table converting (size+15)/16 to the index of the smallest size class which can contain an allocation of that size
+static const unsigned char slab_class_lookup[MAX_SLAB_ALLOC_SIZE/16 + 1] = { 0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 };
+
+// Free blocks are linked together using the first bytes of the (unused) allocation
+typedef struct slab_block_tag
+{
+    struct slab_block_tag *next;
+} slab_block_t;
+
+// Global free lists, protected by slab_access_mutex
+// NOTE: slab_access_mutex is initialised by USP_MEM_Init(), which must be called before any memory is allocated
+static pthread_mutex_t slab_access_mutex;
+static slab_block_t *slab_free_lists[NUM_SLAB_CLASSES];
+static void *slab_chunks = NULL;    // Linked list of all chunks that blocks have been carved from (the link is stored at the start of each chunk)
+
+// Per-thread caches of free blocks
+typedef struct
+{
+    bool is_enabled;
+    slab_block_t *free_lists[NUM_SLAB_CLASSES];
+    unsigned count[NUM_SLAB_CLASSES];
+} slab_cache_t;
+
+static __thread slab_cache_t slab_cache;
+
+#define SLAB_BATCH_SIZE  (USP_MEM_SLAB_THREAD_CACHE_SIZE/2)  // Number of blocks transferred between a thread's cache and the global free lists at a time
+
+void *SlabMalloc(size_t size);
+void SlabFree(void *ptr);
+void *SlabRealloc(void *ptr, size_t size);
+char *SlabStrdup(const char *str);
+slab_block_t *TakeSlabBlock(unsigned cls);
+
+#define MEM_MALLOC(size)        SlabMalloc(size)
+#define MEM_FREE(ptr)           SlabFree(ptr)
+#define MEM_REALLOC(ptr, size)  SlabRealloc(ptr, size)
+#define MEM_STRDUP(str)         SlabStrdup(str)
+#else
+#define MEM_MALLOC(size)        malloc(size)
+#define MEM_FREE(ptr)           free(ptr)
+#define MEM_REALLOC(ptr, size)  realloc(ptr, size)
+#define MEM_STRDUP(str)         strdup(str)
+#endif
+
 /*********************************************************************//**
 **
 ** Protobuf_Alloc
@@ -152,6 +274,606 @@ void Protobuf_Free(void *allocator_data, void *pointer)
     USP_FREE(pointer);
 }
 
+/*********************************************************************//**
+**
+** ProtobufArena_Alloc
+**
+** Allocates memory from the arena, used when unpacking a protocol buffer message
+** This function will terminate USP Agent, if out of memory
+**
+** \param   allocator_data - (UNUSED) opaque pointer passed into this function (defined in protobuf_arena_allocator)
+** \param   size - number of bytes to allocate
+**
+** \return  pointer to allocated buffer
+**
+**************************************************************************/
+void *ProtobufArena_Alloc(void *allocator_data, size_t size)
+{
+    return USP_MEM_ArenaMalloc(__FUNCTION__, __LINE__, size);
+}
+
+/*********************************************************************//**
+**
+** ProtobufArena_Free
+**
+** Frees memory allocated by ProtobufArena_Alloc()
+** Memory allocated from the arena is not actually freed until USP_MEM_ArenaReset() is called
+**
+** \param   allocator_data - (UNUSED) opaque pointer passed into this function (defined in protobuf_arena_allocator)
+** \param   pointer - pointer to buffer to free
+**
+** \return  None
+**
+**************************************************************************/
+void ProtobufArena_Free(void *allocator_data, void *pointer)
+{
+    if (IsArenaPtr(pointer))
+    {
+        return;
+    }
+
+    USP_FREE(pointer);
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_ArenaStart
+**
+** Called by the data model thread before processing a USP message, to start allocating from the arena
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void USP_MEM_ArenaStart(void)
+{
+    USP_ASSERT(OS_UTILS_IsDataModelThread(__FUNCTION__, PRINT_WARNING));
+    is_arena_active = true;
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_ArenaReset
+**
+** Called by the data model thread after processing a USP message, to release all memory allocated from the arena
+** NOTE: All protobuf structures allocated from the arena must have been freed (or be no longer referenced) before calling this function
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void USP_MEM_ArenaReset(void)
+{
+    arena_chunk_t *chunk;
+    arena_chunk_t *next;
+    size_t retained = 0;
+
+    USP_ASSERT(OS_UTILS_IsDataModelThread(__FUNCTION__, PRINT_WARNING));
+    is_arena_active = false;
+
+    // Count the size of the chunks already retained
+    for (chunk = arena_free_chunks; chunk != NULL; chunk = chunk->next)
+    {
+        retained += chunk->size;
+    }
+
+    // Iterate over all chunks, keeping standard sized chunks for use by the next USP message (up to a limit), and freeing the rest
+    // NOTE: Chunks are not retained when collecting memory info, so that they do not show up in the leak report
+    chunk = arena_chunks;
+    arena_chunks = NULL;
+    while (chunk != NULL)
+    {
+        next = chunk->next;
+        if ((chunk->size == USP_ARENA_CHUNK_SIZE) && (retained + chunk->size <= USP_ARENA_MAX_RETAINED) && (collect_memory_info == false))
+        {
+            chunk->used = 0;
+            chunk->last_alloc = 0;
+            chunk->next = arena_free_chunks;
+            arena_free_chunks = chunk;
+            retained += chunk->size;
+        }
+        else
+        {
+            USP_FREE(chunk);
+        }
+        chunk = next;
+    }
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_ArenaMalloc
+**
+** Allocates memory from the arena (if active), otherwise from the heap
+** This function will terminate USP Agent, if out of memory
+**
+** \param   func - name of caller
+** \param   line - line number of caller
+** \param   size - number of bytes to allocate
+**
+** \return  pointer to allocated buffer
+**
+**************************************************************************/
+void *USP_MEM_ArenaMalloc(const char *func, int line, int size)
+{
+    if (is_arena_active == false)
+    {
+        return USP_MEM_Malloc(func, line, size);
+    }
+
+    return ArenaAlloc(size);
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_ArenaRealloc
+**
+** Reallocates memory allocated by USP_MEM_ArenaMalloc()
+** This function will terminate USP Agent, if out of memory
+**
+** \param   func - name of caller
+** \param   line - line number of caller
+** \param   ptr - pointer to current buffer that needs reallocating (or NULL)
+** \param   size - number of bytes to reallocate
+**
+** \return  pointer to reallocated buffer
+**
+**************************************************************************/
+void *USP_MEM_ArenaRealloc(const char *func, int line, void *ptr, int size)
+{
+    arena_chunk_t *chunk;
+    size_t old_size;
+    size_t new_used;
+    void *new_ptr;
+
+    // Use the heap, if the existing buffer was allocated from the heap
+    if ((ptr != NULL) && (IsArenaPtr(ptr) == false))
+    {
+        return USP_MEM_Realloc(func, line, ptr, size);
+    }
+
+    // Exit if there is no existing buffer
+    if (ptr == NULL)
+    {
+        return USP_MEM_ArenaMalloc(func, line, size);
+    }
+
+    // Exit if the buffer is already large enough
+    old_size = ARENA_ALLOC_SIZE(ptr);
+    if ((size_t)size <= old_size)
+    {
+        return ptr;
+    }
+
+    // Grow the buffer in place, if it was the last allocation from the current chunk, and there is room in the chunk
+    chunk = arena_chunks;
+    if ((is_arena_active) && ((unsigned char *)ptr == &chunk->data[chunk->last_alloc + ARENA_HDR_SIZE]))
+    {
+        new_used = chunk->last_alloc + ARENA_HDR_SIZE + ARENA_ALIGN(size);
+        if (new_used <= chunk->size)
+        {
+            chunk->used = new_used;
+            ARENA_ALLOC_SIZE(ptr) = size;
+            return ptr;
+        }
+    }
+
+    // Otherwise allocate a new buffer and copy the contents across
+    // The new buffer is at least double the size of the old buffer, so that arrays of pointers in protobuf structures
+    // (which are built up one entry at a time, interleaved with allocations for the entries) are only copied O(log n) times
+    // NOTE: The old buffer is released when the arena is reset
+    new_ptr = USP_MEM_ArenaMalloc(func, line, MAX((size_t)size, 2*old_size));
+    memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_ArenaStrdup
+**
+** Duplicates the specified string, allocating it from the arena (if active), otherwise from the heap
+** NOTE: This function treats a NULL input string, as a NULL output
+**
+** \param   func - name of caller
+** \param   line - line number of caller
+** \param   str - pointer to string to duplicate
+**
+** \return  pointer to duplicated string
+**
+**************************************************************************/
+char *USP_MEM_ArenaStrdup(const char *func, int line, const char *str)
+{
+    int len;
+    char *new_str;
+
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    len = strlen(str) + 1;
+    new_str = USP_MEM_ArenaMalloc(func, line, len);
+    memcpy(new_str, str, len);
+
+    return new_str;
+}
+
+/*********************************************************************//**
+**
+** ArenaAlloc
+**
+** Bump allocates the specified number of bytes from the arena, adding a new chunk to the arena if necessary
+**
+** \param   size - number of bytes to allocate
+**
+** \return  pointer to allocated buffer
+**
+**************************************************************************/
+void *ArenaAlloc(size_t size)
+{
+    arena_chunk_t *chunk;
+    size_t needed;
+    size_t chunk_size;
+    unsigned char *ptr;
+
+    // Add a new chunk, if there is not enough room in the current chunk
+    needed = ARENA_HDR_SIZE + ARENA_ALIGN(size);
+    chunk = arena_chunks;
+    if ((chunk == NULL) || (chunk->used + needed > chunk->size))
+    {
+        if ((arena_free_chunks != NULL) && (needed <= arena_free_chunks->size))
+        {
+            // Reuse a chunk retained from a previous USP message
+            chunk = arena_free_chunks;
+            arena_free_chunks = chunk->next;
+        }
+        else
+        {
+            // NOTE: Allocations larger than a standard chunk get a chunk of their own
+            chunk_size = MAX(needed, USP_ARENA_CHUNK_SIZE);
+            chunk = USP_MALLOC(sizeof(arena_chunk_t) + chunk_size);
+            chunk->size = chunk_size;
+            chunk->used = 0;
+            chunk->last_alloc = 0;
+        }
+
+        chunk->next = arena_chunks;
+        arena_chunks = chunk;
+    }
+
+    // Bump allocate from the chunk
+    ptr = &chunk->data[chunk->used];
+    chunk->last_alloc = chunk->used;
+    chunk->used += needed;
+    ptr += ARENA_HDR_SIZE;
+    ARENA_ALLOC_SIZE(ptr) = size;
+    ARENA_ALLOC_TAG(ptr) = ARENA_TAG;
+
+    return ptr;
+}
+
+/*********************************************************************//**
+**
+** IsArenaPtr
+**
+** Determines whether the specified pointer was allocated from the arena
+** NOTE: This is called for every pointer freed using the arena allocator, so it is O(1), checking the tag word in the header
+**       preceding the allocation. For heap allocations, the tag word overlays the allocator's own header
+**       (which is cleared by the slab allocator, and contains the chunk size for malloc), so it never matches
+**
+** \param   ptr - pointer to buffer
+**
+** \return  true if the buffer was allocated from the arena
+**
+**************************************************************************/
+bool IsArenaPtr(void *ptr)
+{
+    // Exit if the arena is not active. In this case, no allocations from the arena are still in use
+    if ((is_arena_active == false) || (ptr == NULL))
+    {
+        return false;
+    }
+
+    return (ARENA_ALLOC_TAG(ptr) == ARENA_TAG);
+}
+
+/*********************************************************************//**
+**
+** USP_MEM_EnableThreadCache
+**
+** Called at the start of long lived threads (data model, MTP and bulk data collection threads)
+** to give the calling thread a private cache of free slab blocks, so that allocating and freeing small objects
+** does not contend with other threads. Does nothing if the slab allocator is not compiled in.
+** NOTE: Blocks in the cache are not returned to the global free lists when the thread exits, so this must not be called by short lived threads
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void USP_MEM_EnableThreadCache(void)
+{
+#ifdef USP_MEM_SLAB_ALLOCATOR
+    slab_cache.is_enabled = true;
+#endif
+}
+
+#ifdef USP_MEM_SLAB_ALLOCATOR
+/*********************************************************************//**
+**
+** SlabMalloc
+**
+** Allocates memory from the slab for the size class of the allocation, or from malloc() if the allocation is too large
+**
+** \param   size - number of bytes to allocate
+**
+** \return  pointer to allocated memory, or NULL if out of memory
+**
+**************************************************************************/
+void *SlabMalloc(size_t size)
+{
+    unsigned cls;
+    slab_block_t *block;
+    unsigned char *p;
+
+    // Allocate directly from malloc(), if the allocation is too large for any of the size classes
+    if (size > MAX_SLAB_ALLOC_SIZE)
+    {
+        p = malloc(SLAB_HDR_SIZE + size);
+        if (p == NULL)
+        {
+            return NULL;
+        }
+        memset(p, 0, SLAB_HDR_SIZE);
+        p += SLAB_HDR_SIZE;
+        SLAB_CLASS(p) = SLAB_HEAP_CLASS;
+        return p;
+    }
+
+    cls = slab_class_lookup[(size + 15) >> 4];
+
+    // Allocate from this thread's cache, if it has one, refilling it from the global free lists if necessary
+    if (slab_cache.is_enabled)
+    {
+        if (slab_cache.free_lists[cls] == NULL)
+        {
+            OS_UTILS_LockMutex(&slab_access_mutex);
+            while (slab_cache.count[cls] < SLAB_BATCH_SIZE)
+            {
+                block = TakeSlabBlock(cls);
+                if (block == NULL)
+                {
+                    break;
+                }
+                block->next = slab_cache.free_lists[cls];
+                slab_cache.free_lists[cls] = block;
+                slab_cache.count[cls]++;
+            }
+            OS_UTILS_UnlockMutex(&slab_access_mutex);
+
+            if (slab_cache.free_lists[cls] == NULL)
+            {
+                return NULL;
+            }
+        }
+
+        block = slab_cache.free_lists[cls];
+        slab_cache.free_lists[cls] = block->next;
+        slab_cache.count[cls]--;
+        return block;
+    }
+
+    // Otherwise allocate directly from the global free lists
+    OS_UTILS_LockMutex(&slab_access_mutex);
+    block = TakeSlabBlock(cls);
+    OS_UTILS_UnlockMutex(&slab_access_mutex);
+
+    return block;
+}
+
+/*********************************************************************//**
+**
+** SlabFree
+**
+** Frees memory allocated by SlabMalloc()
+**
+** \param   ptr - pointer to memory to free
+**
+** \return  None
+**
+**************************************************************************/
+void SlabFree(void *ptr)
+{
+    unsigned cls;
+    unsigned i;
+    slab_block_t *block;
+
+    // Exit if there is nothing to free (as for free())
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    // Exit if the memory was allocated directly from malloc()
+    cls = SLAB_CLASS(ptr);
+    if (cls == SLAB_HEAP_CLASS)
+    {
+        free((unsigned char *)ptr - SLAB_HDR_SIZE);
+        return;
+    }
+    USP_ASSERT(cls < NUM_SLAB_CLASSES);
+
+    block = (slab_block_t *) ptr;
+
+    // Return the block to the global free lists, if this thread does not have a cache
+    if (slab_cache.is_enabled == false)
+    {
+        OS_UTILS_LockMutex(&slab_access_mutex);
+        block->next = slab_free_lists[cls];
+        slab_free_lists[cls] = block;
+        OS_UTILS_UnlockMutex(&slab_access_mutex);
+        return;
+    }
+
+    // Otherwise return the block to this thread's cache
+    block->next = slab_cache.free_lists[cls];
+    slab_cache.free_lists[cls] = block;
+    slab_cache.count[cls]++;
+
+    // Transfer a batch of blocks back to the global free lists, if this thread's cache has become too large
+    if (slab_cache.count[cls] > USP_MEM_SLAB_THREAD_CACHE_SIZE)
+    {
+        OS_UTILS_LockMutex(&slab_access_mutex);
+        for (i=0; i<SLAB_BATCH_SIZE; i++)
+        {
+            block = slab_cache.free_lists[cls];
+            slab_cache.free_lists[cls] = block->next;
+            block->next = slab_free_lists[cls];
+            slab_free_lists[cls] = block;
+        }
+        slab_cache.count[cls] -= SLAB_BATCH_SIZE;
+        OS_UTILS_UnlockMutex(&slab_access_mutex);
+    }
+}
+
+/*********************************************************************//**
+**
+** SlabRealloc
+**
+** Reallocates memory allocated by SlabMalloc()
+**
+** \param   ptr - pointer to memory to reallocate, or NULL if the memory has not been allocated yet
+** \param   size - number of bytes to reallocate
+**
+** \return  pointer to reallocated memory, or NULL if out of memory
+**
+**************************************************************************/
+void *SlabRealloc(void *ptr, size_t size)
+{
+    unsigned cls;
+    unsigned char *p;
+    void *new_ptr;
+
+    // Realloc of a NULL pointer is equivalent to malloc
+    if (ptr == NULL)
+    {
+        return SlabMalloc(size);
+    }
+
+    // Reallocate using realloc(), if the memory was allocated directly from malloc()
+    cls = SLAB_CLASS(ptr);
+    if (cls == SLAB_HEAP_CLASS)
+    {
+        p = realloc((unsigned char *)ptr - SLAB_HDR_SIZE, SLAB_HDR_SIZE + size);
+        if (p == NULL)
+        {
+            return NULL;
+        }
+        return p + SLAB_HDR_SIZE;
+    }
+
+    // Exit if the existing block is already large enough
+    USP_ASSERT(cls < NUM_SLAB_CLASSES);
+    if (size <= slab_class_sizes[cls])
+    {
+        return ptr;
+    }
+
+    // Otherwise move the allocation to a larger block
+    new_ptr = SlabMalloc(size);
+    if (new_ptr == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, slab_class_sizes[cls]);
+    SlabFree(ptr);
+
+    return new_ptr;
+}
+
+/*********************************************************************//**
+**
+** SlabStrdup
+**
+** Copies the specified string into memory allocated by SlabMalloc()
+**
+** \param   str - string to copy
+**
+** \return  pointer to copy of the string, or NULL if out of memory
+**
+**************************************************************************/
+char *SlabStrdup(const char *str)
+{
+    size_t size;
+    char *new_str;
+
+    size = strlen(str) + 1;
+    new_str = SlabMalloc(size);
+    if (new_str == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new_str, str, size);
+
+    return new_str;
+}
+
+/*********************************************************************//**
+**
+** TakeSlabBlock
+**
+** Removes a free block of the specified size class from the global free lists,
+** carving more blocks from a new chunk, if there are no free blocks of the size class
+** NOTE: This function must be called with slab_access_mutex taken
+**
+** \param   cls - size class of the block to allocate
+**
+** \return  pointer to the block, or NULL if out of memory
+**
+**************************************************************************/
+slab_block_t *TakeSlabBlock(unsigned cls)
+{
+    slab_block_t *block;
+    unsigned char *chunk;
+    unsigned char *p;
+    size_t stride;
+    size_t offset;
+
+    // Carve a new chunk into blocks of this size class, if there are no free blocks of this size class
+    if (slab_free_lists[cls] == NULL)
+    {
+        chunk = malloc(USP_MEM_SLAB_CHUNK_SIZE);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+
+        // Add the chunk to the list of all chunks. The first SLAB_HDR_SIZE bytes of the chunk contain the link
+        *(void **)chunk = slab_chunks;
+        slab_chunks = chunk;
+
+        stride = SLAB_HDR_SIZE + slab_class_sizes[cls];
+        for (offset = SLAB_HDR_SIZE; offset + stride <= USP_MEM_SLAB_CHUNK_SIZE; offset += stride)
+        {
+            p = chunk + offset + SLAB_HDR_SIZE;
+            memset(p - SLAB_HDR_SIZE, 0, SLAB_HDR_SIZE);    // NOTE: This ensures that the block is not mistaken for an arena allocation
+            SLAB_CLASS(p) = cls;
+            block = (slab_block_t *) p;
+            block->next = slab_free_lists[cls];
+            slab_free_lists[cls] = block;
+        }
+    }
+
+    block = slab_free_lists[cls];
+    slab_free_lists[cls] = block->next;
+
+    return block;
+}
+#endif
+
 /*********************************************************************//**
 **
 ** USP_MEM_Init
@@ -169,6 +891,8 @@ int USP_MEM_Init(void)
 
     // Initialise global varaiables
     minfo = NULL;
+    minfo_table_size = 0;
+    num_minfo_entries = 0;
     collect_memory_info = false;
 
     // Exit if unable to create mutex protecting access to this subsystem
@@ -178,6 +902,15 @@ int USP_MEM_Init(void)
         return err;
     }
 
+#ifdef USP_MEM_SLAB_ALLOCATOR
+    // Exit if unable to create mutex protecting access to the slab allocator's global free lists
+    err = OS_UTILS_InitMutex(&slab_access_mutex);
+    if (err != USP_ERR_OK)
+    {
+        return err;
+    }
+#endif
+
     return USP_ERR_OK;
 }
 
@@ -198,6 +931,7 @@ void USP_MEM_Destroy(void)
     if (minfo != NULL)
     {
         free(minfo);
+        minfo = NULL;
     }
 }
 
@@ -220,7 +954,7 @@ void *USP_MEM_Malloc(const char *func, int line, int size)
     minfo_t *mi;
 
     // Terminate if out of memory
-    ptr = malloc(size);
+    ptr = MEM_MALLOC(size);
     if (ptr == NULL)
     {
         USP_ERR_Terminate("%s (%d): malloc(%d bytes) failed", func, line, size);
@@ -233,20 +967,8 @@ void *USP_MEM_Malloc(const char *func, int line, int size)
         // Uncomment the definition in the line below to get debug logging of memory API functions
         #define tr_mem(...) //USP_LOG_Info(__VA_ARGS__)
         tr_mem("%s(%d): malloc(%d) = %p", func, line, size, ptr);
-        mi = FindFreeMemInfo();
-        if (mi != NULL)
-        {
-            mi->ptr = ptr;
-            mi->func = func;
-            mi->line = line;
-            mi->size = size;
-            mi->flags |= MI_MODIFIED;
-            GetCallers(mi->callers, NUM_ELEM(mi->callers));
-        }
-        else
-        {
-            USP_ERR_Terminate("Need to increase MAX_MINFO_ENTRIES");
-        }
+        mi = AddMemInfo(ptr, func, line, size);
+        RecordMemInfoCallers(mi);
         OS_UTILS_UnlockMutex(&mem_access_mutex);
     }
 
@@ -270,21 +992,20 @@ void USP_MEM_Free(const char *func, int line, void *ptr)
 {
     minfo_t *mi;
 
-    // Free the memory
-    free(ptr);
-
 #ifndef __clang_analyzer__
     // Clang static analyser goes wrong here because the ptr in meminfo is just an address used as a key; ptr is not owned by meminfo
 
     // Collect memory info, if enabled
-    if (collect_memory_info)
+    // NOTE: This is done before freeing the memory, so that the address cannot be reused by another thread before its meminfo entry has been removed
+    // NOTE: Freeing a NULL pointer is allowed (as for free()) and has no meminfo entry
+    if ((collect_memory_info) && (ptr != NULL))
     {
         OS_UTILS_LockMutex(&mem_access_mutex);
         tr_mem("%s(%d): free(%p)", func, line, ptr);
         mi = FindMemInfoByPtr(ptr);
         if (mi != NULL)
         {
-            memset(mi, 0, sizeof(minfo_t));
+            RemoveMemInfo(mi);
         }
         else
         {
@@ -293,6 +1014,9 @@ void USP_MEM_Free(const char *func, int line, void *ptr)
         OS_UTILS_UnlockMutex(&mem_access_mutex);
     }
 #endif
+
+    // Free the memory
+    MEM_FREE(ptr);
 }
 
 /*********************************************************************//**
@@ -314,35 +1038,42 @@ void *USP_MEM_Realloc(const char *func, int line, void *ptr, int size)
     minfo_t *mi;
     void *new_ptr;
 
+#ifndef __clang_analyzer__
+    // Clang static analyser goes wrong here because the ptr in meminfo is just an address used as a key; ptr is not owned by meminfo
+
+    // Remove the meminfo entry keyed by the old pointer, if enabled (realloc of a NULL pointer is equivalent to malloc)
+    // NOTE: This is done before reallocating the memory, so that the old address cannot be reused by another thread before its meminfo entry has been removed
+    if (collect_memory_info)
+    {
+        OS_UTILS_LockMutex(&mem_access_mutex);
+        if (ptr != NULL)
+        {
+            mi = FindMemInfoByPtr(ptr);
+            if (mi == NULL)
+            {
+                USP_ERR_Terminate("Trying to reallocate memory that was not allocated");
+            }
+            RemoveMemInfo(mi);
+        }
+        OS_UTILS_UnlockMutex(&mem_access_mutex);
+    }
+#endif
+
     // Terminate if out of memory
-    new_ptr = realloc(ptr, size);
+    new_ptr = MEM_REALLOC(ptr, size);
     if (new_ptr == NULL)
     {
         USP_ERR_Terminate("%s (%d): realloc(%d bytes) failed", func, line, size);
     }
 
 #ifndef __clang_analyzer__
-    // Clang static analyser goes wrong here because the ptr in meminfo is just an address used as a key; ptr is not owned by meminfo
-
-    // Collect memory info, if enabled
+    // Add a meminfo entry keyed by the new pointer, if enabled
     if (collect_memory_info)
     {
         OS_UTILS_LockMutex(&mem_access_mutex);
-        tr_mem("%s(%d): realloc(%p, %d) = %p", func, line, ptr, size, new_ptr);
-        mi = FindMemInfoByPtr(ptr);
-        if (mi != NULL)
-        {
-            mi->ptr = new_ptr;
-            mi->func = func;
-            mi->line = line;
-            mi->size = size;
-            mi->flags |= MI_MODIFIED;
-            GetCallers(mi->callers, NUM_ELEM(mi->callers));
-        }
-        else
-        {
-            USP_ERR_Terminate("Trying to reallocate memory that was not allocated");
-        }
+        tr_mem("%s(%d): realloc(%d) = %p", func, line, size, new_ptr);
+        mi = AddMemInfo(new_ptr, func, line, size);
+        RecordMemInfoCallers(mi);
         OS_UTILS_UnlockMutex(&mem_access_mutex);
     }
 #endif
@@ -377,7 +1108,7 @@ void *USP_MEM_Strdup(const char *func, int line, void *ptr)
     }
 
     // Terminate if out of memory
-    new_ptr = strdup(ptr);
+    new_ptr = MEM_STRDUP(ptr);
     if (new_ptr == NULL)
     {
         USP_ERR_Terminate("%s (%d): strdup(%d bytes) failed", func, line, (int)strlen(ptr)+1);
@@ -390,20 +1121,8 @@ void *USP_MEM_Strdup(const char *func, int line, void *ptr)
         OS_UTILS_LockMutex(&mem_access_mutex);
         size = strlen(ptr) + 1;
         tr_mem("%s(%d): strdup(%d) = %p", func, line, size, new_ptr);
-        mi = FindFreeMemInfo();
-        if (mi != NULL)
-        {
-            mi->ptr = new_ptr;
-            mi->func = func;
-            mi->line = line;
-            mi->size = size;
-            mi->flags |= MI_MODIFIED;
-            GetCallers(mi->callers, NUM_ELEM(mi->callers));
-        }
-        else
-        {
-            USP_ERR_Terminate("Need to increase MAX_MINFO_ENTRIES");
-        }
+        mi = AddMemInfo(new_ptr, func, line, size);
+        RecordMemInfoCallers(mi);
         OS_UTILS_UnlockMutex(&mem_access_mutex);
     }
 
@@ -423,15 +1142,25 @@ void *USP_MEM_Strdup(const char *func, int line, void *ptr)
 **************************************************************************/
 void USP_MEM_StartCollection(void)
 {
-    minfo_t *mi;
+    void *ptr;
+    int size;
+    arena_chunk_t *chunk;
+
+    // Free all chunks retained by the arena, as they were allocated before collection was started
+    while (arena_free_chunks != NULL)
+    {
+        chunk = arena_free_chunks;
+        arena_free_chunks = chunk->next;
+        USP_FREE(chunk);
+    }
 
     OS_UTILS_LockMutex(&mem_access_mutex);
 
-    #define MAX_MINFO_ENTRIES 10000     // NOTE: Performing a get on 'Device.' can use a lot of entries
-    #define MINFO_SIZE (MAX_MINFO_ENTRIES*sizeof(minfo_t))
-    minfo = malloc(MINFO_SIZE);
-    memset(minfo, 0, MINFO_SIZE);
+    minfo = calloc(MINFO_INITIAL_TABLE_SIZE, sizeof(minfo_t));
     USP_ASSERT(minfo != NULL);
+    minfo_table_size = MINFO_INITIAL_TABLE_SIZE;
+    num_minfo_entries = 0;
+    callstack_sample_count = 0;
 
     // From now on, all current allocations will be logged in the minfo array
     collect_memory_info = true;
@@ -446,10 +1175,11 @@ void USP_MEM_StartCollection(void)
 
     // The sync timer vector is reallocated by BulkDataCollection after collection has been started,
     // so needs to be in the meminfo array (otherwise we assert that a realloc has occured before an alloc)
-    mi = FindFreeMemInfo();
-    USP_ASSERT(mi != NULL);
-    mi->ptr = SYNC_TIMER_PRIV_GetVector(&mi->size);
-    mi->func = sync_timer_add_str;
+    ptr = SYNC_TIMER_PRIV_GetVector(&size);
+    if (ptr != NULL)
+    {
+        AddMemInfo(ptr, sync_timer_add_str, 0, size);
+    }
 
     OS_UTILS_UnlockMutex(&mem_access_mutex);
 }
@@ -539,7 +1269,7 @@ void USP_MEM_Print(void)
 
     // Iterate over the memory info array, printing out all entries which have changed since last time this function was called
     OS_UTILS_LockMutex(&mem_access_mutex);
-    for (i=0; i<MAX_MINFO_ENTRIES; i++)
+    for (i=0; i<minfo_table_size; i++)
     {
         mi = &minfo[i];
         if (mi->ptr != NULL)
@@ -627,7 +1357,7 @@ int USP_MEM_PrintAll(void)
     // Iterate over the memory info array, printing out all entries
     // NOTE: The sync timer vector is deallocated after the leak report has been printed, so to avoid it erroneously reporting as a memory leak, we ignore it here
     OS_UTILS_LockMutex(&mem_access_mutex);
-    for (i=0; i<MAX_MINFO_ENTRIES; i++)
+    for (i=0; i<minfo_table_size; i++)
     {
         mi = &minfo[i];
         if ((mi->ptr != NULL) && (strcmp(mi->func, sync_timer_add_str) != 0))
@@ -678,61 +1408,218 @@ void PrintMemInfoEntry(minfo_t *mi, char *str, int index)
 
 /*********************************************************************//**
 **
-** FindFreeMemInfo
+** AddMemInfo
 **
-** Finds a free entry in the minfo array
+** Adds an entry for the specified pointer to the minfo hash table
 **
-** \param   None
+** \param   ptr - pointer to the allocated memory (the key of the entry)
+** \param   func - name of the function which allocated the memory
+** \param   line - line number in the function which allocated the memory
+** \param   size - number of bytes allocated
 **
-** \return  Pointer to entry in the array
+** \return  Pointer to the entry in the hash table
 **
 **************************************************************************/
-minfo_t *FindFreeMemInfo(void)
+minfo_t *AddMemInfo(void *ptr, const char *func, int line, int size)
 {
-    int i;
+    unsigned index;
     minfo_t *mi;
 
-    for (i=0; i<MAX_MINFO_ENTRIES; i++)
+    // Grow the hash table, if adding this entry would make it more than 3/4 full
+    if ((num_minfo_entries+1)*4 > minfo_table_size*3)
     {
-        mi = &minfo[i];
-        if (mi->ptr == NULL)
-        {
-            return mi;
-        }
+        GrowMemInfoTable();
+    }
+
+    // Probe for the first free slot, starting at the slot which this pointer hashes to
+    index = CalcMemInfoHash(ptr, minfo_table_size);
+    while (minfo[index].ptr != NULL)
+    {
+        USP_ASSERT(minfo[index].ptr != ptr);    // The same pointer cannot have been allocated twice
+        index = (index + 1) & (minfo_table_size - 1);
     }
 
-    // If the code gets here, then the minfo array was full
-    return NULL;
+    mi = &minfo[index];
+    memset(mi, 0, sizeof(minfo_t));
+    mi->ptr = ptr;
+    mi->func = func;
+    mi->line = line;
+    mi->size = size;
+    mi->flags = MI_MODIFIED;
+    num_minfo_entries++;
+
+    return mi;
 }
 
 /*********************************************************************//**
 **
 ** FindMemInfoByPtr
 **
-** Finds the meminfo entry matching the specified pointer
-** NOTE: This function may be called with ptr==NULL, in which case it finds the first free entry (which is the correct behaviour)
+** Finds the entry in the minfo hash table matching the specified pointer
 **
-** \param   ptr - pointer specifying the meminfo array entry to match
+** \param   ptr - pointer specifying the minfo hash table entry to match
 **
-** \return  Pointer to entry in the array
+** \return  Pointer to entry in the hash table, or NULL if no match was found
 **
 **************************************************************************/
 minfo_t *FindMemInfoByPtr(void *ptr)
 {
-    int i;
+    unsigned index;
     minfo_t *mi;
 
-    for (i=0; i<MAX_MINFO_ENTRIES; i++)
+    // Probe from the slot which this pointer hashes to, until either the pointer or a free slot is found
+    index = CalcMemInfoHash(ptr, minfo_table_size);
+    while (1)
     {
-        mi = &minfo[i];
+        // NOTE: The free slot check must come first, otherwise a NULL pointer would match a free slot
+        mi = &minfo[index];
+        if (mi->ptr == NULL)
+        {
+            return NULL;
+        }
+
         if (mi->ptr == ptr)
         {
             return mi;
         }
+
+        index = (index + 1) & (minfo_table_size - 1);
+    }
+}
+
+/*********************************************************************//**
+**
+** RemoveMemInfo
+**
+** Removes the specified entry from the minfo hash table
+** Subsequent entries in the same probe sequence are shifted back into the freed slot,
+** so that lookups never stop early at a hole, and no tombstones are necessary
+**
+** \param   mi - pointer to entry in the hash table to remove
+**
+** \return  None
+**
+**************************************************************************/
+void RemoveMemInfo(minfo_t *mi)
+{
+    unsigned mask;
+    unsigned hole;
+    unsigned index;
+    unsigned home;
+
+    mask = minfo_table_size - 1;
+    hole = (unsigned)(mi - minfo);
+    index = hole;
+    while (1)
+    {
+        index = (index + 1) & mask;
+        if (minfo[index].ptr == NULL)
+        {
+            break;
+        }
+
+        // Move the entry into the hole, if the hole lies cyclically between the entry's home slot and its current slot
+        home = CalcMemInfoHash(minfo[index].ptr, minfo_table_size);
+        if (((index - home) & mask) >= ((index - hole) & mask))
+        {
+            minfo[hole] = minfo[index];
+            hole = index;
+        }
+    }
+
+    memset(&minfo[hole], 0, sizeof(minfo_t));
+    num_minfo_entries--;
+}
+
+/*********************************************************************//**
+**
+** GrowMemInfoTable
+**
+** Doubles the number of slots in the minfo hash table, rehashing all entries into the new table
+** NOTE: The new table is allocated using malloc() directly, so that it is not itself tracked
+**
+** \param   None
+**
+** \return  None
+**
+**************************************************************************/
+void GrowMemInfoTable(void)
+{
+    minfo_t *old_table;
+    unsigned old_size;
+    unsigned new_size;
+    unsigned i;
+    unsigned index;
+
+    old_table = minfo;
+    old_size = minfo_table_size;
+    new_size = 2*old_size;
+    minfo = calloc(new_size, sizeof(minfo_t));
+    if (minfo == NULL)
+    {
+        USP_ERR_Terminate("%s: Unable to grow memory info table to %u entries", __FUNCTION__, new_size);
     }
+    minfo_table_size = new_size;
 
-    // If the code gets here, then the ptr could not be found
-    return NULL;
+    // Rehash all entries from the old table into the new table
+    for (i=0; i<old_size; i++)
+    {
+        if (old_table[i].ptr != NULL)
+        {
+            index = CalcMemInfoHash(old_table[i].ptr, new_size);
+            while (minfo[index].ptr != NULL)
+            {
+                index = (index + 1) & (new_size - 1);
+            }
+            minfo[index] = old_table[i];
+        }
+    }
+
+    free(old_table);
+}
+
+/*********************************************************************//**
+**
+** CalcMemInfoHash
+**
+** Calculates the slot in the minfo hash table which the specified pointer hashes to
+**
+** \param   ptr - pointer to hash
+** \param   table_size - number of slots in the hash table (must be a power of 2)
+**
+** \return  index of the slot in the hash table
+**
+**************************************************************************/
+unsigned CalcMemInfoHash(void *ptr, unsigned table_size)
+{
+    uint64_t key;
+
+    // Discard the low order bits (which are always zero due to malloc alignment), then mix using Fibonacci hashing
+    key = ((uint64_t)(uintptr_t)ptr) >> 4;
+    key *= 0x9E3779B97F4A7C15ULL;
+
+    return (unsigned)(key >> 32) & (table_size - 1);
+}
+
+/*********************************************************************//**
+**
+** RecordMemInfoCallers
+**
+** Records the callstack of the allocation in the specified minfo entry
+** Obtaining the callstack is expensive, so it is only recorded for 1 in USP_MEM_CALLSTACK_SAMPLE_RATE allocations
+** The callers of all other allocations are left empty (the allocating function and line number are always recorded)
+**
+** \param   mi - pointer to entry in the hash table
+**
+** \return  None
+**
+**************************************************************************/
+void RecordMemInfoCallers(minfo_t *mi)
+{
+    if ((callstack_sample_count++ % USP_MEM_CALLSTACK_SAMPLE_RATE) == 0)
+    {
+        GetCallers(mi->callers, NUM_ELEM(mi->callers));
+    }
 }
 
 /*********************************************************************//**
@@ -51,23 +51,37 @@
 #define USP_REALLOC(x, y)           USP_MEM_Realloc(__FUNCTION__, __LINE__, x, y)
 #define USP_STRDUP(x)               USP_MEM_Strdup(__FUNCTION__, __LINE__, x)
 
+// Helper macros for allocating protobuf structures associated with the USP message currently being processed (see USP_MEM_ArenaStart)
+#define USP_ARENA_MALLOC(x)         USP_MEM_ArenaMalloc(__FUNCTION__, __LINE__, x)
+#define USP_ARENA_REALLOC(x, y)     USP_MEM_ArenaRealloc(__FUNCTION__, __LINE__, x, y)
+#define USP_ARENA_STRDUP(x)         USP_MEM_ArenaStrdup(__FUNCTION__, __LINE__, x)
+
 //------------------------------------------------------------------------------------
 // Functions wrapping memory allocation
 int USP_MEM_Init(void);
 void USP_MEM_Destroy(void);
 void *USP_MEM_Malloc(const char *func, int line, int size) ARGS_NONNULL MALLOC RETURNS_NONNULL;
-void USP_MEM_Free(const char *func, int line, void *ptr) ARGS_NONNULL;
+void USP_MEM_Free(const char *func, int line, void *ptr) ARGINDEX_NONNULL(1);    // NOTE: ptr may be NULL, as for free()
 void *USP_MEM_Realloc(const char *func, int line, void *ptr, int size) ARGINDEX_NONNULL(1) MALLOC RETURNS_NONNULL;
 void *USP_MEM_Strdup(const char *func, int line, void *ptr) ARGINDEX_NONNULL(1) MALLOC;
 void USP_MEM_StartCollection(void);
 void USP_MEM_StopCollection(void);
+void USP_MEM_EnableThreadCache(void);
 void USP_MEM_Print(void);
 void USP_MEM_PrintSummary(void);
 int USP_MEM_PrintLeakReport(void);
 int USP_MEM_PrintAll(void);
+void USP_MEM_ArenaStart(void);
+void USP_MEM_ArenaReset(void);
+void *USP_MEM_ArenaMalloc(const char *func, int line, int size) ARGS_NONNULL MALLOC RETURNS_NONNULL;
+void *USP_MEM_ArenaRealloc(const char *func, int line, void *ptr, int size) ARGINDEX_NONNULL(1) RETURNS_NONNULL;
+char *USP_MEM_ArenaStrdup(const char *func, int line, const char *str) ARGINDEX_NONNULL(1);
 void MAIN_Stop(void);
 
 // Pointer to structure containing the protocol buffer allocator function
 extern void *pbuf_allocator;
 
+// Pointer to structure containing the protocol buffer arena allocator function (only for use by the data model thread)
+extern void *pbuf_arena_allocator;
+
 #endif
@@ -1055,6 +1055,60 @@ int USP_REGISTER_Object_RefreshInstances(char *path, dm_refresh_instances_cb_t r
     return USP_ERR_OK;
 }
 
+/*********************************************************************//**
+**
+** USP_REGISTER_Param_ValueChangePollPeriod
+**
+** Registers the period at which a vendor parameter is polled to determine whether its value has changed, for value change subscriptions
+** By default, vendor parameters are polled every VALUE_CHANGE_POLL_PERIOD seconds
+** NOTE: Parameters stored in the database are not polled, as changes to their value are detected when they are set
+**
+** \param   path - full data model schema path for the parameter (which must have already been registered)
+** \param   poll_period - period (in seconds) between polls of the parameter's value
+**
+** \return  USP_ERR_OK if successful
+**          USP_ERR_INTERNAL_ERROR if any other error occurred
+**
+**************************************************************************/
+int USP_REGISTER_Param_ValueChangePollPeriod(char *path, unsigned poll_period)
+{
+    dm_node_t *node;
+
+    // Exit if this function is not being called from within VENDOR_Init()
+    if (is_executing_within_dm_init == false)
+    {
+        USP_ERR_SetMessage(usp_err_bad_scope_str, __FUNCTION__, path);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Exit if calling arguments are specified incorrectly
+    if ((path==NULL) || (poll_period == 0))
+    {
+        USP_ERR_SetMessage(usp_err_invalid_param_str, __FUNCTION__);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Exit if the parameter has not been registered
+    node = DM_PRIV_GetNodeFromPath(path, NULL, NULL);
+    if (node == NULL)
+    {
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Exit if the path is not a parameter whose value is polled
+    if ((node->type != kDMNodeType_VendorParam_ReadOnly) && (node->type != kDMNodeType_VendorParam_ReadWrite) &&
+        (node->type != kDMNodeType_Param_NumEntries))
+    {
+        USP_ERR_SetMessage("%s: Path %s is not a parameter whose value is polled", __FUNCTION__, path);
+        return USP_ERR_INTERNAL_ERROR;
+    }
+
+    // Save registered info into the data model
+    node->registered.param_info.value_change_poll_period = poll_period;
+
+    return USP_ERR_OK;
+}
+
 /*********************************************************************//**
 **
 ** USP_REGISTER_GroupedObject
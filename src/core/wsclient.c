@@ -651,6 +651,9 @@ void *WSCLIENT_Main(void *args)
 {
     int err;
 
+    // Give this thread its own cache of small memory blocks
+    USP_MEM_EnableThreadCache();
+
     while (FOREVER)
     {
         // Service the websocket client thread message queue
@@ -352,6 +352,7 @@ int USP_REGISTER_GroupedVendorParam_ReadWrite(int group_id, char *path, unsigned
 int USP_REGISTER_GroupVendorHooks(int group_id, dm_get_group_cb_t get_group_cb, dm_set_group_cb_t set_group_cb,
                                                 dm_add_group_cb_t add_group_cb, dm_del_group_cb_t del_group_cb);
 int USP_REGISTER_Object_RefreshInstances(char *path, dm_refresh_instances_cb_t refresh_instances_cb);
+int USP_REGISTER_Param_ValueChangePollPeriod(char *path, unsigned poll_period);
 
 //------------------------------------------------------------------------------
 // Functions that may be called from vendor hooks to access the data model